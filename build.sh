@@ -15,6 +15,18 @@ LOADER_PATH="${BUILD_DIR}/loader.efi"
 # コンフィグファイルパス
 CONFIG_PATH="${BUILD_DIR}/loader.cfg"
 
+# バイナリコンフィグファイルパス
+CONFIG_BINARY_PATH="${BUILD_DIR}/config.bin"
+
+# コンフィグコンパイラーのパス
+NEOCFG_PATH="${BUILD_DIR}/neocfg"
+
+# ホスト向けのツールのディレクトリー
+HOST_DIR="${BUILD_DIR}/host"
+
+# ホスト向けのコンパイルフラグ (L""はUEFIと同じ16ビットにする)
+HOST_FLAGS=(-fshort-wchar -DNEOBOOT_HOST -I"${script_dir}/tools/host" -I"${script_dir}/src")
+
 # ボリュームの名前
 VOLUME_NAME="NEOBOOT"
 
@@ -44,10 +56,41 @@ function loader_build() {
     
     # オブジェクトファイルをEFIファイルに変換
     x86_64-elf-objcopy -j .text -j .sdata -j .data -j .rodata -j .dynamic -j .dynsym -j .rel -j .rela -j '.rel.*' -j '.rela.*' -j .reloc --target efi-app-x86_64 --subsystem=10 "${BUILD_DIR}/main.so" "${LOADER_PATH}"
+
+    # コンフィグをバイナリに変換
+    neocfg_build
+    "${NEOCFG_PATH}" "${CONFIG_PATH}" "${CONFIG_BINARY_PATH}"
+}
+
+# コンフィグコンパイラーをビルド
+function neocfg_build() {
+    cc -O2 "${HOST_FLAGS[@]}" "${script_dir}/tools/neocfg.c" "${script_dir}/src/config.c" "${script_dir}/src/crc32.c" "${script_dir}/src/memops.c" "${script_dir}/src/cpu.c" -o "${NEOCFG_PATH}"
+}
+
+# ホストでベンチマークとファザーをビルド
+function host_build() {
+    mkdir -p "${HOST_DIR}"
+
+    local sources=("${script_dir}/src/config.c" "${script_dir}/src/string.c" "${script_dir}/src/crc32.c" "${script_dir}/src/memops.c" "${script_dir}/src/cpu.c")
+
+    cc -O2 "${HOST_FLAGS[@]}" "${script_dir}/tools/bench.c" "${sources[@]}" "${script_dir}/src/sha256.c" -o "${HOST_DIR}/bench"
+
+    # clangがあればlibFuzzer、なければファイルを読むだけのASanビルド
+    if command -v clang > /dev/null; then
+        clang -g -O1 -fsanitize=fuzzer,address,undefined -DNEOBOOT_LIBFUZZER "${HOST_FLAGS[@]}" "${script_dir}/tools/fuzz_config.c" "${sources[@]}" -o "${HOST_DIR}/fuzz_config"
+    else
+        cc -g -O1 -fsanitize=address,undefined "${HOST_FLAGS[@]}" "${script_dir}/tools/fuzz_config.c" "${sources[@]}" -o "${HOST_DIR}/fuzz_config"
+    fi
 }
 
 # イメージファイルを作成
 function make_image() {
+    # LinuxにはhdiutilがないのでGPTとFATを直接書く
+    if [ "$(uname)" = "Linux" ]; then
+        make_image_linux
+        return
+    fi
+
     # DMGファイルの作成
     hdiutil create -size 1g -fs "FAT32" -layout GPTSPUD -volname "${VOLUME_NAME}" "${IMAGE_PATH}.dmg"
 
@@ -68,6 +111,7 @@ function make_image() {
 
     # コンフィグファイルを追加
     cp "${CONFIG_PATH}" "/Volumes/${VOLUME_NAME}/config.cfg"
+    cp "${CONFIG_BINARY_PATH}" "/Volumes/${VOLUME_NAME}/config.bin"
 
     # アンマウント
     hdiutil unmount "/Volumes/${VOLUME_NAME}" -force
@@ -76,6 +120,26 @@ function make_image() {
     rm "${IMAGE_PATH}.dmg"
 }
 
+# Linuxでイメージファイルを作成 (sgdisk, mtools)
+function make_image_linux() {
+    rm -f "${IMAGE_PATH}"
+    truncate -s 1G "${IMAGE_PATH}"
+
+    # 1MiBから始まるEFI System Partition
+    sgdisk -o -n 1:2048:0 -t 1:ef00 -c 1:"${VOLUME_NAME}" "${IMAGE_PATH}" > /dev/null
+    local sectors=$(( $(sgdisk -i 1 "${IMAGE_PATH}" | awk '/^Partition size/ { print $3 }') ))
+    local volume="${IMAGE_PATH}@@1M"
+
+    # FAT32でフォーマット
+    mformat -i "${volume}" -F -h 64 -s 32 -T "${sectors}" -v "${VOLUME_NAME}" ::
+
+    # ファイル構成の作成
+    mmd -i "${volume}" ::/EFI ::/EFI/BOOT
+    mcopy -i "${volume}" "${LOADER_PATH}" ::/EFI/BOOT/BOOTX64.efi
+    mcopy -i "${volume}" "${CONFIG_PATH}" ::/config.cfg
+    mcopy -i "${volume}" "${CONFIG_BINARY_PATH}" ::/config.bin
+}
+
 # 成功率を増やす関数
 function kill_proc() {
     # lsofコマンドでディスクイメージファイルを開いているプロセスを取得し、PIDを抽出
@@ -112,7 +176,8 @@ function run_image_gui() {
 # クリーン
 function trouble() {
     rm -f "${IMAGE_PATH}" "${IMAGE_PATH}.dmg"
-    rm -f ${BUILD_DIR}/*.o ${BUILD_DIR}/*.so ${BUILD_DIR}/*.efi
+    rm -f ${BUILD_DIR}/*.o ${BUILD_DIR}/*.so ${BUILD_DIR}/*.efi "${CONFIG_BINARY_PATH}" "${NEOCFG_PATH}"
+    rm -rf "${HOST_DIR}"
 }
 
 # 使い方
@@ -120,6 +185,8 @@ function usage() {
     echo ""
     echo "Neo Boot Build Tool - NeoBootを今すぐビルド。"
     echo "RUN ビルドして実行"
+    echo "HOST ベンチマークとファザーをホスト向けにビルド"
+    echo "BENCH ホストでベンチマークを実行"
     echo "CLEAN 関連ファイルの削除"
     echo ""
 }
@@ -157,6 +224,13 @@ while (( $# > 0 )); do
     build | BUILD)
       loader_build
       ;;
+    host | HOST)
+      host_build
+      ;;
+    bench | BENCH)
+      host_build
+      "${HOST_DIR}/bench"
+      ;;
     clean | trouble | CLEAN | TROUBLE)
       trouble
       echo "削除完了"
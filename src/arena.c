@@ -0,0 +1,170 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "arena.h"
+#include "proto.h"
+
+// 最後に確保したブロック (前のブロックへ順につながる)
+static struct arena_block *arena_top = NULL;
+
+// 統計
+static UINTN arena_pages = 0;
+static UINTN arena_allocations = 0;
+
+// Bytes usable in a block
+static UINTN arena_capacity(struct arena_block *block) {
+    return block->no_of_pages * EFI_PAGE_SIZE;
+}
+
+// Allocate a block that fits size bytes after its header
+static struct arena_block *arena_grow(UINTN size) {
+
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS address;
+    struct arena_block *block;
+    UINTN no_of_pages = ARENA_BLOCK_PAGES;
+
+    if (size > (UINTN)-1 - sizeof(struct arena_block) - EFI_PAGE_MASK) {
+        return NULL;
+    }
+
+    // 大きいものは専用のブロックにする
+    if (EFI_SIZE_TO_PAGES(sizeof(struct arena_block) + size) > no_of_pages) {
+        no_of_pages = EFI_SIZE_TO_PAGES(sizeof(struct arena_block) + size);
+    }
+
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, no_of_pages, &address);
+    if (EFI_ERROR(status)) {
+        return NULL;
+    }
+
+    block = (struct arena_block *)(UINTN)address;
+    block->prev = arena_top;
+    block->no_of_pages = no_of_pages;
+    block->used = sizeof(struct arena_block);
+    block->reserved = 0;
+
+    arena_top = block;
+    arena_pages += no_of_pages;
+
+    return block;
+}
+
+// Allocate size bytes from the arena, the memory is not cleared
+VOID *arena_alloc(UINTN size) {
+
+    struct arena_block *block = arena_top;
+    VOID *p;
+
+    if (size > (UINTN)-1 - ARENA_ALIGN) {
+        return NULL;
+    }
+    size = (size + ARENA_ALIGN - 1) & ~((UINTN)ARENA_ALIGN - 1);
+
+    // 残りが足りなければ新しいブロックから切り出す
+    if (block == NULL || arena_capacity(block) - block->used < size) {
+        block = arena_grow(size);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+
+    p = (UINT8 *)block + block->used;
+    block->used += size;
+    arena_allocations += 1;
+
+    return p;
+}
+
+// Allocate size bytes filled with zero
+VOID *arena_alloc_zero(UINTN size) {
+
+    VOID *p = arena_alloc(size);
+
+    if (p != NULL) {
+        mem_zero(p, size);
+    }
+
+    return p;
+}
+
+// Allocate count elements of size bytes filled with zero
+VOID *arena_alloc_array(UINTN size, UINTN count) {
+
+    if (count != 0 && size > (UINTN)-1 / count) {
+        return NULL;
+    }
+
+    return arena_alloc_zero(size * count);
+}
+
+// Grow the last allocation in place, or copy it to a new allocation
+VOID *arena_resize(VOID *old, UINTN old_size, UINTN new_size) {
+
+    struct arena_block *block = arena_top;
+    UINTN old_rounded, new_rounded;
+    VOID *p;
+
+    if (old == NULL) {
+        return arena_alloc(new_size);
+    }
+    if (new_size <= old_size) {
+        return old;
+    }
+    if (new_size > (UINTN)-1 - ARENA_ALIGN) {
+        return NULL;
+    }
+    old_rounded = (old_size + ARENA_ALIGN - 1) & ~((UINTN)ARENA_ALIGN - 1);
+    new_rounded = (new_size + ARENA_ALIGN - 1) & ~((UINTN)ARENA_ALIGN - 1);
+
+    // 最後の割り当てならそのまま後ろに伸ばす
+    if (block != NULL && (UINT8 *)old + old_rounded == (UINT8 *)block + block->used && new_rounded - old_rounded <= arena_capacity(block) - block->used) {
+        block->used += new_rounded - old_rounded;
+        return old;
+    }
+
+    p = arena_alloc(new_size);
+    if (p != NULL) {
+        mem_copy(p, old, old_size);
+    }
+
+    return p;
+}
+
+// Remember the current position of the arena
+void arena_mark(struct arena_mark *mark) {
+    mark->block = arena_top;
+    mark->used = arena_top != NULL ? arena_top->used : 0;
+}
+
+// Free everything allocated after the mark
+void arena_release_to(struct arena_mark *mark) {
+
+    // 後から確保したブロックはページごと返す
+    while (arena_top != NULL && arena_top != mark->block) {
+        struct arena_block *prev = arena_top->prev;
+        arena_pages -= arena_top->no_of_pages;
+        uefi_call_wrapper(BS->FreePages, 2, (EFI_PHYSICAL_ADDRESS)(UINTN)arena_top, arena_top->no_of_pages);
+        arena_top = prev;
+    }
+
+    if (arena_top != NULL) {
+        arena_top->used = mark->used;
+    }
+}
+
+// Free the whole arena, nothing allocated from it may be used afterwards
+void arena_release() {
+
+    struct arena_mark empty = { NULL, 0 };
+
+    arena_release_to(&empty);
+}
+
+// Pages held and allocations served so far
+void arena_stats(UINTN *no_of_pages, UINTN *no_of_allocations) {
+    *no_of_pages = arena_pages;
+    *no_of_allocations = arena_allocations;
+}
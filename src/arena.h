@@ -0,0 +1,33 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// 1つのブロックのページ数 (これより大きいものは専用のブロックになる)
+#define ARENA_BLOCK_PAGES 16
+
+// 割り当ての揃え
+#define ARENA_ALIGN 16
+
+// ARENA_BLOCK
+// AllocatePagesで確保したページの先頭に置く
+struct arena_block {
+    struct arena_block *prev; // 前に確保したブロック
+    UINTN no_of_pages;
+    UINTN used; // ヘッダーを含む使用済みのバイト数
+    UINTN reserved; // ヘッダーを16バイトに揃える
+};
+
+// ARENA_MARK
+// arena_release_toで戻る位置
+struct arena_mark {
+    struct arena_block *block;
+    UINTN used;
+};
+
+// 型付きの割り当て (0で埋める)
+#define ARENA_NEW(type) ((type *)arena_alloc_zero(sizeof(type)))
+#define ARENA_ARRAY(type, count) ((type *)arena_alloc_array(sizeof(type), (count)))
+
+#endif
@@ -0,0 +1,466 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "config.h"
+#ifdef NEOBOOT_HOST
+#include "host.h" // tools/でホスト向けにビルドする場合
+#else
+#include "proto.h"
+#endif
+
+// 最初に確保する数
+#define CONFIG_PAIRS_INITIAL 32
+#define CONFIG_SECTIONS_INITIAL 8
+
+// FNV-1a of the key, mixed with the section number
+static UINT32 config_hash(UINTN section, const char *key) {
+
+    UINT32 hash = 2166136261u;
+
+    while (*key != '\0') {
+        hash ^= (UINT8)*key++;
+        hash *= 16777619u;
+    }
+
+    return hash ^ ((UINT32)section * 0x9E3779B1u);
+}
+
+static BOOLEAN is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Cut trailing spaces of [start, end) and terminate it
+static char *config_terminate(char *start, char *end) {
+
+    while (end > start && is_space(end[-1])) {
+        end--;
+    }
+    *end = '\0';
+
+    return start;
+}
+
+// Grow an array to twice its size
+static BOOLEAN config_grow(VOID **array, UINTN *capacity, UINTN element_size) {
+
+    VOID *grown = ReallocatePool(*array, *capacity * element_size, *capacity * 2 * element_size);
+    if (grown == NULL) {
+        return FALSE;
+    }
+
+    *array = grown;
+    *capacity *= 2;
+
+    return TRUE;
+}
+
+// Add a section
+static BOOLEAN config_add_section(Config *config, UINTN *capacity, UINT32 name) {
+
+    if (config->no_of_sections == *capacity && !config_grow((VOID **)&config->sections, capacity, sizeof(config_section))) {
+        return FALSE;
+    }
+
+    config_section *section = &config->sections[config->no_of_sections++];
+    section->name = name;
+    section->first_pair = config->no_of_pairs;
+    section->no_of_pairs = 0;
+    section->reserved = 0;
+
+    return TRUE;
+}
+
+// Build the hash table, a later key replaces an earlier one in the same section
+static BOOLEAN config_build_table(Config *config) {
+
+    config->table_size = 16;
+    while (config->table_size < config->no_of_pairs * 2) {
+        config->table_size *= 2;
+    }
+
+    config->table = AllocateZeroPool(sizeof(UINT32) * config->table_size);
+    if (config->table == NULL) {
+        return FALSE;
+    }
+
+    for (UINTN i = 0; i < config->no_of_pairs; i++) {
+        config_pair *pair = &config->pairs[i];
+        UINTN slot = pair->hash & (config->table_size - 1);
+
+        while (config->table[slot] != 0) {
+            config_pair *other = &config->pairs[config->table[slot] - 1];
+            if (other->hash == pair->hash && other->section == pair->section && strcmpa((CHAR8 *)config->strings + other->key, (CHAR8 *)config->strings + pair->key) == 0) {
+                break;
+            }
+            slot = (slot + 1) & (config->table_size - 1);
+        }
+
+        config->table[slot] = i + 1;
+    }
+
+    return TRUE;
+}
+
+// Config file Parser
+// Splits the text in place, so the text must live as long as the config
+Config *config_file_parser(char *config_txt) {
+
+    Config *config;
+    UINTN pairs_capacity = CONFIG_PAIRS_INITIAL;
+    UINTN sections_capacity = CONFIG_SECTIONS_INITIAL;
+    char *p = config_txt;
+
+    config = AllocateZeroPool(sizeof(Config));
+    if (config == NULL) {
+        return NULL;
+    }
+    config->strings = config_txt;
+    config->pairs = AllocatePool(sizeof(config_pair) * pairs_capacity);
+    config->sections = AllocatePool(sizeof(config_section) * sections_capacity);
+    if (config->pairs == NULL || config->sections == NULL) {
+        goto error;
+    }
+
+    // セクションの前のキー
+    if (!config_add_section(config, &sections_capacity, CONFIG_NO_NAME)) {
+        goto error;
+    }
+
+    while (*p != '\0') {
+
+        // 区切りと空白を飛ばす
+        if (is_space(*p) || *p == '\n' || *p == ',') {
+            p++;
+            continue;
+        }
+
+        // Comment
+        if (*p == '#' || *p == ';') {
+            p += mem_span(p, "\n");
+            continue;
+        }
+
+        // Section
+        if (*p == '[') {
+            char *name = ++p;
+            p += mem_span(p, "\n]");
+            BOOLEAN closed = (*p == ']');
+            char *end = p;
+
+            // 行の残りは無視する
+            p += mem_span(p, "\n");
+            if (!closed) {
+                continue;
+            }
+
+            while (is_space(*name)) {
+                name++;
+            }
+            if (!config_add_section(config, &sections_capacity, config_terminate(name, end) - config_txt)) {
+                goto error;
+            }
+            continue;
+        }
+
+        // Key
+        char *key = p;
+        p += mem_span(p, "\n,=#");
+
+        // "="がなければ無視する
+        if (*p != '=') {
+            continue;
+        }
+        char *key_end = p++;
+
+        // Value
+        while (is_space(*p)) {
+            p++;
+        }
+        char *value;
+        char *value_end;
+        if (*p == '"') {
+
+            // 引用符の中では","や"#"も値になる
+            value = ++p;
+            p += mem_span(p, "\n\"");
+            value_end = p;
+            if (*p == '"') {
+                p++;
+            }
+            p += mem_span(p, "\n,#");
+        } else {
+            value = p;
+            p += mem_span(p, "\n,#");
+            value_end = p;
+            while (value_end > value && is_space(value_end[-1])) {
+                value_end--;
+            }
+        }
+
+        // 区切りを終端文字に置き換える前に進める
+        char separator = *p;
+        if (separator != '\0' && separator != '#') {
+            p++;
+        }
+        if (separator == '#') {
+            p += mem_span(p, "\n");
+        }
+
+        *value_end = '\0';
+        config_terminate(key, key_end);
+
+        // 空のキーは無視する
+        if (*key == '\0') {
+            continue;
+        }
+
+        if (config->no_of_pairs == pairs_capacity && !config_grow((VOID **)&config->pairs, &pairs_capacity, sizeof(config_pair))) {
+            goto error;
+        }
+
+        config_pair *pair = &config->pairs[config->no_of_pairs++];
+        pair->key = key - config_txt;
+        pair->value = value - config_txt;
+        pair->section = config->no_of_sections - 1;
+        pair->hash = config_hash(pair->section, key);
+        config->sections[pair->section].no_of_pairs += 1;
+    }
+
+    if (!config_build_table(config)) {
+        goto error;
+    }
+
+    return config;
+
+error:
+    free_config(config);
+    return NULL;
+}
+
+// Free the config, the text is not freed
+void free_config(Config *config) {
+
+    if (config == NULL) {
+        return;
+    }
+
+    // バイナリ形式の配列はファイルのバッファーの中にある
+    if (config->is_binary) {
+        FreePool(config);
+        return;
+    }
+
+    if (config->pairs != NULL) {
+        FreePool(config->pairs);
+    }
+    if (config->sections != NULL) {
+        FreePool(config->sections);
+    }
+    if (config->table != NULL) {
+        FreePool(config->table);
+    }
+    FreePool(config);
+}
+
+// Get a value of the key in the section
+char *config_lookup(Config *config, UINTN section, const char *key) {
+
+    UINT32 hash = config_hash(section, key);
+    UINTN slot = hash & (config->table_size - 1);
+
+    while (config->table[slot] != 0) {
+        config_pair *pair = &config->pairs[config->table[slot] - 1];
+        if (pair->hash == hash && pair->section == section && strcmpa((CHAR8 *)config->strings + pair->key, (CHAR8 *)key) == 0) {
+            return config->strings + pair->value;
+        }
+        slot = (slot + 1) & (config->table_size - 1);
+    }
+
+    return NULL;
+}
+
+// Number of [entry] sections
+UINTN config_entries(Config *config) {
+    return config->no_of_sections - 1;
+}
+
+// Get a value of the key in the entry, or the global value
+// Entries start at 1, and 0 means only global keys
+char *config_entry_value(Config *config, UINTN entry, const char *key) {
+
+    char *value = NULL;
+
+    if (entry != 0 && entry < config->no_of_sections) {
+        value = config_lookup(config, entry, key);
+    }
+    if (value == NULL) {
+        value = config_lookup(config, 0, key);
+    }
+
+    return value;
+}
+
+// Get a value of the key for the default entry
+char *get_config_value(Config *config, const char *key) {
+    return config_entry_value(config, config_entries(config) > 0 ? 1 : 0, key);
+}
+
+// Parse a decimal value, FALSE if it is missing or not a number
+BOOLEAN config_number(const char *value, UINTN *number) {
+
+    UINTN n = 0;
+
+    if (value == NULL || *value == '\0') {
+        return FALSE;
+    }
+
+    for (; *value != '\0'; value++) {
+        if (*value < '0' || *value > '9' || n > ((UINTN)-1 - 9) / 10) {
+            return FALSE;
+        }
+        n = n * 10 + (*value - '0');
+    }
+
+    *number = n;
+
+    return TRUE;
+}
+
+// Key of the pair
+char *config_key(Config *config, UINTN pair) {
+    return config->strings + config->pairs[pair].key;
+}
+
+// Value of the pair
+char *config_value(Config *config, UINTN pair) {
+    return config->strings + config->pairs[pair].value;
+}
+
+// Name of the section, NULL for the global keys
+char *config_section_name(Config *config, UINTN section) {
+    UINT32 name = config->sections[section].name;
+    return name == CONFIG_NO_NAME ? NULL : config->strings + name;
+}
+
+// Digest of the parsed config
+UINT32 config_digest(Config *config) {
+
+    UINT32 crc = 0;
+
+    // セクション名、キーと値を終端文字ごと順番に
+    for (UINTN i = 1; i < config->no_of_sections; i++) {
+        char *name = config_section_name(config, i);
+        crc = crc32_update(crc, name, mem_span(name, "") + 1);
+    }
+    for (UINTN i = 0; i < config->no_of_pairs; i++) {
+        crc = crc32_update(crc, &config->pairs[i].section, sizeof(UINT32));
+        crc = crc32_update(crc, config_key(config, i), mem_span(config_key(config, i), "") + 1);
+        crc = crc32_update(crc, config_value(config, i), mem_span(config_value(config, i), "") + 1);
+    }
+
+    return crc;
+}
+
+// Is the buffer a binary config
+BOOLEAN config_is_binary(VOID *buffer, UINTN size) {
+    return size >= sizeof(UINT32) && *(UINT32 *)buffer == CONFIG_BINARY_MAGIC;
+}
+
+// Is [offset, offset + count * size) inside the file
+static BOOLEAN config_binary_fits(UINT32 offset, UINT32 count, UINTN element_size, UINTN file_size) {
+    return offset <= file_size && count <= (file_size - offset) / element_size;
+}
+
+// Use a binary config in place, the buffer must live as long as the config
+Config *config_binary_open(VOID *buffer, UINTN size) {
+
+    struct config_binary_header *header = buffer;
+    Config *config;
+    UINT32 crc;
+
+    // Header
+    if (size < sizeof(struct config_binary_header) || header->magic != CONFIG_BINARY_MAGIC || header->version != CONFIG_BINARY_VERSION || header->header_size != sizeof(struct config_binary_header) || header->size != size) {
+        return NULL;
+    }
+
+    // CRC32 (CRC32フィールドを0として計算する)
+    crc = header->crc32;
+    header->crc32 = 0;
+    if (crc32(buffer, size) != crc) {
+        header->crc32 = crc;
+        return NULL;
+    }
+    header->crc32 = crc;
+
+    // 配列がファイルに収まっているか
+    if (!config_binary_fits(header->sections_offset, header->no_of_sections, sizeof(config_section), size) ||
+        !config_binary_fits(header->pairs_offset, header->no_of_pairs, sizeof(config_pair), size) ||
+        !config_binary_fits(header->table_offset, header->table_size, sizeof(UINT32), size) ||
+        !config_binary_fits(header->strings_offset, header->strings_size, 1, size) ||
+        (header->sections_offset | header->pairs_offset | header->table_offset) % sizeof(UINT32) != 0) {
+        return NULL;
+    }
+    if (header->no_of_sections == 0 || header->strings_size == 0 || header->table_size <= header->no_of_pairs || (header->table_size & (header->table_size - 1)) != 0) {
+        return NULL;
+    }
+
+    config = AllocateZeroPool(sizeof(Config));
+    if (config == NULL) {
+        return NULL;
+    }
+    config->is_binary = TRUE;
+    config->strings = (char *)buffer + header->strings_offset;
+    config->sections = (config_section *)((UINT8 *)buffer + header->sections_offset);
+    config->pairs = (config_pair *)((UINT8 *)buffer + header->pairs_offset);
+    config->table = (UINT32 *)((UINT8 *)buffer + header->table_offset);
+    config->no_of_sections = header->no_of_sections;
+    config->no_of_pairs = header->no_of_pairs;
+    config->table_size = header->table_size;
+
+    // 文字列がプールの外を指していないか
+    if (config->strings[header->strings_size - 1] != '\0') {
+        goto error;
+    }
+    for (UINTN i = 0; i < config->no_of_pairs; i++) {
+        if (config->pairs[i].key >= header->strings_size || config->pairs[i].value >= header->strings_size || config->pairs[i].section >= config->no_of_sections) {
+            goto error;
+        }
+    }
+    // 名前がないのはグローバルのセクションだけ
+    for (UINTN i = 0; i < config->no_of_sections; i++) {
+        if (config->sections[i].name == CONFIG_NO_NAME ? i != 0 : config->sections[i].name >= header->strings_size) {
+            goto error;
+        }
+    }
+    // 空きがなければ検索が終わらない
+    UINTN used = 0;
+    for (UINTN i = 0; i < config->table_size; i++) {
+        if (config->table[i] > config->no_of_pairs) {
+            goto error;
+        }
+        if (config->table[i] != 0) {
+            used++;
+        }
+    }
+    if (used >= config->table_size) {
+        goto error;
+    }
+
+    return config;
+
+error:
+    FreePool(config);
+    return NULL;
+}
+
+// Open a config file of either format
+Config *config_open(VOID *buffer, UINTN size) {
+
+    if (config_is_binary(buffer, size)) {
+        return config_binary_open(buffer, size);
+    }
+
+    return config_file_parser(buffer);
+}
@@ -3,43 +3,119 @@
 #define _CONFIG_H
 #include <efi.h>
 
+// "NBCF"
+#define CONFIG_BINARY_MAGIC 0x4643424E
+#define CONFIG_BINARY_VERSION 1
+
+// 名前のないセクション
+#define CONFIG_NO_NAME 0xFFFFFFFF
+
+// キーと値
+// 文字列は文字列プールのオフセットで、バイナリ形式でもそのまま使う
+typedef struct _CONFIG_PAIR {
+    UINT32 key;
+    UINT32 value;
+    UINT32 section; // 0はセクションの前のグローバルなキー
+    UINT32 hash;
+} config_pair;
+
+// セクション ([entry] など)
+typedef struct _CONFIG_SECTION {
+    UINT32 name; // グローバルはCONFIG_NO_NAME
+    UINT32 first_pair;
+    UINT32 no_of_pairs;
+    UINT32 reserved;
+} config_section;
+
+// CONFIG_BINARY_HEADER
+// セクション、キーと値、ハッシュテーブル、文字列プールの順に続く
+struct config_binary_header {
+    UINT32 magic;
+    UINT16 version;
+    UINT16 header_size;
+    UINT32 size; // ファイル全体のサイズ
+    UINT32 crc32; // このフィールドを0として計算したファイル全体のCRC32
+    UINT32 no_of_sections;
+    UINT32 no_of_pairs;
+    UINT32 table_size;
+    UINT32 strings_size;
+    UINT32 sections_offset;
+    UINT32 pairs_offset;
+    UINT32 table_offset;
+    UINT32 strings_offset;
+};
+
 // Config Fileの構造体
 typedef struct _MENU_CONFIG_FILE {
 
-    // コンフィグファイルのキー
-    char **keys;
+    // 文字列プール (テキストならファイルのバッファー)
+    char *strings;
+
+    // キーと値 (ファイルに書かれた順)
+    config_pair *pairs;
+    UINTN no_of_pairs;
+
+    // セクション
+    config_section *sections;
+    UINTN no_of_sections;
 
-    // その値
-    char **values;
+    // (セクション, キー) のハッシュテーブル (オープンアドレス法)
+    // pairsの番号 + 1を入れる。0は空
+    UINT32 *table;
+    UINTN table_size; // 2の累乗
 
-    // キーの数
-    int num_keys;
+    // バイナリ形式ならファイルのバッファーを直接使っている
+    BOOLEAN is_binary;
 
 } Config;
 
 // エントリー
 typedef struct _OS_MENU_ENTRY {
 
-    // OSの名前
-    CHAR16 *os_name; 
+    // 表示する名前 (コンフィグの文字列)
+    const char *name;
 
-    // 選択されているか
-    BOOLEAN is_selected;
+    // コンフィグのエントリー番号 (0ならグローバルの値だけ)
+    UINTN config_entry;
 
 } entry;
 
 // エントリーリスト
+// 選択は番号だけで持ち、見えている範囲の行だけを描く
 typedef struct _OS_MENU_ENTRY_LIST {
 
     // エントリーの個数
-    unsigned int no_of_entries;
+    UINTN no_of_entries;
 
     // 選択中のエントリー番号
-    unsigned int selected_entry_number;
+    UINTN selected;
+
+    // 見えている最初のエントリーと行数
+    UINTN first_visible;
+    UINTN visible_rows;
+
+    // 最初の行の位置と画面の幅
+    UINTN first_y;
+    UINTN columns;
+
+    // 行を作るバッファー (columns + 1文字)
+    CHAR16 *line;
 
     // エントリーの配列
     entry *entries;
 
 } entries_list;
 
+// エントリーの間隔 (行)
+#define MENU_ROW_STEP 3
+
+// 最後のエントリーより下に空ける行 (カウントダウンの表示)
+#define MENU_BOTTOM_MARGIN 3
+
+// wait_for_keyでタイムアウトしない
+#define WAIT_FOREVER ((UINTN)-1)
+
+// カウントダウン中の表示
+#define MENU_LINE_MAX 128
+
 #endif
\ No newline at end of file
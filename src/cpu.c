@@ -0,0 +1,82 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "cpu.h"
+#ifdef NEOBOOT_HOST
+#include "host.h" // tools/でホスト向けにビルドする場合
+#else
+#include "proto.h"
+#endif
+
+static UINT32 cpu_feature_bits = 0;
+static BOOLEAN cpu_features_ready = FALSE;
+
+// Execute CPUID
+static void cpuid(UINT32 leaf, UINT32 subleaf, UINT32 *eax, UINT32 *ebx, UINT32 *ecx, UINT32 *edx) {
+    __asm__ volatile ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(subleaf));
+}
+
+// Read an extended control register
+static UINT64 xgetbv(UINT32 index) {
+    UINT32 low, high;
+    __asm__ volatile ("xgetbv" : "=a"(low), "=d"(high) : "c"(index));
+    return ((UINT64)high << 32) | low;
+}
+
+// Features of the CPU that the loader can use
+UINT32 cpu_features() {
+
+    UINT32 eax, ebx, ecx, edx;
+    UINT32 max_leaf;
+    BOOLEAN ymm = FALSE;
+
+    if (cpu_features_ready) {
+        return cpu_feature_bits;
+    }
+
+    cpuid(0, 0, &max_leaf, &ebx, &ecx, &edx);
+
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (edx & (1 << 26)) {
+        cpu_feature_bits |= CPU_SSE2;
+    }
+    if (ecx & (1 << 9)) {
+        cpu_feature_bits |= CPU_SSSE3;
+    }
+    if (ecx & (1 << 19)) {
+        cpu_feature_bits |= CPU_SSE41;
+    }
+
+    // ファームウェアはAVXを有効にしていないことが多い (OSXSAVEとXCR0を見る)
+    if ((ecx & (1 << 27)) && (ecx & (1 << 28))) {
+        ymm = (xgetbv(0) & 0x6) == 0x6;
+    }
+
+    if (max_leaf >= 7) {
+        cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+        if ((ebx & (1 << 5)) && ymm) {
+            cpu_feature_bits |= CPU_AVX2;
+        }
+        if (ebx & (1 << 8)) {
+            cpu_feature_bits |= CPU_BMI2;
+        }
+        if (ebx & (1 << 29)) {
+            cpu_feature_bits |= CPU_SHA;
+        }
+    }
+
+    // 拡張リーフ
+    cpuid(0x80000000, 0, &max_leaf, &ebx, &ecx, &edx);
+    if (max_leaf >= 0x80000001) {
+        cpuid(0x80000001, 0, &eax, &ebx, &ecx, &edx);
+        if (edx & (1 << 26)) {
+            cpu_feature_bits |= CPU_PAGE_1G;
+        }
+    }
+
+    cpu_features_ready = TRUE;
+
+    return cpu_feature_bits;
+}
@@ -0,0 +1,16 @@
+#ifndef _CPU_H
+#define _CPU_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// CPUIDで調べる機能
+#define CPU_SSSE3 (1 << 0)
+#define CPU_SSE41 (1 << 1)
+#define CPU_AVX2 (1 << 2) // OSがYMMレジスターを有効にしている場合のみ
+#define CPU_BMI2 (1 << 3)
+#define CPU_SHA (1 << 4)
+#define CPU_SSE2 (1 << 5)
+#define CPU_PAGE_1G (1 << 6) // 1GiBのページ
+
+#endif
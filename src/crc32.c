@@ -0,0 +1,73 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#ifdef NEOBOOT_HOST
+#include "host.h" // tools/でホスト向けにビルドする場合
+#else
+#include "proto.h"
+#endif
+
+// Slicing-by-8 tables (CRC-32, reflected 0xEDB88320)
+static UINT32 crc32_table[8][256];
+static BOOLEAN crc32_ready = FALSE;
+
+// 揃っていないバッファーからも読めるワード (memops.hのmem_wordと同じ)
+typedef UINT32 __attribute__((may_alias, aligned(1))) crc32_word;
+
+// Build the tables
+static void crc32_init() {
+
+    for (UINT32 i = 0; i < 256; i++) {
+        UINT32 c = i;
+        for (UINT32 j = 0; j < 8; j++) {
+            c = (c & 1) ? (c >> 1) ^ 0xEDB88320 : c >> 1;
+        }
+        crc32_table[0][i] = c;
+    }
+
+    for (UINT32 i = 0; i < 256; i++) {
+        for (UINT32 k = 1; k < 8; k++) {
+            crc32_table[k][i] = (crc32_table[k - 1][i] >> 8) ^ crc32_table[0][crc32_table[k - 1][i] & 0xFF];
+        }
+    }
+
+    crc32_ready = TRUE;
+}
+
+// Continue a CRC32 over more data
+UINT32 crc32_update(UINT32 crc, const VOID *data, UINTN size) {
+
+    const UINT8 *p = data;
+
+    if (!crc32_ready) {
+        crc32_init();
+    }
+
+    crc = ~crc;
+
+    // 8バイトずつ
+    while (size >= 8) {
+        UINT32 one = *(const crc32_word *)p ^ crc;
+        UINT32 two = *(const crc32_word *)(p + 4);
+        crc = crc32_table[7][one & 0xFF] ^ crc32_table[6][(one >> 8) & 0xFF] ^ crc32_table[5][(one >> 16) & 0xFF] ^ crc32_table[4][one >> 24] ^
+              crc32_table[3][two & 0xFF] ^ crc32_table[2][(two >> 8) & 0xFF] ^ crc32_table[1][(two >> 16) & 0xFF] ^ crc32_table[0][two >> 24];
+        p += 8;
+        size -= 8;
+    }
+
+    // 残り
+    while (size > 0) {
+        crc = crc32_table[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+        p++;
+        size--;
+    }
+
+    return ~crc;
+}
+
+// CRC32 of a buffer
+UINT32 crc32(const VOID *data, UINTN size) {
+    return crc32_update(0, data, size);
+}
@@ -0,0 +1,1584 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "stream.h"
+#include "proto.h"
+
+// Little endian
+static inline UINT16 read_le16(const UINT8 *p) {
+    return (UINT16)(p[0] | (p[1] << 8));
+}
+
+static inline UINT32 read_le32(const UINT8 *p) {
+    return (UINT32)p[0] | ((UINT32)p[1] << 8) | ((UINT32)p[2] << 16) | ((UINT32)p[3] << 24);
+}
+
+static inline UINT64 read_le64(const UINT8 *p) {
+    return (UINT64)read_le32(p) | ((UINT64)read_le32(p + 4) << 32);
+}
+
+// Index of the highest set bit
+static inline UINT32 highbit(UINT32 v) {
+    return 31 - __builtin_clz(v);
+}
+
+/*
+ * xxHash
+ */
+
+#define XXH64_P1 11400714785074694791ULL
+#define XXH64_P2 14029467366897019727ULL
+#define XXH64_P3 1609587929392839161ULL
+#define XXH64_P4 9650029242287828579ULL
+#define XXH64_P5 2870177450012600261ULL
+
+#define XXH32_P1 2654435761U
+#define XXH32_P2 2246822519U
+#define XXH32_P3 3266489917U
+#define XXH32_P4 668265263U
+#define XXH32_P5 374761393U
+
+static inline UINT64 rotl64(UINT64 v, UINT32 r) {
+    return (v << r) | (v >> (64 - r));
+}
+
+static inline UINT32 rotl32(UINT32 v, UINT32 r) {
+    return (v << r) | (v >> (32 - r));
+}
+
+static inline UINT64 xxh64_round(UINT64 acc, UINT64 input) {
+    acc += input * XXH64_P2;
+    acc = rotl64(acc, 31);
+    return acc * XXH64_P1;
+}
+
+static inline UINT32 xxh32_round(UINT32 acc, UINT32 input) {
+    acc += input * XXH32_P2;
+    acc = rotl32(acc, 13);
+    return acc * XXH32_P1;
+}
+
+void xxh64_init(struct xxh64_state *state) {
+    state->v[0] = XXH64_P1 + XXH64_P2;
+    state->v[1] = XXH64_P2;
+    state->v[2] = 0;
+    state->v[3] = -XXH64_P1;
+    state->total = 0;
+    state->buffered = 0;
+}
+
+void xxh64_update(struct xxh64_state *state, const UINT8 *p, UINTN size) {
+
+    state->total += size;
+
+    // 前回の残り
+    if (state->buffered > 0) {
+        while (state->buffered < 32 && size > 0) {
+            state->buffer[state->buffered++] = *p++;
+            size--;
+        }
+        if (state->buffered < 32) {
+            return;
+        }
+        for (UINTN i = 0; i < 4; i++) {
+            state->v[i] = xxh64_round(state->v[i], read_le64(state->buffer + i * 8));
+        }
+        state->buffered = 0;
+    }
+
+    // 32 bytes stripes
+    while (size >= 32) {
+        state->v[0] = xxh64_round(state->v[0], read_le64(p));
+        state->v[1] = xxh64_round(state->v[1], read_le64(p + 8));
+        state->v[2] = xxh64_round(state->v[2], read_le64(p + 16));
+        state->v[3] = xxh64_round(state->v[3], read_le64(p + 24));
+        p += 32;
+        size -= 32;
+    }
+
+    while (size > 0) {
+        state->buffer[state->buffered++] = *p++;
+        size--;
+    }
+}
+
+UINT64 xxh64_digest(struct xxh64_state *state) {
+
+    UINT64 h;
+    const UINT8 *p = state->buffer;
+    UINTN size = state->buffered;
+
+    if (state->total >= 32) {
+        h = rotl64(state->v[0], 1) + rotl64(state->v[1], 7) + rotl64(state->v[2], 12) + rotl64(state->v[3], 18);
+        for (UINTN i = 0; i < 4; i++) {
+            h ^= xxh64_round(0, state->v[i]);
+            h = h * XXH64_P1 + XXH64_P4;
+        }
+    } else {
+        h = XXH64_P5;
+    }
+
+    h += state->total;
+
+    while (size >= 8) {
+        h ^= xxh64_round(0, read_le64(p));
+        h = rotl64(h, 27) * XXH64_P1 + XXH64_P4;
+        p += 8;
+        size -= 8;
+    }
+    if (size >= 4) {
+        h ^= (UINT64)read_le32(p) * XXH64_P1;
+        h = rotl64(h, 23) * XXH64_P2 + XXH64_P3;
+        p += 4;
+        size -= 4;
+    }
+    while (size > 0) {
+        h ^= (*p) * XXH64_P5;
+        h = rotl64(h, 11) * XXH64_P1;
+        p++;
+        size--;
+    }
+
+    h ^= h >> 33;
+    h *= XXH64_P2;
+    h ^= h >> 29;
+    h *= XXH64_P3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+void xxh32_init(struct xxh32_state *state) {
+    state->v[0] = XXH32_P1 + XXH32_P2;
+    state->v[1] = XXH32_P2;
+    state->v[2] = 0;
+    state->v[3] = -XXH32_P1;
+    state->total = 0;
+    state->buffered = 0;
+}
+
+void xxh32_update(struct xxh32_state *state, const UINT8 *p, UINTN size) {
+
+    state->total += size;
+
+    // 前回の残り
+    if (state->buffered > 0) {
+        while (state->buffered < 16 && size > 0) {
+            state->buffer[state->buffered++] = *p++;
+            size--;
+        }
+        if (state->buffered < 16) {
+            return;
+        }
+        for (UINTN i = 0; i < 4; i++) {
+            state->v[i] = xxh32_round(state->v[i], read_le32(state->buffer + i * 4));
+        }
+        state->buffered = 0;
+    }
+
+    // 16 bytes stripes
+    while (size >= 16) {
+        state->v[0] = xxh32_round(state->v[0], read_le32(p));
+        state->v[1] = xxh32_round(state->v[1], read_le32(p + 4));
+        state->v[2] = xxh32_round(state->v[2], read_le32(p + 8));
+        state->v[3] = xxh32_round(state->v[3], read_le32(p + 12));
+        p += 16;
+        size -= 16;
+    }
+
+    while (size > 0) {
+        state->buffer[state->buffered++] = *p++;
+        size--;
+    }
+}
+
+UINT32 xxh32_digest(struct xxh32_state *state) {
+
+    UINT32 h;
+    const UINT8 *p = state->buffer;
+    UINTN size = state->buffered;
+
+    if (state->total >= 16) {
+        h = rotl32(state->v[0], 1) + rotl32(state->v[1], 7) + rotl32(state->v[2], 12) + rotl32(state->v[3], 18);
+    } else {
+        h = XXH32_P5;
+    }
+
+    h += (UINT32)state->total;
+
+    while (size >= 4) {
+        h += read_le32(p) * XXH32_P3;
+        h = rotl32(h, 17) * XXH32_P4;
+        p += 4;
+        size -= 4;
+    }
+    while (size > 0) {
+        h += (*p) * XXH32_P5;
+        h = rotl32(h, 11) * XXH32_P1;
+        p++;
+        size--;
+    }
+
+    h ^= h >> 15;
+    h *= XXH32_P2;
+    h ^= h >> 13;
+    h *= XXH32_P3;
+    h ^= h >> 16;
+
+    return h;
+}
+
+// xxh32 of a whole buffer
+UINT32 xxh32(const UINT8 *p, UINTN size) {
+    struct xxh32_state state;
+    xxh32_init(&state);
+    xxh32_update(&state, p, size);
+    return xxh32_digest(&state);
+}
+
+/*
+ * Common
+ */
+
+// Copy a match from the history, the source may overlap the destination
+static inline void copy_match(UINT8 *dst, UINT64 offset, UINT64 length) {
+
+    const UINT8 *src = dst - offset;
+
+    if (offset >= length) {
+        CopyMem(dst, src, length);
+        return;
+    }
+
+    while (length-- > 0) {
+        *dst++ = *src++;
+    }
+}
+
+// Output produced by the last unit, used by the content checksum
+static void decoder_checksum_update(struct decoder *dec, UINT64 from) {
+
+    if (!dec->content_checksum) {
+        return;
+    }
+
+    if (dec->format == FORMAT_ZSTD) {
+        xxh64_update(&dec->xxh64, dec->dst + from, dec->pos - from);
+    } else {
+        xxh32_update(&dec->xxh32, dec->dst + from, dec->pos - from);
+    }
+}
+
+// Parse the first frame header and find out the format and the content size
+EFI_STATUS decoder_probe(const UINT8 *src, UINTN size, UINT32 *format, UINT64 *content_size) {
+
+    *format = FORMAT_RAW;
+    *content_size = 0;
+
+    if (size < 4) {
+        return EFI_SUCCESS;
+    }
+
+    UINT32 magic = read_le32(src);
+
+    // zstd
+    if (magic == ZSTD_MAGIC) {
+        if (size < 5) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        UINT8 fhd = src[4];
+        UINT32 fcs_flag = fhd >> 6;
+        BOOLEAN single_segment = (fhd >> 5) & 1;
+        UINTN dict_size = (UINTN[]){0, 1, 2, 4}[fhd & 3];
+        UINTN fcs_size = (UINTN[]){single_segment ? 1 : 0, 2, 4, 8}[fcs_flag];
+        UINTN offset = 5 + (single_segment ? 0 : 1) + dict_size;
+
+        *format = FORMAT_ZSTD;
+
+        // 展開後のサイズが書かれていない
+        if (fcs_size == 0) {
+            return EFI_UNSUPPORTED;
+        }
+        if (size < offset + fcs_size) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        switch (fcs_size) {
+            case 1: *content_size = src[offset]; break;
+            case 2: *content_size = read_le16(src + offset) + 256; break;
+            case 4: *content_size = read_le32(src + offset); break;
+            case 8: *content_size = read_le64(src + offset); break;
+        }
+
+        return EFI_SUCCESS;
+    }
+
+    // lz4
+    if (magic == LZ4_MAGIC) {
+        if (size < 6) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        *format = FORMAT_LZ4;
+
+        // 展開後のサイズが書かれていない
+        if (!(src[4] & 0x08)) {
+            return EFI_UNSUPPORTED;
+        }
+        if (size < 14) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        *content_size = read_le64(src + 6);
+
+        return EFI_SUCCESS;
+    }
+
+    return EFI_SUCCESS;
+}
+
+/*
+ * zstd
+ */
+
+// Backward bit stream
+struct bit_reader {
+    const UINT8 *src;
+    UINTN size;
+    INT64 pos; // 残りのビット数
+};
+
+// Bits at the position, bits before the start of the stream read as zero
+static UINT64 bits_at(const UINT8 *src, UINTN size, INT64 pos, UINT32 n) {
+
+    UINT64 v = 0;
+
+    if (n == 0) {
+        return 0;
+    }
+
+    if (pos < 0) {
+        if (pos + (INT64)n <= 0) {
+            return 0;
+        }
+        return bits_at(src, size, 0, n + pos) << (-pos);
+    }
+
+    UINTN byte = pos >> 3;
+    if (byte + 8 <= size) {
+        v = read_le64(src + byte);
+    } else {
+        for (UINTN i = 0; byte + i < size; i++) {
+            v |= (UINT64)src[byte + i] << (i * 8);
+        }
+    }
+
+    v >>= pos & 7;
+
+    return v & ((1ULL << n) - 1);
+}
+
+static EFI_STATUS bit_reader_init(struct bit_reader *br, const UINT8 *src, UINTN size) {
+
+    // 最後のバイトに終端ビットがある
+    if (size == 0 || src[size - 1] == 0) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    br->src = src;
+    br->size = size;
+    br->pos = (INT64)(size - 1) * 8 + highbit(src[size - 1]);
+
+    return EFI_SUCCESS;
+}
+
+static inline UINT64 bit_read(struct bit_reader *br, UINT32 n) {
+    br->pos -= n;
+    return bits_at(br->src, br->size, br->pos, n);
+}
+
+static inline UINT64 bit_peek(struct bit_reader *br, UINT32 n) {
+    return bits_at(br->src, br->size, br->pos - n, n);
+}
+
+// Read a FSE table description
+static EFI_STATUS fse_read_distribution(const UINT8 *src, UINTN size, INT16 *norm, UINT32 *max_symbol, UINT32 max_log, UINT32 *log, UINTN *consumed) {
+
+    INT64 bit = 0;
+    UINT32 symbol = 0;
+
+    if (size < 1) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    // Accuracy log
+    *log = (src[0] & 0xF) + 5;
+    if (*log > max_log) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    bit = 4;
+
+    INT32 remaining = (1 << *log) + 1;
+    INT32 threshold = 1 << *log;
+    UINT32 nb_bits = *log + 1;
+
+    while (remaining > 1) {
+
+        if (symbol > *max_symbol || (UINTN)(bit >> 3) >= size) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        INT32 max = (2 * threshold - 1) - remaining;
+        INT32 count;
+        UINT32 v = (UINT32)bits_at(src, size, bit, nb_bits);
+
+        if ((INT32)(v & (threshold - 1)) < max) {
+            count = v & (threshold - 1);
+            bit += nb_bits - 1;
+        } else {
+            count = v & (2 * threshold - 1);
+            if (count >= threshold) {
+                count -= max;
+            }
+            bit += nb_bits;
+        }
+
+        // -1は"1未満"の確率
+        count -= 1;
+        remaining -= count < 0 ? -count : count;
+        norm[symbol++] = (INT16)count;
+
+        // 確率0の後には繰り返しフラグがある
+        if (count == 0) {
+            UINT32 repeat;
+            do {
+                repeat = (UINT32)bits_at(src, size, bit, 2);
+                bit += 2;
+                for (UINT32 i = 0; i < repeat; i++) {
+                    if (symbol > *max_symbol) {
+                        return EFI_VOLUME_CORRUPTED;
+                    }
+                    norm[symbol++] = 0;
+                }
+            } while (repeat == 3);
+        }
+
+        while (remaining < threshold) {
+            nb_bits--;
+            threshold >>= 1;
+        }
+    }
+
+    if (remaining != 1 || (UINTN)((bit + 7) >> 3) > size) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    *max_symbol = symbol - 1;
+    *consumed = (bit + 7) >> 3;
+
+    return EFI_SUCCESS;
+}
+
+// Build a FSE decoding table
+static EFI_STATUS fse_build_table(fse_entry *table, const INT16 *norm, UINT32 max_symbol, UINT32 log) {
+
+    UINT32 size = 1 << log;
+    UINT32 high = size - 1;
+    UINT32 step = (size >> 1) + (size >> 3) + 3;
+    UINT32 pos = 0;
+    UINT16 next[256];
+
+    // "1未満"の確率のシンボルは最後に置く
+    for (UINT32 s = 0; s <= max_symbol; s++) {
+        if (norm[s] == -1) {
+            table[high--].symbol = (UINT8)s;
+            next[s] = 1;
+        } else {
+            next[s] = (UINT16)norm[s];
+        }
+    }
+
+    // Spread symbols
+    for (UINT32 s = 0; s <= max_symbol; s++) {
+        for (INT32 i = 0; i < norm[s]; i++) {
+            table[pos].symbol = (UINT8)s;
+            do {
+                pos = (pos + step) & (size - 1);
+            } while (pos > high);
+        }
+    }
+
+    if (pos != 0) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    // States
+    for (UINT32 u = 0; u < size; u++) {
+        UINT32 s = table[u].symbol;
+        UINT32 n = next[s]++;
+        table[u].nb_bits = (UINT8)(log - highbit(n));
+        table[u].new_state = (UINT16)((n << table[u].nb_bits) - size);
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Read the Huffman tree description
+static EFI_STATUS huf_read_table(struct decoder *dec, const UINT8 *src, UINTN size, UINTN *consumed) {
+
+    EFI_STATUS status;
+    UINT8 weights[256];
+    UINTN no_of_weights = 0;
+
+    if (size < 1) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    UINT8 header = src[0];
+
+    if (header >= 128) {
+
+        // Direct representation, 4 bits per weight
+        no_of_weights = header - 127;
+        UINTN bytes = (no_of_weights + 1) / 2;
+        if (1 + bytes > size) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        for (UINTN i = 0; i < no_of_weights; i++) {
+            weights[i] = (i & 1) ? (src[1 + i / 2] & 0xF) : (src[1 + i / 2] >> 4);
+        }
+
+        *consumed = 1 + bytes;
+
+    } else {
+
+        // FSE compressed weights
+        INT16 norm[256];
+        UINT32 max_symbol = 255;
+        UINT32 log;
+        UINTN used;
+        fse_entry table[1 << 6];
+        struct bit_reader br;
+
+        if (header == 0 || 1 + (UINTN)header > size) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        status = fse_read_distribution(src + 1, header, norm, &max_symbol, 6, &log, &used);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+
+        status = fse_build_table(table, norm, max_symbol, log);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+
+        status = bit_reader_init(&br, src + 1 + used, header - used);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+
+        // 2つの状態を交互に使う
+        UINT32 state1 = (UINT32)bit_read(&br, log);
+        UINT32 state2 = (UINT32)bit_read(&br, log);
+
+        while (TRUE) {
+            if (no_of_weights > 253) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+
+            weights[no_of_weights++] = table[state1].symbol;
+            state1 = table[state1].new_state + (UINT32)bit_read(&br, table[state1].nb_bits);
+            if (br.pos < 0) {
+                weights[no_of_weights++] = table[state2].symbol;
+                break;
+            }
+
+            weights[no_of_weights++] = table[state2].symbol;
+            state2 = table[state2].new_state + (UINT32)bit_read(&br, table[state2].nb_bits);
+            if (br.pos < 0) {
+                weights[no_of_weights++] = table[state1].symbol;
+                break;
+            }
+        }
+
+        *consumed = 1 + header;
+    }
+
+    // The last weight is implied
+    UINT32 sum = 0;
+    for (UINTN i = 0; i < no_of_weights; i++) {
+        if (weights[i] > HUF_LOG_MAX) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        if (weights[i] != 0) {
+            sum += 1 << (weights[i] - 1);
+        }
+    }
+    if (sum == 0) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    UINT32 max_bits = highbit(sum) + 1;
+    UINT32 rest = (1 << max_bits) - sum;
+    if (max_bits > HUF_LOG_MAX || (rest & (rest - 1)) != 0) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    weights[no_of_weights++] = (UINT8)(highbit(rest) + 1);
+
+    // 重みの小さい順に、同じ重みならシンボル順に並べる
+    UINT32 pos = 0;
+    for (UINT32 w = 1; w <= max_bits; w++) {
+        for (UINTN s = 0; s < no_of_weights; s++) {
+            if (weights[s] != w) {
+                continue;
+            }
+            UINT32 length = 1 << (w - 1);
+            for (UINT32 i = 0; i < length; i++) {
+                dec->huf_table[pos + i].symbol = (UINT8)s;
+                dec->huf_table[pos + i].nb_bits = (UINT8)(max_bits + 1 - w);
+            }
+            pos += length;
+        }
+    }
+
+    dec->huf_log = max_bits;
+    dec->huf_valid = TRUE;
+
+    return EFI_SUCCESS;
+}
+
+// Decode a Huffman stream
+static EFI_STATUS huf_decode_stream(struct decoder *dec, const UINT8 *src, UINTN size, UINT8 *out, UINTN count) {
+
+    EFI_STATUS status;
+    struct bit_reader br;
+
+    status = bit_reader_init(&br, src, size);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    for (UINTN i = 0; i < count; i++) {
+        huf_entry e = dec->huf_table[bit_peek(&br, dec->huf_log)];
+        out[i] = e.symbol;
+        br.pos -= e.nb_bits;
+    }
+
+    // 全てのビットを使い切る
+    if (br.pos != 0) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Decode the literals section
+static EFI_STATUS zstd_decode_literals(struct decoder *dec, const UINT8 *src, UINTN size, const UINT8 **literals, UINTN *literals_size, UINTN *consumed) {
+
+    EFI_STATUS status;
+    UINT32 type, size_format;
+    UINTN header, regenerated, compressed;
+
+    if (size < 1) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    type = src[0] & 3;
+    size_format = (src[0] >> 2) & 3;
+
+    // Raw or RLE
+    if (type == 0 || type == 1) {
+        switch (size_format) {
+            case 1:
+                header = 2;
+                if (size < header) return EFI_VOLUME_CORRUPTED;
+                regenerated = (src[0] >> 4) | (src[1] << 4);
+                break;
+            case 3:
+                header = 3;
+                if (size < header) return EFI_VOLUME_CORRUPTED;
+                regenerated = (src[0] >> 4) | (src[1] << 4) | (src[2] << 12);
+                break;
+            default:
+                header = 1;
+                regenerated = src[0] >> 3;
+                break;
+        }
+
+        if (regenerated > ZSTD_BLOCK_SIZE_MAX) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        if (type == 0) {
+            // そのまま使う
+            if (header + regenerated > size) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            *literals = src + header;
+            *consumed = header + regenerated;
+        } else {
+            if (header + 1 > size) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            SetMem(dec->literals, regenerated, src[header]);
+            *literals = dec->literals;
+            *consumed = header + 1;
+        }
+
+        *literals_size = regenerated;
+        return EFI_SUCCESS;
+    }
+
+    // Compressed or Treeless
+    switch (size_format) {
+        case 0:
+        case 1:
+            header = 3;
+            if (size < header) return EFI_VOLUME_CORRUPTED;
+            regenerated = (src[0] >> 4) | ((src[1] & 0x3F) << 4);
+            compressed = (src[1] >> 6) | (src[2] << 2);
+            break;
+        case 2:
+            header = 4;
+            if (size < header) return EFI_VOLUME_CORRUPTED;
+            regenerated = (src[0] >> 4) | (src[1] << 4) | ((src[2] & 3) << 12);
+            compressed = (src[2] >> 2) | (src[3] << 6);
+            break;
+        default:
+            header = 5;
+            if (size < header) return EFI_VOLUME_CORRUPTED;
+            regenerated = (src[0] >> 4) | (src[1] << 4) | ((src[2] & 0x3F) << 12);
+            compressed = (src[2] >> 6) | (src[3] << 2) | ((UINTN)src[4] << 10);
+            break;
+    }
+
+    if (regenerated > ZSTD_BLOCK_SIZE_MAX || header + compressed > size) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    const UINT8 *p = src + header;
+    UINTN remaining = compressed;
+
+    // Huffman tree
+    if (type == 2) {
+        UINTN used;
+        status = huf_read_table(dec, p, remaining, &used);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+        p += used;
+        remaining -= used;
+    } else if (!dec->huf_valid) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    if (size_format == 0) {
+
+        // 1 stream
+        status = huf_decode_stream(dec, p, remaining, dec->literals, regenerated);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+
+    } else {
+
+        // 4 streams with a jump table
+        if (remaining < 6) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        UINTN sizes[4];
+        sizes[0] = read_le16(p);
+        sizes[1] = read_le16(p + 2);
+        sizes[2] = read_le16(p + 4);
+        if (sizes[0] + sizes[1] + sizes[2] + 6 > remaining) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        sizes[3] = remaining - 6 - sizes[0] - sizes[1] - sizes[2];
+        p += 6;
+
+        UINTN segment = (regenerated + 3) / 4;
+        UINT8 *out = dec->literals;
+        for (UINTN i = 0; i < 4; i++) {
+            UINTN count = (i < 3) ? segment : regenerated - 3 * segment;
+            if (segment * 3 > regenerated) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            status = huf_decode_stream(dec, p, sizes[i], out, count);
+            if (EFI_ERROR(status)) {
+                return status;
+            }
+            p += sizes[i];
+            out += count;
+        }
+    }
+
+    *literals = dec->literals;
+    *literals_size = regenerated;
+    *consumed = header + compressed;
+
+    return EFI_SUCCESS;
+}
+
+// Predefined distributions
+static const INT16 LL_DEFAULT[36] = {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+    -1, -1, -1, -1
+};
+
+static const INT16 ML_DEFAULT[53] = {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+    -1, -1, -1, -1, -1
+};
+
+static const INT16 OF_DEFAULT[29] = {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+};
+
+// Literals length codes
+static const UINT32 LL_BASE[36] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+    8192, 16384, 32768, 65536
+};
+
+static const UINT8 LL_BITS[36] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+    13, 14, 15, 16
+};
+
+// Match length codes
+static const UINT32 ML_BASE[53] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+    35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+    4099, 8195, 16387, 32771, 65539
+};
+
+static const UINT8 ML_BITS[53] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+    12, 13, 14, 15, 16
+};
+
+// Build a sequence decoding table by the mode
+static EFI_STATUS zstd_sequence_table(UINT32 mode, const UINT8 *src, UINTN size, fse_entry *table, UINT32 *log, BOOLEAN *valid, const INT16 *defaults, UINT32 default_max, UINT32 default_log, UINT32 max_symbol, UINT32 max_log, UINTN *consumed) {
+
+    EFI_STATUS status;
+    INT16 norm[64];
+
+    switch (mode) {
+
+        // Predefined
+        case 0:
+            status = fse_build_table(table, defaults, default_max, default_log);
+            if (EFI_ERROR(status)) {
+                return status;
+            }
+            *log = default_log;
+            *consumed = 0;
+            break;
+
+        // RLE
+        case 1:
+            if (size < 1 || src[0] > max_symbol) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            table[0].symbol = src[0];
+            table[0].nb_bits = 0;
+            table[0].new_state = 0;
+            *log = 0;
+            *consumed = 1;
+            break;
+
+        // FSE compressed
+        case 2: {
+            UINT32 max = max_symbol;
+            status = fse_read_distribution(src, size, norm, &max, max_log, log, consumed);
+            if (EFI_ERROR(status)) {
+                return status;
+            }
+            status = fse_build_table(table, norm, max, *log);
+            if (EFI_ERROR(status)) {
+                return status;
+            }
+            break;
+        }
+
+        // Repeat
+        default:
+            if (!*valid) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            *consumed = 0;
+            break;
+    }
+
+    *valid = TRUE;
+
+    return EFI_SUCCESS;
+}
+
+// Decode and execute the sequences section
+static EFI_STATUS zstd_decode_sequences(struct decoder *dec, const UINT8 *src, UINTN size, const UINT8 *literals, UINTN literals_size) {
+
+    EFI_STATUS status;
+    UINTN no_of_sequences;
+    UINTN used;
+    const UINT8 *p = src;
+    const UINT8 *end = src + size;
+
+    if (size < 1) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    // Number of sequences
+    if (p[0] < 128) {
+        no_of_sequences = p[0];
+        p += 1;
+    } else if (p[0] < 255) {
+        if (size < 2) return EFI_VOLUME_CORRUPTED;
+        no_of_sequences = ((p[0] - 128) << 8) + p[1];
+        p += 2;
+    } else {
+        if (size < 3) return EFI_VOLUME_CORRUPTED;
+        no_of_sequences = p[1] + (p[2] << 8) + 0x7F00;
+        p += 3;
+    }
+
+    // Literals only
+    if (no_of_sequences == 0) {
+        if (dec->pos + literals_size > dec->capacity) {
+            return EFI_BUFFER_TOO_SMALL;
+        }
+        CopyMem(dec->dst + dec->pos, literals, literals_size);
+        dec->pos += literals_size;
+        return EFI_SUCCESS;
+    }
+
+    // Symbol compression modes
+    if (p >= end || (p[0] & 3) != 0) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    UINT8 modes = *p++;
+
+    status = zstd_sequence_table(modes >> 6, p, end - p, dec->ll_table, &dec->ll_log, &dec->ll_valid, LL_DEFAULT, 35, 6, 35, LL_LOG_MAX, &used);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+    p += used;
+
+    status = zstd_sequence_table((modes >> 4) & 3, p, end - p, dec->of_table, &dec->of_log, &dec->of_valid, OF_DEFAULT, 28, 5, 31, OF_LOG_MAX, &used);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+    p += used;
+
+    status = zstd_sequence_table((modes >> 2) & 3, p, end - p, dec->ml_table, &dec->ml_log, &dec->ml_valid, ML_DEFAULT, 52, 6, 52, ML_LOG_MAX, &used);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+    p += used;
+
+    // Bit stream
+    struct bit_reader br;
+    status = bit_reader_init(&br, p, end - p);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    UINT32 ll_state = (UINT32)bit_read(&br, dec->ll_log);
+    UINT32 of_state = (UINT32)bit_read(&br, dec->of_log);
+    UINT32 ml_state = (UINT32)bit_read(&br, dec->ml_log);
+
+    UINTN literals_pos = 0;
+
+    for (UINTN i = 0; i < no_of_sequences; i++) {
+
+        UINT32 of_code = dec->of_table[of_state].symbol;
+        UINT32 ll_code = dec->ll_table[ll_state].symbol;
+        UINT32 ml_code = dec->ml_table[ml_state].symbol;
+
+        if (of_code > 31 || ll_code > 35 || ml_code > 52) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        // Offset, match length, literals length の順に読む
+        UINT64 offset_value = (1ULL << of_code) + bit_read(&br, of_code);
+        UINT64 match_length = ML_BASE[ml_code] + bit_read(&br, ML_BITS[ml_code]);
+        UINT64 literals_length = LL_BASE[ll_code] + bit_read(&br, LL_BITS[ll_code]);
+        UINT64 offset;
+
+        // Repeat offsets
+        if (offset_value > 3) {
+            offset = offset_value - 3;
+            dec->rep[2] = dec->rep[1];
+            dec->rep[1] = dec->rep[0];
+            dec->rep[0] = offset;
+        } else {
+            UINT32 index = (UINT32)offset_value - 1 + (literals_length == 0 ? 1 : 0);
+            if (index == 0) {
+                offset = dec->rep[0];
+            } else {
+                offset = (index == 3) ? dec->rep[0] - 1 : dec->rep[index];
+                if (index != 1) {
+                    dec->rep[2] = dec->rep[1];
+                }
+                dec->rep[1] = dec->rep[0];
+                dec->rep[0] = offset;
+            }
+        }
+
+        // Check bounds
+        if (literals_pos + literals_length > literals_size) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        if (dec->pos + literals_length + match_length > dec->capacity) {
+            return EFI_BUFFER_TOO_SMALL;
+        }
+
+        // Literals
+        CopyMem(dec->dst + dec->pos, literals + literals_pos, literals_length);
+        literals_pos += literals_length;
+        dec->pos += literals_length;
+
+        // Match
+        if (offset == 0 || offset > dec->pos - dec->frame_start) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        copy_match(dec->dst + dec->pos, offset, match_length);
+        dec->pos += match_length;
+
+        // Update states (最後のシーケンスでは更新しない)
+        if (i + 1 < no_of_sequences) {
+            ll_state = dec->ll_table[ll_state].new_state + (UINT32)bit_read(&br, dec->ll_table[ll_state].nb_bits);
+            ml_state = dec->ml_table[ml_state].new_state + (UINT32)bit_read(&br, dec->ml_table[ml_state].nb_bits);
+            of_state = dec->of_table[of_state].new_state + (UINT32)bit_read(&br, dec->of_table[of_state].nb_bits);
+        }
+    }
+
+    // 全てのビットを使い切る
+    if (br.pos != 0) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    // Remaining literals
+    UINTN rest = literals_size - literals_pos;
+    if (dec->pos + rest > dec->capacity) {
+        return EFI_BUFFER_TOO_SMALL;
+    }
+    CopyMem(dec->dst + dec->pos, literals + literals_pos, rest);
+    dec->pos += rest;
+
+    return EFI_SUCCESS;
+}
+
+// Size of the next zstd unit
+static EFI_STATUS zstd_unit_size(struct decoder *dec, const UINT8 *p, UINTN avail, UINTN *size) {
+
+    switch (dec->stage) {
+
+        case STAGE_FRAME: {
+            if (avail < 5) {
+                *size = 5;
+                return EFI_SUCCESS;
+            }
+            UINT8 fhd = p[4];
+            BOOLEAN single_segment = (fhd >> 5) & 1;
+            UINTN dict_size = (UINTN[]){0, 1, 2, 4}[fhd & 3];
+            UINTN fcs_size = (UINTN[]){single_segment ? 1 : 0, 2, 4, 8}[fhd >> 6];
+            *size = 5 + (single_segment ? 0 : 1) + dict_size + fcs_size;
+            return EFI_SUCCESS;
+        }
+
+        case STAGE_BLOCK: {
+            if (avail < 3) {
+                *size = 3;
+                return EFI_SUCCESS;
+            }
+            UINT32 header = p[0] | (p[1] << 8) | (p[2] << 16);
+            UINT32 type = (header >> 1) & 3;
+            UINT32 block_size = header >> 3;
+            if (type == 3 || block_size > ZSTD_BLOCK_SIZE_MAX) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            *size = 3 + (type == 1 ? 1 : block_size);
+            return EFI_SUCCESS;
+        }
+
+        default:
+            *size = 4;
+            return EFI_SUCCESS;
+    }
+}
+
+// Decode a zstd unit
+static EFI_STATUS zstd_decode_unit(struct decoder *dec, const UINT8 *p, UINTN size) {
+
+    EFI_STATUS status;
+
+    switch (dec->stage) {
+
+        case STAGE_FRAME: {
+            UINT8 fhd = p[4];
+
+            // 予約ビットと辞書は非対応
+            if ((fhd & 0x08) || (fhd & 3) != 0) {
+                return EFI_UNSUPPORTED;
+            }
+
+            dec->content_checksum = (fhd >> 2) & 1;
+            dec->frame_start = dec->pos;
+            dec->rep[0] = 1;
+            dec->rep[1] = 4;
+            dec->rep[2] = 8;
+            dec->huf_valid = FALSE;
+            dec->ll_valid = FALSE;
+            dec->of_valid = FALSE;
+            dec->ml_valid = FALSE;
+            xxh64_init(&dec->xxh64);
+            dec->stage = STAGE_BLOCK;
+            return EFI_SUCCESS;
+        }
+
+        case STAGE_BLOCK: {
+            UINT32 header = p[0] | (p[1] << 8) | (p[2] << 16);
+            BOOLEAN last = header & 1;
+            UINT32 type = (header >> 1) & 3;
+            UINT32 block_size = header >> 3;
+            UINT64 from = dec->pos;
+
+            if (dec->pos + block_size > dec->capacity && type != 2) {
+                return EFI_BUFFER_TOO_SMALL;
+            }
+
+            if (type == 0) {
+                CopyMem(dec->dst + dec->pos, p + 3, block_size);
+                dec->pos += block_size;
+            } else if (type == 1) {
+                SetMem(dec->dst + dec->pos, block_size, p[3]);
+                dec->pos += block_size;
+            } else {
+                const UINT8 *literals;
+                UINTN literals_size, used;
+
+                status = zstd_decode_literals(dec, p + 3, block_size, &literals, &literals_size, &used);
+                if (EFI_ERROR(status)) {
+                    return status;
+                }
+
+                status = zstd_decode_sequences(dec, p + 3 + used, block_size - used, literals, literals_size);
+                if (EFI_ERROR(status)) {
+                    return status;
+                }
+
+                if (dec->pos - from > ZSTD_BLOCK_SIZE_MAX) {
+                    return EFI_VOLUME_CORRUPTED;
+                }
+            }
+
+            decoder_checksum_update(dec, from);
+
+            if (last) {
+                dec->stage = dec->content_checksum ? STAGE_CHECKSUM : STAGE_FRAME;
+                if (!dec->content_checksum) {
+                    dec->no_of_frames += 1;
+                }
+            }
+            return EFI_SUCCESS;
+        }
+
+        default:
+            if ((UINT32)xxh64_digest(&dec->xxh64) != read_le32(p)) {
+                return EFI_CRC_ERROR;
+            }
+            dec->stage = STAGE_FRAME;
+            dec->no_of_frames += 1;
+            return EFI_SUCCESS;
+    }
+}
+
+/*
+ * lz4
+ */
+
+// Decode a lz4 block
+static EFI_STATUS lz4_decode_block(struct decoder *dec, const UINT8 *src, UINTN size) {
+
+    const UINT8 *ip = src;
+    const UINT8 *end = src + size;
+
+    while (TRUE) {
+
+        if (ip >= end) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        UINT8 token = *ip++;
+
+        // Literals
+        UINT64 literals_length = token >> 4;
+        if (literals_length == 15) {
+            UINT8 b;
+            do {
+                if (ip >= end) {
+                    return EFI_VOLUME_CORRUPTED;
+                }
+                b = *ip++;
+                literals_length += b;
+            } while (b == 255);
+        }
+
+        if (literals_length > (UINT64)(end - ip)) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        if (dec->pos + literals_length > dec->capacity) {
+            return EFI_BUFFER_TOO_SMALL;
+        }
+
+        CopyMem(dec->dst + dec->pos, ip, literals_length);
+        ip += literals_length;
+        dec->pos += literals_length;
+
+        // 最後のシーケンスはリテラルのみ
+        if (ip == end) {
+            return EFI_SUCCESS;
+        }
+
+        // Match
+        if (end - ip < 2) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        UINT64 offset = read_le16(ip);
+        ip += 2;
+
+        UINT64 match_length = token & 0xF;
+        if (match_length == 15) {
+            UINT8 b;
+            do {
+                if (ip >= end) {
+                    return EFI_VOLUME_CORRUPTED;
+                }
+                b = *ip++;
+                match_length += b;
+            } while (b == 255);
+        }
+        match_length += 4;
+
+        if (offset == 0 || offset > dec->pos - dec->frame_start) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        if (dec->pos + match_length > dec->capacity) {
+            return EFI_BUFFER_TOO_SMALL;
+        }
+
+        copy_match(dec->dst + dec->pos, offset, match_length);
+        dec->pos += match_length;
+    }
+}
+
+// Size of the next lz4 unit
+static EFI_STATUS lz4_unit_size(struct decoder *dec, const UINT8 *p, UINTN avail, UINTN *size) {
+
+    switch (dec->stage) {
+
+        case STAGE_FRAME:
+            if (avail < 6) {
+                *size = 6;
+                return EFI_SUCCESS;
+            }
+            *size = 4 + 2 + ((p[4] & 0x08) ? 8 : 0) + ((p[4] & 0x01) ? 4 : 0) + 1;
+            return EFI_SUCCESS;
+
+        case STAGE_BLOCK: {
+            if (avail < 4) {
+                *size = 4;
+                return EFI_SUCCESS;
+            }
+            UINT32 block_size = read_le32(p) & 0x7FFFFFFF;
+            if (block_size > LZ4_BLOCK_SIZE_MAX) {
+                return EFI_VOLUME_CORRUPTED;
+            }
+            // EndMark
+            if (read_le32(p) == 0) {
+                *size = 4;
+            } else {
+                *size = 4 + block_size + (dec->block_checksum ? 4 : 0);
+            }
+            return EFI_SUCCESS;
+        }
+
+        default:
+            *size = 4;
+            return EFI_SUCCESS;
+    }
+}
+
+// Decode a lz4 unit
+static EFI_STATUS lz4_decode_unit(struct decoder *dec, const UINT8 *p, UINTN size) {
+
+    EFI_STATUS status;
+
+    switch (dec->stage) {
+
+        case STAGE_FRAME: {
+            UINT8 flg = p[4];
+
+            // Version 01, 予約ビットと辞書は非対応
+            if ((flg >> 6) != 1 || (flg & 0x02) || (flg & 0x01) || (p[5] & 0x8F)) {
+                return EFI_UNSUPPORTED;
+            }
+
+            // Header checksum
+            if (((xxh32(p + 4, size - 5) >> 8) & 0xFF) != p[size - 1]) {
+                return EFI_CRC_ERROR;
+            }
+
+            dec->block_checksum = (flg >> 4) & 1;
+            dec->content_checksum = (flg >> 2) & 1;
+            dec->frame_start = dec->pos;
+            xxh32_init(&dec->xxh32);
+            dec->stage = STAGE_BLOCK;
+            return EFI_SUCCESS;
+        }
+
+        case STAGE_BLOCK: {
+            UINT32 header = read_le32(p);
+            UINT32 block_size = header & 0x7FFFFFFF;
+            UINT64 from = dec->pos;
+
+            // EndMark
+            if (header == 0) {
+                dec->stage = dec->content_checksum ? STAGE_CHECKSUM : STAGE_FRAME;
+                if (!dec->content_checksum) {
+                    dec->no_of_frames += 1;
+                }
+                return EFI_SUCCESS;
+            }
+
+            // Block checksum
+            if (dec->block_checksum && xxh32(p + 4, block_size) != read_le32(p + 4 + block_size)) {
+                return EFI_CRC_ERROR;
+            }
+
+            if (header & 0x80000000) {
+                // Uncompressed
+                if (dec->pos + block_size > dec->capacity) {
+                    return EFI_BUFFER_TOO_SMALL;
+                }
+                CopyMem(dec->dst + dec->pos, p + 4, block_size);
+                dec->pos += block_size;
+            } else {
+                status = lz4_decode_block(dec, p + 4, block_size);
+                if (EFI_ERROR(status)) {
+                    return status;
+                }
+            }
+
+            decoder_checksum_update(dec, from);
+            return EFI_SUCCESS;
+        }
+
+        default:
+            if (xxh32_digest(&dec->xxh32) != read_le32(p)) {
+                return EFI_CRC_ERROR;
+            }
+            dec->stage = STAGE_FRAME;
+            dec->no_of_frames += 1;
+            return EFI_SUCCESS;
+    }
+}
+
+/*
+ * Decoder
+ */
+
+// Size of the next unit
+static EFI_STATUS decoder_unit_size(struct decoder *dec, const UINT8 *p, UINTN avail, UINTN *size) {
+
+    // フレームの先頭で形式を確認する
+    if (dec->stage == STAGE_FRAME) {
+        if (avail < 4) {
+            *size = 4;
+            return EFI_SUCCESS;
+        }
+
+        UINT32 magic = read_le32(p);
+
+        // Skippable frame
+        if ((magic & SKIPPABLE_MASK) == SKIPPABLE_MAGIC) {
+            *size = 8;
+            return EFI_SUCCESS;
+        }
+
+        if ((dec->format == FORMAT_ZSTD && magic != ZSTD_MAGIC) || (dec->format == FORMAT_LZ4 && magic != LZ4_MAGIC)) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+    }
+
+    if (dec->format == FORMAT_ZSTD) {
+        return zstd_unit_size(dec, p, avail, size);
+    }
+
+    return lz4_unit_size(dec, p, avail, size);
+}
+
+// Decode a unit
+static EFI_STATUS decoder_decode_unit(struct decoder *dec, const UINT8 *p, UINTN size) {
+
+    // Skippable frame
+    if (dec->stage == STAGE_FRAME && (read_le32(p) & SKIPPABLE_MASK) == SKIPPABLE_MAGIC) {
+        dec->skip = read_le32(p + 4);
+        dec->stage = dec->skip > 0 ? STAGE_SKIP : STAGE_FRAME;
+        return EFI_SUCCESS;
+    }
+
+    if (dec->format == FORMAT_ZSTD) {
+        return zstd_decode_unit(dec, p, size);
+    }
+
+    return lz4_decode_unit(dec, p, size);
+}
+
+// Initialize a decoder that writes into dst
+EFI_STATUS decoder_init(struct decoder *dec, UINT32 format, UINT8 *dst, UINT64 capacity) {
+
+    ZeroMem(dec, sizeof(struct decoder));
+
+    dec->format = format;
+    dec->dst = dst;
+    dec->capacity = capacity;
+    dec->stage = STAGE_FRAME;
+
+    // ブロックがチャンクの境界をまたぐ時だけ使う
+    dec->staging_size = (format == FORMAT_ZSTD ? ZSTD_BLOCK_SIZE_MAX : LZ4_BLOCK_SIZE_MAX) + 8;
+    dec->staging = AllocatePool(dec->staging_size);
+    if (dec->staging == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    if (format == FORMAT_ZSTD) {
+        dec->literals = AllocatePool(ZSTD_BLOCK_SIZE_MAX);
+        if (dec->literals == NULL) {
+            FreePool(dec->staging);
+            return EFI_OUT_OF_RESOURCES;
+        }
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Feed a chunk of the compressed data, decoding every complete block in it
+EFI_STATUS decoder_feed(struct decoder *dec, const UINT8 *data, UINTN size) {
+
+    EFI_STATUS status;
+    UINTN need;
+
+    while (size > 0) {
+
+        // Skippable frame
+        if (dec->stage == STAGE_SKIP) {
+            UINTN n = dec->skip < size ? dec->skip : size;
+            dec->skip -= n;
+            data += n;
+            size -= n;
+            if (dec->skip == 0) {
+                dec->stage = STAGE_FRAME;
+            }
+            continue;
+        }
+
+        // 前のチャンクの残りがある場合はそれを完成させる
+        if (dec->staged > 0) {
+            while (TRUE) {
+                status = decoder_unit_size(dec, dec->staging, dec->staged, &need);
+                if (EFI_ERROR(status)) {
+                    return status;
+                }
+                if (need > dec->staging_size) {
+                    return EFI_VOLUME_CORRUPTED;
+                }
+                if (dec->staged >= need) {
+                    break;
+                }
+
+                // 次のチャンクを待つ
+                if (size == 0) {
+                    return EFI_SUCCESS;
+                }
+
+                UINTN n = need - dec->staged < size ? need - dec->staged : size;
+                CopyMem(dec->staging + dec->staged, data, n);
+                dec->staged += n;
+                data += n;
+                size -= n;
+            }
+
+            status = decoder_decode_unit(dec, dec->staging, need);
+            if (EFI_ERROR(status)) {
+                return status;
+            }
+            dec->staged = 0;
+            continue;
+        }
+
+        // チャンクの中で完結していればそのまま展開する
+        status = decoder_unit_size(dec, data, size, &need);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+
+        if (need <= size) {
+            status = decoder_decode_unit(dec, data, need);
+            if (EFI_ERROR(status)) {
+                return status;
+            }
+            data += need;
+            size -= need;
+            continue;
+        }
+
+        // 次のチャンクを待つ
+        if (size > dec->staging_size) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        CopyMem(dec->staging, data, size);
+        dec->staged = size;
+        size = 0;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Finish decoding
+EFI_STATUS decoder_finish(struct decoder *dec) {
+
+    EFI_STATUS status = EFI_SUCCESS;
+
+    // フレームが途中で終わっている
+    if (dec->staged > 0 || dec->stage != STAGE_FRAME || dec->no_of_frames == 0) {
+        status = EFI_END_OF_FILE;
+    }
+
+    FreePool(dec->staging);
+    dec->staging = NULL;
+
+    if (dec->literals != NULL) {
+        FreePool(dec->literals);
+        dec->literals = NULL;
+    }
+
+    return status;
+}
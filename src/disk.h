@@ -5,8 +5,48 @@
 #include <efilib.h>
 #include <efigpt.h>
 
+#include "stream.h"
+
+// 同時に発行する読み込みの数
+#define READ_ENGINE_QUEUE_DEPTH 8
+
+// 1つの読み込みの最大サイズ
+#define READ_ENGINE_CHUNK_SIZE (1024 * 1024)
+
+// パーティションエントリー配列の最大サイズ
+#define GPT_ENTRIES_SIZE_MAX (1024 * 1024)
+
+// READ_REQUEST
+struct read_request {
+    EFI_EVENT event; // 完了イベント
+    BOOLEAN is_block_io2; // Block I/O 2で発行したか
+    EFI_DISK_IO2_TOKEN disk_token;
+    EFI_BLOCK_IO2_TOKEN block_token;
+};
+
+// READ_ENGINE
+struct read_engine {
+    EFI_BLOCK_IO_PROTOCOL *block_io;
+    EFI_BLOCK_IO2_PROTOCOL *block_io2; // なければNULL
+    EFI_DISK_IO_PROTOCOL *disk_io;
+    EFI_DISK_IO2_PROTOCOL *disk_io2; // なければNULL
+    UINT32 media_id;
+    UINT32 block_size;
+    UINT32 io_align;
+    UINTN chunk_size;
+
+    // 発行中のリクエスト (リングバッファー)
+    struct read_request requests[READ_ENGINE_QUEUE_DEPTH];
+    UINTN head;
+    UINTN in_flight;
+
+    // 最初に失敗したリクエストのステータス
+    EFI_STATUS status;
+};
+
 // DISK_INFO
 struct disk_info{
+    EFI_HANDLE handle;
     EFI_BLOCK_IO_MEDIA Media;
     BOOLEAN gpt_found; // GPTヘッダーが存在するか
     EFI_PARTITION_TABLE_HEADER gpt_header;
@@ -16,8 +56,34 @@ struct disk_info{
 
 // BOOTABLE DISK INFO
 struct bootable_disk_info {
+    EFI_HANDLE handle;
     EFI_FILE_PROTOCOL *root;
     UINTN no_of_partition;
 };
 
+// 探しているコンフィグファイル (バイナリ形式を優先する)
+#define CONFIG_FILE_NAME L"\\config.cfg"
+#define CONFIG_BINARY_NAME L"\\config.bin"
+
+// コンフィグファイルのサイズの上限
+#define CONFIG_FILE_SIZE_MAX (1024 * 1024)
+
+// ボリュームの探索状態
+#define PROBE_IDLE 0
+#define PROBE_OPEN 1 // OpenExの完了待ち
+#define PROBE_READ 2 // ReadExの完了待ち
+#define PROBE_DONE 3
+#define PROBE_FAILED 4
+
+// VOLUME_PROBE
+struct volume_probe {
+    UINTN index; // bootable_disk_infoの番号
+    EFI_FILE_PROTOCOL *root;
+    EFI_FILE_PROTOCOL *file; // OpenExの完了時に設定される
+    EFI_FILE_IO_TOKEN token;
+    UINT32 state;
+    BOOLEAN is_text; // バイナリ形式がなくテキストを開いている
+    file_view view;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,285 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "disk.h"
+#include "proto.h"
+
+// Open a read engine on the handle
+EFI_STATUS read_engine_open(EFI_HANDLE handle, EFI_HANDLE ImageHandle, struct read_engine *engine) {
+
+    EFI_STATUS status;
+    EFI_GUID block_io_guid = EFI_BLOCK_IO_PROTOCOL_GUID;
+    EFI_GUID block_io2_guid = EFI_BLOCK_IO2_PROTOCOL_GUID;
+    EFI_GUID disk_io_guid = EFI_DISK_IO_PROTOCOL_GUID;
+    EFI_GUID disk_io2_guid = EFI_DISK_IO2_PROTOCOL_GUID;
+
+    ZeroMem(engine, sizeof(struct read_engine));
+
+    // Block I/O is required
+    status = uefi_call_wrapper(BS->OpenProtocol, 6, handle, &block_io_guid, (VOID **)&engine->block_io, ImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    // その他はあれば使う
+    if (EFI_ERROR(uefi_call_wrapper(BS->OpenProtocol, 6, handle, &disk_io_guid, (VOID **)&engine->disk_io, ImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL))) {
+        engine->disk_io = NULL;
+    }
+    if (EFI_ERROR(uefi_call_wrapper(BS->OpenProtocol, 6, handle, &block_io2_guid, (VOID **)&engine->block_io2, ImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL))) {
+        engine->block_io2 = NULL;
+    }
+    if (EFI_ERROR(uefi_call_wrapper(BS->OpenProtocol, 6, handle, &disk_io2_guid, (VOID **)&engine->disk_io2, ImageHandle, NULL, EFI_OPEN_PROTOCOL_GET_PROTOCOL))) {
+        engine->disk_io2 = NULL;
+    }
+
+    // Media
+    engine->media_id = engine->block_io->Media->MediaId;
+    engine->block_size = engine->block_io->Media->BlockSize;
+    engine->io_align = engine->block_io->Media->IoAlign;
+    engine->chunk_size = READ_ENGINE_CHUNK_SIZE;
+    engine->status = EFI_SUCCESS;
+
+    // Completion events for asynchronous requests
+    if (engine->disk_io2 != NULL || engine->block_io2 != NULL) {
+        for (UINTN i = 0; i < READ_ENGINE_QUEUE_DEPTH; i++) {
+            status = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL, &engine->requests[i].event);
+            if (EFI_ERROR(status)) {
+                // 非同期は諦める
+                for (UINTN j = 0; j < i; j++) {
+                    uefi_call_wrapper(BS->CloseEvent, 1, engine->requests[j].event);
+                    engine->requests[j].event = NULL;
+                }
+                engine->disk_io2 = NULL;
+                engine->block_io2 = NULL;
+                break;
+            }
+        }
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Wait for the oldest request
+EFI_STATUS read_engine_wait(struct read_engine *engine) {
+
+    EFI_STATUS status;
+    UINTN index;
+
+    if (engine->in_flight == 0) {
+        return engine->status;
+    }
+
+    struct read_request *request = &engine->requests[engine->head];
+
+    // Wait for the completion event
+    status = uefi_call_wrapper(BS->WaitForEvent, 3, 1, &request->event, &index);
+    if (!EFI_ERROR(status)) {
+        status = request->is_block_io2 ? request->block_token.TransactionStatus : request->disk_token.TransactionStatus;
+    }
+
+    // 最初のエラーを記録
+    if (EFI_ERROR(status) && !EFI_ERROR(engine->status)) {
+        engine->status = status;
+    }
+
+    engine->head = (engine->head + 1) % READ_ENGINE_QUEUE_DEPTH;
+    engine->in_flight -= 1;
+
+    return engine->status;
+}
+
+// Issue one request of at most chunk_size bytes
+EFI_STATUS read_engine_issue(struct read_engine *engine, UINT64 offset, UINTN size, VOID *buffer) {
+
+    EFI_STATUS status;
+    BOOLEAN aligned;
+
+    // Block単位か
+    aligned = (offset % engine->block_size) == 0 && (size % engine->block_size) == 0 && (engine->io_align <= 1 || ((UINTN)buffer % engine->io_align) == 0);
+
+    // Asynchronous
+    if (engine->disk_io2 != NULL || (engine->block_io2 != NULL && aligned)) {
+
+        // 空きがなければ一番古いリクエストを待つ
+        if (engine->in_flight == READ_ENGINE_QUEUE_DEPTH) {
+            read_engine_wait(engine);
+        }
+
+        struct read_request *request = &engine->requests[(engine->head + engine->in_flight) % READ_ENGINE_QUEUE_DEPTH];
+
+        if (engine->disk_io2 != NULL) {
+            request->is_block_io2 = FALSE;
+            request->disk_token.Event = request->event;
+            request->disk_token.TransactionStatus = EFI_SUCCESS;
+            status = uefi_call_wrapper(engine->disk_io2->ReadDiskEx, 6, engine->disk_io2, engine->media_id, offset, &request->disk_token, size, buffer);
+        } else {
+            request->is_block_io2 = TRUE;
+            request->block_token.Event = request->event;
+            request->block_token.TransactionStatus = EFI_SUCCESS;
+            status = uefi_call_wrapper(engine->block_io2->ReadBlocksEx, 6, engine->block_io2, engine->media_id, offset / engine->block_size, &request->block_token, size, buffer);
+        }
+
+        if (!EFI_ERROR(status)) {
+            engine->in_flight += 1;
+        }
+
+    // Synchronous
+    } else if (engine->disk_io != NULL) {
+        status = uefi_call_wrapper(engine->disk_io->ReadDisk, 5, engine->disk_io, engine->media_id, offset, size, buffer);
+    } else if (aligned) {
+        status = uefi_call_wrapper(engine->block_io->ReadBlocks, 5, engine->block_io, engine->media_id, offset / engine->block_size, size, buffer);
+    } else {
+        status = EFI_UNSUPPORTED;
+    }
+
+    // 最初のエラーを記録
+    if (EFI_ERROR(status) && !EFI_ERROR(engine->status)) {
+        engine->status = status;
+    }
+
+    return status;
+}
+
+// Submit a read without waiting for it
+EFI_STATUS read_engine_submit(struct read_engine *engine, UINT64 offset, UINTN size, VOID *buffer) {
+
+    EFI_STATUS status = EFI_SUCCESS;
+    UINT8 *p = buffer;
+
+    // Split into chunks
+    while (size > 0) {
+        UINTN chunk = size < engine->chunk_size ? size : engine->chunk_size;
+
+        status = read_engine_issue(engine, offset, chunk, p);
+        if (EFI_ERROR(status)) {
+            break;
+        }
+
+        offset += chunk;
+        p += chunk;
+        size -= chunk;
+    }
+
+    return status;
+}
+
+// Wait for all requests
+EFI_STATUS read_engine_drain(struct read_engine *engine) {
+
+    EFI_STATUS status;
+
+    while (engine->in_flight > 0) {
+        read_engine_wait(engine);
+    }
+
+    // 次の読み込みのためにリセット
+    status = engine->status;
+    engine->status = EFI_SUCCESS;
+
+    return status;
+}
+
+// Read and wait
+EFI_STATUS read_engine_read(struct read_engine *engine, UINT64 offset, UINTN size, VOID *buffer) {
+
+    read_engine_submit(engine, offset, size, buffer);
+
+    return read_engine_drain(engine);
+}
+
+// Close the read engine
+void read_engine_close(struct read_engine *engine) {
+
+    // 発行中のリクエストがバッファーを使っている
+    read_engine_drain(engine);
+
+    for (UINTN i = 0; i < READ_ENGINE_QUEUE_DEPTH; i++) {
+        if (engine->requests[i].event != NULL) {
+            uefi_call_wrapper(BS->CloseEvent, 1, engine->requests[i].event);
+            engine->requests[i].event = NULL;
+        }
+    }
+}
+
+// Read and validate a GPT header and its partition entry array at the LBA
+EFI_STATUS read_gpt(struct read_engine *engine, EFI_LBA lba, EFI_PARTITION_TABLE_HEADER *header, EFI_PARTITION_ENTRY **entries) {
+
+    EFI_STATUS status;
+    UINT8 *block;
+    UINT8 *array;
+    UINT32 crc, array_size;
+    struct arena_mark mark;
+
+    *entries = NULL;
+
+    // Read the header block
+    block = AllocatePool(engine->block_size);
+    if (block == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    status = read_engine_read(engine, lba * engine->block_size, engine->block_size, block);
+    if (EFI_ERROR(status)) {
+        FreePool(block);
+        return status;
+    }
+
+    CopyMem(header, block, sizeof(EFI_PARTITION_TABLE_HEADER));
+
+    // Signature
+    if (CompareMem(block, EFI_PTAB_HEADER_ID, 8) != 0) {
+        FreePool(block);
+        return EFI_NOT_FOUND;
+    }
+
+    // Header CRC (CRC32フィールドを0として計算する)
+    if (header->Header.HeaderSize < sizeof(EFI_PARTITION_TABLE_HEADER) || header->Header.HeaderSize > engine->block_size) {
+        FreePool(block);
+        return EFI_VOLUME_CORRUPTED;
+    }
+    ((EFI_PARTITION_TABLE_HEADER *)block)->Header.CRC32 = 0;
+    crc = crc32(block, header->Header.HeaderSize);
+    FreePool(block);
+
+    if (crc != header->Header.CRC32 || header->MyLBA != lba) {
+        return EFI_CRC_ERROR;
+    }
+
+    // Entry array
+    if (header->SizeOfPartitionEntry < sizeof(EFI_PARTITION_ENTRY) || (header->SizeOfPartitionEntry % 8) != 0 || header->NumberOfPartitionEntries == 0 || header->NumberOfPartitionEntries > GPT_ENTRIES_SIZE_MAX / header->SizeOfPartitionEntry) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    array_size = header->NumberOfPartitionEntries * header->SizeOfPartitionEntry;
+
+    // 全てのエントリーを一度に読む (ディスクの一覧と同じだけ使うのでアリーナに置く)
+    arena_mark(&mark);
+    array = arena_alloc(array_size);
+    if (array == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    status = read_engine_read(engine, header->PartitionEntryLBA * engine->block_size, array_size, array);
+    if (EFI_ERROR(status)) {
+        arena_release_to(&mark);
+        return status;
+    }
+
+    // Array CRC
+    if (crc32(array, array_size) != header->PartitionEntryArrayCRC32) {
+        arena_release_to(&mark);
+        return EFI_CRC_ERROR;
+    }
+
+    // エントリーが128バイトより大きい場合は詰める
+    if (header->SizeOfPartitionEntry != sizeof(EFI_PARTITION_ENTRY)) {
+        for (UINT32 i = 1; i < header->NumberOfPartitionEntries; i++) {
+            CopyMem(array + i * sizeof(EFI_PARTITION_ENTRY), array + i * header->SizeOfPartitionEntry, sizeof(EFI_PARTITION_ENTRY));
+        }
+    }
+
+    *entries = (EFI_PARTITION_ENTRY *)array;
+
+    return EFI_SUCCESS;
+}
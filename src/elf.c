@@ -0,0 +1,384 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "elf.h"
+#include "stream.h"
+#include "proto.h"
+
+// Hash the file up to the offset through the scratch buffer
+// ヘッダーとセグメントの間のバイトもハッシュに含める
+static EFI_STATUS hash_kernel_to(kernel_source *source, UINT64 offset) {
+
+    EFI_STATUS status;
+
+    while (source->hashed < offset) {
+        UINTN size = offset - source->hashed < KERNEL_SCRATCH_SIZE ? offset - source->hashed : KERNEL_SCRATCH_SIZE;
+        status = read_file_at(source->file, source->hashed, size, source->scratch);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+        sha256_update(source->sha, source->scratch, size);
+        source->hashed += size;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Read bytes of the kernel image
+EFI_STATUS read_kernel_at(kernel_source *source, UINT64 offset, UINTN size, VOID *buffer) {
+
+    EFI_STATUS status;
+    UINT8 *dst = buffer;
+
+    // 展開済み
+    if (source->image != NULL) {
+        if (offset > source->size || size > source->size - offset) {
+            return EFI_END_OF_FILE;
+        }
+        mem_copy(buffer, source->image + offset, size);
+        return EFI_SUCCESS;
+    }
+
+    if (source->sha == NULL) {
+        return read_file_at(source->file, offset, size, buffer);
+    }
+
+    // 検証する場合は読み込み先に直接読み、届いたチャンクから順にハッシュする
+    status = hash_kernel_to(source, offset);
+    for (UINTN done = 0; done < size && !EFI_ERROR(status); ) {
+        UINTN chunk = size - done < KERNEL_HASH_CHUNK ? size - done : KERNEL_HASH_CHUNK;
+        UINT64 end = offset + done + chunk;
+
+        status = read_file_at(source->file, offset + done, chunk, dst + done);
+        if (!EFI_ERROR(status) && end > source->hashed) {
+            sha256_update(source->sha, dst + done + chunk - (end - source->hashed), end - source->hashed);
+            source->hashed = end;
+        }
+        done += chunk;
+    }
+
+    return status;
+}
+
+// Validate ELF header
+EFI_STATUS validate_elf_header(Elf64_Ehdr *ehdr) {
+
+    // Magic
+    if (*(UINT32 *)ehdr->e_ident != ELF_MAGIC) {
+        return EFI_UNSUPPORTED;
+    }
+
+    // 64bit Little Endianのx86_64のみ
+    if (ehdr->e_ident[4] != ELFCLASS64 || ehdr->e_ident[5] != ELFDATA2LSB || ehdr->e_machine != EM_X86_64) {
+        return EFI_UNSUPPORTED;
+    }
+
+    // 実行ファイル (再配置しないので、PIEのET_DYNは読み込めない)
+    if (ehdr->e_type != ET_EXEC) {
+        return EFI_UNSUPPORTED;
+    }
+
+    // Program header
+    if (ehdr->e_phnum == 0 || ehdr->e_phentsize != sizeof(Elf64_Phdr)) {
+        return EFI_UNSUPPORTED;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Free pages of the kernel
+void free_kernel(kernel_image *kernel) {
+
+    if (kernel->segments == NULL) {
+        return;
+    }
+
+    for (UINTN i = 0; i < kernel->no_of_segments; i++) {
+        if (kernel->segments[i].no_of_pages != 0) {
+            uefi_call_wrapper(BS->FreePages, 2, kernel->segments[i].page_base, kernel->segments[i].no_of_pages);
+        }
+    }
+
+    // セグメントの表はアリーナにあり、ハンドオフ前にまとめて返す
+    kernel->segments = NULL;
+    kernel->no_of_segments = 0;
+}
+
+// Load a PT_LOAD segment straight to its physical address
+EFI_STATUS load_segment(kernel_source *source, Elf64_Phdr *phdr, EFI_PHYSICAL_ADDRESS allocated_end, kernel_segment *segment) {
+
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS page_base, page_end;
+    EFI_MEMORY_TYPE type;
+
+    // ファイル上のサイズがメモリー上のサイズを超えることはない
+    if (phdr->p_filesz > phdr->p_memsz) {
+        return EFI_LOAD_ERROR;
+    }
+
+    // Page range of the segment
+    page_base = phdr->p_paddr & ~((EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK);
+    page_end = (phdr->p_paddr + phdr->p_memsz + EFI_PAGE_MASK) & ~((EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK);
+
+    // 前のセグメントと共有するページは確保済み
+    if (page_base < allocated_end) {
+        page_base = allocated_end;
+    }
+
+    // Code or Data
+    type = (phdr->p_flags & PF_X) ? EfiLoaderCode : EfiLoaderData;
+
+    segment->paddr = phdr->p_paddr;
+    segment->vaddr = phdr->p_vaddr;
+    segment->memsz = phdr->p_memsz;
+    segment->flags = phdr->p_flags;
+    segment->page_base = page_base;
+    segment->no_of_pages = 0;
+
+    // Allocate pages at the physical address
+    if (page_end > page_base) {
+        status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAddress, type, EFI_SIZE_TO_PAGES(page_end - page_base), &page_base);
+        if (EFI_ERROR(status)) {
+            Print(L"Cannot allocate pages at 0x%lx: %r\n", page_base, status);
+            return status;
+        }
+        segment->no_of_pages = EFI_SIZE_TO_PAGES(page_end - page_base);
+    }
+
+    // Read the file image directly into the target pages
+    if (phdr->p_filesz != 0) {
+        status = read_kernel_at(source, phdr->p_offset, phdr->p_filesz, (VOID *)phdr->p_paddr);
+        if (EFI_ERROR(status)) {
+            Print(L"Cannot read the segment at 0x%lx: %r\n", phdr->p_paddr, status);
+            return status;
+        }
+    }
+
+    // Zero only the BSS tail
+    if (phdr->p_memsz > phdr->p_filesz) {
+        parallel_zero((VOID *)(phdr->p_paddr + phdr->p_filesz), phdr->p_memsz - phdr->p_filesz);
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Check the SHA-256 of the kernel file
+// 生のカーネルはセグメントの後ろからファイルの終わりまでをハッシュしてから比べる
+static EFI_STATUS verify_kernel(kernel_source *source, struct sha256_state *sha, const UINT8 *digest) {
+
+    EFI_STATUS status;
+    UINT8 actual[SHA256_DIGEST_SIZE];
+
+    if (source->sha != NULL) {
+        status = hash_kernel_to(source, source->size);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+    }
+
+    sha256_final(sha, actual);
+    if (CompareMem(actual, digest, SHA256_DIGEST_SIZE) != 0) {
+        Print(L"SHA-256 of the kernel does not match\n");
+        return EFI_SECURITY_VIOLATION;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Load the kernel
+// If digest is not NULL, the kernel file must have this SHA-256
+EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *root, CHAR16 *path, const UINT8 *digest, kernel_image *kernel) {
+
+    EFI_STATUS status;
+    EFI_FILE_PROTOCOL *file;
+    Elf64_Ehdr ehdr;
+    Elf64_Phdr *phdrs;
+    UINTN phdrs_size;
+    EFI_PHYSICAL_ADDRESS allocated_end = 0;
+    kernel_source source;
+    UINT32 format;
+    UINT64 content_size;
+    UINTN image_pages = 0;
+    struct sha256_state sha;
+
+    kernel->entry = 0;
+    kernel->base = ~((EFI_PHYSICAL_ADDRESS)0);
+    kernel->end = 0;
+    kernel->no_of_segments = 0;
+    kernel->segments = NULL;
+
+    // Open the kernel file
+    status = uefi_call_wrapper(root->Open, 5, root, &file, path, EFI_FILE_MODE_READ, 0);
+    if (EFI_ERROR(status)) {
+        Print(L"Cannot open the kernel %s: %r\n", path, status);
+        return status;
+    }
+
+    source.file = file;
+    source.image = NULL;
+    source.size = 0;
+    source.sha = NULL;
+    source.hashed = 0;
+    source.scratch = NULL;
+
+    // Read the ELF header
+    status = read_file_at(file, 0, sizeof(ehdr), &ehdr);
+    if (EFI_ERROR(status)) {
+        Print(L"Cannot read the ELF header: %r\n", status);
+        goto close;
+    }
+
+    // Compressed kernel
+    status = decoder_probe((UINT8 *)&ehdr, sizeof(ehdr), &format, &content_size);
+    if (EFI_ERROR(status)) {
+        Print(L"Cannot decompress the kernel: %r\n", status);
+        goto close;
+    }
+
+    sha256_init(&sha);
+
+    // 生のカーネルはセグメントを読み込み先に直接読みながら、ファイル全体を順にハッシュする
+    if (format == FORMAT_RAW && digest != NULL) {
+        EFI_FILE_INFO *info = LibFileInfo(file);
+        if (info == NULL) {
+            status = EFI_DEVICE_ERROR;
+            goto close;
+        }
+        source.size = info->FileSize;
+        FreePool(info);
+
+        source.scratch = AllocatePool(KERNEL_SCRATCH_SIZE);
+        if (source.scratch == NULL) {
+            status = EFI_OUT_OF_RESOURCES;
+            goto close;
+        }
+        source.sha = &sha;
+
+        // 読み込み済みのヘッダーから始める
+        sha256_update(&sha, &ehdr, sizeof(ehdr));
+        source.hashed = sizeof(ehdr);
+    }
+
+    if (format != FORMAT_RAW) {
+
+        // セグメントは連続していないので、一度展開してから配置する
+        EFI_PHYSICAL_ADDRESS address;
+        image_pages = EFI_SIZE_TO_PAGES(content_size);
+        status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, image_pages, &address);
+        if (EFI_ERROR(status)) {
+            image_pages = 0;
+            goto close;
+        }
+        source.image = (UINT8 *)address;
+        source.size = content_size;
+
+        status = decompress_file(file, format, source.image, content_size, digest != NULL ? &sha : NULL);
+        if (EFI_ERROR(status)) {
+            Print(L"Cannot decompress the kernel: %r\n", status);
+            goto free_image;
+        }
+
+        if (digest != NULL) {
+            status = verify_kernel(&source, &sha, digest);
+            if (EFI_ERROR(status)) {
+                goto free_image;
+            }
+        }
+
+        status = read_kernel_at(&source, 0, sizeof(ehdr), &ehdr);
+        if (EFI_ERROR(status)) {
+            goto free_image;
+        }
+    }
+
+    // Validate
+    status = validate_elf_header(&ehdr);
+    if (EFI_ERROR(status)) {
+        Print(L"The kernel is not a x86_64 ELF64 executable\n");
+        goto free_image;
+    }
+
+    // Read program headers only
+    phdrs_size = ehdr.e_phnum * sizeof(Elf64_Phdr);
+    phdrs = AllocatePool(phdrs_size);
+    if (phdrs == NULL) {
+        status = EFI_OUT_OF_RESOURCES;
+        goto free_image;
+    }
+
+    status = read_kernel_at(&source, ehdr.e_phoff, phdrs_size, phdrs);
+    if (EFI_ERROR(status)) {
+        Print(L"Cannot read program headers: %r\n", status);
+        goto free_phdrs;
+    }
+
+    // Segment table
+    kernel->segments = ARENA_ARRAY(kernel_segment, ehdr.e_phnum);
+    if (kernel->segments == NULL) {
+        status = EFI_OUT_OF_RESOURCES;
+        goto free_phdrs;
+    }
+
+    // Load each PT_LOAD segment
+    for (UINTN i = 0; i < ehdr.e_phnum; i++) {
+
+        if (phdrs[i].p_type != PT_LOAD || phdrs[i].p_memsz == 0) {
+            continue;
+        }
+
+        // PT_LOADはアドレス順に並んでいる
+        if (phdrs[i].p_paddr < kernel->end) {
+            Print(L"PT_LOAD segments are not sorted\n");
+            status = EFI_LOAD_ERROR;
+            break;
+        }
+
+        status = load_segment(&source, &phdrs[i], allocated_end, &kernel->segments[kernel->no_of_segments]);
+        kernel->no_of_segments += 1;
+        if (EFI_ERROR(status)) {
+            break;
+        }
+
+        // Update the range
+        if (phdrs[i].p_paddr < kernel->base) {
+            kernel->base = phdrs[i].p_paddr;
+        }
+        kernel->end = phdrs[i].p_paddr + phdrs[i].p_memsz;
+        allocated_end = (kernel->end + EFI_PAGE_MASK) & ~((EFI_PHYSICAL_ADDRESS)EFI_PAGE_MASK);
+    }
+
+    // 読み込むセグメントがない
+    if (!EFI_ERROR(status) && kernel->end == 0) {
+        Print(L"The kernel has no PT_LOAD segments\n");
+        status = EFI_LOAD_ERROR;
+    }
+
+    // 生のカーネルは全てのセグメントを読んだ後で比べる (一致しなければ配置したページを返す)
+    if (!EFI_ERROR(status) && source.sha != NULL) {
+        status = verify_kernel(&source, &sha, digest);
+    }
+
+    if (EFI_ERROR(status)) {
+        free_kernel(kernel);
+    } else {
+        kernel->entry = ehdr.e_entry;
+    }
+
+free_phdrs:
+    FreePool(phdrs);
+
+free_image:
+    if (image_pages != 0) {
+        uefi_call_wrapper(BS->FreePages, 2, (EFI_PHYSICAL_ADDRESS)source.image, image_pages);
+    }
+    if (source.scratch != NULL) {
+        FreePool(source.scratch);
+    }
+
+close:
+    uefi_call_wrapper(file->Close, 1, file);
+
+    return status;
+}
@@ -0,0 +1,106 @@
+#ifndef _ELF_H
+#define _ELF_H
+
+#include <efi.h>
+
+// ELF識別子
+#define ELF_MAGIC 0x464C457F // "\x7FELF"
+#define ELFCLASS64 2
+#define ELFDATA2LSB 1
+#define ET_EXEC 2
+#define EM_X86_64 62
+
+// プログラムヘッダーの種類
+#define PT_NULL 0
+#define PT_LOAD 1
+
+// セグメントの属性
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
+// ELF64 ヘッダー
+typedef struct {
+    UINT8 e_ident[16];
+    UINT16 e_type;
+    UINT16 e_machine;
+    UINT32 e_version;
+    UINT64 e_entry;
+    UINT64 e_phoff;
+    UINT64 e_shoff;
+    UINT32 e_flags;
+    UINT16 e_ehsize;
+    UINT16 e_phentsize;
+    UINT16 e_phnum;
+    UINT16 e_shentsize;
+    UINT16 e_shnum;
+    UINT16 e_shstrndx;
+} Elf64_Ehdr;
+
+// ELF64 プログラムヘッダー
+typedef struct {
+    UINT32 p_type;
+    UINT32 p_flags;
+    UINT64 p_offset;
+    UINT64 p_vaddr;
+    UINT64 p_paddr;
+    UINT64 p_filesz;
+    UINT64 p_memsz;
+    UINT64 p_align;
+} Elf64_Phdr;
+
+// 検証する生のカーネルをハッシュしながら読む単位
+#define KERNEL_HASH_CHUNK (2 * 1024 * 1024)
+
+// セグメントの間の読み飛ばすバイトをハッシュするバッファーの大きさ
+#define KERNEL_SCRATCH_SIZE (64 * 1024)
+
+// カーネルの読み込み元
+// 圧縮されていればファイルではなく展開済みのメモリーから読む
+typedef struct _KERNEL_SOURCE {
+    EFI_FILE_PROTOCOL *file;
+    UINT8 *image;
+    UINT64 size;
+
+    // 生のカーネルを検証する場合は、先頭から順に一度ずつハッシュする
+    struct sha256_state *sha;
+    UINT64 hashed; // ハッシュ済みのバイト数
+    UINT8 *scratch;
+} kernel_source;
+
+// 配置されたセグメント
+typedef struct _KERNEL_SEGMENT {
+
+    // 物理アドレスと仮想アドレス
+    EFI_PHYSICAL_ADDRESS paddr;
+    UINT64 vaddr;
+
+    // メモリー上のサイズ
+    UINT64 memsz;
+
+    // PF_X / PF_W / PF_R
+    UINT32 flags;
+
+    // 確保したページ (他のセグメントと共有するページは含まない)
+    EFI_PHYSICAL_ADDRESS page_base;
+    UINTN no_of_pages;
+
+} kernel_segment;
+
+// 読み込まれたカーネル
+typedef struct _KERNEL_IMAGE {
+
+    // エントリーポイント
+    UINT64 entry;
+
+    // 物理アドレスの範囲
+    EFI_PHYSICAL_ADDRESS base;
+    EFI_PHYSICAL_ADDRESS end;
+
+    // セグメントの配列
+    UINTN no_of_segments;
+    kernel_segment *segments;
+
+} kernel_image;
+
+#endif
@@ -0,0 +1,1085 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "ext4.h"
+#include "proto.h"
+
+static EXT4_API EFI_STATUS ext4_open(EFI_FILE_PROTOCOL *This, EFI_FILE_PROTOCOL **NewHandle, CHAR16 *FileName, UINT64 OpenMode, UINT64 Attributes);
+static EXT4_API EFI_STATUS ext4_close(EFI_FILE_PROTOCOL *This);
+static EXT4_API EFI_STATUS ext4_delete(EFI_FILE_PROTOCOL *This);
+static EXT4_API EFI_STATUS ext4_read(EFI_FILE_PROTOCOL *This, UINTN *BufferSize, VOID *Buffer);
+static EXT4_API EFI_STATUS ext4_write(EFI_FILE_PROTOCOL *This, UINTN *BufferSize, VOID *Buffer);
+static EXT4_API EFI_STATUS ext4_get_position(EFI_FILE_PROTOCOL *This, UINT64 *Position);
+static EXT4_API EFI_STATUS ext4_set_position(EFI_FILE_PROTOCOL *This, UINT64 Position);
+static EXT4_API EFI_STATUS ext4_get_info(EFI_FILE_PROTOCOL *This, EFI_GUID *InformationType, UINTN *BufferSize, VOID *Buffer);
+static EXT4_API EFI_STATUS ext4_set_info(EFI_FILE_PROTOCOL *This, EFI_GUID *InformationType, UINTN BufferSize, VOID *Buffer);
+static EXT4_API EFI_STATUS ext4_flush(EFI_FILE_PROTOCOL *This);
+
+static UINT16 ext4_u16(const UINT8 *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static UINT32 ext4_u32(const UINT8 *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((UINT32)p[3] << 24);
+}
+
+// Read bytes at the offset of the partition
+static EFI_STATUS ext4_read_disk(struct ext4_volume *vol, UINT64 offset, UINTN size, VOID *buffer) {
+    return read_engine_read(&vol->engine, vol->offset + offset, size, buffer);
+}
+
+// Whether the group has a copy of the superblock and the descriptors
+static BOOLEAN ext4_group_has_super(struct ext4_volume *vol, UINT32 group) {
+
+    if (group <= 1) {
+        return TRUE;
+    }
+    if (vol->compat & EXT4_FEATURE_COMPAT_SPARSE_SUPER2) {
+        return group == vol->backup_bgs[0] || group == vol->backup_bgs[1];
+    }
+    if (!(vol->ro_compat & EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER)) {
+        return TRUE;
+    }
+
+    // 3, 5, 7の累乗
+    for (UINT32 base = 3; base <= 7; base += 2) {
+        UINT64 power = base;
+        while (power < group) {
+            power *= base;
+        }
+        if (power == group) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+// Disk offset of the group descriptor
+static UINT64 ext4_desc_offset(struct ext4_volume *vol, UINT32 group) {
+
+    UINT32 per_block = vol->block_size / vol->desc_size;
+
+    // meta_bgでは記述子のブロックはメタグループの最初のグループに置かれる
+    if ((vol->incompat & EXT4_FEATURE_INCOMPAT_META_BG) && group / per_block >= vol->first_meta_bg) {
+        UINT32 first = group - group % per_block;
+        UINT64 block = vol->first_data_block + (UINT64)first * vol->blocks_per_group + (ext4_group_has_super(vol, first) ? 1 : 0);
+        return block * vol->block_size + (UINT64)(group % per_block) * vol->desc_size;
+    }
+
+    return (UINT64)(vol->first_data_block + 1) * vol->block_size + (UINT64)group * vol->desc_size;
+}
+
+// Read the first 128 bytes of the inode
+static EFI_STATUS ext4_read_inode(struct ext4_volume *vol, UINT32 ino, UINT8 *inode) {
+
+    EFI_STATUS status;
+    UINT8 desc[EXT4_DESC_SIZE_64BIT];
+    UINT32 group, index;
+    UINT64 table;
+
+    if (ino == 0 || ino > vol->no_of_inodes) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    group = (ino - 1) / vol->inodes_per_group;
+    index = (ino - 1) % vol->inodes_per_group;
+
+    status = ext4_read_disk(vol, ext4_desc_offset(vol, group), vol->desc_size < sizeof(desc) ? vol->desc_size : sizeof(desc), desc);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    // Inode table
+    table = ext4_u32(desc + 0x08);
+    if (vol->desc_size >= EXT4_DESC_SIZE_64BIT) {
+        table |= (UINT64)ext4_u32(desc + 0x28) << 32;
+    }
+
+    return ext4_read_disk(vol, table * vol->block_size + (UINT64)index * vol->inode_size, EXT4_GOOD_OLD_INODE_SIZE, inode);
+}
+
+// Append a run of blocks, merging it into the last one when both are contiguous
+static EFI_STATUS ext4_add_extent(struct ext4_file *file, UINT64 file_offset, UINT64 disk_offset, UINT64 size, BOOLEAN unwritten) {
+
+    struct ext4_extent *last = file->no_of_extents > 0 ? &file->extents[file->no_of_extents - 1] : NULL;
+
+    // 前のエクステントの直後なら伸ばす
+    if (last != NULL && last->file_offset + last->size == file_offset && last->unwritten == unwritten &&
+        (unwritten || last->disk_offset + last->size == disk_offset)) {
+        last->size += size;
+        return EFI_SUCCESS;
+    }
+
+    if (file->no_of_extents == file->extents_capacity) {
+        UINTN capacity = file->extents_capacity == 0 ? EXT4_EXTENTS_INITIAL : file->extents_capacity * 2;
+        struct ext4_extent *grown = ReallocatePool(file->extents, file->extents_capacity * sizeof(struct ext4_extent), capacity * sizeof(struct ext4_extent));
+        if (grown == NULL) {
+            return EFI_OUT_OF_RESOURCES;
+        }
+        file->extents = grown;
+        file->extents_capacity = capacity;
+    }
+
+    file->extents[file->no_of_extents].file_offset = file_offset;
+    file->extents[file->no_of_extents].disk_offset = disk_offset;
+    file->extents[file->no_of_extents].size = size;
+    file->extents[file->no_of_extents].unwritten = unwritten;
+    file->no_of_extents += 1;
+
+    return EFI_SUCCESS;
+}
+
+// Walk a node of the extent tree in logical order
+static EFI_STATUS ext4_extent_node(struct ext4_file *file, const UINT8 *node, UINTN node_size, UINTN depth) {
+
+    EFI_STATUS status = EFI_SUCCESS;
+    struct ext4_volume *vol = file->volume;
+    UINT32 bs = vol->block_size;
+    UINTN no_of_entries = ext4_u16(node + 2);
+
+    if (ext4_u16(node) != EXT4_EXTENT_MAGIC || ext4_u16(node + 6) != depth ||
+        EXT4_EXTENT_HEADER_SIZE + no_of_entries * EXT4_EXTENT_ENTRY_SIZE > node_size) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    for (UINTN i = 0; i < no_of_entries && !EFI_ERROR(status); i++) {
+        const UINT8 *e = node + EXT4_EXTENT_HEADER_SIZE + i * EXT4_EXTENT_ENTRY_SIZE;
+
+        // Leaf
+        if (depth == 0) {
+            UINT64 logical = ext4_u32(e);
+            UINT32 length = ext4_u16(e + 4);
+            UINT64 start = ((UINT64)ext4_u16(e + 6) << 32) | ext4_u32(e + 8);
+            BOOLEAN unwritten = length > EXT4_EXTENT_INIT_MAX;
+
+            if (unwritten) {
+                length -= EXT4_EXTENT_INIT_MAX;
+            }
+            status = ext4_add_extent(file, logical * bs, start * bs, (UINT64)length * bs, unwritten);
+            continue;
+        }
+
+        // Index (子のノードは1ブロック)
+        UINT64 leaf = ext4_u32(e + 4) | ((UINT64)ext4_u16(e + 8) << 32);
+        UINT8 *child = AllocatePool(bs);
+        if (child == NULL) {
+            return EFI_OUT_OF_RESOURCES;
+        }
+        status = ext4_read_disk(vol, leaf * bs, bs, child);
+        if (!EFI_ERROR(status)) {
+            status = ext4_extent_node(file, child, bs, depth - 1);
+        }
+        FreePool(child);
+    }
+
+    return status;
+}
+
+// Walk a block of the old indirect block map
+// level 0 is a data block, 1 to 3 are blocks of pointers
+static EFI_STATUS ext4_indirect(struct ext4_file *file, UINT32 block, UINTN level, UINT64 *logical, UINT64 needed) {
+
+    EFI_STATUS status = EFI_SUCCESS;
+    struct ext4_volume *vol = file->volume;
+    UINT32 bs = vol->block_size;
+    UINT64 span = 1;
+    UINT8 *pointers;
+
+    if (*logical >= needed) {
+        return EFI_SUCCESS;
+    }
+
+    for (UINTN i = 0; i < level; i++) {
+        span *= bs / 4;
+    }
+
+    // 穴
+    if (block == 0) {
+        *logical += span;
+        return EFI_SUCCESS;
+    }
+
+    if (level == 0) {
+        status = ext4_add_extent(file, *logical * bs, (UINT64)block * bs, bs, FALSE);
+        *logical += 1;
+        return status;
+    }
+
+    pointers = AllocatePool(bs);
+    if (pointers == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    status = ext4_read_disk(vol, (UINT64)block * bs, bs, pointers);
+    for (UINTN i = 0; i < bs / 4 && *logical < needed && !EFI_ERROR(status); i++) {
+        status = ext4_indirect(file, ext4_u32(pointers + i * 4), level - 1, logical, needed);
+    }
+    FreePool(pointers);
+
+    return status;
+}
+
+// Allocate a file with the protocol functions
+static struct ext4_file *ext4_new_file(struct ext4_volume *vol) {
+
+    struct ext4_file *file = AllocateZeroPool(sizeof(struct ext4_file));
+    if (file == NULL) {
+        return NULL;
+    }
+
+    file->protocol.Revision = EFI_FILE_PROTOCOL_REVISION;
+    file->protocol.Open = (EFI_FILE_OPEN)ext4_open;
+    file->protocol.Close = (EFI_FILE_CLOSE)ext4_close;
+    file->protocol.Delete = (EFI_FILE_DELETE)ext4_delete;
+    file->protocol.Read = (EFI_FILE_READ)ext4_read;
+    file->protocol.Write = (EFI_FILE_WRITE)ext4_write;
+    file->protocol.GetPosition = (EFI_FILE_GET_POSITION)ext4_get_position;
+    file->protocol.SetPosition = (EFI_FILE_SET_POSITION)ext4_set_position;
+    file->protocol.GetInfo = (EFI_FILE_GET_INFO)ext4_get_info;
+    file->protocol.SetInfo = (EFI_FILE_SET_INFO)ext4_set_info;
+    file->protocol.Flush = (EFI_FILE_FLUSH)ext4_flush;
+    file->volume = vol;
+
+    return file;
+}
+
+static void ext4_free_file(struct ext4_file *file) {
+    if (file->extents != NULL) {
+        FreePool(file->extents);
+    }
+    FreePool(file);
+}
+
+static BOOLEAN ext4_is_directory(struct ext4_file *file) {
+    return (file->mode & EXT4_S_IFMT) == EXT4_S_IFDIR;
+}
+
+static BOOLEAN ext4_is_symlink(struct ext4_file *file) {
+    return (file->mode & EXT4_S_IFMT) == EXT4_S_IFLNK;
+}
+
+// Open the inode and turn its block map into extents
+static EFI_STATUS ext4_open_inode(struct ext4_volume *vol, UINT32 ino, struct ext4_file **out) {
+
+    EFI_STATUS status;
+    UINT8 inode[EXT4_GOOD_OLD_INODE_SIZE];
+    struct ext4_file *file;
+
+    status = ext4_read_inode(vol, ino, inode);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    file = ext4_new_file(vol);
+    if (file == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    file->inode = ino;
+    file->mode = ext4_u16(inode);
+    file->flags = ext4_u32(inode + 0x20);
+    file->size = ext4_u32(inode + 0x04) | ((UINT64)ext4_u32(inode + 0x6C) << 32);
+    mem_copy(file->inline_data, inode + 0x28, EXT4_I_BLOCK_SIZE);
+
+    if (file->flags & EXT4_INLINE_DATA_FL) {
+        // 60バイトを超える分は拡張属性にあるので読めない
+        file->is_inline = TRUE;
+        status = file->size <= EXT4_I_BLOCK_SIZE ? EFI_SUCCESS : EFI_UNSUPPORTED;
+    } else if (ext4_is_symlink(file) && file->size < EXT4_I_BLOCK_SIZE) {
+        // 短いリンク先はinodeに直接入る
+        file->is_inline = TRUE;
+        status = EFI_SUCCESS;
+    } else if (file->flags & EXT4_EXTENTS_FL) {
+        status = ext4_u16(file->inline_data + 6) <= EXT4_EXTENT_DEPTH_MAX ? ext4_extent_node(file, file->inline_data, EXT4_I_BLOCK_SIZE, ext4_u16(file->inline_data + 6)) : EFI_VOLUME_CORRUPTED;
+    } else {
+        UINT64 logical = 0;
+        UINT64 needed = (file->size + vol->block_size - 1) / vol->block_size;
+        status = EFI_SUCCESS;
+        for (UINTN i = 0; i < EXT4_I_BLOCK_SIZE / 4 && !EFI_ERROR(status); i++) {
+            status = ext4_indirect(file, ext4_u32(file->inline_data + i * 4), i < EXT4_NDIR_BLOCKS ? 0 : i - EXT4_NDIR_BLOCKS + 1, &logical, needed);
+        }
+    }
+
+    if (EFI_ERROR(status)) {
+        ext4_free_file(file);
+        return status;
+    }
+
+    *out = file;
+
+    return EFI_SUCCESS;
+}
+
+// Read bytes at the offset with one request per extent, holes and unwritten extents read as zeros
+static EFI_STATUS ext4_read_at(struct ext4_file *file, UINT64 offset, UINTN size, UINT8 *buffer) {
+
+    EFI_STATUS status = EFI_SUCCESS;
+    struct ext4_volume *vol = file->volume;
+    UINTN lo = 0, hi = file->no_of_extents, i;
+
+    if (file->is_inline) {
+        mem_copy(buffer, file->inline_data + offset, size);
+        return EFI_SUCCESS;
+    }
+
+    // 最初のエクステントを二分探索で探す
+    while (hi - lo > 1) {
+        UINTN mid = (lo + hi) / 2;
+        if (file->extents[mid].file_offset <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // 全てのエクステントをまとめて発行してから待つ
+    i = lo;
+    while (size > 0 && !EFI_ERROR(status)) {
+        struct ext4_extent *e = i < file->no_of_extents ? &file->extents[i] : NULL;
+        UINTN length;
+
+        if (e != NULL && offset >= e->file_offset + e->size) {
+            i++;
+            continue;
+        }
+
+        if (e == NULL || offset < e->file_offset) {
+            // 穴
+            length = (e == NULL || e->file_offset - offset > size) ? size : e->file_offset - offset;
+            mem_zero(buffer, length);
+        } else {
+            UINT64 skip = offset - e->file_offset;
+            length = e->size - skip < size ? e->size - skip : size;
+            if (e->unwritten) {
+                mem_zero(buffer, length);
+            } else {
+                status = read_engine_submit(&vol->engine, vol->offset + e->disk_offset + skip, length, buffer);
+            }
+        }
+
+        offset += length;
+        buffer += length;
+        size -= length;
+    }
+
+    // 発行済みの読み込みは失敗しても待つ
+    EFI_STATUS drained = read_engine_drain(&vol->engine);
+    if (!EFI_ERROR(status)) {
+        status = drained;
+    }
+
+    return status;
+}
+
+// Find the name in one block of directory entries
+static BOOLEAN ext4_find_in_block(const UINT8 *block, UINTN size, const UINT8 *name, UINTN length, UINT32 *ino) {
+
+    UINTN offset = 0;
+
+    while (offset + EXT4_DIR_ENTRY_HEADER <= size) {
+        const UINT8 *e = block + offset;
+        UINT32 inode = ext4_u32(e);
+        UINT16 rec_len = ext4_u16(e + 4);
+        UINT8 name_len = e[6];
+
+        // 壊れたエントリーの後は読まない
+        if (rec_len < EXT4_DIR_ENTRY_HEADER || (rec_len & 3) != 0 || offset + rec_len > size) {
+            return FALSE;
+        }
+
+        if (inode != 0 && name_len == length && EXT4_DIR_ENTRY_HEADER + name_len <= rec_len && CompareMem(e + EXT4_DIR_ENTRY_HEADER, name, length) == 0) {
+            *ino = inode;
+            return TRUE;
+        }
+        offset += rec_len;
+    }
+
+    return FALSE;
+}
+
+static UINT32 ext4_rol(UINT32 x, UINTN s) {
+    return (x << s) | (x >> (32 - s));
+}
+
+// Half MD4 transform of the directory hash
+static void ext4_half_md4(UINT32 buf[4], const UINT32 in[8]) {
+
+    UINT32 a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+#define EXT4_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define EXT4_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define EXT4_H(x, y, z) ((x) ^ (y) ^ (z))
+#define EXT4_ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + (x), a = ext4_rol(a, s))
+#define EXT4_K2 013240474631UL
+#define EXT4_K3 015666365641UL
+
+    // Round 1
+    EXT4_ROUND(EXT4_F, a, b, c, d, in[0], 3);
+    EXT4_ROUND(EXT4_F, d, a, b, c, in[1], 7);
+    EXT4_ROUND(EXT4_F, c, d, a, b, in[2], 11);
+    EXT4_ROUND(EXT4_F, b, c, d, a, in[3], 19);
+    EXT4_ROUND(EXT4_F, a, b, c, d, in[4], 3);
+    EXT4_ROUND(EXT4_F, d, a, b, c, in[5], 7);
+    EXT4_ROUND(EXT4_F, c, d, a, b, in[6], 11);
+    EXT4_ROUND(EXT4_F, b, c, d, a, in[7], 19);
+
+    // Round 2
+    EXT4_ROUND(EXT4_G, a, b, c, d, in[1] + EXT4_K2, 3);
+    EXT4_ROUND(EXT4_G, d, a, b, c, in[3] + EXT4_K2, 5);
+    EXT4_ROUND(EXT4_G, c, d, a, b, in[5] + EXT4_K2, 9);
+    EXT4_ROUND(EXT4_G, b, c, d, a, in[7] + EXT4_K2, 13);
+    EXT4_ROUND(EXT4_G, a, b, c, d, in[0] + EXT4_K2, 3);
+    EXT4_ROUND(EXT4_G, d, a, b, c, in[2] + EXT4_K2, 5);
+    EXT4_ROUND(EXT4_G, c, d, a, b, in[4] + EXT4_K2, 9);
+    EXT4_ROUND(EXT4_G, b, c, d, a, in[6] + EXT4_K2, 13);
+
+    // Round 3
+    EXT4_ROUND(EXT4_H, a, b, c, d, in[3] + EXT4_K3, 3);
+    EXT4_ROUND(EXT4_H, d, a, b, c, in[7] + EXT4_K3, 9);
+    EXT4_ROUND(EXT4_H, c, d, a, b, in[2] + EXT4_K3, 11);
+    EXT4_ROUND(EXT4_H, b, c, d, a, in[6] + EXT4_K3, 15);
+    EXT4_ROUND(EXT4_H, a, b, c, d, in[1] + EXT4_K3, 3);
+    EXT4_ROUND(EXT4_H, d, a, b, c, in[5] + EXT4_K3, 9);
+    EXT4_ROUND(EXT4_H, c, d, a, b, in[0] + EXT4_K3, 11);
+    EXT4_ROUND(EXT4_H, b, c, d, a, in[4] + EXT4_K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+
+#undef EXT4_F
+#undef EXT4_G
+#undef EXT4_H
+#undef EXT4_ROUND
+#undef EXT4_K2
+#undef EXT4_K3
+}
+
+// TEA transform of the directory hash
+static void ext4_tea(UINT32 buf[4], const UINT32 in[4]) {
+
+    UINT32 sum = 0;
+    UINT32 b0 = buf[0], b1 = buf[1];
+
+    for (UINTN n = 0; n < 16; n++) {
+        sum += 0x9E3779B9;
+        b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+        b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+// Pack the name into words, padded with its length
+static void ext4_hash_words(const UINT8 *name, INTN length, UINT32 *words, INTN count, BOOLEAN is_unsigned) {
+
+    UINT32 pad = (UINT32)length | ((UINT32)length << 8);
+    UINT32 value;
+
+    pad |= pad << 16;
+    value = pad;
+    if (length > count * 4) {
+        length = count * 4;
+    }
+
+    for (INTN i = 0; i < length; i++) {
+        INT32 c = is_unsigned ? (INT32)name[i] : (INT32)(INT8)name[i];
+        value = (UINT32)c + (value << 8);
+        if ((i % 4) == 3) {
+            *words++ = value;
+            value = pad;
+            count--;
+        }
+    }
+    if (--count >= 0) {
+        *words++ = value;
+    }
+    while (--count >= 0) {
+        *words++ = pad;
+    }
+}
+
+// Hash of a name in a hash tree directory (fs/ext4/hash.c)
+static EFI_STATUS ext4_hash(struct ext4_volume *vol, UINT8 version, const UINT8 *name, UINTN length, UINT32 *out) {
+
+    UINT32 buf[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+    UINT32 words[8];
+    UINT32 hash = 0;
+    BOOLEAN is_unsigned = version >= EXT4_HASH_UNSIGNED;
+
+    // シードが全て0ならデフォルトのまま
+    if (vol->hash_seed[0] | vol->hash_seed[1] | vol->hash_seed[2] | vol->hash_seed[3]) {
+        mem_copy(buf, vol->hash_seed, sizeof(buf));
+    }
+
+    switch (is_unsigned ? version - EXT4_HASH_UNSIGNED : version) {
+        case EXT4_HASH_LEGACY: {
+            UINT32 hash0 = 0x12A3FE2D, hash1 = 0x37ABE8F9;
+            for (UINTN i = 0; i < length; i++) {
+                INT32 c = is_unsigned ? (INT32)name[i] : (INT32)(INT8)name[i];
+                hash = hash1 + (hash0 ^ (UINT32)(c * 7152373));
+                if (hash & 0x80000000) {
+                    hash -= 0x7FFFFFFF;
+                }
+                hash1 = hash0;
+                hash0 = hash;
+            }
+            hash = hash0 << 1;
+            break;
+        }
+        case EXT4_HASH_HALF_MD4:
+            for (INTN rest = length; rest > 0; rest -= 32, name += 32) {
+                ext4_hash_words(name, rest, words, 8, is_unsigned);
+                ext4_half_md4(buf, words);
+            }
+            hash = buf[1];
+            break;
+        case EXT4_HASH_TEA:
+            for (INTN rest = length; rest > 0; rest -= 16, name += 16) {
+                ext4_hash_words(name, rest, words, 4, is_unsigned);
+                ext4_tea(buf, words);
+            }
+            hash = buf[0];
+            break;
+        default:
+            return EFI_UNSUPPORTED; // casefoldのSipHashなど
+    }
+
+    hash &= ~1;
+    if (hash == (EXT4_HTREE_EOF << 1)) {
+        hash = (EXT4_HTREE_EOF - 1) << 1;
+    }
+    *out = hash;
+
+    return EFI_SUCCESS;
+}
+
+// Find the name through the hash tree, reading one block per level
+static EFI_STATUS ext4_htree_find(struct ext4_file *dir, const UINT8 *name, UINTN length, UINT32 *ino) {
+
+    EFI_STATUS status;
+    struct ext4_volume *vol = dir->volume;
+    UINT32 bs = vol->block_size;
+    UINT8 *block;
+    UINT8 *entries;
+    UINT8 version, info_length, levels;
+    UINT32 hash;
+
+    block = AllocatePool(bs);
+    if (block == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    // dx_root
+    status = ext4_read_at(dir, 0, bs, block);
+    if (EFI_ERROR(status)) {
+        goto done;
+    }
+    version = block[EXT4_DX_ROOT_INFO + 4];
+    info_length = block[EXT4_DX_ROOT_INFO + 5];
+    levels = block[EXT4_DX_ROOT_INFO + 6];
+    if (levels >= EXT4_DX_LEVELS_MAX || EXT4_DX_ROOT_INFO + info_length >= bs) {
+        status = EFI_VOLUME_CORRUPTED;
+        goto done;
+    }
+
+    // 符号なしのハッシュはスーパーブロックのフラグで決まる
+    if (version < EXT4_HASH_UNSIGNED && vol->unsigned_hash) {
+        version += EXT4_HASH_UNSIGNED;
+    }
+    status = ext4_hash(vol, version, name, length, &hash);
+    if (EFI_ERROR(status)) {
+        goto done;
+    }
+
+    entries = block + EXT4_DX_ROOT_INFO + info_length;
+    for (UINTN level = 0; ; level++) {
+        UINTN limit = ext4_u16(entries);
+        UINTN count = ext4_u16(entries + 2);
+        UINTN lo = 0, hi;
+
+        if (count == 0 || count > limit || (UINTN)(entries - block) + count * 8 > bs) {
+            status = EFI_VOLUME_CORRUPTED;
+            goto done;
+        }
+
+        // ハッシュがhash以下の最後のエントリー (最初のエントリーはハッシュを持たない)
+        hi = count;
+        while (hi - lo > 1) {
+            UINTN mid = (lo + hi) / 2;
+            if (ext4_u32(entries + mid * 8) <= hash) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+
+        status = ext4_read_at(dir, (UINT64)(ext4_u32(entries + lo * 8 + 4) & EXT4_DX_BLOCK_MASK) * bs, bs, block);
+        if (EFI_ERROR(status)) {
+            goto done;
+        }
+
+        if (level == levels) {
+            break;
+        }
+        entries = block + EXT4_DX_NODE_ENTRIES;
+    }
+
+    // Leaf (同じハッシュが次の葉に続く場合は見つからず、呼び出し元が全体を調べる)
+    status = ext4_find_in_block(block, bs, name, length, ino) ? EFI_SUCCESS : EFI_NOT_FOUND;
+
+done:
+    FreePool(block);
+
+    return status;
+}
+
+// Find the name in the directory
+static EFI_STATUS ext4_lookup(struct ext4_file *dir, const UINT8 *name, UINTN length, UINT32 *ino) {
+
+    EFI_STATUS status;
+    UINT32 bs = dir->volume->block_size;
+    UINT8 *entries;
+
+    // Inline (先頭の4バイトは親のinode、".."と"."のエントリーはない)
+    if (dir->is_inline) {
+        if (dir->size < EXT4_INLINE_DIR_HEADER) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+        if (length == 2 && name[0] == '.' && name[1] == '.') {
+            *ino = ext4_u32(dir->inline_data);
+            return EFI_SUCCESS;
+        }
+        return ext4_find_in_block(dir->inline_data + EXT4_INLINE_DIR_HEADER, dir->size - EXT4_INLINE_DIR_HEADER, name, length, ino) ? EFI_SUCCESS : EFI_NOT_FOUND;
+    }
+
+    // Hash tree
+    if ((dir->flags & EXT4_INDEX_FL) && dir->size > bs) {
+        status = ext4_htree_find(dir, name, length, ino);
+        if (status != EFI_NOT_FOUND && status != EFI_UNSUPPORTED && status != EFI_VOLUME_CORRUPTED) {
+            return status;
+        }
+    }
+
+    // Linear (ハッシュ木の葉も通常のエントリーとして読める)
+    entries = AllocatePool(dir->size);
+    if (entries == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    status = ext4_read_at(dir, 0, dir->size, entries);
+    if (!EFI_ERROR(status)) {
+        status = EFI_NOT_FOUND;
+        for (UINT64 offset = 0; offset < dir->size; offset += bs) {
+            UINTN size = dir->size - offset < bs ? dir->size - offset : bs;
+            if (ext4_find_in_block(entries + offset, size, name, length, ino)) {
+                status = EFI_SUCCESS;
+                break;
+            }
+        }
+    }
+    FreePool(entries);
+
+    return status;
+}
+
+// Decode the UTF-8 name for EFI_FILE_INFO
+static void ext4_set_name(struct ext4_file *file, const UINT8 *name, UINTN length) {
+
+    UINTN j = 0;
+
+    for (UINTN i = 0; i < length && j < EXT4_NAME_MAX; ) {
+        UINT8 c = name[i];
+        if (c < 0x80) {
+            file->name[j++] = c;
+            i += 1;
+        } else if ((c & 0xE0) == 0xC0 && i + 1 < length) {
+            file->name[j++] = ((c & 0x1F) << 6) | (name[i + 1] & 0x3F);
+            i += 2;
+        } else if ((c & 0xF0) == 0xE0 && i + 2 < length) {
+            file->name[j++] = ((c & 0x0F) << 12) | ((name[i + 1] & 0x3F) << 6) | (name[i + 2] & 0x3F);
+            i += 3;
+        } else {
+            file->name[j++] = '?'; // BMPの外
+            i += 1;
+            while (i < length && (name[i] & 0xC0) == 0x80) {
+                i++;
+            }
+        }
+    }
+    file->name[j] = '\0';
+}
+
+// Encode the EFI path as UTF-8
+static BOOLEAN ext4_encode_path(const CHAR16 *path, UINT8 *out, UINTN size) {
+
+    UINTN j = 0;
+
+    for (UINTN i = 0; path[i] != '\0'; i++) {
+        CHAR16 c = path[i];
+        if (j + 4 > size) {
+            return FALSE;
+        }
+        if (c < 0x80) {
+            out[j++] = c;
+        } else if (c < 0x800) {
+            out[j++] = 0xC0 | (c >> 6);
+            out[j++] = 0x80 | (c & 0x3F);
+        } else {
+            out[j++] = 0xE0 | (c >> 12);
+            out[j++] = 0x80 | ((c >> 6) & 0x3F);
+            out[j++] = 0x80 | (c & 0x3F);
+        }
+    }
+    out[j] = '\0';
+
+    return TRUE;
+}
+
+static BOOLEAN ext4_is_separator(UINT8 c) {
+    return c == '\\' || c == '/';
+}
+
+// Walk the path from the directory, following symbolic links
+// The path buffer holds EXT4_PATH_MAX bytes and is rewritten when a link is followed
+static EFI_STATUS ext4_walk(struct ext4_volume *vol, UINT32 start, UINT8 *path, struct ext4_file **out) {
+
+    EFI_STATUS status;
+    struct ext4_file *current, *child;
+    UINT8 *p = path;
+    UINTN links = 0;
+
+    // "\"で始まればルートから
+    status = ext4_open_inode(vol, ext4_is_separator(*p) ? EXT4_ROOT_INODE : start, &current);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    while (*p != '\0') {
+        UINTN length = 0;
+        UINT32 ino;
+
+        while (ext4_is_separator(*p)) {
+            p++;
+        }
+        while (p[length] != '\0' && !ext4_is_separator(p[length])) {
+            length++;
+        }
+        if (length == 0 || (length == 1 && p[0] == '.')) {
+            p += length;
+            continue;
+        }
+
+        if (!ext4_is_directory(current)) {
+            status = EFI_NOT_FOUND;
+            break;
+        }
+
+        status = ext4_lookup(current, p, length, &ino);
+        if (!EFI_ERROR(status)) {
+            status = ext4_open_inode(vol, ino, &child);
+        }
+        if (EFI_ERROR(status)) {
+            break;
+        }
+        ext4_set_name(child, p, length);
+        p += length;
+
+        if (!ext4_is_symlink(child)) {
+            ext4_free_file(current);
+            current = child;
+            continue;
+        }
+
+        // リンク先に残りのパスをつなげて読み直す (相対リンクはリンクのあるディレクトリから)
+        UINTN rest = 0;
+        while (p[rest] != '\0') {
+            rest++;
+        }
+        if (++links > EXT4_SYMLINKS_MAX || child->size == 0 || child->size + 1 + rest + 1 > EXT4_PATH_MAX) {
+            ext4_free_file(child);
+            status = EFI_NOT_FOUND;
+            break;
+        }
+        CopyMem(path + child->size + 1, p, rest + 1);
+        path[child->size] = '/';
+        status = ext4_read_at(child, 0, child->size, path);
+        ext4_free_file(child);
+        if (EFI_ERROR(status)) {
+            break;
+        }
+        p = path;
+
+        if (ext4_is_separator(*p)) {
+            ext4_free_file(current);
+            status = ext4_open_inode(vol, EXT4_ROOT_INODE, &current);
+            if (EFI_ERROR(status)) {
+                return status;
+            }
+        }
+    }
+
+    if (EFI_ERROR(status)) {
+        ext4_free_file(current);
+        return status;
+    }
+
+    *out = current;
+
+    return EFI_SUCCESS;
+}
+
+// Open a file or a directory relative to This, read only
+static EXT4_API EFI_STATUS ext4_open(EFI_FILE_PROTOCOL *This, EFI_FILE_PROTOCOL **NewHandle, CHAR16 *FileName, UINT64 OpenMode, UINT64 Attributes) {
+
+    EFI_STATUS status;
+    struct ext4_file *dir = (struct ext4_file *)This;
+    struct ext4_file *file;
+    UINT8 *path;
+
+    if (OpenMode != EFI_FILE_MODE_READ) {
+        return EFI_WRITE_PROTECTED;
+    }
+    if (!ext4_is_directory(dir) && FileName[0] != '\\') {
+        return EFI_NOT_FOUND;
+    }
+
+    path = AllocatePool(EXT4_PATH_MAX);
+    if (path == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    if (!ext4_encode_path(FileName, path, EXT4_PATH_MAX)) {
+        FreePool(path);
+        return EFI_INVALID_PARAMETER;
+    }
+
+    status = ext4_walk(dir->volume, dir->inode, path, &file);
+    FreePool(path);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    *NewHandle = &file->protocol;
+
+    return EFI_SUCCESS;
+}
+
+static EXT4_API EFI_STATUS ext4_close(EFI_FILE_PROTOCOL *This) {
+    ext4_free_file((struct ext4_file *)This);
+    return EFI_SUCCESS;
+}
+
+static EXT4_API EFI_STATUS ext4_delete(EFI_FILE_PROTOCOL *This) {
+    ext4_free_file((struct ext4_file *)This);
+    return EFI_WARN_DELETE_FAILURE;
+}
+
+// Read from the position, directories cannot be listed
+static EXT4_API EFI_STATUS ext4_read(EFI_FILE_PROTOCOL *This, UINTN *BufferSize, VOID *Buffer) {
+
+    EFI_STATUS status;
+    struct ext4_file *file = (struct ext4_file *)This;
+    UINTN size = *BufferSize;
+
+    if (ext4_is_directory(file)) {
+        return EFI_UNSUPPORTED;
+    }
+    if (file->position > file->size) {
+        return EFI_DEVICE_ERROR;
+    }
+    if (size > file->size - file->position) {
+        size = file->size - file->position;
+    }
+
+    status = ext4_read_at(file, file->position, size, Buffer);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    file->position += size;
+    *BufferSize = size;
+
+    return EFI_SUCCESS;
+}
+
+static EXT4_API EFI_STATUS ext4_write(EFI_FILE_PROTOCOL *This, UINTN *BufferSize, VOID *Buffer) {
+    return EFI_WRITE_PROTECTED;
+}
+
+static EXT4_API EFI_STATUS ext4_get_position(EFI_FILE_PROTOCOL *This, UINT64 *Position) {
+
+    struct ext4_file *file = (struct ext4_file *)This;
+
+    if (ext4_is_directory(file)) {
+        return EFI_UNSUPPORTED;
+    }
+    *Position = file->position;
+
+    return EFI_SUCCESS;
+}
+
+// 0xFFFFFFFFFFFFFFFF moves to the end of the file
+static EXT4_API EFI_STATUS ext4_set_position(EFI_FILE_PROTOCOL *This, UINT64 Position) {
+
+    struct ext4_file *file = (struct ext4_file *)This;
+
+    if (ext4_is_directory(file)) {
+        return Position == 0 ? EFI_SUCCESS : EFI_UNSUPPORTED;
+    }
+    file->position = Position == 0xFFFFFFFFFFFFFFFF ? file->size : Position;
+
+    return EFI_SUCCESS;
+}
+
+// Only EFI_FILE_INFO is supported
+static EXT4_API EFI_STATUS ext4_get_info(EFI_FILE_PROTOCOL *This, EFI_GUID *InformationType, UINTN *BufferSize, VOID *Buffer) {
+
+    struct ext4_file *file = (struct ext4_file *)This;
+    EFI_GUID file_info_guid = EFI_FILE_INFO_ID;
+    EFI_FILE_INFO *info = Buffer;
+    UINTN size = SIZE_OF_EFI_FILE_INFO + (StrLen(file->name) + 1) * sizeof(CHAR16);
+    UINT64 physical_size = 0;
+
+    if (CompareGuid(InformationType, &file_info_guid) != 0) {
+        return EFI_UNSUPPORTED;
+    }
+    if (*BufferSize < size) {
+        *BufferSize = size;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+
+    for (UINTN i = 0; i < file->no_of_extents; i++) {
+        physical_size += file->extents[i].size;
+    }
+
+    ZeroMem(info, SIZE_OF_EFI_FILE_INFO);
+    info->Size = size;
+    info->FileSize = file->size;
+    info->PhysicalSize = physical_size;
+    info->Attribute = EFI_FILE_READ_ONLY | (ext4_is_directory(file) ? EFI_FILE_DIRECTORY : 0);
+    StrCpy(info->FileName, file->name);
+    *BufferSize = size;
+
+    return EFI_SUCCESS;
+}
+
+static EXT4_API EFI_STATUS ext4_set_info(EFI_FILE_PROTOCOL *This, EFI_GUID *InformationType, UINTN BufferSize, VOID *Buffer) {
+    return EFI_WRITE_PROTECTED;
+}
+
+static EXT4_API EFI_STATUS ext4_flush(EFI_FILE_PROTOCOL *This) {
+    return EFI_WRITE_PROTECTED;
+}
+
+// Parse the superblock
+static EFI_STATUS ext4_parse(struct ext4_volume *vol, const UINT8 *sb) {
+
+    UINT32 log_block_size = ext4_u32(sb + 0x18);
+    UINT32 rev_level = ext4_u32(sb + 0x4C);
+
+    if (ext4_u16(sb + 0x38) != EXT4_MAGIC) {
+        return EFI_UNSUPPORTED;
+    }
+    if (log_block_size > EXT4_LOG_BLOCK_SIZE_MAX) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    vol->block_size = 1024 << log_block_size;
+    vol->no_of_inodes = ext4_u32(sb + 0x00);
+    vol->first_data_block = ext4_u32(sb + 0x14);
+    vol->blocks_per_group = ext4_u32(sb + 0x20);
+    vol->inodes_per_group = ext4_u32(sb + 0x28);
+    vol->inode_size = rev_level >= 1 ? ext4_u16(sb + 0x58) : EXT4_GOOD_OLD_INODE_SIZE;
+
+    // 初期のリビジョンは機能のフィールドを持たない
+    if (rev_level >= 1) {
+        vol->compat = ext4_u32(sb + 0x5C);
+        vol->incompat = ext4_u32(sb + 0x60);
+        vol->ro_compat = ext4_u32(sb + 0x64);
+    }
+    if (vol->incompat & ~EXT4_INCOMPAT_SUPPORTED) {
+        return EFI_UNSUPPORTED;
+    }
+
+    vol->desc_size = (vol->incompat & EXT4_FEATURE_INCOMPAT_64BIT) ? ext4_u16(sb + 0xFE) : EXT4_DESC_SIZE;
+    vol->first_meta_bg = ext4_u32(sb + 0x104);
+    vol->backup_bgs[0] = ext4_u32(sb + 0x24C);
+    vol->backup_bgs[1] = ext4_u32(sb + 0x250);
+    for (UINTN i = 0; i < 4; i++) {
+        vol->hash_seed[i] = ext4_u32(sb + 0xEC + i * 4);
+    }
+    vol->unsigned_hash = (ext4_u32(sb + 0x160) & EXT4_FLAGS_UNSIGNED_HASH) != 0;
+
+    if (vol->inode_size < EXT4_GOOD_OLD_INODE_SIZE || vol->inode_size > vol->block_size || (vol->inode_size & (vol->inode_size - 1)) != 0 ||
+        vol->desc_size < EXT4_DESC_SIZE || vol->desc_size > vol->block_size || (vol->desc_size & (vol->desc_size - 1)) != 0 ||
+        vol->inodes_per_group == 0 || vol->blocks_per_group == 0) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Mount the ext4 volume that starts at the byte offset of the disk and open its root directory
+// The root is an EFI_FILE_PROTOCOL that reads through Block I/O
+EFI_STATUS ext4_mount(EFI_HANDLE handle, UINT64 offset, EFI_HANDLE ImageHandle, EFI_FILE_PROTOCOL **root) {
+
+    EFI_STATUS status;
+    struct ext4_volume *vol;
+    struct ext4_file *root_file = NULL;
+    UINT8 *sb;
+
+    vol = AllocateZeroPool(sizeof(struct ext4_volume));
+    if (vol == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    status = read_engine_open(handle, ImageHandle, &vol->engine);
+    if (EFI_ERROR(status)) {
+        FreePool(vol);
+        return status;
+    }
+
+    // エクステントはなるべく大きく読む
+    vol->engine.chunk_size = EXT4_READ_CHUNK_SIZE;
+    vol->offset = offset;
+
+    // Superblock
+    sb = AllocatePool(EXT4_SUPERBLOCK_SIZE);
+    if (sb == NULL) {
+        status = EFI_OUT_OF_RESOURCES;
+        goto error;
+    }
+    status = ext4_read_disk(vol, EXT4_SUPERBLOCK_OFFSET, EXT4_SUPERBLOCK_SIZE, sb);
+    if (!EFI_ERROR(status)) {
+        status = ext4_parse(vol, sb);
+    }
+    FreePool(sb);
+
+    // Root directory
+    if (!EFI_ERROR(status)) {
+        status = ext4_open_inode(vol, EXT4_ROOT_INODE, &root_file);
+    }
+    if (!EFI_ERROR(status) && !ext4_is_directory(root_file)) {
+        ext4_free_file(root_file);
+        status = EFI_VOLUME_CORRUPTED;
+    }
+    if (EFI_ERROR(status)) {
+        goto error;
+    }
+
+    *root = &root_file->protocol;
+
+    return EFI_SUCCESS;
+
+error:
+    read_engine_close(&vol->engine);
+    FreePool(vol);
+
+    return status;
+}
+
+// Whether the file was opened by the ext4 reader
+BOOLEAN ext4_is_native(EFI_FILE_PROTOCOL *file) {
+    return file->Read == (EFI_FILE_READ)ext4_read;
+}
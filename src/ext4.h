@@ -0,0 +1,147 @@
+#ifndef _EXT4_H
+#define _EXT4_H
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "disk.h"
+
+// ファームウェアから呼ばれるので常にMicrosoftの呼び出し規約を使う
+#define EXT4_API __attribute__((ms_abi))
+
+// Superblock
+#define EXT4_SUPERBLOCK_OFFSET 1024
+#define EXT4_SUPERBLOCK_SIZE 1024
+#define EXT4_MAGIC 0xEF53
+#define EXT4_LOG_BLOCK_SIZE_MAX 6 // 64KiB
+#define EXT4_GOOD_OLD_INODE_SIZE 128
+#define EXT4_DESC_SIZE 32
+#define EXT4_DESC_SIZE_64BIT 64
+
+// s_feature_compat
+#define EXT4_FEATURE_COMPAT_SPARSE_SUPER2 0x0200
+
+// s_feature_ro_compat
+#define EXT4_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
+
+// s_feature_incompat
+#define EXT4_FEATURE_INCOMPAT_FILETYPE 0x0002
+#define EXT4_FEATURE_INCOMPAT_RECOVER 0x0004
+#define EXT4_FEATURE_INCOMPAT_META_BG 0x0010
+#define EXT4_FEATURE_INCOMPAT_EXTENTS 0x0040
+#define EXT4_FEATURE_INCOMPAT_64BIT 0x0080
+#define EXT4_FEATURE_INCOMPAT_MMP 0x0100
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG 0x0200
+#define EXT4_FEATURE_INCOMPAT_EA_INODE 0x0400
+#define EXT4_FEATURE_INCOMPAT_CSUM_SEED 0x2000
+#define EXT4_FEATURE_INCOMPAT_LARGEDIR 0x4000
+#define EXT4_FEATURE_INCOMPAT_INLINE_DATA 0x8000
+#define EXT4_FEATURE_INCOMPAT_CASEFOLD 0x20000
+
+// 読むのに困らない機能 (圧縮、暗号化、外部ジャーナル、dirdataは読めない)
+#define EXT4_INCOMPAT_SUPPORTED (EXT4_FEATURE_INCOMPAT_FILETYPE | EXT4_FEATURE_INCOMPAT_RECOVER | EXT4_FEATURE_INCOMPAT_META_BG | \
+    EXT4_FEATURE_INCOMPAT_EXTENTS | EXT4_FEATURE_INCOMPAT_64BIT | EXT4_FEATURE_INCOMPAT_MMP | EXT4_FEATURE_INCOMPAT_FLEX_BG | \
+    EXT4_FEATURE_INCOMPAT_EA_INODE | EXT4_FEATURE_INCOMPAT_CSUM_SEED | EXT4_FEATURE_INCOMPAT_LARGEDIR | \
+    EXT4_FEATURE_INCOMPAT_INLINE_DATA | EXT4_FEATURE_INCOMPAT_CASEFOLD)
+
+// s_flags
+#define EXT4_FLAGS_UNSIGNED_HASH 0x0002
+
+// Inode
+#define EXT4_ROOT_INODE 2
+#define EXT4_S_IFMT 0xF000
+#define EXT4_S_IFDIR 0x4000
+#define EXT4_S_IFREG 0x8000
+#define EXT4_S_IFLNK 0xA000
+#define EXT4_INDEX_FL 0x00001000
+#define EXT4_EXTENTS_FL 0x00080000
+#define EXT4_INLINE_DATA_FL 0x10000000
+#define EXT4_I_BLOCK_SIZE 60
+#define EXT4_NDIR_BLOCKS 12
+
+// Extent tree
+#define EXT4_EXTENT_MAGIC 0xF30A
+#define EXT4_EXTENT_HEADER_SIZE 12
+#define EXT4_EXTENT_ENTRY_SIZE 12
+#define EXT4_EXTENT_INIT_MAX 32768 // これより長いエクステントは未初期化 (ゼロとして読む)
+#define EXT4_EXTENT_DEPTH_MAX 5
+
+// Directory
+#define EXT4_DIR_ENTRY_HEADER 8
+#define EXT4_NAME_MAX 255
+#define EXT4_INLINE_DIR_HEADER 4 // インラインのディレクトリの親のinode
+
+// Hash tree (dx_root)
+#define EXT4_DX_ROOT_INFO 0x18
+#define EXT4_DX_NODE_ENTRIES 8
+#define EXT4_DX_BLOCK_MASK 0x0FFFFFFF
+#define EXT4_DX_LEVELS_MAX 3
+#define EXT4_HASH_LEGACY 0
+#define EXT4_HASH_HALF_MD4 1
+#define EXT4_HASH_TEA 2
+#define EXT4_HASH_UNSIGNED 3 // 符号なしの版は3を足す
+#define EXT4_HTREE_EOF 0x7FFFFFFFU
+
+// パスとシンボリックリンク
+#define EXT4_PATH_MAX 4096
+#define EXT4_SYMLINKS_MAX 8
+
+// エクステントを1回に読む最大サイズ (大きい読み込みはエンジンが分ける)
+#define EXT4_READ_CHUNK_SIZE (4 * 1024 * 1024)
+
+// エクステントの配列の最初の大きさ
+#define EXT4_EXTENTS_INITIAL 8
+
+// EXT4_EXTENT
+// ディスク上で連続したブロックの並び
+struct ext4_extent {
+    UINT64 file_offset;
+    UINT64 disk_offset; // パーティションの先頭から
+    UINT64 size;
+    BOOLEAN unwritten; // 未初期化 (ゼロ)
+};
+
+// EXT4_VOLUME
+struct ext4_volume {
+    struct read_engine engine;
+    UINT64 offset; // ディスク上のパーティションの位置
+    UINT32 block_size;
+    UINT32 inode_size;
+    UINT32 no_of_inodes;
+    UINT32 inodes_per_group;
+    UINT32 blocks_per_group;
+    UINT32 first_data_block;
+    UINT32 desc_size;
+    UINT32 compat;
+    UINT32 ro_compat;
+    UINT32 incompat;
+    UINT32 first_meta_bg;
+    UINT32 backup_bgs[2];
+
+    // ディレクトリのハッシュ
+    UINT32 hash_seed[4];
+    BOOLEAN unsigned_hash;
+};
+
+// EXT4_FILE
+// EFI_FILE_PROTOCOLとして他のコードに渡すので、protocolは先頭に置く
+struct ext4_file {
+    EFI_FILE_PROTOCOL protocol;
+    struct ext4_volume *volume;
+    UINT32 inode;
+    UINT16 mode;
+    UINT32 flags;
+    UINT64 size;
+    UINT64 position;
+    struct ext4_extent *extents;
+    UINTN no_of_extents;
+    UINTN extents_capacity;
+
+    // 短いシンボリックリンクとインラインデータはinodeの中にある
+    BOOLEAN is_inline;
+    UINT8 inline_data[EXT4_I_BLOCK_SIZE];
+
+    CHAR16 name[EXT4_NAME_MAX + 1];
+};
+
+#endif
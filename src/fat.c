@@ -0,0 +1,735 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "fat.h"
+#include "proto.h"
+
+static FAT_API EFI_STATUS fat_open(EFI_FILE_PROTOCOL *This, EFI_FILE_PROTOCOL **NewHandle, CHAR16 *FileName, UINT64 OpenMode, UINT64 Attributes);
+static FAT_API EFI_STATUS fat_close(EFI_FILE_PROTOCOL *This);
+static FAT_API EFI_STATUS fat_delete(EFI_FILE_PROTOCOL *This);
+static FAT_API EFI_STATUS fat_read(EFI_FILE_PROTOCOL *This, UINTN *BufferSize, VOID *Buffer);
+static FAT_API EFI_STATUS fat_write(EFI_FILE_PROTOCOL *This, UINTN *BufferSize, VOID *Buffer);
+static FAT_API EFI_STATUS fat_get_position(EFI_FILE_PROTOCOL *This, UINT64 *Position);
+static FAT_API EFI_STATUS fat_set_position(EFI_FILE_PROTOCOL *This, UINT64 Position);
+static FAT_API EFI_STATUS fat_get_info(EFI_FILE_PROTOCOL *This, EFI_GUID *InformationType, UINTN *BufferSize, VOID *Buffer);
+static FAT_API EFI_STATUS fat_set_info(EFI_FILE_PROTOCOL *This, EFI_GUID *InformationType, UINTN BufferSize, VOID *Buffer);
+static FAT_API EFI_STATUS fat_flush(EFI_FILE_PROTOCOL *This);
+
+static UINT16 fat_u16(const UINT8 *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static UINT32 fat_u32(const UINT8 *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((UINT32)p[3] << 24);
+}
+
+// Read the FAT entry of the cluster through the cache
+static EFI_STATUS fat_entry(struct fat_volume *vol, UINT32 cluster, UINT32 *next) {
+
+    EFI_STATUS status;
+    UINT64 offset;
+    UINTN width;
+    UINT8 *p;
+
+    switch (vol->type) {
+        case FAT12: offset = cluster + cluster / 2; width = 2; break;
+        case FAT16: offset = (UINT64)cluster * 2; width = 2; break;
+        default: offset = (UINT64)cluster * 4; width = 4; break;
+    }
+    if (offset + width > vol->fat_size) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    // キャッシュになければブロックに揃えて読み直す (FAT12のエントリーはブロックをまたぐことがある)
+    if (offset < vol->cache_offset || offset + width > vol->cache_offset + vol->cache_size) {
+        vol->cache_offset = offset - offset % vol->engine.block_size;
+        vol->cache_size = vol->fat_size - vol->cache_offset < FAT_CACHE_SIZE ? vol->fat_size - vol->cache_offset : FAT_CACHE_SIZE;
+        status = read_engine_read(&vol->engine, vol->fat_offset + vol->cache_offset, vol->cache_size, vol->cache);
+        if (EFI_ERROR(status)) {
+            vol->cache_size = 0;
+            return status;
+        }
+    }
+    p = vol->cache + (offset - vol->cache_offset);
+
+    switch (vol->type) {
+        case FAT12: *next = (cluster & 1) ? fat_u16(p) >> 4 : fat_u16(p) & 0xFFF; break;
+        case FAT16: *next = fat_u16(p); break;
+        default: *next = fat_u32(p) & 0x0FFFFFFF; break;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Whether the FAT entry ends the chain
+static BOOLEAN fat_is_end(struct fat_volume *vol, UINT32 value) {
+    switch (vol->type) {
+        case FAT12: return value >= 0xFF8;
+        case FAT16: return value >= 0xFFF8;
+        default: return value >= 0x0FFFFFF8;
+    }
+}
+
+// Walk the cluster chain once and merge contiguous clusters into extents
+// size 0 follows the chain to its end (directories)
+static EFI_STATUS fat_chain(struct fat_volume *vol, UINT32 first, UINT64 size, struct fat_file *file) {
+
+    EFI_STATUS status;
+    UINTN capacity = FAT_EXTENTS_INITIAL;
+    UINT64 needed = (size + vol->cluster_size - 1) / vol->cluster_size;
+    UINT64 count = 0;
+    UINT32 cluster = first;
+
+    file->extents = AllocatePool(sizeof(struct fat_extent) * capacity);
+    if (file->extents == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    file->no_of_extents = 0;
+
+    while (size == 0 || count < needed) {
+
+        // 壊れたチェーンやループは全てのクラスタを数えたところで止まる
+        if (cluster < FAT_FIRST_CLUSTER || cluster >= vol->no_of_clusters + FAT_FIRST_CLUSTER || count >= vol->no_of_clusters) {
+            return EFI_VOLUME_CORRUPTED;
+        }
+
+        UINT64 disk_offset = vol->data_offset + (UINT64)(cluster - FAT_FIRST_CLUSTER) * vol->cluster_size;
+        struct fat_extent *last = file->no_of_extents > 0 ? &file->extents[file->no_of_extents - 1] : NULL;
+
+        // 前のクラスタの直後なら伸ばす
+        if (last != NULL && last->disk_offset + last->size == disk_offset) {
+            last->size += vol->cluster_size;
+        } else {
+            if (file->no_of_extents == capacity) {
+                struct fat_extent *grown = ReallocatePool(file->extents, capacity * sizeof(struct fat_extent), capacity * 2 * sizeof(struct fat_extent));
+                if (grown == NULL) {
+                    return EFI_OUT_OF_RESOURCES;
+                }
+                file->extents = grown;
+                capacity *= 2;
+            }
+            file->extents[file->no_of_extents].file_offset = count * vol->cluster_size;
+            file->extents[file->no_of_extents].disk_offset = disk_offset;
+            file->extents[file->no_of_extents].size = vol->cluster_size;
+            file->no_of_extents += 1;
+        }
+        count += 1;
+
+        status = fat_entry(vol, cluster, &cluster);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+        if (fat_is_end(vol, cluster)) {
+            break;
+        }
+    }
+
+    // ファイルサイズよりチェーンが短い
+    if (count < needed) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    // ディレクトリはチェーンの長さがサイズになる
+    if (size == 0) {
+        file->size = count * vol->cluster_size;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Read bytes at the offset with one request per extent
+static EFI_STATUS fat_read_at(struct fat_file *file, UINT64 offset, UINTN size, UINT8 *buffer) {
+
+    EFI_STATUS status = EFI_SUCCESS;
+    struct read_engine *engine = &file->volume->engine;
+    UINTN lo = 0, hi = file->no_of_extents;
+
+    // 最初のエクステントを二分探索で探す
+    while (hi - lo > 1) {
+        UINTN mid = (lo + hi) / 2;
+        if (file->extents[mid].file_offset <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // 全てのエクステントをまとめて発行してから待つ
+    for (UINTN i = lo; i < file->no_of_extents && size > 0 && !EFI_ERROR(status); i++) {
+        struct fat_extent *e = &file->extents[i];
+        UINT64 skip = offset - e->file_offset;
+        UINTN length = e->size - skip < size ? e->size - skip : size;
+
+        status = read_engine_submit(engine, e->disk_offset + skip, length, buffer);
+        offset += length;
+        buffer += length;
+        size -= length;
+    }
+
+    // 発行済みの読み込みは失敗しても待つ
+    EFI_STATUS drained = read_engine_drain(engine);
+    if (!EFI_ERROR(status)) {
+        status = drained;
+    }
+
+    return status;
+}
+
+// Allocate a file with the protocol functions
+static struct fat_file *fat_new_file(struct fat_volume *vol) {
+
+    struct fat_file *file = AllocateZeroPool(sizeof(struct fat_file));
+    if (file == NULL) {
+        return NULL;
+    }
+
+    file->protocol.Revision = EFI_FILE_PROTOCOL_REVISION;
+    file->protocol.Open = (EFI_FILE_OPEN)fat_open;
+    file->protocol.Close = (EFI_FILE_CLOSE)fat_close;
+    file->protocol.Delete = (EFI_FILE_DELETE)fat_delete;
+    file->protocol.Read = (EFI_FILE_READ)fat_read;
+    file->protocol.Write = (EFI_FILE_WRITE)fat_write;
+    file->protocol.GetPosition = (EFI_FILE_GET_POSITION)fat_get_position;
+    file->protocol.SetPosition = (EFI_FILE_SET_POSITION)fat_set_position;
+    file->protocol.GetInfo = (EFI_FILE_GET_INFO)fat_get_info;
+    file->protocol.SetInfo = (EFI_FILE_SET_INFO)fat_set_info;
+    file->protocol.Flush = (EFI_FILE_FLUSH)fat_flush;
+    file->volume = vol;
+
+    return file;
+}
+
+static void fat_free_file(struct fat_file *file) {
+    if (file->extents != NULL) {
+        FreePool(file->extents);
+    }
+    FreePool(file);
+}
+
+// Open the root directory
+static EFI_STATUS fat_open_root(struct fat_volume *vol, struct fat_file **out) {
+
+    EFI_STATUS status = EFI_SUCCESS;
+    struct fat_file *root = fat_new_file(vol);
+
+    if (root == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    root->is_directory = TRUE;
+
+    if (vol->type == FAT32) {
+        status = fat_chain(vol, vol->root_cluster, 0, root);
+    } else {
+        // FAT12/16のルートはFATの後の固定の領域
+        root->extents = AllocatePool(sizeof(struct fat_extent));
+        if (root->extents == NULL) {
+            status = EFI_OUT_OF_RESOURCES;
+        } else {
+            root->extents[0].file_offset = 0;
+            root->extents[0].disk_offset = vol->root_offset;
+            root->extents[0].size = vol->root_size;
+            root->no_of_extents = 1;
+            root->size = vol->root_size;
+        }
+    }
+
+    if (EFI_ERROR(status)) {
+        fat_free_file(root);
+        return status;
+    }
+
+    *out = root;
+
+    return EFI_SUCCESS;
+}
+
+// Open the same file again, the copy has its own position
+static EFI_STATUS fat_duplicate(struct fat_file *file, struct fat_file **out) {
+
+    struct fat_file *copy = fat_new_file(file->volume);
+
+    if (copy == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    copy->is_directory = file->is_directory;
+    copy->size = file->size;
+    StrCpy(copy->name, file->name);
+
+    if (file->no_of_extents > 0) {
+        copy->extents = AllocatePool(sizeof(struct fat_extent) * file->no_of_extents);
+        if (copy->extents == NULL) {
+            fat_free_file(copy);
+            return EFI_OUT_OF_RESOURCES;
+        }
+        mem_copy(copy->extents, file->extents, sizeof(struct fat_extent) * file->no_of_extents);
+        copy->no_of_extents = file->no_of_extents;
+    }
+
+    *out = copy;
+
+    return EFI_SUCCESS;
+}
+
+// Checksum of the short name that the long name entries carry
+static UINT8 fat_lfn_checksum(const UINT8 *short_name) {
+
+    UINT8 sum = 0;
+
+    for (UINTN i = 0; i < 11; i++) {
+        sum = ((sum & 1) << 7) + (sum >> 1) + short_name[i];
+    }
+
+    return sum;
+}
+
+// Format the 8.3 name of the entry
+static void fat_short_name(const UINT8 *e, CHAR16 *name) {
+
+    UINTN j = 0;
+    UINTN base = 8, ext = 3;
+
+    while (base > 0 && e[base - 1] == ' ') {
+        base--;
+    }
+    while (ext > 0 && e[8 + ext - 1] == ' ') {
+        ext--;
+    }
+
+    for (UINTN i = 0; i < base; i++) {
+        CHAR16 c = (i == 0 && e[0] == 0x05) ? 0xE5 : e[i]; // 0x05は0xE5で始まる名前
+        name[j++] = ((e[12] & FAT_NT_LOWER_BASE) && c >= 'A' && c <= 'Z') ? c + 32 : c;
+    }
+    if (ext > 0) {
+        name[j++] = '.';
+        for (UINTN i = 0; i < ext; i++) {
+            CHAR16 c = e[8 + i];
+            name[j++] = ((e[12] & FAT_NT_LOWER_EXT) && c >= 'A' && c <= 'Z') ? c + 32 : c;
+        }
+    }
+    name[j] = '\0';
+}
+
+// Compare a name with a path component, ignoring the ASCII case
+static BOOLEAN fat_name_equal(const CHAR16 *name, const CHAR16 *component, UINTN length) {
+
+    for (UINTN i = 0; i < length; i++) {
+        CHAR16 a = name[i], b = component[i];
+        if (a >= 'a' && a <= 'z') {
+            a -= 32;
+        }
+        if (b >= 'a' && b <= 'z') {
+            b -= 32;
+        }
+        if (a != b) {
+            return FALSE;
+        }
+    }
+
+    return name[length] == '\0';
+}
+
+// Find the component in the directory and open it
+static EFI_STATUS fat_lookup(struct fat_file *dir, const CHAR16 *component, UINTN length, struct fat_file **out) {
+
+    EFI_STATUS status;
+    struct fat_volume *vol = dir->volume;
+    UINT8 *entries;
+    CHAR16 long_name[FAT_NAME_MAX + 1];
+    CHAR16 short_name[13];
+    UINTN lfn_count = 0;
+    UINT8 lfn_checksum = 0;
+    static const UINT8 lfn_offsets[FAT_LFN_CHARS] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+    entries = AllocatePool(dir->size);
+    if (entries == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    status = fat_read_at(dir, 0, dir->size, entries);
+    if (EFI_ERROR(status)) {
+        FreePool(entries);
+        return status;
+    }
+
+    status = EFI_NOT_FOUND;
+    for (UINT64 offset = 0; offset + FAT_DIR_ENTRY_SIZE <= dir->size; offset += FAT_DIR_ENTRY_SIZE) {
+        UINT8 *e = entries + offset;
+        UINT8 attr = e[11];
+
+        if (e[0] == FAT_ENTRY_END) {
+            break;
+        }
+        if (e[0] == FAT_ENTRY_FREE) {
+            lfn_count = 0;
+            continue;
+        }
+
+        // 長い名前は後ろの部分から順に並ぶ
+        if ((attr & 0x3F) == FAT_ATTR_LONG_NAME) {
+            UINTN order = e[0] & 0x1F;
+            if (e[0] & FAT_LFN_LAST) {
+                if (order == 0 || order * FAT_LFN_CHARS > FAT_NAME_MAX + FAT_LFN_CHARS) {
+                    lfn_count = 0;
+                    continue;
+                }
+                lfn_count = order;
+                lfn_checksum = e[13];
+                long_name[order * FAT_LFN_CHARS < FAT_NAME_MAX ? order * FAT_LFN_CHARS : FAT_NAME_MAX] = '\0';
+            } else if (order != lfn_count - 1 || e[13] != lfn_checksum) {
+                lfn_count = 0;
+                continue;
+            } else {
+                lfn_count = order;
+            }
+            for (UINTN i = 0; i < FAT_LFN_CHARS; i++) {
+                UINTN at = (order - 1) * FAT_LFN_CHARS + i;
+                CHAR16 c = fat_u16(e + lfn_offsets[i]);
+                if (at < FAT_NAME_MAX) {
+                    long_name[at] = c == 0xFFFF ? '\0' : c;
+                }
+            }
+            continue;
+        }
+
+        // ボリュームラベル
+        if (attr & FAT_ATTR_VOLUME_ID) {
+            lfn_count = 0;
+            continue;
+        }
+
+        fat_short_name(e, short_name);
+        BOOLEAN has_long_name = lfn_count == 1 && lfn_checksum == fat_lfn_checksum(e);
+        lfn_count = 0;
+
+        if (!(has_long_name && fat_name_equal(long_name, component, length)) && !fat_name_equal(short_name, component, length)) {
+            continue;
+        }
+
+        // Found
+        UINT32 cluster = fat_u16(e + 26) | (vol->type == FAT32 ? (UINT32)fat_u16(e + 20) << 16 : 0);
+        struct fat_file *file;
+
+        // ".."のクラスタ0はルート
+        if ((attr & FAT_ATTR_DIRECTORY) && cluster == 0) {
+            status = fat_open_root(vol, &file);
+            if (!EFI_ERROR(status)) {
+                StrCpy(file->name, has_long_name ? long_name : short_name);
+                *out = file;
+            }
+            break;
+        }
+
+        file = fat_new_file(vol);
+        if (file == NULL) {
+            status = EFI_OUT_OF_RESOURCES;
+            break;
+        }
+        StrCpy(file->name, has_long_name ? long_name : short_name);
+        file->is_directory = (attr & FAT_ATTR_DIRECTORY) != 0;
+        file->size = file->is_directory ? 0 : fat_u32(e + 28);
+
+        status = EFI_SUCCESS;
+        if (file->is_directory || file->size > 0) {
+            status = fat_chain(vol, cluster, file->size, file);
+        }
+        if (EFI_ERROR(status)) {
+            fat_free_file(file);
+        } else {
+            *out = file;
+        }
+        break;
+    }
+
+    FreePool(entries);
+
+    return status;
+}
+
+// Open a file or a directory relative to This, read only
+static FAT_API EFI_STATUS fat_open(EFI_FILE_PROTOCOL *This, EFI_FILE_PROTOCOL **NewHandle, CHAR16 *FileName, UINT64 OpenMode, UINT64 Attributes) {
+
+    EFI_STATUS status;
+    struct fat_file *dir = (struct fat_file *)This;
+    struct fat_file *current;
+    CHAR16 *p = FileName;
+
+    if (OpenMode != EFI_FILE_MODE_READ) {
+        return EFI_WRITE_PROTECTED;
+    }
+
+    // "\"で始まればルートから
+    if (*p == '\\') {
+        status = fat_open_root(dir->volume, &current);
+    } else if (!dir->is_directory) {
+        return EFI_NOT_FOUND;
+    } else {
+        status = fat_duplicate(dir, &current);
+    }
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    while (*p != '\0') {
+        UINTN length = 0;
+        struct fat_file *next;
+
+        while (*p == '\\') {
+            p++;
+        }
+        while (p[length] != '\0' && p[length] != '\\') {
+            length++;
+        }
+        if (length == 0 || (length == 1 && p[0] == '.')) {
+            p += length;
+            continue;
+        }
+
+        if (!current->is_directory) {
+            fat_free_file(current);
+            return EFI_NOT_FOUND;
+        }
+
+        status = fat_lookup(current, p, length, &next);
+        fat_free_file(current);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+        current = next;
+        p += length;
+    }
+
+    *NewHandle = &current->protocol;
+
+    return EFI_SUCCESS;
+}
+
+static FAT_API EFI_STATUS fat_close(EFI_FILE_PROTOCOL *This) {
+    fat_free_file((struct fat_file *)This);
+    return EFI_SUCCESS;
+}
+
+static FAT_API EFI_STATUS fat_delete(EFI_FILE_PROTOCOL *This) {
+    fat_free_file((struct fat_file *)This);
+    return EFI_WARN_DELETE_FAILURE;
+}
+
+// Read from the position, directories cannot be listed
+static FAT_API EFI_STATUS fat_read(EFI_FILE_PROTOCOL *This, UINTN *BufferSize, VOID *Buffer) {
+
+    EFI_STATUS status;
+    struct fat_file *file = (struct fat_file *)This;
+    UINTN size = *BufferSize;
+
+    if (file->is_directory) {
+        return EFI_UNSUPPORTED;
+    }
+    if (file->position > file->size) {
+        return EFI_DEVICE_ERROR;
+    }
+    if (size > file->size - file->position) {
+        size = file->size - file->position;
+    }
+
+    status = fat_read_at(file, file->position, size, Buffer);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    file->position += size;
+    *BufferSize = size;
+
+    return EFI_SUCCESS;
+}
+
+static FAT_API EFI_STATUS fat_write(EFI_FILE_PROTOCOL *This, UINTN *BufferSize, VOID *Buffer) {
+    return EFI_WRITE_PROTECTED;
+}
+
+static FAT_API EFI_STATUS fat_get_position(EFI_FILE_PROTOCOL *This, UINT64 *Position) {
+
+    struct fat_file *file = (struct fat_file *)This;
+
+    if (file->is_directory) {
+        return EFI_UNSUPPORTED;
+    }
+    *Position = file->position;
+
+    return EFI_SUCCESS;
+}
+
+// 0xFFFFFFFFFFFFFFFF moves to the end of the file
+static FAT_API EFI_STATUS fat_set_position(EFI_FILE_PROTOCOL *This, UINT64 Position) {
+
+    struct fat_file *file = (struct fat_file *)This;
+
+    if (file->is_directory) {
+        return Position == 0 ? EFI_SUCCESS : EFI_UNSUPPORTED;
+    }
+    file->position = Position == 0xFFFFFFFFFFFFFFFF ? file->size : Position;
+
+    return EFI_SUCCESS;
+}
+
+// Only EFI_FILE_INFO is supported
+static FAT_API EFI_STATUS fat_get_info(EFI_FILE_PROTOCOL *This, EFI_GUID *InformationType, UINTN *BufferSize, VOID *Buffer) {
+
+    struct fat_file *file = (struct fat_file *)This;
+    EFI_GUID file_info_guid = EFI_FILE_INFO_ID;
+    EFI_FILE_INFO *info = Buffer;
+    UINTN size = SIZE_OF_EFI_FILE_INFO + (StrLen(file->name) + 1) * sizeof(CHAR16);
+
+    if (CompareGuid(InformationType, &file_info_guid) != 0) {
+        return EFI_UNSUPPORTED;
+    }
+    if (*BufferSize < size) {
+        *BufferSize = size;
+        return EFI_BUFFER_TOO_SMALL;
+    }
+
+    ZeroMem(info, SIZE_OF_EFI_FILE_INFO);
+    info->Size = size;
+    info->FileSize = file->size;
+    info->PhysicalSize = file->no_of_extents > 0 ? file->extents[file->no_of_extents - 1].file_offset + file->extents[file->no_of_extents - 1].size : 0;
+    info->Attribute = EFI_FILE_READ_ONLY | (file->is_directory ? EFI_FILE_DIRECTORY : 0);
+    StrCpy(info->FileName, file->name);
+    *BufferSize = size;
+
+    return EFI_SUCCESS;
+}
+
+static FAT_API EFI_STATUS fat_set_info(EFI_FILE_PROTOCOL *This, EFI_GUID *InformationType, UINTN BufferSize, VOID *Buffer) {
+    return EFI_WRITE_PROTECTED;
+}
+
+static FAT_API EFI_STATUS fat_flush(EFI_FILE_PROTOCOL *This) {
+    return EFI_WRITE_PROTECTED;
+}
+
+// Parse the boot sector of a FAT12/16/32 volume
+static EFI_STATUS fat_parse(struct fat_volume *vol, const UINT8 *boot) {
+
+    UINT32 bytes_per_sector = fat_u16(boot + 11);
+    UINT32 sectors_per_cluster = boot[13];
+    UINT32 reserved_sectors = fat_u16(boot + 14);
+    UINT32 no_of_fats = boot[16];
+    UINT32 root_entries = fat_u16(boot + 17);
+    UINT32 total_sectors = fat_u16(boot + 19) != 0 ? fat_u16(boot + 19) : fat_u32(boot + 32);
+    UINT32 fat_sectors = fat_u16(boot + 22) != 0 ? fat_u16(boot + 22) : fat_u32(boot + 36);
+    UINT32 root_sectors, data_sectors;
+
+    // Signature
+    if (boot[510] != 0x55 || boot[511] != 0xAA) {
+        return EFI_UNSUPPORTED;
+    }
+
+    // BPB
+    if ((bytes_per_sector != 512 && bytes_per_sector != 1024 && bytes_per_sector != 2048 && bytes_per_sector != 4096) ||
+        sectors_per_cluster == 0 || (sectors_per_cluster & (sectors_per_cluster - 1)) != 0 ||
+        reserved_sectors == 0 || no_of_fats == 0 || fat_sectors == 0) {
+        return EFI_UNSUPPORTED;
+    }
+
+    root_sectors = (root_entries * FAT_DIR_ENTRY_SIZE + bytes_per_sector - 1) / bytes_per_sector;
+    if ((UINT64)reserved_sectors + (UINT64)no_of_fats * fat_sectors + root_sectors >= total_sectors) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+    data_sectors = total_sectors - (reserved_sectors + no_of_fats * fat_sectors + root_sectors);
+
+    vol->cluster_size = bytes_per_sector * sectors_per_cluster;
+    vol->no_of_clusters = data_sectors / sectors_per_cluster;
+    vol->fat_offset = (UINT64)reserved_sectors * bytes_per_sector;
+    vol->fat_size = (UINT64)fat_sectors * bytes_per_sector;
+    vol->root_offset = vol->fat_offset + no_of_fats * vol->fat_size;
+    vol->root_size = (UINT64)root_sectors * bytes_per_sector;
+    vol->data_offset = vol->root_offset + vol->root_size;
+
+    // 種類はクラスタ数だけで決まる
+    if (vol->no_of_clusters < FAT12_CLUSTERS_MAX) {
+        vol->type = FAT12;
+    } else if (vol->no_of_clusters < FAT16_CLUSTERS_MAX) {
+        vol->type = FAT16;
+    } else {
+        vol->type = FAT32;
+        vol->root_cluster = fat_u32(boot + 44);
+    }
+
+    // FAT12/16のルートは空にできない
+    if (vol->type != FAT32 && root_entries == 0) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    // FATに全てのクラスタのエントリーがあるか
+    if ((UINT64)(vol->no_of_clusters + FAT_FIRST_CLUSTER) * vol->type / 8 > vol->fat_size) {
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Mount the FAT volume on the handle and open its root directory
+// The root is an EFI_FILE_PROTOCOL that reads through Block I/O
+EFI_STATUS fat_mount(EFI_HANDLE handle, EFI_HANDLE ImageHandle, EFI_FILE_PROTOCOL **root) {
+
+    EFI_STATUS status;
+    struct fat_volume *vol;
+    struct fat_file *root_file;
+    UINT8 *boot;
+    UINTN boot_size;
+
+    vol = AllocateZeroPool(sizeof(struct fat_volume));
+    if (vol == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    status = read_engine_open(handle, ImageHandle, &vol->engine);
+    if (EFI_ERROR(status)) {
+        FreePool(vol);
+        return status;
+    }
+
+    // エクステントはなるべく大きく読む
+    vol->engine.chunk_size = FAT_READ_CHUNK_SIZE;
+
+    // Boot sector (ブロックが512バイトより大きくても読めるように1ブロック読む)
+    boot_size = vol->engine.block_size > 512 ? vol->engine.block_size : 512;
+    boot = AllocatePool(boot_size);
+    vol->cache = AllocatePool(FAT_CACHE_SIZE);
+    if (boot == NULL || vol->cache == NULL) {
+        status = EFI_OUT_OF_RESOURCES;
+        goto error;
+    }
+
+    status = read_engine_read(&vol->engine, 0, boot_size, boot);
+    if (!EFI_ERROR(status)) {
+        status = fat_parse(vol, boot);
+    }
+    if (!EFI_ERROR(status)) {
+        status = fat_open_root(vol, &root_file);
+    }
+    if (EFI_ERROR(status)) {
+        goto error;
+    }
+
+    FreePool(boot);
+    *root = &root_file->protocol;
+
+    return EFI_SUCCESS;
+
+error:
+    if (boot != NULL) {
+        FreePool(boot);
+    }
+    if (vol->cache != NULL) {
+        FreePool(vol->cache);
+    }
+    read_engine_close(&vol->engine);
+    FreePool(vol);
+
+    return status;
+}
+
+// Whether the file was opened by the native reader
+BOOLEAN fat_is_native(EFI_FILE_PROTOCOL *file) {
+    return file->Read == (EFI_FILE_READ)fat_read;
+}
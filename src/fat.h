@@ -0,0 +1,93 @@
+#ifndef _FAT_H
+#define _FAT_H
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "disk.h"
+
+// ファームウェアから呼ばれるので常にMicrosoftの呼び出し規約を使う
+#define FAT_API __attribute__((ms_abi))
+
+// FATの種類
+#define FAT12 12
+#define FAT16 16
+#define FAT32 32
+
+// クラスタ数の境界 (Microsoft FAT Specification)
+#define FAT12_CLUSTERS_MAX 4085
+#define FAT16_CLUSTERS_MAX 65525
+
+// 最初のデータクラスタ
+#define FAT_FIRST_CLUSTER 2
+
+// ディレクトリエントリー
+#define FAT_DIR_ENTRY_SIZE 32
+#define FAT_ATTR_READ_ONLY 0x01
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_LONG_NAME 0x0F
+#define FAT_ENTRY_FREE 0xE5
+#define FAT_ENTRY_END 0x00
+#define FAT_LFN_LAST 0x40
+#define FAT_LFN_CHARS 13
+
+// 8.3形式の名前を小文字で表示する (NTRes)
+#define FAT_NT_LOWER_BASE 0x08
+#define FAT_NT_LOWER_EXT 0x10
+
+// 長い名前の最大文字数
+#define FAT_NAME_MAX 255
+
+// FATを読むキャッシュの大きさ
+#define FAT_CACHE_SIZE (64 * 1024)
+
+// エクステントを1回に読む最大サイズ (大きい読み込みはエンジンが分ける)
+#define FAT_READ_CHUNK_SIZE (4 * 1024 * 1024)
+
+// エクステントの配列の最初の大きさ
+#define FAT_EXTENTS_INITIAL 8
+
+// FAT_EXTENT
+// ディスク上で連続したクラスタの並び
+struct fat_extent {
+    UINT64 file_offset;
+    UINT64 disk_offset; // ボリュームの先頭から
+    UINT64 size;
+};
+
+// FAT_VOLUME
+struct fat_volume {
+    struct read_engine engine;
+    UINT32 type; // FAT12 / FAT16 / FAT32
+    UINT32 cluster_size;
+    UINT32 no_of_clusters;
+    UINT64 fat_offset;
+    UINT64 fat_size;
+    UINT64 data_offset;
+
+    // ルートディレクトリ (FAT12/16は固定の領域、FAT32はクラスタ)
+    UINT32 root_cluster;
+    UINT64 root_offset;
+    UINT64 root_size;
+
+    // FATのキャッシュ
+    UINT8 *cache;
+    UINT64 cache_offset;
+    UINTN cache_size;
+};
+
+// FAT_FILE
+// EFI_FILE_PROTOCOLとして他のコードに渡すので、protocolは先頭に置く
+struct fat_file {
+    EFI_FILE_PROTOCOL protocol;
+    struct fat_volume *volume;
+    BOOLEAN is_directory;
+    UINT64 size;
+    UINT64 position;
+    struct fat_extent *extents;
+    UINTN no_of_extents;
+    CHAR16 name[FAT_NAME_MAX + 1];
+};
+
+#endif
@@ -0,0 +1,248 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "handoff.h"
+#include "proto.h"
+
+// Physical address of the entry point
+// ファームウェアのページテーブルのまま飛ぶ時は、仮想アドレスのエントリーを配置した物理アドレスに直す
+static UINT64 kernel_entry_address(kernel_image *kernel) {
+
+    for (UINTN i = 0; i < kernel->no_of_segments; i++) {
+        kernel_segment *s = &kernel->segments[i];
+        if (kernel->entry >= s->vaddr && kernel->entry - s->vaddr < s->memsz) {
+            return s->paddr + (kernel->entry - s->vaddr);
+        }
+    }
+
+    return kernel->entry;
+}
+
+// Whether a segment is linked at a virtual address other than its physical one
+static BOOLEAN kernel_is_higher_half(kernel_image *kernel) {
+
+    for (UINTN i = 0; i < kernel->no_of_segments; i++) {
+        if (kernel->segments[i].vaddr != kernel->segments[i].paddr) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+// Build page tables for a higher-half kernel
+static BOOLEAN boot_info_page_tables(kernel_image *kernel, payload *image, struct boot_framebuffer *fb, struct page_tables *pt) {
+
+    EFI_STATUS status;
+
+    if (!kernel_is_higher_half(kernel)) {
+        return FALSE;
+    }
+
+    status = page_tables_build(kernel, image, fb, pt);
+    if (EFI_ERROR(status)) {
+        Print(L"Cannot build page tables: %r, entering at the physical address\n", status);
+        return FALSE;
+    }
+
+    Print(L"Page tables: %u pages (%u x 1 GiB, %u x 2 MiB, %u x 4 KiB)\n", pt->no_of_tables, pt->no_of_pages[2], pt->no_of_pages[1], pt->no_of_pages[0]);
+
+    return TRUE;
+}
+
+// Describe the GOP framebuffer if there is one
+static BOOLEAN boot_info_framebuffer(struct boot_framebuffer *fb) {
+
+    EFI_STATUS status;
+    EFI_GUID gop_guid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *gop;
+    EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *mode;
+
+    status = uefi_call_wrapper(BS->LocateProtocol, 3, &gop_guid, NULL, (VOID **)&gop);
+    if (EFI_ERROR(status) || gop->Mode == NULL || gop->Mode->Info == NULL) {
+        return FALSE;
+    }
+    mode = gop->Mode->Info;
+
+    // Bltしか使えなければカーネルは描けない
+    if (mode->PixelFormat == PixelBltOnly || gop->Mode->FrameBufferBase == 0) {
+        return FALSE;
+    }
+
+    fb->base = gop->Mode->FrameBufferBase;
+    fb->size = gop->Mode->FrameBufferSize;
+    fb->width = mode->HorizontalResolution;
+    fb->height = mode->VerticalResolution;
+    fb->pixels_per_scan_line = mode->PixelsPerScanLine;
+    fb->format = mode->PixelFormat;
+    if (mode->PixelFormat == PixelBitMask) {
+        fb->red_mask = mode->PixelInformation.RedMask;
+        fb->green_mask = mode->PixelInformation.GreenMask;
+        fb->blue_mask = mode->PixelInformation.BlueMask;
+        fb->reserved_mask = mode->PixelInformation.ReservedMask;
+    }
+
+    return TRUE;
+}
+
+// Build the boot info block while boot services can still allocate
+// Everything except the memory map is filled in here
+EFI_STATUS boot_info_create(kernel_image *kernel, payload *image, const char *flags, struct boot_info **out) {
+
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS address;
+    struct boot_info *info;
+    UINTN map_size = 0, map_key, desc_size = 0;
+    UINT32 desc_version;
+    UINTN flags_size, map_offset, size;
+    VOID *trace;
+    struct boot_framebuffer framebuffer;
+    struct page_tables pt;
+    BOOLEAN has_framebuffer, has_page_tables;
+
+    *out = NULL;
+
+    ZeroMem(&framebuffer, sizeof(framebuffer));
+    has_framebuffer = boot_info_framebuffer(&framebuffer);
+
+    // テーブルの確保で記述子が増えるので、マップの大きさを調べる前に作る
+    has_page_tables = boot_info_page_tables(kernel, image, has_framebuffer ? &framebuffer : NULL, &pt);
+
+    // 今のマップの大きさを調べる (バッファーがないのでBUFFER_TOO_SMALLになる)
+    status = uefi_call_wrapper(BS->GetMemoryMap, 5, &map_size, NULL, &map_key, &desc_size, &desc_version);
+    if (status != EFI_BUFFER_TOO_SMALL || desc_size == 0) {
+        status = EFI_ERROR(status) ? status : EFI_DEVICE_ERROR;
+        goto error;
+    }
+
+    // ヘッダー、flags=、マップの順に並べる
+    flags_size = flags != NULL ? my_strlen(flags) + 1 : 0;
+    map_offset = (sizeof(struct boot_info) + flags_size + 15) & ~(UINTN)15;
+    map_size += BOOT_INFO_MAP_SLACK * desc_size;
+    size = map_offset + map_size;
+
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(size), &address);
+    if (EFI_ERROR(status)) {
+        goto error;
+    }
+    info = (struct boot_info *)(UINTN)address;
+    mem_zero(info, map_offset);
+
+    info->magic = BOOT_INFO_MAGIC;
+    info->version = BOOT_INFO_VERSION;
+    info->header_size = sizeof(struct boot_info);
+    info->size = size;
+
+    // Kernel
+    info->kernel_base = kernel->base;
+    info->kernel_end = kernel->end;
+    info->kernel_entry = kernel_entry_address(kernel);
+
+    // Image
+    if (image != NULL) {
+        info->image_base = image->base;
+        info->image_size = image->size;
+        info->present |= BOOT_INFO_HAS_IMAGE;
+    }
+
+    // Flags
+    if (flags != NULL) {
+        info->flags_offset = sizeof(struct boot_info);
+        info->flags_size = flags_size;
+        mem_copy((UINT8 *)info + info->flags_offset, flags, flags_size);
+        info->present |= BOOT_INFO_HAS_FLAGS;
+    }
+
+    // Memory map (ExitBootServicesの直前に埋める)
+    info->map_offset = map_offset;
+    info->map_capacity = map_size;
+    info->map_desc_size = desc_size;
+
+    // Framebuffer
+    if (has_framebuffer) {
+        info->framebuffer = framebuffer;
+        info->present |= BOOT_INFO_HAS_FRAMEBUFFER;
+    }
+
+    // Page tables (カーネルには仮想アドレスのエントリーから入る)
+    if (has_page_tables) {
+        info->page_table = (UINT64)(UINTN)pt.pml4;
+        info->direct_map = PAGING_DIRECT_MAP_BASE;
+        info->identity_end = pt.identity_end;
+        info->kernel_entry = kernel->entry;
+        info->present |= BOOT_INFO_HAS_PAGE_TABLES;
+    }
+
+    // Trace
+    trace = trace_buffer();
+    if (trace != NULL) {
+        info->trace = (UINT64)(UINTN)trace;
+        info->present |= BOOT_INFO_HAS_TRACE;
+    }
+
+    info->system_table = (UINT64)(UINTN)ST;
+
+    *out = info;
+
+    return EFI_SUCCESS;
+
+error:
+    if (has_page_tables) {
+        page_tables_free(&pt);
+    }
+
+    return status;
+}
+
+// Take the final memory map, exit boot services and jump to the kernel
+// Nothing is allocated or printed between GetMemoryMap and ExitBootServices, so a retry only happens
+// when the firmware itself changes the map. It returns only on failure, and then
+// only GetMemoryMap and ExitBootServices may still be usable
+EFI_STATUS handoff(EFI_HANDLE ImageHandle, struct boot_info *info) {
+
+    EFI_STATUS status = EFI_INVALID_PARAMETER;
+    EFI_MEMORY_DESCRIPTOR *map = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)info + info->map_offset);
+    UINTN map_size, map_key, desc_size;
+    UINT32 desc_version;
+    kernel_entry entry = (kernel_entry)(UINTN)info->kernel_entry;
+
+    trace_begin(TRACE_EXIT_BOOT_SERVICES);
+
+    for (UINTN attempt = 0; attempt < HANDOFF_RETRIES && status == EFI_INVALID_PARAMETER; attempt++) {
+
+        // 確保済みのバッファーに取る
+        map_size = info->map_capacity;
+        status = uefi_call_wrapper(BS->GetMemoryMap, 5, &map_size, map, &map_key, &desc_size, &desc_version);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+
+        // マップキーが古ければEFI_INVALID_PARAMETERが返る
+        status = uefi_call_wrapper(BS->ExitBootServices, 2, ImageHandle, map_key);
+    }
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    // ここからはファームウェアのBoot Servicesを呼ばない
+    info->map_size = map_size;
+    info->map_desc_size = desc_size;
+    info->map_desc_version = desc_version;
+
+    trace_end(TRACE_EXIT_BOOT_SERVICES);
+
+    // 割り込みはカーネルが準備してから有効にする
+    __asm__ volatile ("cli");
+
+    // ローダーのコード、スタック、boot_infoは恒等マッピングで見えたままになる
+    if (info->present & BOOT_INFO_HAS_PAGE_TABLES) {
+        __asm__ volatile ("mov %0, %%cr3" : : "r"(info->page_table) : "memory");
+    }
+
+    entry(info);
+
+    // カーネルは戻らない
+    return EFI_LOAD_ERROR;
+}
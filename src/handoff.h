@@ -0,0 +1,89 @@
+#ifndef _HANDOFF_H
+#define _HANDOFF_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// "NBBI"
+#define BOOT_INFO_MAGIC 0x4942424E
+#define BOOT_INFO_VERSION 2
+
+// ブロックを確保した後に増える記述子の分の余裕
+#define BOOT_INFO_MAP_SLACK 32
+
+// マップキーが古くなった時にExitBootServicesをやり直す回数
+#define HANDOFF_RETRIES 8
+
+// boot_info.presentのビット
+#define BOOT_INFO_HAS_IMAGE (1 << 0)
+#define BOOT_INFO_HAS_FRAMEBUFFER (1 << 1)
+#define BOOT_INFO_HAS_TRACE (1 << 2)
+#define BOOT_INFO_HAS_FLAGS (1 << 3)
+#define BOOT_INFO_HAS_PAGE_TABLES (1 << 4)
+
+// BOOT_FRAMEBUFFER
+// GOPのフレームバッファー
+struct boot_framebuffer {
+    UINT64 base;
+    UINT64 size;
+    UINT32 width;
+    UINT32 height;
+    UINT32 pixels_per_scan_line;
+    UINT32 format; // EFI_GRAPHICS_PIXEL_FORMAT
+    UINT32 red_mask; // formatがPixelBitMaskの時だけ
+    UINT32 green_mask;
+    UINT32 blue_mask;
+    UINT32 reserved_mask;
+};
+
+// BOOT_INFO
+// カーネルに渡す1つのブロック
+// この後にflags=の文字列とメモリーマップが続き、オフセットはブロックの先頭から数える
+struct boot_info {
+    UINT32 magic;
+    UINT16 version;
+    UINT16 header_size; // sizeof(struct boot_info)
+    UINT32 size; // ブロック全体のバイト数
+    UINT32 present; // BOOT_INFO_HAS_*
+
+    // カーネル (エントリーは物理アドレス)
+    UINT64 kernel_base;
+    UINT64 kernel_end;
+    UINT64 kernel_entry;
+
+    // イメージ
+    UINT64 image_base;
+    UINT64 image_size;
+
+    // コンフィグのflags= (NULL終端)
+    UINT32 flags_offset;
+    UINT32 flags_size;
+
+    // ExitBootServicesの直前に取ったメモリーマップ
+    UINT32 map_offset;
+    UINT32 map_capacity;
+    UINT64 map_size;
+    UINT64 map_desc_size;
+    UINT32 map_desc_version;
+    UINT32 reserved;
+
+    struct boot_framebuffer framebuffer;
+
+    // Boot Trace (struct trace_header)
+    UINT64 trace;
+
+    // EFI_SYSTEM_TABLE (Runtime Servicesのため)
+    UINT64 system_table;
+
+    // ローダーが作ったページテーブル (version 2から)
+    // 物理メモリーは0とdirect_mapの両方から[0, identity_end)が見える
+    UINT64 page_table; // PML4の物理アドレス
+    UINT64 direct_map;
+    UINT64 identity_end;
+};
+
+// カーネルのエントリーポイント
+// カーネルはELFなのでSystem Vの呼び出し規約で、boot_infoは第1引数 (RDI) に入る
+typedef VOID (__attribute__((sysv_abi)) *kernel_entry)(struct boot_info *info);
+
+#endif
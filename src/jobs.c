@@ -0,0 +1,271 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "mp.h"
+#include "proto.h"
+
+static struct scheduler job_scheduler;
+
+// Spinlock
+static void job_lock(volatile UINT32 *lock) {
+    while (__sync_lock_test_and_set(lock, 1)) {
+        while (*lock) {
+            __asm__ volatile ("pause");
+        }
+    }
+}
+
+static void job_unlock(volatile UINT32 *lock) {
+    __sync_lock_release(lock);
+}
+
+// Push a job to the bottom of the queue
+static void job_queue_push(struct job_queue *queue, UINT32 index) {
+
+    job_lock(&queue->lock);
+    queue->jobs[queue->bottom % JOB_QUEUE_SIZE] = index;
+    queue->bottom += 1;
+    job_unlock(&queue->lock);
+}
+
+// Pop a job from the bottom, only the owner does this
+static BOOLEAN job_queue_pop(struct job_queue *queue, UINT32 *index) {
+
+    BOOLEAN found = FALSE;
+
+    job_lock(&queue->lock);
+    if (queue->top != queue->bottom) {
+        queue->bottom -= 1;
+        *index = queue->jobs[queue->bottom % JOB_QUEUE_SIZE];
+        found = TRUE;
+    }
+    job_unlock(&queue->lock);
+
+    return found;
+}
+
+// Steal a job from the top
+static BOOLEAN job_queue_steal(struct job_queue *queue, UINT32 *index) {
+
+    BOOLEAN found = FALSE;
+
+    // 空なら鍵を取らない
+    if (queue->top == queue->bottom) {
+        return FALSE;
+    }
+
+    job_lock(&queue->lock);
+    if (queue->top != queue->bottom) {
+        *index = queue->jobs[queue->top % JOB_QUEUE_SIZE];
+        queue->top += 1;
+        found = TRUE;
+    }
+    job_unlock(&queue->lock);
+
+    return found;
+}
+
+// Run jobs until all queues are empty
+static void job_worker_loop(struct scheduler *s, UINTN id) {
+
+    UINT32 index;
+
+    while (s->remaining > 0) {
+        BOOLEAN found = FALSE;
+
+        // 自分のキューから
+        if (id < s->no_of_workers) {
+            found = job_queue_pop(&s->queues[id], &index);
+        }
+
+        // 無ければ他のワーカーから盗む
+        for (UINTN i = 1; !found && i <= s->no_of_workers; i++) {
+            UINTN victim = (id + i) % s->no_of_workers;
+            found = job_queue_steal(&s->queues[victim], &index);
+        }
+
+        // ジョブは新しいジョブを作らないので、全て空なら終わり
+        if (!found) {
+            break;
+        }
+
+        job *j = &s->jobs[index];
+        j->function(j->arg, j->begin, j->end);
+        __sync_fetch_and_sub(&s->remaining, 1);
+    }
+}
+
+// Entry point of the APs
+static VOID __attribute__((ms_abi)) job_ap_entry(VOID *argument) {
+
+    struct scheduler *s = argument;
+
+    // BSPが0なので1から
+    UINTN id = __sync_fetch_and_add(&s->next_worker, 1);
+
+    job_worker_loop(s, id);
+}
+
+// Run a batch that fits in the queues
+static void job_dispatch(struct scheduler *s, job *jobs, UINTN count) {
+
+    EFI_STATUS status;
+    BOOLEAN started = FALSE;
+
+    s->jobs = jobs;
+    s->remaining = count;
+    s->next_worker = 1;
+
+    // 順番にキューに配る
+    for (UINTN i = 0; i < s->no_of_workers; i++) {
+        s->queues[i].top = 0;
+        s->queues[i].bottom = 0;
+    }
+    for (UINTN i = 0; i < count; i++) {
+        job_queue_push(&s->queues[i % s->no_of_workers], i);
+    }
+
+    if (s->mp != NULL && s->no_of_workers > 1 && count > 1) {
+
+        // APを起動してBSPも一緒に処理する
+        status = uefi_call_wrapper(s->mp->StartupAllAPs, 7, s->mp, job_ap_entry, FALSE, s->done, 0, s, NULL);
+        if (!EFI_ERROR(status)) {
+            started = TRUE;
+        } else if (status == EFI_UNSUPPORTED) {
+            // 非ブロッキングに対応していなければAPだけで処理する
+            uefi_call_wrapper(s->mp->StartupAllAPs, 7, s->mp, job_ap_entry, FALSE, NULL, 0, s, NULL);
+        }
+    }
+
+    // APがいなければBSPが全て処理する
+    job_worker_loop(s, 0);
+
+    // 他のワーカーが実行中のジョブを待つ
+    while (s->remaining > 0) {
+        __asm__ volatile ("pause");
+    }
+
+    // 次に起動する前にAPが戻るのを待つ
+    if (started) {
+        UINTN index;
+        uefi_call_wrapper(BS->WaitForEvent, 3, 1, &s->done, &index);
+    }
+}
+
+// Find the MP services and count the cores
+EFI_STATUS scheduler_init() {
+
+    EFI_STATUS status;
+    EFI_GUID mp_guid = NEOBOOT_MP_SERVICES_GUID;
+    struct scheduler *s = &job_scheduler;
+    UINTN no_of_processors, no_of_enabled;
+
+    ZeroMem(s, sizeof(struct scheduler));
+    s->no_of_workers = 1;
+
+    status = uefi_call_wrapper(BS->LocateProtocol, 3, &mp_guid, NULL, (VOID **)&s->mp);
+    if (EFI_ERROR(status)) {
+        s->mp = NULL;
+        return status;
+    }
+
+    status = uefi_call_wrapper(s->mp->GetNumberOfProcessors, 3, s->mp, &no_of_processors, &no_of_enabled);
+    if (EFI_ERROR(status)) {
+        s->mp = NULL;
+        return status;
+    }
+
+    // APの完了を待つイベント
+    status = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL, &s->done);
+    if (EFI_ERROR(status)) {
+        s->mp = NULL;
+        return status;
+    }
+
+    s->no_of_workers = no_of_enabled < JOB_WORKERS_MAX ? no_of_enabled : JOB_WORKERS_MAX;
+    if (s->no_of_workers == 0) {
+        s->no_of_workers = 1;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Number of cores that run jobs
+UINTN scheduler_workers() {
+    return job_scheduler.no_of_workers == 0 ? 1 : job_scheduler.no_of_workers;
+}
+
+// Run the jobs on all cores and wait for them
+void jobs_run(job *jobs, UINTN count) {
+
+    struct scheduler *s = &job_scheduler;
+
+    // 初期化されていなければその場で実行する
+    if (s->no_of_workers <= 1) {
+        for (UINTN i = 0; i < count; i++) {
+            jobs[i].function(jobs[i].arg, jobs[i].begin, jobs[i].end);
+        }
+        return;
+    }
+
+    // キューに入る分ずつ
+    UINTN capacity = s->no_of_workers * JOB_QUEUE_SIZE;
+    while (count > 0) {
+        UINTN batch = count < capacity ? count : capacity;
+        job_dispatch(s, jobs, batch);
+        jobs += batch;
+        count -= batch;
+    }
+}
+
+// Split [0, size) into jobs of at least grain bytes
+void parallel_for(job_function function, VOID *arg, UINTN size, UINTN grain) {
+
+    UINTN workers = scheduler_workers();
+    UINTN count;
+    job *jobs;
+
+    if (size < JOB_PARALLEL_MIN || workers <= 1) {
+        function(arg, 0, size);
+        return;
+    }
+
+    // 盗めるようにワーカーあたり4つ程度に分ける
+    if (grain < JOB_GRAIN_MIN) {
+        grain = JOB_GRAIN_MIN;
+    }
+    if (grain < size / (workers * 4)) {
+        grain = size / (workers * 4);
+    }
+    grain = (grain + EFI_PAGE_SIZE - 1) & ~(UINTN)(EFI_PAGE_SIZE - 1);
+    count = (size + grain - 1) / grain;
+
+    jobs = AllocatePool(sizeof(job) * count);
+    if (jobs == NULL) {
+        function(arg, 0, size);
+        return;
+    }
+
+    for (UINTN i = 0; i < count; i++) {
+        jobs[i].function = function;
+        jobs[i].arg = arg;
+        jobs[i].begin = i * grain;
+        jobs[i].end = (i + 1) * grain < size ? (i + 1) * grain : size;
+    }
+
+    jobs_run(jobs, count);
+
+    FreePool(jobs);
+}
+
+// Zero a part of the buffer
+static VOID zero_job(VOID *arg, UINTN begin, UINTN end) {
+    mem_zero_any_core((UINT8 *)arg + begin, end - begin);
+}
+
+// Zero a large buffer on all cores
+void parallel_zero(VOID *buffer, UINTN size) {
+    parallel_for(zero_job, buffer, size, 0);
+}
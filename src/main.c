@@ -9,166 +9,8 @@
 #include "config.h"
 #include "proto.h"
 
-// Strlen
-unsigned int my_strlen(const char *str) {
-
-    unsigned int str_size = 0;
-
-    while(*str != '\0') {
-        str++;
-        str_size++;
-    }
-
-    return str_size;
-}
-
-// Strcpy
-char *my_strcpy(char *dest, const char *src) {
-    char *original_dest = dest;
-
-    while (*src) {
-        *dest = *src;
-        dest++;
-        src++;
-    }
-
-    *dest = '\0';
-
-    return original_dest;
-}
-
-// Strchr
-char *my_strchr(const char *str, int c) {
-
-    // 一文字づつ探す
-    while(*str != '\0') {
-        if (*str == (char)c) {
-            return (char *)str;
-        }
-        str++;
-    }
-
-    // 終端文字を探している場合
-    if (c == '\0') {
-        return (char *)str;
-    }
-
-    return NULL;
-
-}
-
-void split_key_value(char *str, char **key, char **value) {
-    char *eq = my_strchr(str, '=');
-    if (eq) {
-        *eq = '\0';
-        *key = str;
-        *value = eq + 1;
-    } else {
-        *key = NULL;
-        *value = NULL;
-    }
-}
-
-
-// Strdup
-char *my_strdup(const char *s) {
-
-    // Caluclate size of string
-    int len = 0;
-    while (s[len] != '\0') {
-        len++;
-    }
-
-    // Reserve memory
-    char *dup = (char *)AllocatePool(len + 1);
-    if (dup == NULL) {
-        return NULL;
-    }
-
-    // Copy string
-    for (int i = 0; i < len; i++) {
-        dup[i] = s[i];
-    }
-    dup[len] = '\0'; // NULL終端
-
-    return dup;
-}
-
-// Strtok
-char *my_strtok(char *str, const char *delim) {
-
-    static char *next_token = NULL; // トークンを保存
-    
-    if (str == NULL) {
-        str = next_token;
-    }
-
-    if (str == NULL) {
-        return NULL;
-    }
-
-    while (*str && my_strchr(delim, *str)) {
-        str++;
-    }
-
-    if (*str == '\0') {
-        return NULL;
-    }
-
-    char *start = str; // トークンの開始位置を保存
-
-    // トークンの終端を探す
-    while( *str && !my_strchr(delim, *str)) {
-        str++;
-    }
-
-    if (*str) {
-        *str = '\0';
-        next_token = str + 1; // 次の文字へ
-        
-        // This does NOT have in original C library
-        if (delim == ",") {
-            next_token = str + 2; // Ignore "\n" after ","
-        }
-
-    } else {
-        next_token = NULL; // 次のトークンなし
-    }
-
-    return start;
-
-}
-
-// Split
-char **split(char *txt, const char *delimiter, int *count) {
-
-    // Array of tokens
-    char **tokens = AllocatePool(100 * sizeof(char));
-    if (tokens == NULL) {
-        return NULL;
-    }
-
-    UINT32 i = 0;
-
-    // Find a first token by strtok
-    char *token = my_strtok(txt, ",");
-
-    // Copy tokens from text to array
-    while (token != NULL && i < 100) {
-        tokens[i] = token;
-        i++;
-        token = my_strtok(NULL, ",");
-    }
-
-    // NULL terminate the array of tokens
-    tokens[i] = NULL;
-
-    // Set count
-    *count = i;
-
-    // Return
-    return tokens;
-}
+// メニューで選ばれたコンフィグのエントリー
+static UINTN menu_choice = 1;
 
 // AsciiSPrint
 UINTN EFIAPI AsciiSPrint(CHAR8 *buffer, UINTN buffer_size, CONST CHAR8 *str, ...) {
@@ -181,82 +23,6 @@ UINTN EFIAPI AsciiSPrint(CHAR8 *buffer, UINTN buffer_size, CONST CHAR8 *str, ...
     return num_printed;
 }
 
-// Add spaces around text
-CHAR16 *add_spaces_around_text(const CHAR16 *text, UINTN num_spaces) {
-    UINTN text_length = StrLen(text);
-    UINTN new_length = text_length + 2 * num_spaces;
-
-    // AllocatePoolでメモリーを確保
-    CHAR16 *new_text = AllocatePool((new_length + 1) * sizeof(CHAR16));
-    if (new_text == NULL) {
-        return NULL;
-    }
-
-    // 先頭にスペースを挿入
-    for (UINTN i = 0; i < num_spaces; i++) {
-        new_text[i] = ' ';
-    }
-
-    // 元の文字列を挿入
-    for (UINTN i = 0; i < text_length; i++) {
-        new_text[num_spaces + i] = text[i];
-    }
-
-    // 後尾にスペースを挿入
-    for (UINTN i = 0; i < num_spaces; i++) {
-        new_text[num_spaces + text_length + i] = ' ';
-    }
-
-    // 終端の設定
-    new_text[new_length] = '\0';
-
-    return new_text;
-}
-
-// Config file Parser
-Config *config_file_parser(char *config_txt) {
-    char **lines;
-    int count;
-    Config *config = AllocatePool(sizeof(config));
-
-    // Split by ","
-    lines = split(config_txt, ",", &count);
-
-    config->keys = AllocatePool(sizeof(char *) * count);
-    config->values = AllocatePool(sizeof(char *) * count);
-
-    for (int i = 0; i < count; i++) {
-
-        char *key, *value = NULL;
-        unsigned int key_size, value_size = 0;
-
-        // Split by "="
-        split_key_value(lines[i], &key, &value);
-
-        // Strlen
-        key_size = my_strlen(key) + 1;
-        value_size = my_strlen(value) + 1;
-
-        // Allocate each elements
-        config->keys[i] = AllocatePool(20);
-        config->values[i] = AllocatePool(20);
-
-        // Copy to arrays
-        my_strcpy(config->keys[i], key);
-        my_strcpy(config->values[i], value);
-    }
-
-    // Free
-    FreePool(lines);
-
-    // Final
-    config->num_keys = count;
-
-    // Return
-    return config;
-
-};
-
 // Get memory type
 const CHAR16 *get_memtype(EFI_MEMORY_TYPE type) {
     switch (type) {
@@ -280,40 +46,6 @@ const CHAR16 *get_memtype(EFI_MEMORY_TYPE type) {
     }
 }
 
-// Save memory map file
-EFI_STATUS save_memmap(memmap *map, EFI_FILE_PROTOCOL *f, EFI_FILE_PROTOCOL *esp_root) {
-    char buffer[4096];
-    EFI_STATUS status;
-    UINTN size;
-
-    // Header
-    CHAR8 *header = "Index, Buffer, Type, Type(name), PhysicalStart, VirtualStart, NumberOfPages, Size, Attribute\n"
-                    "-----|------------------|----|----------------------|------------------|------------------|------------------|-----|----------------|\n";
-    size = strlena(header);
-
-    // Create a file
-    status = uefi_call_wrapper(esp_root->Open, 5, esp_root, &f, L"\\memmap", EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0);
-    ASSERT(!EFI_ERROR(status));
-
-    // Write header
-    status = uefi_call_wrapper(f->Write, 3, f, &size, header);
-    ASSERT(!EFI_ERROR(status));
-
-    // Write memory map
-    for (UINTN i = 0; i < map->entry; i++) {
-        EFI_MEMORY_DESCRIPTOR *desc = (EFI_MEMORY_DESCRIPTOR *)((char *)map->buffer + map->desc_size * i);
-        size = AsciiSPrint(buffer, sizeof(buffer), "| %02u | %016x | %02x | %20ls | %016x | %016x | %016x | %3d | %2ls %5lx | \n", i, desc, desc->Type, get_memtype(desc->Type), desc->PhysicalStart, desc->VirtualStart, desc->NumberOfPages, desc->NumberOfPages, (desc->Attribute & EFI_MEMORY_RUNTIME) ? L"RT" : L"", desc->Attribute & 0xffffflu);
-
-        status = uefi_call_wrapper(f->Write, 3, f, &size, buffer);
-        ASSERT(!EFI_ERROR(status));
-    }
-
-    // Close file handle
-    uefi_call_wrapper(f->Close, 1, f);
-
-    return EFI_SUCCESS;
-}
-
 // Open protocol
 EFI_STATUS open_protocol(EFI_HANDLE handle, EFI_GUID *guid, VOID **protocol, EFI_HANDLE ImageHandle, UINT32 attr) {
     EFI_STATUS status = uefi_call_wrapper(BS->OpenProtocol, 6, handle, guid, protocol, ImageHandle, NULL, attr);
@@ -323,26 +55,30 @@ EFI_STATUS open_protocol(EFI_HANDLE handle, EFI_GUID *guid, VOID **protocol, EFI
 }
 
 // List disks
-void list_disks(EFI_HANDLE ImageHandle, struct disk_info **disk_info, UINTN *no_of_disks) {
+// verboseなら見つけたディスクとパーティションを表示する
+void list_disks(EFI_HANDLE ImageHandle, struct disk_info **disk_info, UINTN *no_of_disks, BOOLEAN verbose) {
     EFI_STATUS status;
     EFI_HANDLE *handleBuffer;
     UINTN handleCount;
     EFI_GUID BlockIoProtocol = EFI_BLOCK_IO_PROTOCOL_GUID;
-    EFI_BLOCK_IO_PROTOCOL *BlockIo;
-    EFI_DISK_IO_PROTOCOL *DiskIo;
-    EFI_GUID DiskIoProtocol = EFI_DISK_IO_PROTOCOL_GUID;
+    EFI_BLOCK_IO_MEDIA *Media;
+    struct read_engine engine;
 
     // Locate all handles that support the Block I/O protocol
     status = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol, &BlockIoProtocol, NULL, &handleCount, &handleBuffer);
     if (EFI_ERROR(status)) {
-        Print(L"Failed to locate handles: %r\n", status);
+        if (verbose) {
+            Print(L"Failed to locate handles: %r\n", status);
+        }
         return;
     }
 
-    // Allocate the disk_info struct in the memory
-    *disk_info = AllocatePool(handleCount * sizeof(struct disk_info));
+    // Allocate the disk_info struct in the arena
+    *disk_info = ARENA_ARRAY(struct disk_info, handleCount);
     if (*disk_info == NULL) {
-        Print(L"Failed to allocate memory\n");
+        if (verbose) {
+            Print(L"Failed to allocate memory\n");
+        }
         FreePool(handleBuffer);
         return;
     }
@@ -352,109 +88,192 @@ void list_disks(EFI_HANDLE ImageHandle, struct disk_info **disk_info, UINTN *no_
 
     // Iterate over each handle
     for (UINTN i = 0; i < handleCount; i++) {
-        // Open Block I/O protocol
-        status = open_protocol(handleBuffer[i], &BlockIoProtocol, (void **)&BlockIo, ImageHandle, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
-        if (EFI_ERROR(status)) {
-            Print(L"Failed to open Block I/O protocol: %r\n", status);
-            continue;
-        }
+        (*disk_info)[i].handle = handleBuffer[i];
 
-        // Open Disk I/O protocol
-        status = open_protocol(handleBuffer[i], &DiskIoProtocol, (void **)&DiskIo, ImageHandle, EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+        // Open Block I/O (2) and Disk I/O (2) protocols
+        status = read_engine_open(handleBuffer[i], ImageHandle, &engine);
         if (EFI_ERROR(status)) {
-            Print(L"Failed to open Disk I/O protocol: %r\n", status);
+            if (verbose) {
+                Print(L"Failed to open Block I/O protocol: %r\n", status);
+            }
             continue;
         }
+        Media = engine.block_io->Media;
 
         // Print disk information
-        Print(L"Disk %u:\n", i);
-        Print(L"  MediaId: %u\n", BlockIo->Media->MediaId);
-        Print(L"  RemovableMedia: %u\n", BlockIo->Media->RemovableMedia);
-        Print(L"  MediaPresent: %u\n", BlockIo->Media->MediaPresent);
-        Print(L"  LastBlock: %lu\n", BlockIo->Media->LastBlock);
-        Print(L"  BlockSize: %u\n", BlockIo->Media->BlockSize);
-        Print(L"  LogicalPartition: %u\n", BlockIo->Media->LogicalPartition);
-        Print(L"  ReadOnly: %u\n", BlockIo->Media->ReadOnly);
-        Print(L"  WriteCaching: %u\n", BlockIo->Media->WriteCaching);
+        if (verbose) {
+            Print(L"Disk %u:\n", i);
+            Print(L"  MediaId: %u\n", Media->MediaId);
+            Print(L"  RemovableMedia: %u\n", Media->RemovableMedia);
+            Print(L"  MediaPresent: %u\n", Media->MediaPresent);
+            Print(L"  LastBlock: %lu\n", Media->LastBlock);
+            Print(L"  BlockSize: %u\n", Media->BlockSize);
+            Print(L"  LogicalPartition: %u\n", Media->LogicalPartition);
+            Print(L"  ReadOnly: %u\n", Media->ReadOnly);
+            Print(L"  WriteCaching: %u\n", Media->WriteCaching);
+            Print(L"  Async: %s\n", engine.disk_io2 != NULL ? L"Disk I/O 2" : (engine.block_io2 != NULL ? L"Block I/O 2" : L"None"));
+        }
 
         // Check the media
-        if (!BlockIo->Media->MediaPresent) {
-            Print(L"  No media present.\n");
+        if (!Media->MediaPresent) {
+            if (verbose) {
+                Print(L"  No media present.\n");
+            }
             (*disk_info)[i].gpt_found = 0;
+            read_engine_close(&engine);
             continue;
         }
 
-        
-
         // Put Media into disk_info
-        (*disk_info)[i].Media = *(BlockIo->Media);
-
-        // Read GPT header
-        CHAR8 headerBuffer[512];
-        EFI_PARTITION_TABLE_HEADER *GptHeader;
-        status = uefi_call_wrapper(DiskIo->ReadDisk, 5, DiskIo, BlockIo->Media->MediaId, 1 * BlockIo->Media->BlockSize, sizeof(headerBuffer), headerBuffer);
-        if (EFI_ERROR(status)) {
-            Print(L"  Failed to read GPT header: %r\n", status);
-            continue;
+        (*disk_info)[i].Media = *Media;
+
+        // Read the primary GPT
+        EFI_PARTITION_TABLE_HEADER Header;
+        EFI_PARTITION_TABLE_HEADER *GptHeader = &Header;
+        EFI_PARTITION_ENTRY *Entries;
+        EFI_LBA AlternateLBA = Media->LastBlock;
+        status = read_gpt(&engine, PRIMARY_PART_HEADER_LBA, &Header, &Entries);
+
+        // Fall back to the backup GPT
+        if (EFI_ERROR(status) && status != EFI_NOT_FOUND && status != EFI_OUT_OF_RESOURCES) {
+            if (verbose) {
+                Print(L"  Primary GPT is broken: %r\n", status);
+            }
+            if (status == EFI_CRC_ERROR && Header.AlternateLBA != 0 && Header.AlternateLBA <= Media->LastBlock) {
+                AlternateLBA = Header.AlternateLBA;
+            }
+            status = read_gpt(&engine, AlternateLBA, &Header, &Entries);
+            if (!EFI_ERROR(status) && verbose) {
+                Print(L"  Using the backup GPT at LBA %lu\n", AlternateLBA);
+            }
         }
 
         // Validate GPT header
-        if (!strncmpa(headerBuffer, EFI_PTAB_HEADER_ID, 8) == 0) {
-            Print(L"GPT Header is Not Found \n");
+        if (EFI_ERROR(status)) {
+            if (verbose) {
+                Print(L"GPT Header is Not Found \n");
+            }
             (*disk_info)[i].gpt_found = 0;
+            read_engine_close(&engine);
             continue;
         }
 
-        // Put struct into gpt_header
-        GptHeader = (EFI_PARTITION_TABLE_HEADER *)headerBuffer;
-
         // Put GptHeader into disk_info
         (*disk_info)[i].gpt_found = 1;
         (*disk_info)[i].gpt_header = *GptHeader;
 
-        Print(L"  GPT Header found:\n");
-        Print(L"    Signature :%u", GptHeader->Header.Signature);
-        Print(L"    Revision: %u.%u\n", GptHeader->Header.Revision >> 16, GptHeader->Header.Revision & 0xFFFF);
-        Print(L"    HeaderSize: %u\n", GptHeader->Header.HeaderSize);
-        Print(L"    MyLBA: %lu\n", GptHeader->MyLBA);
-        Print(L"    AlternateLBA: %lu\n", GptHeader->AlternateLBA);
-        Print(L"    FirstUsableLBA: %lu\n", GptHeader->FirstUsableLBA);
-        Print(L"    LastUsableLBA: %lu\n", GptHeader->LastUsableLBA);
-        Print(L"    NumberOfPartitionEntries: %u\n", GptHeader->NumberOfPartitionEntries);
-
-        // Read partition entries
-        UINT8 partitionBuffer[BlockIo->Media->BlockSize];
-        
-        // Allocate partition_entries structure
-        (*disk_info)[i].partition_entries = AllocatePool(GptHeader->NumberOfPartitionEntries * sizeof(EFI_PARTITION_ENTRY));
-
-        // Get the number of partition
-        (*disk_info)[i].no_of_partition = GptHeader->NumberOfPartitionEntries;
+        if (verbose) {
+            Print(L"  GPT Header found:\n");
+            Print(L"    Signature :%u", GptHeader->Header.Signature);
+            Print(L"    Revision: %u.%u\n", GptHeader->Header.Revision >> 16, GptHeader->Header.Revision & 0xFFFF);
+            Print(L"    HeaderSize: %u\n", GptHeader->Header.HeaderSize);
+            Print(L"    MyLBA: %lu\n", GptHeader->MyLBA);
+            Print(L"    AlternateLBA: %lu\n", GptHeader->AlternateLBA);
+            Print(L"    FirstUsableLBA: %lu\n", GptHeader->FirstUsableLBA);
+            Print(L"    LastUsableLBA: %lu\n", GptHeader->LastUsableLBA);
+            Print(L"    NumberOfPartitionEntries: %u\n", GptHeader->NumberOfPartitionEntries);
+        }
 
+        // Put partition entries into disk_info
+        (*disk_info)[i].partition_entries = Entries;
+        (*disk_info)[i].no_of_partition = GptHeader->NumberOfPartitionEntries;
 
         for (UINTN j = 0; j < GptHeader->NumberOfPartitionEntries; j++) {
-            status = uefi_call_wrapper(DiskIo->ReadDisk, 5, DiskIo, BlockIo->Media->MediaId, GptHeader->PartitionEntryLBA * BlockIo->Media->BlockSize + j * sizeof(EFI_PARTITION_ENTRY), sizeof(partitionBuffer), partitionBuffer);
-            if (EFI_ERROR(status)) {
-                Print(L"    Failed to read partition entry: %r\n", status);
-                continue;
-            }
-
-            EFI_PARTITION_ENTRY *PartitionEntry = (EFI_PARTITION_ENTRY *)partitionBuffer;
-            if (PartitionEntry->PartitionTypeGUID.Data1 != 0 || PartitionEntry->PartitionTypeGUID.Data2 != 0 || PartitionEntry->PartitionTypeGUID.Data3 != 0 || PartitionEntry->PartitionTypeGUID.Data4[0] != 0) {
+            EFI_PARTITION_ENTRY *PartitionEntry = &(*disk_info)[i].partition_entries[j];
+            if (verbose && (PartitionEntry->PartitionTypeGUID.Data1 != 0 || PartitionEntry->PartitionTypeGUID.Data2 != 0 || PartitionEntry->PartitionTypeGUID.Data3 != 0 || PartitionEntry->PartitionTypeGUID.Data4[0] != 0)) {
                 Print(L"    Partition %u:\n", j);
                 Print(L"      StartingLBA: %lu\n", PartitionEntry->StartingLBA);
                 Print(L"      EndingLBA: %lu\n", PartitionEntry->EndingLBA);
                 Print(L"      PartitionName: %s\n", PartitionEntry->PartitionName);
             }
-
-            (*disk_info)[i].partition_entries[j] = *PartitionEntry;
         }
+
+        // Close the engine
+        read_engine_close(&engine);
     }
 
     // Free the handle buffer
     FreePool(handleBuffer);
 }
 
+// Parse a GUID in the registry format (XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX)
+// 最初の3つのフィールドはリトルエンディアンで格納される
+BOOLEAN guid_parse(const char *text, EFI_GUID *guid) {
+
+    UINT8 bytes[16];
+    UINTN n = 0;
+
+    for (UINTN i = 0; i < 36; i++) {
+        char c = text[i];
+        UINT8 v;
+
+        if (i == 8 || i == 13 || i == 18 || i == 23) {
+            if (c != '-') {
+                return FALSE;
+            }
+            continue;
+        }
+
+        if (c >= '0' && c <= '9') {
+            v = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            v = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            v = c - 'A' + 10;
+        } else {
+            return FALSE;
+        }
+
+        bytes[n / 2] = (n % 2 == 0) ? v << 4 : bytes[n / 2] | v;
+        n++;
+    }
+    if (text[36] != '\0') {
+        return FALSE;
+    }
+
+    guid->Data1 = ((UINT32)bytes[0] << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+    guid->Data2 = (bytes[4] << 8) | bytes[5];
+    guid->Data3 = (bytes[6] << 8) | bytes[7];
+    mem_copy(guid->Data4, bytes + 8, 8);
+
+    return TRUE;
+}
+
+// Find the GPT partition by its unique GUID
+// The disk is the whole-disk handle and the offset is the byte offset of the partition on it
+EFI_STATUS find_partition(EFI_HANDLE ImageHandle, EFI_GUID *guid, EFI_HANDLE *disk, UINT64 *offset) {
+
+    EFI_STATUS status = EFI_NOT_FOUND;
+    struct disk_info *disks = NULL;
+    UINTN no_of_disks = 0;
+    struct arena_mark mark;
+
+    // ディスクの一覧は探す間だけ使う
+    arena_mark(&mark);
+    list_disks(ImageHandle, &disks, &no_of_disks, FALSE);
+
+    for (UINTN i = 0; i < no_of_disks && status == EFI_NOT_FOUND; i++) {
+
+        // パーティションの子ハンドルにも同じGPTが見えることがある
+        if (!disks[i].gpt_found || disks[i].Media.LogicalPartition) {
+            continue;
+        }
+
+        for (UINTN j = 0; j < disks[i].no_of_partition; j++) {
+            EFI_PARTITION_ENTRY *entry = &disks[i].partition_entries[j];
+            if (CompareGuid(&entry->UniquePartitionGUID, guid) == 0) {
+                *disk = disks[i].handle;
+                *offset = entry->StartingLBA * disks[i].Media.BlockSize;
+                status = EFI_SUCCESS;
+                break;
+            }
+        }
+    }
+    arena_release_to(&mark);
+
+    return status;
+}
+
 // List Bootable Disk
 void list_bootable_disk(struct bootable_disk_info **disk_info, UINTN *no_of_disks) {
     EFI_STATUS status;
@@ -465,9 +284,12 @@ void list_bootable_disk(struct bootable_disk_info **disk_info, UINTN *no_of_disk
 
     // FAT
     EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *fs;
-    EFI_HANDLE *device_handle;
+    EFI_HANDLE device_handle;
     EFI_FILE_PROTOCOL *root;
 
+    *disk_info = NULL;
+    *no_of_disks = 0;
+
     // Get FS Protocols
     status = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol, &gEfiSimpleFileSystemProtocolGuid, NULL, &handle_count, &handle_buffer);
     if (EFI_ERROR(status)) {
@@ -476,9 +298,13 @@ void list_bootable_disk(struct bootable_disk_info **disk_info, UINTN *no_of_disk
     }
 
     // Allocate the srtuct
-    *disk_info = AllocatePool(sizeof(struct bootable_disk_info));
+    *disk_info = ARENA_ARRAY(struct bootable_disk_info, handle_count);
+    if (*disk_info == NULL) {
+        FreePool(handle_buffer);
+        return;
+    }
 
-    *no_of_disks = handle_count;
+    *no_of_disks = 0;
 
     // Iterate over each handle
     for (UINTN i = 0; i < handle_count; i++) {
@@ -488,150 +314,185 @@ void list_bootable_disk(struct bootable_disk_info **disk_info, UINTN *no_of_disk
 
         // Get a Simple FS Protocol
         status = uefi_call_wrapper(BS->HandleProtocol, 3, device_handle, &gEfiSimpleFileSystemProtocolGuid, (VOID **) &fs);
-        ASSERT(!EFI_ERROR(status));
+        if (EFI_ERROR(status)) {
+            continue;
+        }
 
         // Open Root Directory
         status = uefi_call_wrapper(fs->OpenVolume, 2, fs, &root);
-        ASSERT(!EFI_ERROR(status));
+        if (EFI_ERROR(status)) {
+            continue;
+        }
 
         // Put root struct in struct
-        (*disk_info)->root = root;
+        (*disk_info)[*no_of_disks].handle = device_handle;
+        (*disk_info)[*no_of_disks].root = root;
+        *no_of_disks += 1;
     }
 
     // Count devices
-    (*disk_info)->no_of_partition = handle_count;
+    for (UINTN i = 0; i < *no_of_disks; i++) {
+        (*disk_info)[i].no_of_partition = *no_of_disks;
+    }
 
     // Free
     FreePool(handle_buffer);
 
 }
 
-// Init a struct for the menu
-entries_list *init_entries_list() {
+// Build the menu entries from the config in a single allocation
+entries_list *build_entries_list(Config *config) {
 
-    // Allocate the struct
-    entries_list *entries = AllocatePool(sizeof(entries_list));
+    // エントリーがなければグローバルの値だけで1つ作る
+    UINTN no_of_entries = config_entries(config) > 0 ? config_entries(config) : 1;
 
-    // Initallize
-    if (entries != NULL) {
-        entries->entries = NULL;
-        entries->no_of_entries = 0;
-        entries->selected_entry_number = 0;
+    // リストの後ろにエントリーの配列を置く
+    entries_list *list = arena_alloc_array(1, sizeof(entries_list) + no_of_entries * sizeof(entry));
+    if (list == NULL) {
+        return NULL;
+    }
+    list->entries = (entry *)(list + 1);
+    list->no_of_entries = no_of_entries;
+
+    for (UINTN i = 0; i < no_of_entries; i++) {
+        entry *e = &list->entries[i];
+        e->config_entry = config_entries(config) > 0 ? i + 1 : 0;
+
+        // 名前がなければカーネルのパスを表示する
+        e->name = config_entry_value(config, e->config_entry, "name");
+        if (e->name == NULL) {
+            e->name = config_entry_value(config, e->config_entry, "kernel");
+        }
+        if (e->name == NULL) {
+            e->name = "(no name)";
+        }
     }
 
-    return entries;
+    return list;
 
 }
 
-// Add a entry to the struct
-void add_a_entry(CHAR16 *os_name, entries_list **entries) {
+// Lay out the visible window below first_y on a screen of c x r
+EFI_STATUS layout_menu(entries_list *list, UINTN first_y, UINTN c, UINTN r) {
 
-    // Allocate a entry
-    if ((*entries)->no_of_entries == 0) {
-        (*entries)->entries = AllocatePool(sizeof(entry));
-        if ((*entries)->entries == NULL) {
-            return;
-        }
-        (*entries)->no_of_entries = 1;
-    } else {
-        // Reallocate a entry
-        entry *new_entries = ReallocatePool((*entries)->entries, ((*entries)->no_of_entries * sizeof(entry)), ( ((*entries)->no_of_entries + 1) * sizeof(entry)));
-        if (new_entries == NULL) {
-            return;
-        }
-        (*entries)->entries = new_entries;
-        (*entries)->no_of_entries += 1;
+    list->first_y = first_y;
+    list->columns = c;
+
+    // 最後の行はカウントダウンのために空ける
+    list->visible_rows = 1;
+    if (r > MENU_BOTTOM_MARGIN && r - MENU_BOTTOM_MARGIN > first_y) {
+        list->visible_rows = (r - MENU_BOTTOM_MARGIN - first_y - 1) / MENU_ROW_STEP + 1;
+    }
+    if (list->visible_rows > list->no_of_entries) {
+        list->visible_rows = list->no_of_entries;
     }
 
-    // Create a entry
-    BOOLEAN is_selected;
-    UINT32 index = (*entries)->no_of_entries - 1;
-    index == 0 ? (is_selected = TRUE) : (is_selected = FALSE); // デフォルトで0が選択される
-    (*entries)->entries[index].os_name = os_name; // OSの名前
-    (*entries)->entries[index].is_selected = is_selected; // 選択状態
+    // 行は描く時にこのバッファーで作る
+    list->line = ARENA_ARRAY(CHAR16, c + 1);
+    if (list->line == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
 
-    // Return
-    return;
+    // 選択中のエントリーが見えるようにする
+    list->first_visible = 0;
+    if (list->selected >= list->visible_rows) {
+        list->first_visible = list->selected - list->visible_rows + 1;
+    }
+
+    return EFI_SUCCESS;
 
 }
 
 // Print a entry to the menu
-void print_a_entry(CHAR16 *name, UINTN no_of_entries, UINTN *pos_x, UINTN *pos_y, UINTN c, BOOLEAN is_selected) {
-
-    EFI_STATUS status;
-    UINTN length;
+void print_a_entry(entries_list *list, UINTN index) {
 
     // Print Attribute Modes
     UINTN not_selected = EFI_WHITE | EFI_BACKGROUND_BLACK;
     UINTN selected = EFI_BLACK | EFI_BACKGROUND_LIGHTGRAY;
-    UINTN default_font = EFI_LIGHTGRAY | EFI_BLACK;
-
-    // Decide text color and background color
-    UINTN font;
-    is_selected == 0 ? (font = not_selected) : (font = selected);
 
-    // Get length name 
-    length = StrLen(name);
-
-    // Calculate the entry text position
-    *pos_x = (c - length) / 2;
-    *pos_y += 3;
-    if (no_of_entries == 0) {
-        *pos_y += 2;
+    // 見えていなければ描かない
+    if (index < list->first_visible || index >= list->first_visible + list->visible_rows) {
+        return;
     }
 
-    // Set the cursor
-    status = uefi_call_wrapper(ST->ConOut->SetCursorPosition, 3, ST->ConOut, 0, *pos_y);
-    ASSERT(!EFI_ERROR(status));
-
-    // Add spaces around the text
-    name = add_spaces_around_text(name, *pos_x);
-
-    // Set the background color and font color
-    uefi_call_wrapper(ST->ConOut->SetAttribute, 2, ST->ConOut, font);
-    
-    // Print the entry
-    uefi_call_wrapper(ST->ConOut->OutputString, 2, ST->ConOut, name);
+    // 行全体に背景色が付くように両側を埋める (最後の列には書かない)
+    const char *name = list->entries[index].name;
+    UINTN length = my_strlen(name);
+    if (length > list->columns - 1) {
+        length = list->columns - 1;
+    }
+    UINTN num_spaces = (list->columns - 1 - length) / 2;
+    UINTN width = length + 2 * num_spaces;
+    for (UINTN i = 0; i < width; i++) {
+        list->line[i] = ' ';
+    }
+    for (UINTN i = 0; i < length; i++) {
+        list->line[num_spaces + i] = (UINT8)name[i];
+    }
+    list->line[width] = '\0';
 
-    // Back to the default
-    uefi_call_wrapper(ST->ConOut->SetAttribute, 2, ST->ConOut, default_font);
+    // Print the entry with the background color and font color
+    screen_print_at(0, list->first_y + (index - list->first_visible) * MENU_ROW_STEP, index == list->selected ? selected : not_selected, list->line);
 
     // Return
     return;
 
 }
 
+// Print the position when the entries do not fit
+void print_menu_position(entries_list *list) {
 
-// Print entries
-void print_entries(entries_list *entries, UINTN *pos_x, UINTN *pos_y, UINTN c) {
+    CHAR16 text[MENU_LINE_MAX];
+    UINTN length;
 
-    EFI_STATUS status;
+    if (list->visible_rows >= list->no_of_entries) {
+        return;
+    }
+
+    // 前の表示より短くなっても消えるように余白を付ける
+    SPrint(text, sizeof(text), L"   %u / %u   ", list->selected + 1, list->no_of_entries);
+    length = StrLen(text);
+    screen_print_at(length < list->columns ? (list->columns - length) / 2 : 0, list->first_y - 2, EFI_LIGHTGRAY | EFI_BACKGROUND_BLACK, text);
+
+}
+
+// Print the visible entries
+void print_entries(entries_list *list) {
 
     // if entries is NULL, return
-    if (entries == NULL) {
+    if (list == NULL) {
         return;
     }
 
     // Print entries
-    for (UINTN i = 0; i < entries->no_of_entries; i++) {
-        print_a_entry(entries->entries[i].os_name, i, pos_x, pos_y, c, entries->entries[i].is_selected);
+    for (UINTN i = 0; i < list->visible_rows; i++) {
+        print_a_entry(list, list->first_visible + i);
     }
+    print_menu_position(list);
 
 }
 
-// エントリー番号の変更
-void modify_an_entry_order(entries_list *list_entries, UINT32 new_entry_order) {
+// Select an entry, scrolling the window when it is not visible
+// 窓の中で動くなら変わった2行だけ描き直す
+void select_entry(entries_list *list, UINTN index) {
 
-    // Change the order
-    list_entries->selected_entry_number = new_entry_order;
+    UINTN old = list->selected;
 
-    // Change the state
-    for (UINT32 i = 0; i < list_entries->no_of_entries; i++) {
-        if (i == new_entry_order) {
-            list_entries->entries[i].is_selected = TRUE;
-        } else {
-            list_entries->entries[i].is_selected = FALSE;
-        }
+    if (index >= list->no_of_entries || index == old) {
+        return;
+    }
+    list->selected = index;
+
+    if (index < list->first_visible) {
+        list->first_visible = index;
+        print_entries(list);
+    } else if (index >= list->first_visible + list->visible_rows) {
+        list->first_visible = index - list->visible_rows + 1;
+        print_entries(list);
+    } else {
+        print_a_entry(list, old);
+        print_a_entry(list, index);
+        print_menu_position(list);
     }
 
     // Return
@@ -639,105 +500,141 @@ void modify_an_entry_order(entries_list *list_entries, UINT32 new_entry_order) {
 
 }
 
-// Redraw the menu
-void redraw_menu(CHAR16 *title, UINTN c, UINTN r, entries_list *list_entries) {
+// Config entry chosen in the menu (1 if the menu was not opened)
+UINTN menu_entry() {
+    return menu_choice;
+}
 
-    EFI_STATUS status;
-    UINTN pos_x, pos_y;
-    UINTN length;
+// Wait for a key without polling, EFI_TIMEOUT after timeout microseconds
+// 0 only checks a pending key, and WAIT_FOREVER never times out
+EFI_STATUS wait_for_key(EFI_INPUT_KEY *key, UINTN timeout) {
 
-    // Clear the screen
-    uefi_call_wrapper(ST->ConOut->ClearScreen, 1, ST->ConOut);
+    EFI_STATUS status;
+    EFI_EVENT events[2];
+    UINTN no_of_events = 1;
+    UINTN index;
 
-    // Get the title
-    length = StrLen(title);
+    if (timeout == 0) {
+        status = uefi_call_wrapper(ST->ConIn->ReadKeyStroke, 2, ST->ConIn, key);
+        return status == EFI_NOT_READY ? EFI_TIMEOUT : status;
+    }
 
-    // Calculate the title position
-    pos_x = (c - length) / 2;
-    pos_y = r / 8;
+    events[0] = ST->ConIn->WaitForKey;
 
-    // Set the cursor
-    status = uefi_call_wrapper(ST->ConOut->SetCursorPosition, 3, ST->ConOut, pos_x, pos_y);
-    ASSERT(!EFI_ERROR(status));
+    // タイマーも一緒に待つ
+    if (timeout != WAIT_FOREVER) {
+        status = uefi_call_wrapper(BS->CreateEvent, 5, EVT_TIMER, 0, NULL, NULL, &events[1]);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+        status = uefi_call_wrapper(BS->SetTimer, 3, events[1], TimerRelative, (UINT64)timeout * 10); // 100ns単位
+        if (EFI_ERROR(status)) {
+            uefi_call_wrapper(BS->CloseEvent, 1, events[1]);
+            return status;
+        }
+        no_of_events = 2;
+    }
 
-    // Print the title
-    uefi_call_wrapper(ST->ConOut->OutputString, 2, ST->ConOut, title);
+    while (TRUE) {
+        status = uefi_call_wrapper(BS->WaitForEvent, 3, no_of_events, events, &index);
+        if (EFI_ERROR(status)) {
+            break;
+        }
+        if (index == 1) {
+            status = EFI_TIMEOUT;
+            break;
+        }
 
-    // Print entries
-    print_entries(list_entries, &pos_x, &pos_y, c);
+        // キーのイベントだけ来て読めないこともある
+        status = uefi_call_wrapper(ST->ConIn->ReadKeyStroke, 2, ST->ConIn, key);
+        if (status != EFI_NOT_READY) {
+            break;
+        }
+    }
 
-    // Return
-    return;
+    if (no_of_events == 2) {
+        uefi_call_wrapper(BS->CloseEvent, 1, events[1]);
+    }
 
+    return status;
 }
 
 // コマンドの判別
-void determine_command(CHAR16 *buffer) {
+// メニューに戻るならTRUEを返す
+BOOLEAN determine_command(CHAR16 *buffer) {
 
     // コマンドを実行
     if ( StrCmp(buffer, L"help") == 0) {
 
         // Shows help
-        Print(L"\nNEOBOOT Console\nCommands\n  1.help - shows help\n  2.menu - back to menu\n  3.start [number] - start any entry\n  4.version - shows version of neoboot\n  5.memmap - shows memory map\n  6.pcinfo - shows info of your pc\n");
+        screen_print(L"\nNEOBOOT Console\nCommands\n  1.help - shows help\n  2.menu - back to menu\n  3.start [number] - start any entry\n  4.version - shows version of neoboot\n  5.memmap - shows memory map\n  6.pcinfo - shows info of your pc\n");
 
+    } else if (StrCmp(buffer, L"memmap") == 0) {
+        // Shows the memory map
+        print_memmap();
     } else if (StrCmp(buffer, L"menu") == 0 ) {
         // Back to the menu
-        open_menu(NULL);
+        return TRUE;
     } else if (StrCmp(buffer, L"") == 0) {
-        Print(L"\nneoboot >");
-        return;
+        screen_print(L"\nneoboot >");
+        return FALSE;
     } else {
-        Print(L"\nUnknown Command : %s", buffer);
+        screen_print(L"\nUnknown Command : %s", buffer);
     }
 
     // コンソールの表示
-    Print(L"\nneoboot >");
-    return;
+    screen_print(L"\nneoboot >");
+    return FALSE;
 
 }
 
-// Open the console
+// Open the console, it returns to the menu that opened it
 void open_console() {
 
     EFI_STATUS status;
 
     // Clear the screen
-    uefi_call_wrapper(ST->ConOut->ClearScreen, 1, ST->ConOut);
+    screen_clear();
 
     // Print the title
-    Print(L"Welcome to NEOBOOT Console !\n");
+    screen_print(L"Welcome to NEOBOOT Console !\n");
 
     // Print the screen
-    Print(L"neoboot > ");
+    screen_print(L"neoboot > ");
 
     // Buffer
     CHAR16 buffer[100]; // コマンドは100文字以内
     UINT32 buffer_index = 0;
+    BOOLEAN back_to_menu = FALSE;
+    struct arena_mark mark;
 
     // Main Loop
     EFI_INPUT_KEY key;
-    while (TRUE) {
+    while (!back_to_menu) {
 
         // Reauest keytype
-        status = uefi_call_wrapper(ST->ConIn->ReadKeyStroke, 2, ST->ConIn, &key);
+        status = wait_for_key(&key, WAIT_FOREVER);
 
         // Request Commands
         if (!EFI_ERROR(status)) {
-            if (key.UnicodeChar != CHAR_CARRIAGE_RETURN) {
+            if (key.ScanCode == SCAN_ESC) {
+                back_to_menu = TRUE;
+            } else if (key.UnicodeChar == CHAR_CARRIAGE_RETURN) {
 
-                // Save texts and Print
-                Print(L"%c", key.UnicodeChar);
-                buffer[buffer_index] = key.UnicodeChar;
-                buffer_index++;
-                
-            } else if (key.ScanCode == SCAN_ESC) {
-                open_menu(NULL);
-            } else {
-                
                 buffer[buffer_index] = '\0'; // コマンドの終端
                 buffer_index = 0; // バッファーも初めに戻る
 
-                determine_command(buffer); // コマンドの判別
+                // コマンドがアリーナから確保したものは次のコマンドの前に返す
+                arena_mark(&mark);
+                back_to_menu = determine_command(buffer); // コマンドの判別
+                arena_release_to(&mark);
+
+            } else if (key.UnicodeChar != 0 && buffer_index < sizeof(buffer) / sizeof(buffer[0]) - 1) {
+
+                // Save texts and Print (終端の分を残す)
+                screen_print(L"%c", key.UnicodeChar);
+                buffer[buffer_index] = key.UnicodeChar;
+                buffer_index++;
 
             }
         }
@@ -745,78 +642,75 @@ void open_console() {
     }
 }
 
-// Read config file
-VOID *read_config_file(EFI_FILE_PROTOCOL *root) {
-    
-    EFI_FILE_PROTOCOL *config_file;
-    EFI_STATUS status;
-    CHAR16 *file_name = L"\\config.cfg";
-    UINTN buffer_size = 0;
-    VOID *buffer = NULL;
+// Read the config, the binary form is preferred
+EFI_STATUS read_config(EFI_FILE_PROTOCOL *root, file_view *view) {
 
-    // Open the config file
-    status = uefi_call_wrapper(root->Open, 5, root, &config_file, file_name, EFI_FILE_MODE_READ, 0);
+    EFI_STATUS status = map_file(root, CONFIG_BINARY_NAME, CONFIG_FILE_SIZE_MAX, view);
     if (EFI_ERROR(status)) {
-        Print(L"Cannot open the config file\n");
+        status = map_file(root, CONFIG_FILE_NAME, CONFIG_FILE_SIZE_MAX, view);
     }
 
-    // Get the config file size
-    status = uefi_call_wrapper(config_file->GetInfo, 4, config_file, &gEfiFileInfoGuid, &buffer_size, NULL);
-    if (status == EFI_BUFFER_TOO_SMALL) {
-        buffer = AllocatePool(buffer_size);
-        status = uefi_call_wrapper(config_file->GetInfo, 4, config_file, &gEfiFileInfoGuid, &buffer_size, buffer);
-        if (EFI_ERROR(status)) {
-            Print(L"Cannot get the config file size\n");
-        }
-    } else {
-        Print(L"Cannot determine file size\n");
-    }
+    return status;
+}
 
-    // Read the file content
-    buffer_size = ((EFI_FILE_INFO *)buffer)->FileSize;
-    FreePool(buffer);
-    buffer = AllocatePool(buffer_size);
-    status = uefi_call_wrapper(config_file->Read, 3, config_file, &buffer_size, buffer);
-    if (EFI_ERROR(status)) {
-        Print(L"Cannot read the config file\n");
-    }
+// Open the config read by read_config
+// A broken binary config is ignored and the text config is used instead
+Config *open_config(EFI_FILE_PROTOCOL *root, file_view *view) {
 
-    // Add the NULL end
-    CHAR8 *char8_buffer = (CHAR8 *)buffer;
-    char8_buffer[buffer_size] = '\0';
+    Config *config = config_open(view->data, view->size);
 
-    // Close the file
-    uefi_call_wrapper(config_file->Close, 1, config_file);
+    if (config == NULL && config_is_binary(view->data, view->size)) {
+        Print(L"config.bin is broken, using config.cfg\n");
+        unmap_file(view);
+        if (!EFI_ERROR(map_file(root, CONFIG_FILE_NAME, CONFIG_FILE_SIZE_MAX, view))) {
+            config = config_file_parser((char *)view->data);
+        }
+    }
 
-    return buffer;
+    return config;
 }
 
 // Open the menu
-void open_menu(Config *con) {
+EFI_STATUS open_menu(Config *con) {
 
     EFI_STATUS status;
     UINTN c, r;
     UINTN pos_x, pos_y;
     UINTN length;
-    UINT32 selected_index = 0; // デフォルトで0が選択される
     static int count_opened = 0;
     static Config *config = NULL;
+    UINTN remaining = WAIT_FOREVER; // 自動起動までの秒数
+    CHAR16 line[MENU_LINE_MAX] = L"";
 
     // ユーザーがメニューを開いた回数を記録
     count_opened += 1;
     
     // メニューを開いた回数によって動作を変える
-    if (count_opened = 1) {
+    if (count_opened == 1) {
 
         // 1回目にNULLであれば
-        if (con = NULL) {
+        if (con == NULL) {
             Print(L"[FATAL ERROR] Could not open the menu");
-            return;
+            return EFI_INVALID_PARAMETER;
         }
 
         // NULLでなければ
         config = con;
 
+        // 指定があればGOPに直接描く
+        char *renderer = get_config_value(config, "renderer");
+        if (renderer != NULL && strcmpa((CHAR8 *)renderer, (CHAR8 *)"gop") == 0) {
+            status = screen_init(TRUE);
+            if (EFI_ERROR(status)) {
+                Print(L"Cannot use the GOP renderer: %r\n", status);
+            }
+        }
+
+        // 最初に開いた時だけ自動起動する
+        if (!config_number(get_config_value(config, "timeout"), &remaining)) {
+            remaining = WAIT_FOREVER;
+        }
+
     }
 
     // Set the title
@@ -824,51 +718,92 @@ void open_menu(Config *con) {
     length = StrLen(title);
 
     // Clear the screen
-    uefi_call_wrapper(ST->ConOut->ClearScreen, 1, ST->ConOut);
+    screen_clear();
 
     // Get the conosole size
-    status = uefi_call_wrapper(ST->ConOut->QueryMode, 4, ST->ConOut, ST->ConOut->Mode->Mode, &c, &r);
-    ASSERT(!EFI_ERROR(status));
+    screen_size(&c, &r);
 
     // Calculate the title text position
     pos_x = (c - length) / 2;
     pos_y = r / 8;
 
-    // Set the cursor
-    status = uefi_call_wrapper(ST->ConOut->SetCursorPosition, 3, ST->ConOut, pos_x, pos_y);
-    ASSERT(!EFI_ERROR(status));
-    
     // Print the title
-    uefi_call_wrapper(ST->ConOut->OutputString, 2, ST->ConOut, title);
+    screen_print_at(pos_x, pos_y, EFI_LIGHTGRAY | EFI_BACKGROUND_BLACK, title);
 
     // Create entries list
     entries_list *list_entries;
 
-    // Init entries list
-    list_entries = init_entries_list();
+    // メニューを閉じる時にリストと行をまとめて返す
+    struct arena_mark mark;
+    arena_mark(&mark);
 
-    // Add entries
-    add_a_entry(L"OS 1", &list_entries);
-    add_a_entry(L"OS 2", &list_entries);
-    add_a_entry(L"OS 3", &list_entries);
-    add_a_entry(L"OS 4", &list_entries);
+    // Build entries list
+    list_entries = build_entries_list(config);
+    if (list_entries == NULL) {
+        arena_release_to(&mark);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    // タイトルの下に見えるだけ並べる
+    status = layout_menu(list_entries, pos_y + 5, c, r);
+    if (EFI_ERROR(status)) {
+        arena_release_to(&mark);
+        return status;
+    }
 
     // Print entries
-    print_entries(list_entries, &pos_x, &pos_y, c);
+    print_entries(list_entries);
 
     // Main Loop 
     EFI_INPUT_KEY key;
     while (TRUE) {
-        status = uefi_call_wrapper(ST->ConIn->ReadKeyStroke, 2, ST->ConIn, &key);
+
+        if (remaining == WAIT_FOREVER) {
+            status = wait_for_key(&key, WAIT_FOREVER);
+        } else {
+
+            // カウントダウンを表示
+            if (remaining > 0) {
+                SPrint(line, sizeof(line), L"Booting the default entry in %u s, press any key to stop", remaining);
+                screen_print_at((c - StrLen(line)) / 2, r - 2, EFI_LIGHTGRAY | EFI_BACKGROUND_BLACK, line);
+            }
+
+            // 1秒ずつ待つ
+            status = wait_for_key(&key, remaining > 0 ? 1000000 : 0);
+            if (status == EFI_TIMEOUT) {
+                if (remaining == 0) {
+                    menu_choice = list_entries->entries[list_entries->selected].config_entry;
+                    arena_release_to(&mark);
+                    return EFI_SUCCESS; // デフォルトのエントリーを起動
+                }
+                remaining -= 1;
+                continue;
+            }
+
+            // キーが押されたらカウントダウンをやめる
+            remaining = WAIT_FOREVER;
+            for (UINTN i = 0; line[i] != '\0'; i++) {
+                line[i] = ' ';
+            }
+            screen_print_at((c - StrLen(line)) / 2, r - 2, EFI_LIGHTGRAY | EFI_BACKGROUND_BLACK, line);
+        }
+
         if (!EFI_ERROR(status)) {
             if (key.UnicodeChar != 0) {
                 switch (key.UnicodeChar) {
                     case CHAR_CARRIAGE_RETURN: // Enterキー
-                        redraw_menu(title, c, r, list_entries);
-                        break;
+                        menu_choice = list_entries->entries[list_entries->selected].config_entry;
+                        arena_release_to(&mark);
+                        return EFI_SUCCESS; // 選択されたエントリーを起動
                     case 'c':
                     case 'C':
                         open_console();
+
+                        // コンソールから戻ったらタイトルとリストを描き直す
+                        screen_clear();
+                        screen_print_at(pos_x, pos_y, EFI_LIGHTGRAY | EFI_BACKGROUND_BLACK, title);
+                        print_entries(list_entries);
+                        break;
                     default:
                         break;
                 }
@@ -877,37 +812,34 @@ void open_menu(Config *con) {
                     case SCAN_UP:
 
                         // 0は上に行けないし、再描画する必要もない
-                        if (selected_index  == 0) {
-                            break;
+                        if (list_entries->selected > 0) {
+                            select_entry(list_entries, list_entries->selected - 1);
                         }
-
-                        // Indexの変更
-                        selected_index = selected_index - 1;
-
-                        // 表示順を変更
-                        modify_an_entry_order(list_entries, selected_index);
-
-                        // 再描画
-                        redraw_menu(title, c, r, list_entries);
                         break;
                     case SCAN_DOWN:
 
-                        // 合計数より下には行けないし、再描画する必要もない
-                        if (selected_index  == list_entries->no_of_entries - 1) {
-                            break;
-                        }
-
-                        // Indexの変更
-                        selected_index = selected_index + 1;
+                        // 合計数より下には行けない
+                        select_entry(list_entries, list_entries->selected + 1);
+                        break;
+                    case SCAN_PAGE_UP:
 
-                        // 表示順を変更
-                        modify_an_entry_order(list_entries, selected_index);
+                        // 1画面分上へ
+                        select_entry(list_entries, list_entries->selected > list_entries->visible_rows ? list_entries->selected - list_entries->visible_rows : 0);
+                        break;
+                    case SCAN_PAGE_DOWN:
 
-                        // 再描画
-                        redraw_menu(title, c, r, list_entries);
+                        // 1画面分下へ
+                        select_entry(list_entries, list_entries->selected + list_entries->visible_rows < list_entries->no_of_entries ? list_entries->selected + list_entries->visible_rows : list_entries->no_of_entries - 1);
+                        break;
+                    case SCAN_HOME:
+                        select_entry(list_entries, 0);
+                        break;
+                    case SCAN_END:
+                        select_entry(list_entries, list_entries->no_of_entries - 1);
                         break;
                     case SCAN_ESC:
-                        return; // BIOSに戻る
+                        arena_release_to(&mark);
+                        return EFI_ABORTED; // BIOSに戻る
                     default:
                         break;
                 }
@@ -921,14 +853,19 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
     EFI_STATUS status;
     InitializeLib(ImageHandle, SystemTable);
 
+    // Choose the memory primitives for this CPU
+    mem_init();
+
     // Unlock the watch dog timer
     uefi_call_wrapper(BS->SetWatchdogTimer, 4, 0, 0, 0, NULL);
 
-    // Start timer
-    EFI_TIME start_time;
-    EFI_TIME end_time;
-    uefi_call_wrapper(RT->GetTime, 2, &start_time, NULL);
-    Print(L"Start Time: %d:%d:%d\n", start_time.Hour, start_time.Minute, start_time.Second);
+    // Start the tracer
+    trace_init();
+    trace_begin(TRACE_BOOT);
+
+    // Start the job scheduler on all cores
+    scheduler_init();
+    Print(L"CPUs: %u\n", scheduler_workers());
 
     // Open LIP
     EFI_LOADED_IMAGE_PROTOCOL *lip = NULL;
@@ -945,73 +882,242 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable
     ASSERT(map.buffer != NULL);
 
     // Save memory map
-    EFI_FILE_PROTOCOL *memmap_file = NULL;
-    save_memmap(&map, memmap_file, esp_root);
-
-    // Get pointers of bootable disks
-    struct bootable_disk_info *bootable_disks;
-    UINTN no_of_bootable_disks;
-    list_bootable_disk(&bootable_disks, &no_of_bootable_disks);
-
-    // Get info of bootable disks
-    UINTN buffer_size = 0;
-    EFI_FILE_SYSTEM_INFO *fs_info;
-    char *config_txt;
-    for (UINTN i = 0; i < no_of_bootable_disks; i++) {
-        status = uefi_call_wrapper(bootable_disks[i].root->GetInfo, 4, bootable_disks[i].root, &gEfiFileSystemInfoGuid, &buffer_size, NULL);
-        if (status == EFI_BUFFER_TOO_SMALL) {
-
-            fs_info = AllocateZeroPool(buffer_size);
-            if (fs_info == NULL) {
-                Print(L"Unknown Error Buffer cannot be allocated\n");
-                while(1);
+    trace_begin(TRACE_MEMMAP);
+    save_memmap(&map, esp_root);
+    trace_end(TRACE_MEMMAP);
+
+    // Try the volume of the last boot first
+    EFI_HANDLE config_handle = NULL;
+    EFI_FILE_PROTOCOL *config_root = NULL;
+    EFI_DEVICE_PATH *cached_path;
+    UINT32 cached_digest;
+    BOOLEAN fast_boot = FALSE;
+    file_view config_file = { NULL, 0, 0 };
+    Config *config = NULL;
+    trace_begin(TRACE_CONFIG_DISCOVERY);
+    if (!EFI_ERROR(boot_cache_load(&cached_path, &cached_digest))) {
+        if (!EFI_ERROR(boot_cache_open(cached_path, &config_handle, &config_root))) {
+            if (!EFI_ERROR(read_config(config_root, &config_file))) {
+                trace_begin(TRACE_CONFIG_PARSE);
+                config = open_config(config_root, &config_file);
+                trace_end(TRACE_CONFIG_PARSE);
+
+                // コンフィグが変わっていれば全てのボリュームを探し直す
+                fast_boot = config != NULL && config_digest(config) == cached_digest;
             }
+            if (!fast_boot) {
+                if (config != NULL) {
+                    free_config(config);
+                    config = NULL;
+                }
+                unmap_file(&config_file);
+                uefi_call_wrapper(config_root->Close, 1, config_root);
+            }
+        }
+        FreePool(cached_path);
+    }
+
+    if (!fast_boot) {
+
+        // Get pointers of bootable disks
+        struct bootable_disk_info *bootable_disks;
+        UINTN no_of_bootable_disks;
+        trace_begin(TRACE_DISK_ENUMERATION);
+        list_bootable_disk(&bootable_disks, &no_of_bootable_disks);
+        trace_end(TRACE_DISK_ENUMERATION);
 
-            status = uefi_call_wrapper(bootable_disks[i].root->GetInfo, 4, bootable_disks[i].root, &gEfiFileSystemInfoGuid, &buffer_size, fs_info);
-            config_txt = read_config_file(bootable_disks[i].root);
+        // Look for the config file on all volumes at once
+        UINTN config_index;
+        status = probe_volumes(bootable_disks, no_of_bootable_disks, lip->DeviceHandle, &config_index, &config_file);
+        if (EFI_ERROR(status)) {
+            Print(L"Config file is not found\n");
+            return EFI_NOT_FOUND;
+        }
+        config_handle = bootable_disks[config_index].handle;
+        config_root = bootable_disks[config_index].root;
+
+        // Parse the config file
+        trace_begin(TRACE_CONFIG_PARSE);
+        config = open_config(config_root, &config_file);
+        trace_end(TRACE_CONFIG_PARSE);
+        if (config == NULL) {
+            Print(L"Cannot parse the config file\n");
+            return EFI_OUT_OF_RESOURCES;
+        }
+
+        // 次回はこのボリュームから直接起動する
+        status = boot_cache_save(config_handle, config_digest(config));
+        if (EFI_ERROR(status)) {
+            Print(L"Cannot save the boot cache: %r\n", status);
+        }
+    }
+    trace_end(TRACE_CONFIG_DISCOVERY);
+
+    // カーネルとイメージもこのボリュームから読む
+    file_io_configure(config_handle);
+
+    // reader=nativeならファームウェアのドライバーを通さずにFATを読む
+    EFI_FILE_PROTOCOL *payload_root = config_root;
+    char *reader = get_config_value(config, "reader");
+    if (reader != NULL && strcmpa((CHAR8 *)reader, (CHAR8 *)"native") == 0) {
+        status = fat_mount(config_handle, ImageHandle, &payload_root);
+        if (EFI_ERROR(status)) {
+            Print(L"Cannot use the native FAT reader: %r\n", status);
+            payload_root = config_root;
+        }
+    }
+
+    Print(L"\nKey, Value\n");
+    for (UINTN i = 0; i < config->no_of_pairs; i++) {
+        Print(L"%a, %a\n", config_key(config, i), config_value(config, i));
+    }
+
+    // Dump the memory map as text if requested
+    char *memmap_format = get_config_value(config, "memmap");
+    if (memmap_format != NULL && strcmpa((CHAR8 *)memmap_format, (CHAR8 *)"text") == 0) {
+        dump_memmap(&map, esp_root);
+    }
+
+    trace_begin(TRACE_MENU);
+    if (fast_boot) {
+
+        // キーが押されていればメニューを開く
+        EFI_INPUT_KEY key;
+        if (!EFI_ERROR(wait_for_key(&key, 0))) {
+            status = open_menu(config);
+        } else {
+            status = EFI_SUCCESS; // デフォルトのエントリーを起動
+        }
+
+    } else {
+
+        // Open a menu, it boots the default entry after timeout= seconds
+        status = open_menu(config);
+    }
+    trace_end(TRACE_MENU);
+
+    // Values of the selected entry
+    UINTN selected = menu_entry();
+
+    // Digests of the selected entry, a broken digest must not boot
+    UINT8 kernel_digest[SHA256_DIGEST_SIZE];
+    UINT8 image_digest[SHA256_DIGEST_SIZE];
+    char *kernel_sha256 = config_entry_value(config, selected, "sha256");
+    char *image_sha256 = config_entry_value(config, selected, "image_sha256");
+    if (kernel_sha256 != NULL && !sha256_parse(kernel_sha256, kernel_digest)) {
+        Print(L"sha256= is not a SHA-256 digest\n");
+        status = EFI_INVALID_PARAMETER;
+    }
+    if (image_sha256 != NULL && !sha256_parse(image_sha256, image_digest)) {
+        Print(L"image_sha256= is not a SHA-256 digest\n");
+        status = EFI_INVALID_PARAMETER;
+    }
+    if (kernel_sha256 != NULL || image_sha256 != NULL) {
+        Print(L"SHA-256: %s\n", sha256_implementation());
+    }
+
+    // root=があればカーネルとイメージをそのGPTパーティションのext4から読む
+    char *root_guid = config_entry_value(config, selected, "root");
+    if (!EFI_ERROR(status) && root_guid != NULL) {
+        EFI_GUID partition_guid;
+        EFI_HANDLE root_disk;
+        UINT64 root_offset;
+
+        if (!guid_parse(root_guid, &partition_guid)) {
+            Print(L"root= is not a partition GUID\n");
+            status = EFI_INVALID_PARAMETER;
+        } else {
+            status = find_partition(ImageHandle, &partition_guid, &root_disk, &root_offset);
+            if (!EFI_ERROR(status)) {
+                status = ext4_mount(root_disk, root_offset, ImageHandle, &payload_root);
+            }
             if (EFI_ERROR(status)) {
-                Print(L"Error cannnot get disk info\n");
-                while(1);
+                Print(L"Cannot mount the root partition %a: %r\n", root_guid, status);
             }
         }
     }
 
-    // Parse the config file
-    Config *config = config_file_parser(config_txt);
+    // Load the kernel of the selected entry
+    kernel_image kernel;
+    char *kernel_path = config_entry_value(config, selected, "kernel");
+    if (!EFI_ERROR(status) && kernel_path != NULL) {
+        CHAR16 *efi_kernel_path = to_efi_path(kernel_path);
+        trace_begin(TRACE_KERNEL_LOAD);
+        status = load_kernel(payload_root, efi_kernel_path, kernel_sha256 != NULL ? kernel_digest : NULL, &kernel);
+
+        // ネイティブのFATリーダーで読めなければファームウェアのドライバーで読み直す (ハッシュの不一致はやり直さない)
+        // ext4は別のパーティションなので読み直さない
+        if (EFI_ERROR(status) && status != EFI_SECURITY_VIOLATION && fat_is_native(payload_root)) {
+            Print(L"Native FAT reader failed: %r, using the firmware driver\n", status);
+            payload_root = config_root;
+            status = load_kernel(payload_root, efi_kernel_path, kernel_sha256 != NULL ? kernel_digest : NULL, &kernel);
+        }
+        trace_end(TRACE_KERNEL_LOAD);
+        if (!EFI_ERROR(status)) {
+            Print(L"\nKernel: 0x%lx - 0x%lx Entry: 0x%lx\n", kernel.base, kernel.end, kernel.entry);
+        }
+        FreePool(efi_kernel_path);
+    }
 
-    Print(L"\nKey, Value\n");
-    for (int i = 0; i < config->num_keys; i++) {
-        Print(L"%a, %a\n", config->keys[i], config->values[i]);
+    // Load the image
+    payload image;
+    BOOLEAN image_loaded = FALSE;
+    char *image_path = config_entry_value(config, selected, "image");
+    if (!EFI_ERROR(status) && image_path != NULL && strcmpa((CHAR8 *)image_path, (CHAR8 *)"none") != 0) {
+        CHAR16 *efi_image_path = to_efi_path(image_path);
+        trace_begin(TRACE_IMAGE_LOAD);
+        status = load_payload(payload_root, efi_image_path, image_sha256 != NULL ? image_digest : NULL, &image);
+        if (EFI_ERROR(status) && status != EFI_SECURITY_VIOLATION && fat_is_native(payload_root)) {
+            Print(L"Native FAT reader failed: %r, using the firmware driver\n", status);
+            payload_root = config_root;
+            status = load_payload(payload_root, efi_image_path, image_sha256 != NULL ? image_digest : NULL, &image);
+        }
+        trace_end(TRACE_IMAGE_LOAD);
+        if (!EFI_ERROR(status)) {
+            Print(L"Image: 0x%lx Size: %lu\n", image.base, image.size);
+            image_loaded = TRUE;
+        }
+        FreePool(efi_image_path);
     }
 
+    // Arena usage
+    UINTN arena_no_of_pages, arena_no_of_allocations;
+    arena_stats(&arena_no_of_pages, &arena_no_of_allocations);
+    Print(L"Arena: %u allocations in %u pages\n", arena_no_of_allocations, arena_no_of_pages);
 
-    // Stall
-    uefi_call_wrapper(BS->Stall, 1, 10000000);
+    // Hand off to the kernel
+    trace_begin(TRACE_HANDOFF);
 
-    // Open a menu
-    open_menu(config);
+    // アリーナを返す前にカーネルに渡すものを1つのブロックにまとめる
+    struct boot_info *info = NULL;
+    if (!EFI_ERROR(status) && kernel_path != NULL) {
+        status = boot_info_create(&kernel, image_loaded ? &image : NULL, config_entry_value(config, selected, "flags"), &info);
+        if (EFI_ERROR(status)) {
+            Print(L"Cannot prepare the handoff: %r\n", status);
+        }
+    }
 
     // Free up memory
     FreePool(map.buffer);
 
-    // End timer
-    uefi_call_wrapper(RT->GetTime, 2, &end_time, NULL);
-    UINTN end_time_second = 0;
- 
-    // 分が違う場合
-    end_time_second += (end_time.Minute - start_time.Minute) * 60;
+    // ローダーの小さな割り当てはExitBootServicesの前に一度で返す
+    arena_release();
 
-    // 秒を追加
-    end_time_second += end_time.Second - start_time.Second;
+    trace_end(TRACE_HANDOFF);
+    trace_end(TRACE_BOOT);
 
-    // Print
-    Print(L"\nBoot Time: %us \n", end_time_second);
+    // Print and save the trace
+    trace_print();
+    trace_save(esp_root);
 
     // All Done
     Print(L"All Done!\n");
 
-    // Wait for a minute
-    uefi_call_wrapper(BS->Stall, 1, 5000000);
+    // 成功すれば戻らない
+    // 失敗した後はファームウェアのサービスが使えるとは限らないので何も表示しない
+    if (info != NULL) {
+        return handoff(ImageHandle, info);
+    }
 
     return EFI_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,160 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "memory.h"
+#include "proto.h"
+
+// Sort the descriptors by address and merge adjacent regions of the same type
+EFI_STATUS memmap_compact(memmap *map, struct memmap_entry **entries, UINTN *no_of_entries) {
+
+    struct memmap_entry *e;
+    UINTN count = 0;
+
+    e = AllocatePool(sizeof(struct memmap_entry) * (map->entry + 1));
+    if (e == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    // ほとんどのファームウェアは既に並んでいるので挿入ソートで十分
+    for (UINTN i = 0; i < map->entry; i++) {
+        EFI_MEMORY_DESCRIPTOR *desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)map->buffer + map->desc_size * i);
+        UINTN j = i;
+
+        while (j > 0 && e[j - 1].base > desc->PhysicalStart) {
+            e[j] = e[j - 1];
+            j--;
+        }
+
+        e[j].base = desc->PhysicalStart;
+        e[j].no_of_pages = desc->NumberOfPages;
+        e[j].attribute = desc->Attribute;
+        e[j].type = desc->Type;
+        e[j].reserved = 0;
+    }
+
+    // Coalesce
+    for (UINTN i = 0; i < map->entry; i++) {
+        if (count > 0) {
+            struct memmap_entry *last = &e[count - 1];
+            if (last->type == e[i].type && last->attribute == e[i].attribute && last->base + last->no_of_pages * EFI_PAGE_SIZE == e[i].base) {
+                last->no_of_pages += e[i].no_of_pages;
+                continue;
+            }
+        }
+        e[count++] = e[i];
+    }
+
+    *entries = e;
+    *no_of_entries = count;
+
+    return EFI_SUCCESS;
+}
+
+// Save the memory map in the binary format with a single write
+EFI_STATUS save_memmap(memmap *map, EFI_FILE_PROTOCOL *esp_root) {
+
+    EFI_STATUS status;
+    struct memmap_entry *entries;
+    struct memmap_file_header *header;
+    UINTN count, size;
+
+    status = memmap_compact(map, &entries, &count);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    // ヘッダーとエントリーを1つのバッファーにまとめる
+    size = sizeof(struct memmap_file_header) + sizeof(struct memmap_entry) * count;
+    header = AllocatePool(size);
+    if (header == NULL) {
+        FreePool(entries);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    header->magic = MEMMAP_MAGIC;
+    header->version = MEMMAP_VERSION;
+    header->entry_size = sizeof(struct memmap_entry);
+    header->no_of_entries = count;
+    header->reserved = 0;
+    CopyMem(header + 1, entries, sizeof(struct memmap_entry) * count);
+
+    status = write_file(esp_root, L"\\memmap", header, size);
+
+    FreePool(header);
+    FreePool(entries);
+
+    return status;
+}
+
+// Format one entry as a line of text
+static UINTN format_memmap_entry(CHAR8 *buffer, UINTN index, struct memmap_entry *entry) {
+    return AsciiSPrint(buffer, MEMMAP_LINE_SIZE, "| %03u | %016lx | %016lx | %10lu | %02x %-22ls | %016lx |\n", index, entry->base, entry->base + entry->no_of_pages * EFI_PAGE_SIZE - 1, entry->no_of_pages, entry->type, get_memtype(entry->type), entry->attribute);
+}
+
+// Write the memory map as text to \memmap.txt with a single write
+EFI_STATUS dump_memmap(memmap *map, EFI_FILE_PROTOCOL *esp_root) {
+
+    EFI_STATUS status;
+    struct memmap_entry *entries;
+    CHAR8 *text;
+    UINTN count, size;
+
+    CHAR8 *header = "| Idx | Start            | End              | Pages      | Type                      | Attribute        |\n"
+                    "|-----|------------------|------------------|------------|---------------------------|------------------|\n";
+
+    status = memmap_compact(map, &entries, &count);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    text = AllocatePool(strlena(header) + MEMMAP_LINE_SIZE * count + 1);
+    if (text == NULL) {
+        FreePool(entries);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    // 全ての行をバッファーに書いてから一度に書き込む
+    size = strlena(header);
+    CopyMem(text, header, size);
+    for (UINTN i = 0; i < count; i++) {
+        size += format_memmap_entry(text + size, i, &entries[i]);
+    }
+
+    status = write_file(esp_root, L"\\memmap.txt", text, size);
+
+    FreePool(text);
+    FreePool(entries);
+
+    return status;
+}
+
+// Print the current memory map on the console
+void print_memmap() {
+
+    memmap map;
+    struct memmap_entry *entries;
+    CHAR8 line[MEMMAP_LINE_SIZE];
+    UINTN count;
+
+    map.buffer = LibMemoryMap(&map.entry, &map.map_key, &map.desc_size, &map.desc_ver);
+    if (map.buffer == NULL) {
+        screen_print(L"\nCannot get the memory map");
+        return;
+    }
+
+    if (EFI_ERROR(memmap_compact(&map, &entries, &count))) {
+        FreePool(map.buffer);
+        return;
+    }
+
+    screen_print(L"\n");
+    for (UINTN i = 0; i < count; i++) {
+        format_memmap_entry(line, i, &entries[i]);
+        screen_print(L"%a", line);
+    }
+
+    FreePool(entries);
+    FreePool(map.buffer);
+}
@@ -0,0 +1,378 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// SIMD
+#include <immintrin.h>
+
+// NEOBOOT
+#include "memops.h"
+#include "cpu.h"
+#ifdef NEOBOOT_HOST
+#include "host.h" // tools/でホスト向けにビルドする場合
+#else
+#include "proto.h"
+#endif
+
+// ローダーは最適化なしでビルドされるので、このファイルだけ最適化する
+// ファイルは1つにまとめてコンパイルされるので、最後に元に戻す
+#pragma GCC push_options
+#pragma GCC optimize("O2")
+
+// 各バイトが0かどうか (一番下の立ったビットは正しい)
+#define MEM_ONES 0x0101010101010101ULL
+#define MEM_HIGHS 0x8080808080808080ULL
+#define MEM_HAS_ZERO(v) (((v) - MEM_ONES) & ~(v) & MEM_HIGHS)
+
+// Word at a time
+
+static void mem_copy_word(VOID *dst, const VOID *src, UINTN size) {
+
+    UINT8 *d = dst;
+    const UINT8 *s = src;
+
+    // dstを8バイト境界に揃える
+    while (size > 0 && ((UINTN)d & 7) != 0) {
+        *d++ = *s++;
+        size--;
+    }
+
+    for (; size >= 8; size -= 8, d += 8, s += 8) {
+        *(mem_word *)d = *(const mem_word *)s;
+    }
+
+    while (size-- > 0) {
+        *d++ = *s++;
+    }
+}
+
+static void mem_zero_word(VOID *dst, UINTN size) {
+
+    UINT8 *d = dst;
+
+    while (size > 0 && ((UINTN)d & 7) != 0) {
+        *d++ = 0;
+        size--;
+    }
+
+    for (; size >= 8; size -= 8, d += 8) {
+        *(mem_word *)d = 0;
+    }
+
+    while (size-- > 0) {
+        *d++ = 0;
+    }
+}
+
+MEM_NO_SANITIZE
+static UINTN mem_span_word(const char *s, const char *stops) {
+
+    UINT64 patterns[MEM_SPAN_MAX];
+    UINTN n = 0;
+    const char *p = s;
+
+    for (; n < MEM_SPAN_MAX && stops[n] != '\0'; n++) {
+        patterns[n] = MEM_ONES * (UINT8)stops[n];
+    }
+
+    // 8バイト境界までは1バイトずつ
+    for (; ((UINTN)p & 7) != 0; p++) {
+        if (*p == '\0') {
+            return p - s;
+        }
+        for (UINTN i = 0; i < n; i++) {
+            if (*p == stops[i]) {
+                return p - s;
+            }
+        }
+    }
+
+    while (TRUE) {
+        UINT64 w = *(const mem_word *)p;
+        UINT64 hit = MEM_HAS_ZERO(w);
+        for (UINTN i = 0; i < n; i++) {
+            hit |= MEM_HAS_ZERO(w ^ patterns[i]);
+        }
+        if (hit != 0) {
+            return p - s + (__builtin_ctzll(hit) >> 3);
+        }
+        p += 8;
+    }
+}
+
+// SSE2
+// x86_64では常に使える
+
+__attribute__((target("sse2")))
+static void mem_copy_sse2(VOID *dst, const VOID *src, UINTN size) {
+
+    UINT8 *d = dst;
+    const UINT8 *s = src;
+    UINTN head;
+
+    if (size < MEM_VECTOR_MIN) {
+        mem_copy_word(dst, src, size);
+        return;
+    }
+
+    // 先頭の16バイトを書いてdstを16バイト境界に揃える
+    head = 16 - ((UINTN)d & 15);
+    _mm_storeu_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+    d += head;
+    s += head;
+    size -= head;
+
+    if (size >= MEM_NONTEMPORAL_MIN) {
+        for (; size >= 64; size -= 64, d += 64, s += 64) {
+            _mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+            _mm_stream_si128((__m128i *)(d + 16), _mm_loadu_si128((const __m128i *)(s + 16)));
+            _mm_stream_si128((__m128i *)(d + 32), _mm_loadu_si128((const __m128i *)(s + 32)));
+            _mm_stream_si128((__m128i *)(d + 48), _mm_loadu_si128((const __m128i *)(s + 48)));
+        }
+        _mm_sfence();
+    }
+
+    for (; size >= 64; size -= 64, d += 64, s += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)s);
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+        _mm_store_si128((__m128i *)d, a);
+        _mm_store_si128((__m128i *)(d + 16), b);
+        _mm_store_si128((__m128i *)(d + 32), c);
+        _mm_store_si128((__m128i *)(d + 48), e);
+    }
+    for (; size >= 16; size -= 16, d += 16, s += 16) {
+        _mm_store_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+    }
+
+    // 残りは最後の16バイトを重ねて書く
+    if (size > 0) {
+        _mm_storeu_si128((__m128i *)(d + size - 16), _mm_loadu_si128((const __m128i *)(s + size - 16)));
+    }
+}
+
+__attribute__((target("sse2")))
+static void mem_zero_sse2(VOID *dst, UINTN size) {
+
+    UINT8 *d = dst;
+    UINTN head;
+    const __m128i zero = _mm_setzero_si128();
+
+    if (size < MEM_VECTOR_MIN) {
+        mem_zero_word(dst, size);
+        return;
+    }
+
+    head = 16 - ((UINTN)d & 15);
+    _mm_storeu_si128((__m128i *)d, zero);
+    d += head;
+    size -= head;
+
+    if (size >= MEM_NONTEMPORAL_MIN) {
+        for (; size >= 64; size -= 64, d += 64) {
+            _mm_stream_si128((__m128i *)d, zero);
+            _mm_stream_si128((__m128i *)(d + 16), zero);
+            _mm_stream_si128((__m128i *)(d + 32), zero);
+            _mm_stream_si128((__m128i *)(d + 48), zero);
+        }
+        _mm_sfence();
+    }
+
+    for (; size >= 64; size -= 64, d += 64) {
+        _mm_store_si128((__m128i *)d, zero);
+        _mm_store_si128((__m128i *)(d + 16), zero);
+        _mm_store_si128((__m128i *)(d + 32), zero);
+        _mm_store_si128((__m128i *)(d + 48), zero);
+    }
+    for (; size >= 16; size -= 16, d += 16) {
+        _mm_store_si128((__m128i *)d, zero);
+    }
+    if (size > 0) {
+        _mm_storeu_si128((__m128i *)(d + size - 16), zero);
+    }
+}
+
+// 16バイトの中で止まる文字の位置のビット
+__attribute__((target("sse2")))
+static inline UINT32 mem_match_sse2(__m128i v, const __m128i *patterns, UINTN n) {
+
+    __m128i hit = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+
+    for (UINTN i = 0; i < n; i++) {
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, patterns[i]));
+    }
+
+    return (UINT32)_mm_movemask_epi8(hit);
+}
+
+// 16バイト境界から読むので、ページをまたいで読むことはない
+MEM_NO_SANITIZE __attribute__((target("sse2")))
+static UINTN mem_span_sse2(const char *s, const char *stops) {
+
+    __m128i patterns[MEM_SPAN_MAX];
+    UINTN n = 0;
+    UINTN offset = (UINTN)s & 15;
+    const __m128i *p = (const __m128i *)(s - offset);
+    UINT32 mask;
+
+    for (; n < MEM_SPAN_MAX && stops[n] != '\0'; n++) {
+        patterns[n] = _mm_set1_epi8(stops[n]);
+    }
+
+    // 先頭のブロックはsより前を除く
+    mask = mem_match_sse2(_mm_load_si128(p), patterns, n) >> offset;
+    if (mask != 0) {
+        return __builtin_ctz(mask);
+    }
+
+    while (TRUE) {
+        p++;
+        mask = mem_match_sse2(_mm_load_si128(p), patterns, n);
+        if (mask != 0) {
+            return (const char *)p - s + __builtin_ctz(mask);
+        }
+    }
+}
+
+// AVX2
+
+__attribute__((target("avx2")))
+static void mem_copy_avx2(VOID *dst, const VOID *src, UINTN size) {
+
+    UINT8 *d = dst;
+    const UINT8 *s = src;
+    UINTN head;
+
+    if (size < 2 * MEM_VECTOR_MIN) {
+        mem_copy_sse2(dst, src, size);
+        return;
+    }
+
+    head = 32 - ((UINTN)d & 31);
+    _mm256_storeu_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+    d += head;
+    s += head;
+    size -= head;
+
+    if (size >= MEM_NONTEMPORAL_MIN) {
+        for (; size >= 128; size -= 128, d += 128, s += 128) {
+            _mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+            _mm256_stream_si256((__m256i *)(d + 32), _mm256_loadu_si256((const __m256i *)(s + 32)));
+            _mm256_stream_si256((__m256i *)(d + 64), _mm256_loadu_si256((const __m256i *)(s + 64)));
+            _mm256_stream_si256((__m256i *)(d + 96), _mm256_loadu_si256((const __m256i *)(s + 96)));
+        }
+        _mm_sfence();
+    }
+
+    for (; size >= 128; size -= 128, d += 128, s += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)s);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(s + 64));
+        __m256i e = _mm256_loadu_si256((const __m256i *)(s + 96));
+        _mm256_store_si256((__m256i *)d, a);
+        _mm256_store_si256((__m256i *)(d + 32), b);
+        _mm256_store_si256((__m256i *)(d + 64), c);
+        _mm256_store_si256((__m256i *)(d + 96), e);
+    }
+    for (; size >= 32; size -= 32, d += 32, s += 32) {
+        _mm256_store_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+    }
+    if (size > 0) {
+        _mm256_storeu_si256((__m256i *)(d + size - 32), _mm256_loadu_si256((const __m256i *)(s + size - 32)));
+    }
+}
+
+__attribute__((target("avx2")))
+static void mem_zero_avx2(VOID *dst, UINTN size) {
+
+    UINT8 *d = dst;
+    UINTN head;
+    const __m256i zero = _mm256_setzero_si256();
+
+    if (size < 2 * MEM_VECTOR_MIN) {
+        mem_zero_sse2(dst, size);
+        return;
+    }
+
+    head = 32 - ((UINTN)d & 31);
+    _mm256_storeu_si256((__m256i *)d, zero);
+    d += head;
+    size -= head;
+
+    if (size >= MEM_NONTEMPORAL_MIN) {
+        for (; size >= 128; size -= 128, d += 128) {
+            _mm256_stream_si256((__m256i *)d, zero);
+            _mm256_stream_si256((__m256i *)(d + 32), zero);
+            _mm256_stream_si256((__m256i *)(d + 64), zero);
+            _mm256_stream_si256((__m256i *)(d + 96), zero);
+        }
+        _mm_sfence();
+    }
+
+    for (; size >= 128; size -= 128, d += 128) {
+        _mm256_store_si256((__m256i *)d, zero);
+        _mm256_store_si256((__m256i *)(d + 32), zero);
+        _mm256_store_si256((__m256i *)(d + 64), zero);
+        _mm256_store_si256((__m256i *)(d + 96), zero);
+    }
+    for (; size >= 32; size -= 32, d += 32) {
+        _mm256_store_si256((__m256i *)d, zero);
+    }
+    if (size > 0) {
+        _mm256_storeu_si256((__m256i *)(d + size - 32), zero);
+    }
+}
+
+static const struct mem_ops mem_ops_word = { mem_copy_word, mem_zero_word, mem_span_word, L"word" };
+static const struct mem_ops mem_ops_sse2 = { mem_copy_sse2, mem_zero_sse2, mem_span_sse2, L"SSE2" };
+static const struct mem_ops mem_ops_avx2 = { mem_copy_avx2, mem_zero_avx2, mem_span_sse2, L"AVX2" };
+
+// mem_initの前でも使えるように、x86_64ならどのCPUでも動く実装から始める
+static const struct mem_ops *mem_selected = &mem_ops_sse2;
+
+// Use the implementations for the features regardless of the CPU, for tests and benchmarks
+void mem_force(UINT32 features) {
+
+    if (features & CPU_AVX2) {
+        mem_selected = &mem_ops_avx2;
+    } else if (features & CPU_SSE2) {
+        mem_selected = &mem_ops_sse2;
+    } else {
+        mem_selected = &mem_ops_word;
+    }
+}
+
+// Choose the implementations by CPUID, once at startup
+void mem_init() {
+    mem_force(cpu_features());
+}
+
+// Name of the selected implementations
+const CHAR16 *mem_implementation() {
+    return mem_selected->name;
+}
+
+// Copy bytes, the buffers must not overlap
+void mem_copy(VOID *dst, const VOID *src, UINTN size) {
+    mem_selected->copy(dst, src, size);
+}
+
+// Zero bytes
+void mem_zero(VOID *dst, UINTN size) {
+    mem_selected->zero(dst, size);
+}
+
+// Zero bytes on any core
+// APではYMMが有効になっているとは限らないので、SSE2を使う
+void mem_zero_any_core(VOID *dst, UINTN size) {
+    mem_zero_sse2(dst, size);
+}
+
+// Length of the leading part of s without NULL and the stop characters
+// stops has up to MEM_SPAN_MAX characters
+UINTN mem_span(const char *s, const char *stops) {
+    return mem_selected->span(s, stops);
+}
+
+#pragma GCC pop_options
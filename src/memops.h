@@ -0,0 +1,32 @@
+#ifndef _MEMOPS_H
+#define _MEMOPS_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// これより大きいコピーと0埋めはキャッシュを通さずに書く
+#define MEM_NONTEMPORAL_MIN (2 * 1024 * 1024)
+
+// これより小さいものはベクトルを使わない
+#define MEM_VECTOR_MIN 64
+
+// mem_spanで探せる文字の数 (NULL終端は常に探す)
+#define MEM_SPAN_MAX 4
+
+// 揃えて読むので文字列の後ろを読むことがある (ページはまたがない)
+// ホストのASanでは調べない
+#define MEM_NO_SANITIZE __attribute__((no_sanitize_address))
+
+// 8バイトずつ読み書きするための型
+typedef UINT64 __attribute__((may_alias, aligned(1))) mem_word;
+
+// MEM_OPS
+// CPUによって選ぶ実装
+struct mem_ops {
+    void (*copy)(VOID *dst, const VOID *src, UINTN size); // 重なってはいけない
+    void (*zero)(VOID *dst, UINTN size);
+    UINTN (*span)(const char *s, const char *stops);
+    const CHAR16 *name;
+};
+
+#endif
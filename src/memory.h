@@ -14,4 +14,31 @@ typedef struct memory_map {
     UINTN entry;
 } memmap;
 
+// "NBMM"
+#define MEMMAP_MAGIC 0x4D4D424E
+#define MEMMAP_VERSION 1
+
+// テキストの1行の最大サイズ
+#define MEMMAP_LINE_SIZE 128
+
+// MEMMAP_FILE_HEADER
+// このヘッダーの後にアドレス順のエントリーが続く
+struct memmap_file_header {
+    UINT32 magic;
+    UINT16 version;
+    UINT16 entry_size;
+    UINT32 no_of_entries;
+    UINT32 reserved;
+};
+
+// MEMMAP_ENTRY
+// 隣接する同じ種類の領域はまとめられている
+struct memmap_entry {
+    UINT64 base;
+    UINT64 no_of_pages;
+    UINT64 attribute;
+    UINT32 type;
+    UINT32 reserved;
+};
+
 #endif
\ No newline at end of file
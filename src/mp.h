@@ -0,0 +1,71 @@
+#ifndef _MP_H
+#define _MP_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// EFI_MP_SERVICES_PROTOCOL (PI Specification Vol.2)
+// gnu-efiには含まれていないので定義する
+#define NEOBOOT_MP_SERVICES_GUID { 0x3fdda605, 0xa76e, 0x4f46, { 0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08 } }
+
+// ファームウェアから呼ばれるので常にMicrosoftの呼び出し規約を使う
+typedef VOID (__attribute__((ms_abi)) *MP_PROCEDURE)(VOID *argument);
+
+typedef struct _NEOBOOT_MP_SERVICES {
+    EFI_STATUS (EFIAPI *GetNumberOfProcessors)(struct _NEOBOOT_MP_SERVICES *This, UINTN *NumberOfProcessors, UINTN *NumberOfEnabledProcessors);
+    VOID *GetProcessorInfo;
+    EFI_STATUS (EFIAPI *StartupAllAPs)(struct _NEOBOOT_MP_SERVICES *This, MP_PROCEDURE Procedure, BOOLEAN SingleThread, EFI_EVENT WaitEvent, UINTN TimeoutInMicroSeconds, VOID *ProcedureArgument, UINTN **FailedCpuList);
+    EFI_STATUS (EFIAPI *StartupThisAP)(struct _NEOBOOT_MP_SERVICES *This, MP_PROCEDURE Procedure, UINTN ProcessorNumber, EFI_EVENT WaitEvent, UINTN TimeoutInMicroSeconds, VOID *ProcedureArgument, BOOLEAN *Finished);
+    VOID *SwitchBSP;
+    VOID *EnableDisableAP;
+    EFI_STATUS (EFIAPI *WhoAmI)(struct _NEOBOOT_MP_SERVICES *This, UINTN *ProcessorNumber);
+} NEOBOOT_MP_SERVICES;
+
+// ワーカーの最大数 (BSPを含む)
+#define JOB_WORKERS_MAX 128
+
+// 1つのワーカーのキューに入るジョブの数
+#define JOB_QUEUE_SIZE 64
+
+// これより小さい処理は分割しない
+#define JOB_PARALLEL_MIN (4 * 1024 * 1024)
+
+// 分割する単位
+#define JOB_GRAIN_MIN (256 * 1024)
+
+// ジョブの処理
+// APでも実行されるので、Boot Servicesを呼んではいけない
+typedef VOID (*job_function)(VOID *arg, UINTN begin, UINTN end);
+
+// JOB
+typedef struct _JOB {
+    job_function function;
+    VOID *arg;
+    UINTN begin;
+    UINTN end;
+} job;
+
+// JOB_QUEUE
+// 持ち主は後ろから取り出し、他のワーカーは前から盗む
+struct job_queue {
+    volatile UINT32 lock;
+    UINT32 top;
+    UINT32 bottom;
+    UINT32 jobs[JOB_QUEUE_SIZE]; // jobの番号
+};
+
+// SCHEDULER
+struct scheduler {
+    NEOBOOT_MP_SERVICES *mp; // なければNULL
+    EFI_EVENT done; // 全てのAPが戻ったら通知される
+    UINTN no_of_workers;
+
+    // 実行中のジョブ
+    job *jobs;
+    volatile UINTN remaining;
+    volatile UINTN next_worker;
+
+    struct job_queue queues[JOB_WORKERS_MAX];
+};
+
+#endif
@@ -0,0 +1,134 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "nvram.h"
+#include "proto.h"
+
+static EFI_GUID boot_cache_guid = BOOT_CACHE_GUID;
+
+// Check that the device path ends within the size
+static BOOLEAN is_valid_device_path(EFI_DEVICE_PATH *path, UINTN size) {
+
+    UINT8 *p = (UINT8 *)path;
+    UINT8 *end = p + size;
+
+    while (p + sizeof(EFI_DEVICE_PATH) <= end) {
+        EFI_DEVICE_PATH *node = (EFI_DEVICE_PATH *)p;
+        UINTN length = node->Length[0] | (node->Length[1] << 8);
+
+        if (length < sizeof(EFI_DEVICE_PATH) || p + length > end) {
+            return FALSE;
+        }
+        if (IsDevicePathEnd(node)) {
+            return p + length == end;
+        }
+
+        p += length;
+    }
+
+    return FALSE;
+}
+
+// Load the device path and the config digest of the last boot
+EFI_STATUS boot_cache_load(EFI_DEVICE_PATH **path, UINT32 *digest) {
+
+    struct boot_cache *cache;
+    UINTN size = 0;
+
+    *path = NULL;
+
+    cache = LibGetVariableAndSize(BOOT_CACHE_VARIABLE, &boot_cache_guid, &size);
+    if (cache == NULL) {
+        return EFI_NOT_FOUND;
+    }
+
+    // 壊れた変数や古い形式は使わない
+    if (size < sizeof(struct boot_cache) || size > BOOT_CACHE_SIZE_MAX || cache->version != BOOT_CACHE_VERSION || cache->device_path_size != size - sizeof(struct boot_cache) || !is_valid_device_path((EFI_DEVICE_PATH *)(cache + 1), cache->device_path_size)) {
+        FreePool(cache);
+        return EFI_VOLUME_CORRUPTED;
+    }
+
+    *path = AllocatePool(cache->device_path_size);
+    if (*path == NULL) {
+        FreePool(cache);
+        return EFI_OUT_OF_RESOURCES;
+    }
+    CopyMem(*path, cache + 1, cache->device_path_size);
+    *digest = cache->digest;
+
+    FreePool(cache);
+
+    return EFI_SUCCESS;
+}
+
+// Open the root directory of the volume at the device path
+EFI_STATUS boot_cache_open(EFI_DEVICE_PATH *path, EFI_HANDLE *handle, EFI_FILE_PROTOCOL **root) {
+
+    EFI_STATUS status;
+    EFI_DEVICE_PATH *remaining = path;
+
+    // デバイスパスに一致するファイルシステムを探す
+    status = uefi_call_wrapper(BS->LocateDevicePath, 3, &gEfiSimpleFileSystemProtocolGuid, &remaining, handle);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    // 途中までしか一致しなければ別のボリューム
+    if (!IsDevicePathEnd(remaining)) {
+        return EFI_NOT_FOUND;
+    }
+
+    *root = LibOpenRoot(*handle);
+    if (*root == NULL) {
+        return EFI_DEVICE_ERROR;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Save the volume and the config digest for the next boot
+EFI_STATUS boot_cache_save(EFI_HANDLE handle, UINT32 digest) {
+
+    EFI_STATUS status;
+    EFI_DEVICE_PATH *path;
+    struct boot_cache *cache;
+    VOID *old;
+    UINTN path_size, size, old_size = 0;
+
+    path = DevicePathFromHandle(handle);
+    if (path == NULL) {
+        return EFI_NOT_FOUND;
+    }
+
+    path_size = DevicePathSize(path);
+    size = sizeof(struct boot_cache) + path_size;
+    if (size > BOOT_CACHE_SIZE_MAX) {
+        return EFI_BAD_BUFFER_SIZE;
+    }
+
+    cache = AllocateZeroPool(size);
+    if (cache == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    cache->version = BOOT_CACHE_VERSION;
+    cache->digest = digest;
+    cache->device_path_size = path_size;
+    CopyMem(cache + 1, path, path_size);
+
+    // 変わっていなければNVRAMに書き込まない
+    old = LibGetVariableAndSize(BOOT_CACHE_VARIABLE, &boot_cache_guid, &old_size);
+    if (old != NULL && old_size == size && CompareMem(old, cache, size) == 0) {
+        status = EFI_SUCCESS;
+    } else {
+        status = uefi_call_wrapper(RT->SetVariable, 5, BOOT_CACHE_VARIABLE, &boot_cache_guid, EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS, size, cache);
+    }
+
+    if (old != NULL) {
+        FreePool(old);
+    }
+    FreePool(cache);
+
+    return status;
+}
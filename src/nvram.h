@@ -0,0 +1,28 @@
+#ifndef _NVRAM_H
+#define _NVRAM_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// 前回起動したボリュームを記録する変数
+#define BOOT_CACHE_VARIABLE L"NeobootCache"
+
+// ローダーが所有するベンダーGUID
+#define BOOT_CACHE_GUID { 0x6e656f62, 0x6f6f, 0x4574, { 0x8c, 0x1a, 0x3d, 0x52, 0x9e, 0x47, 0x0b, 0x61 } }
+
+// 変数の形式が変わったら上げる
+#define BOOT_CACHE_VERSION 1
+
+// 変数のサイズの上限
+#define BOOT_CACHE_SIZE_MAX 1024
+
+// BOOT_CACHE
+// このヘッダーの後にボリュームのデバイスパスが続く
+struct boot_cache {
+    UINT32 version;
+    UINT32 digest; // 解析したコンフィグのCRC32
+    UINT32 device_path_size;
+    UINT32 reserved;
+};
+
+#endif
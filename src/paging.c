@@ -0,0 +1,282 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "paging.h"
+#include "proto.h"
+
+// 各段のエントリーが表すアドレスのビット位置
+static const UINTN page_shift[PAGE_TABLE_LEVELS] = { 12, 21, 30, 39 };
+
+// Allocate a zeroed page for a table
+static UINT64 *page_table_new(struct page_tables *pt) {
+
+    EFI_PHYSICAL_ADDRESS address;
+
+    if (EFI_ERROR(uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, 1, &address))) {
+        return NULL;
+    }
+    mem_zero((VOID *)(UINTN)address, EFI_PAGE_SIZE);
+    pt->no_of_tables += 1;
+
+    return (UINT64 *)(UINTN)address;
+}
+
+// Free the table and the tables below it
+static void page_table_free(UINT64 *table, UINTN level) {
+
+    for (UINTN i = 0; i < PAGE_TABLE_ENTRIES && level > 0; i++) {
+        if ((table[i] & PAGE_PRESENT) && !(table[i] & PAGE_LARGE)) {
+            page_table_free((UINT64 *)(UINTN)(table[i] & PAGE_ADDRESS_MASK), level - 1);
+        }
+    }
+    uefi_call_wrapper(BS->FreePages, 2, (EFI_PHYSICAL_ADDRESS)(UINTN)table, 1);
+}
+
+// Replace a large page with a table of the next smaller pages that translate the same way
+static EFI_STATUS page_split(struct page_tables *pt, UINT64 *entry, UINTN level) {
+
+    UINT64 *table = page_table_new(pt);
+    UINT64 size = 1ULL << page_shift[level];
+    UINT64 base = *entry & PAGE_ADDRESS_MASK & ~(size - 1);
+    UINT64 flags = *entry & PAGE_WRITABLE;
+    UINT64 child = 1ULL << page_shift[level - 1];
+
+    if (table == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    for (UINTN i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+        table[i] = (base + i * child) | flags | PAGE_PRESENT | (level - 1 > 0 ? PAGE_LARGE : 0);
+    }
+    pt->no_of_pages[level - 1] += PAGE_TABLE_ENTRIES;
+    pt->no_of_pages[level] -= 1;
+
+    *entry = (UINT64)(UINTN)table | PAGE_PRESENT | PAGE_WRITABLE;
+
+    return EFI_SUCCESS;
+}
+
+// Map one page of the level (0: 4KiB, 1: 2MiB, 2: 1GiB)
+// 同じ変換のページが既にあれば権限だけを足す
+static EFI_STATUS page_map_one(struct page_tables *pt, UINT64 virt, UINT64 phys, UINTN level, UINT64 flags) {
+
+    EFI_STATUS status;
+    UINT64 *table = pt->pml4;
+
+    for (UINTN l = PAGE_TABLE_LEVELS - 1; ; l--) {
+        UINT64 *entry = &table[(virt >> page_shift[l]) & (PAGE_TABLE_ENTRIES - 1)];
+        UINT64 size = 1ULL << page_shift[l];
+        BOOLEAN leaf = (*entry & PAGE_PRESENT) && (l == 0 || (*entry & PAGE_LARGE));
+
+        // 既にあるページの中に収まる
+        if (leaf) {
+            if ((*entry & PAGE_ADDRESS_MASK & ~(size - 1)) + (virt & (size - 1)) == phys) {
+                *entry |= flags;
+                return EFI_SUCCESS;
+            }
+            if (l == level) {
+                return EFI_INVALID_PARAMETER; // 別の物理アドレスに割り当て済み
+            }
+            status = page_split(pt, entry, l);
+            if (EFI_ERROR(status)) {
+                return status;
+            }
+        }
+
+        if (l == level) {
+            if (*entry & PAGE_PRESENT) {
+                return EFI_INVALID_PARAMETER; // 小さいページのテーブルがある
+            }
+            *entry = phys | flags | PAGE_PRESENT | (l > 0 ? PAGE_LARGE : 0);
+            pt->no_of_pages[l] += 1;
+            return EFI_SUCCESS;
+        }
+
+        // 次の段のテーブル
+        if (!(*entry & PAGE_PRESENT)) {
+            UINT64 *next = page_table_new(pt);
+            if (next == NULL) {
+                return EFI_OUT_OF_RESOURCES;
+            }
+            *entry = (UINT64)(UINTN)next | PAGE_PRESENT | PAGE_WRITABLE;
+        }
+        table = (UINT64 *)(UINTN)(*entry & PAGE_ADDRESS_MASK);
+    }
+}
+
+// Map the range with the largest pages that the alignment of both addresses allows
+static EFI_STATUS page_map(struct page_tables *pt, UINT64 virt, UINT64 phys, UINT64 size, UINT64 flags) {
+
+    EFI_STATUS status;
+
+    while (size > 0) {
+        UINTN level = 0;
+        for (UINTN l = pt->large_1g ? 2 : 1; l > 0; l--) {
+            UINT64 page = 1ULL << page_shift[l];
+            if (((virt | phys) & (page - 1)) == 0 && size >= page) {
+                level = l;
+                break;
+            }
+        }
+
+        status = page_map_one(pt, virt, phys, level, flags);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+
+        UINT64 page = 1ULL << page_shift[level];
+        virt += page;
+        phys += page;
+        size = size > page ? size - page : 0;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// End of the highest range in the memory map
+static UINT64 memory_top() {
+
+    EFI_MEMORY_DESCRIPTOR *buffer, *desc;
+    UINTN no_of_entries, map_key, desc_size;
+    UINT32 desc_version;
+    UINT64 top = 0;
+
+    buffer = LibMemoryMap(&no_of_entries, &map_key, &desc_size, &desc_version);
+    if (buffer == NULL) {
+        return 0;
+    }
+
+    desc = buffer;
+    for (UINTN i = 0; i < no_of_entries; i++) {
+        UINT64 end = desc->PhysicalStart + desc->NumberOfPages * EFI_PAGE_SIZE;
+        if (end > top) {
+            top = end;
+        }
+        desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)desc + desc_size);
+    }
+    FreePool(buffer);
+
+    return top;
+}
+
+// Whether the firmware runs with 5-level paging
+static BOOLEAN paging_is_5_level() {
+    UINT64 cr4;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+    return (cr4 & CR4_LA57) != 0;
+}
+
+// Build page tables for a higher-half kernel
+// Physical memory is mapped at 0 and at PAGING_DIRECT_MAP_BASE, and the kernel segments at their virtual addresses
+// 恒等マッピングはCR3を切り替えた後もローダーのコードとスタックを動かすために要る
+EFI_STATUS page_tables_build(kernel_image *kernel, payload *image, struct boot_framebuffer *fb, struct page_tables *pt) {
+
+    EFI_STATUS status;
+    UINT64 top;
+
+    ZeroMem(pt, sizeof(struct page_tables));
+
+    // 4段のテーブルしか作らない
+    if (paging_is_5_level()) {
+        return EFI_UNSUPPORTED;
+    }
+
+    pt->large_1g = (cpu_features() & CPU_PAGE_1G) != 0;
+    pt->pml4 = page_table_new(pt);
+    if (pt->pml4 == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    // Identity window (1GiBに揃えて、2MiBのページでも端数が出ないようにする)
+    top = memory_top();
+    if (top < PAGING_IDENTITY_MIN) {
+        top = PAGING_IDENTITY_MIN;
+    }
+    top = (top + PAGE_SIZE_1G - 1) & ~(PAGE_SIZE_1G - 1);
+    pt->identity_end = top;
+
+    status = page_map(pt, 0, 0, top, PAGE_WRITABLE);
+    if (!EFI_ERROR(status)) {
+        status = page_map(pt, PAGING_DIRECT_MAP_BASE, 0, top, PAGE_WRITABLE);
+    }
+
+    // Framebuffer (PCIのBARは窓の外にあることがある)
+    if (!EFI_ERROR(status) && fb != NULL && fb->base + fb->size > top) {
+        UINT64 base = fb->base & ~(PAGE_SIZE_4K - 1);
+        UINT64 size = ((fb->base + fb->size + PAGE_SIZE_4K - 1) & ~(PAGE_SIZE_4K - 1)) - base;
+        status = page_map(pt, base, base, size, PAGE_WRITABLE);
+        if (!EFI_ERROR(status)) {
+            status = page_map(pt, PAGING_DIRECT_MAP_BASE + base, base, size, PAGE_WRITABLE);
+        }
+    }
+
+    // Image (窓の中にあるが、窓の外に置かれても読めるようにする)
+    if (!EFI_ERROR(status) && image != NULL && image->no_of_pages != 0) {
+        status = page_map(pt, PAGING_DIRECT_MAP_BASE + image->base, image->base, image->no_of_pages * EFI_PAGE_SIZE, PAGE_WRITABLE);
+    }
+
+    // Kernel segments
+    for (UINTN i = 0; i < kernel->no_of_segments && !EFI_ERROR(status); i++) {
+        kernel_segment *s = &kernel->segments[i];
+        UINT64 virt = s->vaddr & ~(PAGE_SIZE_4K - 1);
+        UINT64 phys = s->paddr & ~(PAGE_SIZE_4K - 1);
+        UINT64 end = (s->vaddr + s->memsz + PAGE_SIZE_4K - 1) & ~(PAGE_SIZE_4K - 1);
+
+        if (s->memsz == 0) {
+            continue;
+        }
+
+        // 仮想アドレスと物理アドレスのページ内のオフセットが違えばマップできない
+        if ((s->vaddr ^ s->paddr) & (PAGE_SIZE_4K - 1)) {
+            status = EFI_LOAD_ERROR;
+            break;
+        }
+        status = page_map(pt, virt, phys, end - virt, (s->flags & PF_W) ? PAGE_WRITABLE : 0);
+    }
+
+    if (EFI_ERROR(status)) {
+        page_tables_free(pt);
+        return status;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Free every table
+void page_tables_free(struct page_tables *pt) {
+    if (pt->pml4 != NULL) {
+        page_table_free(pt->pml4, PAGE_TABLE_LEVELS - 1);
+        pt->pml4 = NULL;
+    }
+}
+
+// Allocate pages whose base is a multiple of the alignment
+// 余分に確保して前後を返す
+EFI_STATUS allocate_aligned_pages(EFI_MEMORY_TYPE type, UINTN no_of_pages, UINT64 alignment, EFI_PHYSICAL_ADDRESS *base) {
+
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS address, aligned;
+    UINTN extra = EFI_SIZE_TO_PAGES(alignment) - 1;
+    UINTN head, tail;
+
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, type, no_of_pages + extra, &address);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    aligned = (address + alignment - 1) & ~(alignment - 1);
+    head = EFI_SIZE_TO_PAGES(aligned - address);
+    tail = extra - head;
+
+    if (head > 0) {
+        uefi_call_wrapper(BS->FreePages, 2, address, head);
+    }
+    if (tail > 0) {
+        uefi_call_wrapper(BS->FreePages, 2, aligned + no_of_pages * EFI_PAGE_SIZE, tail);
+    }
+    *base = aligned;
+
+    return EFI_SUCCESS;
+}
@@ -0,0 +1,45 @@
+#ifndef _PAGING_H
+#define _PAGING_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// ページテーブルのエントリー
+#define PAGE_PRESENT (1ULL << 0)
+#define PAGE_WRITABLE (1ULL << 1)
+#define PAGE_LARGE (1ULL << 7) // PDPTなら1GiB、PDなら2MiBのページ
+#define PAGE_ADDRESS_MASK 0x000FFFFFFFFFF000ULL
+
+// 4段のページング (PT, PD, PDPT, PML4)
+#define PAGE_TABLE_LEVELS 4
+#define PAGE_TABLE_ENTRIES 512
+
+// ページの大きさ
+#define PAGE_SIZE_4K 0x1000ULL
+#define PAGE_SIZE_2M 0x200000ULL
+#define PAGE_SIZE_1G 0x40000000ULL
+
+// 恒等マッピングの最小の範囲 (4GiBの下のLAPICやIOAPICも含める)
+#define PAGING_IDENTITY_MIN (4ULL << 30)
+
+// 恒等マッピングと同じ範囲を上位のアドレスにも置く
+#define PAGING_DIRECT_MAP_BASE 0xFFFF800000000000ULL
+
+// ペイロードは2MiBのページに載るように揃える
+#define PAYLOAD_ALIGN PAGE_SIZE_2M
+
+// CR4.LA57 (5段のページング)
+#define CR4_LA57 (1ULL << 12)
+
+// PAGE_TABLES
+struct page_tables {
+    UINT64 *pml4;
+    UINTN no_of_tables;
+    BOOLEAN large_1g; // 1GiBのページが使えるか
+    UINT64 identity_end;
+
+    // 大きさごとのページの数 (4KiB, 2MiB, 1GiB)
+    UINTN no_of_pages[3];
+};
+
+#endif
@@ -0,0 +1,279 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "disk.h"
+#include "proto.h"
+
+// Has a probe with a higher priority already found the config
+static BOOLEAN probe_is_decided(struct volume_probe *probes, UINTN count, UINTN position) {
+
+    // 優先度順に並んでいるので、前にあるものだけを見る
+    for (UINTN i = 0; i < position && i < count; i++) {
+        if (probes[i].state == PROBE_DONE) {
+            return TRUE;
+        }
+        if (probes[i].state != PROBE_FAILED) {
+            return FALSE;
+        }
+    }
+
+    return FALSE;
+}
+
+// Mark the probe as failed and release its file
+static void probe_fail(struct volume_probe *probe) {
+
+    if (probe->file != NULL) {
+        uefi_call_wrapper(probe->file->Close, 1, probe->file);
+        probe->file = NULL;
+    }
+
+    probe->state = PROBE_FAILED;
+}
+
+// Open the binary config, or the text config if there is no binary one
+static void probe_open(struct volume_probe *probe) {
+
+    EFI_STATUS status;
+
+    probe->token.Status = EFI_SUCCESS;
+    probe->file = NULL;
+    status = uefi_call_wrapper(probe->root->OpenEx, 6, probe->root, &probe->file, probe->is_text ? CONFIG_FILE_NAME : CONFIG_BINARY_NAME, EFI_FILE_MODE_READ, 0, &probe->token);
+    if (EFI_ERROR(status)) {
+        probe->file = NULL;
+
+        // ファイルが無ければここで失敗することもある
+        if (status == EFI_NOT_FOUND && !probe->is_text) {
+            probe->is_text = TRUE;
+            probe_open(probe);
+            return;
+        }
+
+        probe->state = (status == EFI_UNSUPPORTED) ? PROBE_IDLE : PROBE_FAILED;
+        return;
+    }
+
+    probe->state = PROBE_OPEN;
+}
+
+// Start opening the config file on the volume
+static void probe_start(struct volume_probe *probe) {
+
+    EFI_STATUS status;
+
+    // OpenEx is available from the revision 2
+    if (probe->root->Revision < EFI_FILE_PROTOCOL_REVISION2) {
+        return;
+    }
+
+    status = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL, &probe->token.Event);
+    if (EFI_ERROR(status)) {
+        probe->token.Event = NULL;
+        return;
+    }
+
+    probe_open(probe);
+}
+
+// Advance the probe whose event was signaled
+static void probe_advance(struct volume_probe *probe, BOOLEAN decided) {
+
+    EFI_STATUS status;
+    EFI_FILE_INFO *info;
+    UINT64 size;
+
+    if (EFI_ERROR(probe->token.Status)) {
+        // 開けなかった場合はファイルがない
+        if (probe->state == PROBE_OPEN) {
+            probe->file = NULL;
+
+            // バイナリ形式がなければテキストを開く
+            if (probe->token.Status == EFI_NOT_FOUND && !probe->is_text) {
+                probe->is_text = TRUE;
+                probe_open(probe);
+                return;
+            }
+        }
+        probe_fail(probe);
+        return;
+    }
+
+    switch (probe->state) {
+        case PROBE_OPEN:
+
+            // 優先度の高いボリュームで見つかっていれば読まない
+            if (decided) {
+                probe_fail(probe);
+                return;
+            }
+
+            // Get the config file size
+            info = LibFileInfo(probe->file);
+            if (info == NULL) {
+                probe_fail(probe);
+                return;
+            }
+            size = info->FileSize;
+            FreePool(info);
+
+            if (size > CONFIG_FILE_SIZE_MAX) {
+                probe_fail(probe);
+                return;
+            }
+
+            if (EFI_ERROR(file_view_alloc(&probe->view, size))) {
+                probe_fail(probe);
+                return;
+            }
+
+            // Read the whole file
+            probe->token.Status = EFI_SUCCESS;
+            probe->token.BufferSize = size;
+            probe->token.Buffer = probe->view.data;
+            status = uefi_call_wrapper(probe->file->ReadEx, 2, probe->file, &probe->token);
+            if (EFI_ERROR(status)) {
+                unmap_file(&probe->view);
+                probe_fail(probe);
+                return;
+            }
+
+            probe->state = PROBE_READ;
+            break;
+
+        case PROBE_READ:
+
+            // 短く読めた場合も後ろは0で埋まっている
+            probe->view.size = probe->token.BufferSize;
+
+            uefi_call_wrapper(probe->file->Close, 1, probe->file);
+            probe->file = NULL;
+            probe->state = PROBE_DONE;
+            break;
+
+        default:
+            break;
+    }
+}
+
+// Look for the config file on all volumes at once
+// The boot volume has the highest priority, and the others follow in handle order
+EFI_STATUS probe_volumes(struct bootable_disk_info *disks, UINTN no_of_disks, EFI_HANDLE boot_handle, UINTN *index, file_view *view) {
+
+    struct volume_probe *probes;
+    EFI_EVENT *events;
+    UINTN *owners;
+    UINTN count = 0;
+    EFI_STATUS status = EFI_NOT_FOUND;
+
+    view->data = NULL;
+
+    probes = AllocateZeroPool(sizeof(struct volume_probe) * (no_of_disks + 1));
+    events = AllocatePool(sizeof(EFI_EVENT) * (no_of_disks + 1));
+    owners = AllocatePool(sizeof(UINTN) * (no_of_disks + 1));
+    if (probes == NULL || events == NULL || owners == NULL) {
+        status = EFI_OUT_OF_RESOURCES;
+        goto free;
+    }
+
+    // 優先度順に並べる
+    for (UINTN i = 0; i < no_of_disks; i++) {
+        if (disks[i].handle == boot_handle) {
+            probes[count].index = i;
+            probes[count].root = disks[i].root;
+            count++;
+        }
+    }
+    for (UINTN i = 0; i < no_of_disks; i++) {
+        if (disks[i].handle != boot_handle) {
+            probes[count].index = i;
+            probes[count].root = disks[i].root;
+            count++;
+        }
+    }
+
+    // Issue all asynchronous opens first
+    for (UINTN i = 0; i < count; i++) {
+        probe_start(&probes[i]);
+    }
+
+    // 非同期に対応していないボリュームは、その間に同期で読む
+    for (UINTN i = 0; i < count; i++) {
+        if (probes[i].state != PROBE_IDLE) {
+            continue;
+        }
+        if (probe_is_decided(probes, count, i)) {
+            probes[i].state = PROBE_FAILED;
+            continue;
+        }
+        probes[i].state = EFI_ERROR(read_config(probes[i].root, &probes[i].view)) ? PROBE_FAILED : PROBE_DONE;
+    }
+
+    // Advance each probe as its event is signaled
+    while (TRUE) {
+        UINTN no_of_events = 0;
+        UINTN signaled;
+
+        for (UINTN i = 0; i < count; i++) {
+            if (probes[i].state == PROBE_OPEN || probes[i].state == PROBE_READ) {
+                events[no_of_events] = probes[i].token.Event;
+                owners[no_of_events] = i;
+                no_of_events++;
+            }
+        }
+
+        // 発行中のものが無くなるまで待つ (トークンとバッファーを解放できない)
+        if (no_of_events == 0) {
+            break;
+        }
+
+        if (EFI_ERROR(uefi_call_wrapper(BS->WaitForEvent, 3, no_of_events, events, &signaled))) {
+
+            // 待てなければポーリングする
+            signaled = no_of_events;
+            for (UINTN i = 0; i < no_of_events; i++) {
+                if (uefi_call_wrapper(BS->CheckEvent, 1, events[i]) == EFI_SUCCESS) {
+                    signaled = i;
+                    break;
+                }
+            }
+            if (signaled == no_of_events) {
+                continue;
+            }
+        }
+
+        UINTN position = owners[signaled];
+        probe_advance(&probes[position], probe_is_decided(probes, count, position));
+    }
+
+    // Pick the first found config in priority order
+    for (UINTN i = 0; i < count; i++) {
+        if (probes[i].state == PROBE_DONE && view->data == NULL) {
+            *index = probes[i].index;
+            *view = probes[i].view;
+            status = EFI_SUCCESS;
+        } else {
+            unmap_file(&probes[i].view);
+        }
+    }
+
+    for (UINTN i = 0; i < count; i++) {
+        if (probes[i].token.Event != NULL) {
+            uefi_call_wrapper(BS->CloseEvent, 1, probes[i].token.Event);
+        }
+    }
+
+free:
+    if (probes != NULL) {
+        FreePool(probes);
+    }
+    if (events != NULL) {
+        FreePool(events);
+    }
+    if (owners != NULL) {
+        FreePool(owners);
+    }
+
+    return status;
+}
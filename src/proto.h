@@ -11,6 +11,20 @@
 #include "memory.h"
 #include "disk.h"
 #include "config.h"
+#include "elf.h"
+#include "stream.h"
+#include "nvram.h"
+#include "mp.h"
+#include "trace.h"
+#include "screen.h"
+#include "cpu.h"
+#include "sha256.h"
+#include "memops.h"
+#include "arena.h"
+#include "handoff.h"
+#include "paging.h"
+#include "fat.h"
+#include "ext4.h"
 
 // Functions
 
@@ -18,40 +32,182 @@
 unsigned int my_strlen(const char *str);
 char *my_strcpy(char *dest, const char *src);
 UINTN EFIAPI AsciiSPrint(CHAR8 *buffer, UINTN buffer_size, CONST CHAR8 *str, ...);
-CHAR16 *add_spaces_around_text(const CHAR16 *text, UINTN num_spaces);
-char *my_strtok(char *str, const char *delim);
 char *my_strchr(const char *str, int c);
 char *my_strdup(const char *s);
-void split_key_value(char *str, char **key, char **value);
-char **split(char *txt, const char *delimiter, int *count);
+CHAR16 *to_efi_path(const char *path);
+
+// Config
 Config *config_file_parser(char *config_txt);
+void free_config(Config *config);
+char *config_lookup(Config *config, UINTN section, const char *key);
+UINTN config_entries(Config *config);
+char *config_entry_value(Config *config, UINTN entry, const char *key);
+char *get_config_value(Config *config, const char *key);
+BOOLEAN config_number(const char *value, UINTN *number);
+char *config_key(Config *config, UINTN pair);
+char *config_value(Config *config, UINTN pair);
+char *config_section_name(Config *config, UINTN section);
+UINT32 config_digest(Config *config);
+BOOLEAN config_is_binary(VOID *buffer, UINTN size);
+Config *config_binary_open(VOID *buffer, UINTN size);
+Config *config_open(VOID *buffer, UINTN size);
+
+// CRC32
+UINT32 crc32_update(UINT32 crc, const VOID *data, UINTN size);
+UINT32 crc32(const VOID *data, UINTN size);
+
+// NVRAM
+EFI_STATUS boot_cache_load(EFI_DEVICE_PATH **path, UINT32 *digest);
+EFI_STATUS boot_cache_open(EFI_DEVICE_PATH *path, EFI_HANDLE *handle, EFI_FILE_PROTOCOL **root);
+EFI_STATUS boot_cache_save(EFI_HANDLE handle, UINT32 digest);
 
 // Memorymap
 const CHAR16 *get_memtype(EFI_MEMORY_TYPE type);
-EFI_STATUS save_memmap(memmap *map, EFI_FILE_PROTOCOL *f, EFI_FILE_PROTOCOL *esp_root);
+EFI_STATUS memmap_compact(memmap *map, struct memmap_entry **entries, UINTN *no_of_entries);
+EFI_STATUS save_memmap(memmap *map, EFI_FILE_PROTOCOL *esp_root);
+EFI_STATUS dump_memmap(memmap *map, EFI_FILE_PROTOCOL *esp_root);
+void print_memmap();
 
 // Protocol
 EFI_STATUS open_protocol(EFI_HANDLE handle, EFI_GUID *guid, VOID **protocol, EFI_HANDLE ImageHandle, UINT32 attr);
 
 // Disk
-void list_disks(EFI_HANDLE ImageHandle, struct disk_info **disk_info, UINTN *no_of_disks);
+EFI_STATUS read_engine_open(EFI_HANDLE handle, EFI_HANDLE ImageHandle, struct read_engine *engine);
+EFI_STATUS read_engine_wait(struct read_engine *engine);
+EFI_STATUS read_engine_issue(struct read_engine *engine, UINT64 offset, UINTN size, VOID *buffer);
+EFI_STATUS read_engine_submit(struct read_engine *engine, UINT64 offset, UINTN size, VOID *buffer);
+EFI_STATUS read_engine_drain(struct read_engine *engine);
+EFI_STATUS read_engine_read(struct read_engine *engine, UINT64 offset, UINTN size, VOID *buffer);
+void read_engine_close(struct read_engine *engine);
+EFI_STATUS read_gpt(struct read_engine *engine, EFI_LBA lba, EFI_PARTITION_TABLE_HEADER *header, EFI_PARTITION_ENTRY **entries);
+void list_disks(EFI_HANDLE ImageHandle, struct disk_info **disk_info, UINTN *no_of_disks, BOOLEAN verbose);
 void list_bootable_disk(struct bootable_disk_info **disk_info, UINTN *no_of_disks);
+BOOLEAN guid_parse(const char *text, EFI_GUID *guid);
+EFI_STATUS find_partition(EFI_HANDLE ImageHandle, EFI_GUID *guid, EFI_HANDLE *disk, UINT64 *offset);
+EFI_STATUS fat_mount(EFI_HANDLE handle, EFI_HANDLE ImageHandle, EFI_FILE_PROTOCOL **root);
+BOOLEAN fat_is_native(EFI_FILE_PROTOCOL *file);
+EFI_STATUS ext4_mount(EFI_HANDLE handle, UINT64 offset, EFI_HANDLE ImageHandle, EFI_FILE_PROTOCOL **root);
+BOOLEAN ext4_is_native(EFI_FILE_PROTOCOL *file);
+EFI_STATUS probe_volumes(struct bootable_disk_info *disks, UINTN no_of_disks, EFI_HANDLE boot_handle, UINTN *index, file_view *view);
 
 // Menu
-entries_list *init_entries_list();
-void add_a_entry(CHAR16 *os_name, entries_list **entries);
-void print_a_entry(CHAR16 *name, UINTN no_of_entries, UINTN *pos_x, UINTN *pos_y, UINTN c, BOOLEAN is_selected);
-void print_entries(entries_list *entries, UINTN *pos_x, UINTN *pos_y, UINTN c);
-void modify_an_entry_order(entries_list *list_entries, UINT32 new_entry_order);
-void redraw_menu(CHAR16 *title, UINTN c, UINTN r, entries_list *list_entries);
-void open_menu(Config *con);
+entries_list *build_entries_list(Config *config);
+EFI_STATUS layout_menu(entries_list *list, UINTN first_y, UINTN c, UINTN r);
+void print_a_entry(entries_list *list, UINTN index);
+void print_menu_position(entries_list *list);
+void print_entries(entries_list *list);
+void select_entry(entries_list *list, UINTN index);
+UINTN menu_entry();
+EFI_STATUS open_menu(Config *con);
+
+// Screen
+EFI_STATUS screen_init(BOOLEAN use_gop);
+BOOLEAN screen_is_graphics();
+void screen_size(UINTN *columns, UINTN *rows);
+void screen_flush();
+void screen_clear();
+void screen_print_at(UINTN column, UINTN row, UINTN attribute, CHAR16 *text);
+void screen_print(CHAR16 *format, ...);
 
 // Console
-void determine_command(CHAR16 *buffer);
+EFI_STATUS wait_for_key(EFI_INPUT_KEY *key, UINTN timeout);
+BOOLEAN determine_command(CHAR16 *buffer);
 void open_console();
 
+// Trace
+EFI_STATUS trace_init();
+void trace_begin(UINT16 phase);
+void trace_end(UINT16 phase);
+VOID *trace_buffer();
+UINT64 trace_to_us(UINT64 ticks);
+void trace_print();
+EFI_STATUS trace_save(EFI_FILE_PROTOCOL *esp_root);
+
+// Jobs
+EFI_STATUS scheduler_init();
+UINTN scheduler_workers();
+void jobs_run(job *jobs, UINTN count);
+void parallel_for(job_function function, VOID *arg, UINTN size, UINTN grain);
+void parallel_zero(VOID *buffer, UINTN size);
+
+// Kernel
+EFI_STATUS read_kernel_at(kernel_source *source, UINT64 offset, UINTN size, VOID *buffer);
+EFI_STATUS validate_elf_header(Elf64_Ehdr *ehdr);
+void free_kernel(kernel_image *kernel);
+EFI_STATUS load_segment(kernel_source *source, Elf64_Phdr *phdr, EFI_PHYSICAL_ADDRESS allocated_end, kernel_segment *segment);
+EFI_STATUS load_kernel(EFI_FILE_PROTOCOL *root, CHAR16 *path, const UINT8 *digest, kernel_image *kernel);
+
+// Stream
+void file_io_configure(EFI_HANDLE volume);
+EFI_STATUS read_file_at(EFI_FILE_PROTOCOL *file, UINT64 offset, UINTN size, VOID *buffer);
+EFI_STATUS file_view_alloc(file_view *view, UINT64 size);
+EFI_STATUS map_file(EFI_FILE_PROTOCOL *root, CHAR16 *path, UINT64 max_size, file_view *view);
+void unmap_file(file_view *view);
+EFI_STATUS file_stream_open(EFI_FILE_PROTOCOL *file, struct file_stream *stream);
+EFI_STATUS file_stream_open_into(EFI_FILE_PROTOCOL *file, UINT8 *dst, struct file_stream *stream);
+EFI_STATUS file_stream_next(struct file_stream *stream, UINT8 **data, UINTN *size);
+void file_stream_close(struct file_stream *stream);
+EFI_STATUS read_file_into(EFI_FILE_PROTOCOL *file, UINT8 *dst, UINT64 size, struct sha256_state *sha);
+EFI_STATUS decompress_file(EFI_FILE_PROTOCOL *file, UINT32 format, UINT8 *dst, UINT64 size, struct sha256_state *sha);
+EFI_STATUS load_payload(EFI_FILE_PROTOCOL *root, CHAR16 *path, const UINT8 *digest, payload *out);
+void free_payload(payload *p);
+EFI_STATUS write_file(EFI_FILE_PROTOCOL *root, CHAR16 *path, VOID *data, UINTN size);
+
+// CPU
+UINT32 cpu_features();
+
+// Memory
+void mem_init();
+void mem_force(UINT32 features);
+const CHAR16 *mem_implementation();
+void mem_copy(VOID *dst, const VOID *src, UINTN size);
+void mem_zero(VOID *dst, UINTN size);
+void mem_zero_any_core(VOID *dst, UINTN size);
+UINTN mem_span(const char *s, const char *stops);
+
+// Arena
+VOID *arena_alloc(UINTN size);
+VOID *arena_alloc_zero(UINTN size);
+VOID *arena_alloc_array(UINTN size, UINTN count);
+VOID *arena_resize(VOID *old, UINTN old_size, UINTN new_size);
+void arena_mark(struct arena_mark *mark);
+void arena_release_to(struct arena_mark *mark);
+void arena_release();
+void arena_stats(UINTN *no_of_pages, UINTN *no_of_allocations);
+
+// SHA-256
+void sha256_force(UINT32 features);
+const CHAR16 *sha256_implementation();
+void sha256_init(struct sha256_state *state);
+void sha256_update(struct sha256_state *state, const VOID *data, UINTN size);
+void sha256_final(struct sha256_state *state, UINT8 digest[SHA256_DIGEST_SIZE]);
+BOOLEAN sha256_parse(const char *hex, UINT8 digest[SHA256_DIGEST_SIZE]);
+
+// Decompress
+void xxh64_init(struct xxh64_state *state);
+void xxh64_update(struct xxh64_state *state, const UINT8 *p, UINTN size);
+UINT64 xxh64_digest(struct xxh64_state *state);
+void xxh32_init(struct xxh32_state *state);
+void xxh32_update(struct xxh32_state *state, const UINT8 *p, UINTN size);
+UINT32 xxh32_digest(struct xxh32_state *state);
+UINT32 xxh32(const UINT8 *p, UINTN size);
+EFI_STATUS decoder_probe(const UINT8 *src, UINTN size, UINT32 *format, UINT64 *content_size);
+EFI_STATUS decoder_init(struct decoder *dec, UINT32 format, UINT8 *dst, UINT64 capacity);
+EFI_STATUS decoder_feed(struct decoder *dec, const UINT8 *data, UINTN size);
+EFI_STATUS decoder_finish(struct decoder *dec);
+
+// Handoff
+EFI_STATUS boot_info_create(kernel_image *kernel, payload *image, const char *flags, struct boot_info **out);
+EFI_STATUS handoff(EFI_HANDLE ImageHandle, struct boot_info *info);
+
+// Paging
+EFI_STATUS page_tables_build(kernel_image *kernel, payload *image, struct boot_framebuffer *fb, struct page_tables *pt);
+void page_tables_free(struct page_tables *pt);
+EFI_STATUS allocate_aligned_pages(EFI_MEMORY_TYPE type, UINTN no_of_pages, UINT64 alignment, EFI_PHYSICAL_ADDRESS *base);
+
 // Config file
-VOID *read_config_file(EFI_FILE_PROTOCOL *root);
+EFI_STATUS read_config(EFI_FILE_PROTOCOL *root, file_view *view);
+Config *open_config(EFI_FILE_PROTOCOL *root, file_view *view);
 
 // Main
 EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable);
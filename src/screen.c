@@ -0,0 +1,401 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "screen.h"
+#include "proto.h"
+
+// GOPを使わない時はNULL
+static struct gop_renderer *renderer = NULL;
+
+// テキストモードと同じ16色 (青、緑、赤、予約)
+static EFI_GRAPHICS_OUTPUT_BLT_PIXEL screen_palette[16] = {
+    { 0x00, 0x00, 0x00, 0x00 }, // EFI_BLACK
+    { 0x98, 0x00, 0x00, 0x00 }, // EFI_BLUE
+    { 0x00, 0x98, 0x00, 0x00 }, // EFI_GREEN
+    { 0x98, 0x98, 0x00, 0x00 }, // EFI_CYAN
+    { 0x00, 0x00, 0x98, 0x00 }, // EFI_RED
+    { 0x98, 0x00, 0x98, 0x00 }, // EFI_MAGENTA
+    { 0x00, 0x98, 0x98, 0x00 }, // EFI_BROWN
+    { 0x98, 0x98, 0x98, 0x00 }, // EFI_LIGHTGRAY
+    { 0x30, 0x30, 0x30, 0x00 }, // EFI_DARKGRAY
+    { 0xff, 0x00, 0x00, 0x00 }, // EFI_LIGHTBLUE
+    { 0x00, 0xff, 0x00, 0x00 }, // EFI_LIGHTGREEN
+    { 0xff, 0xff, 0x00, 0x00 }, // EFI_LIGHTCYAN
+    { 0x00, 0x00, 0xff, 0x00 }, // EFI_LIGHTRED
+    { 0xff, 0x00, 0xff, 0x00 }, // EFI_LIGHTMAGENTA
+    { 0x00, 0xff, 0xff, 0x00 }, // EFI_YELLOW
+    { 0xff, 0xff, 0xff, 0x00 }, // EFI_WHITE
+};
+
+// Rasterize the printable ASCII glyphs of the firmware font into masks
+static EFI_STATUS build_glyph_cache(struct gop_renderer *r, NEOBOOT_HII_FONT *font) {
+
+    HII_FONT_DISPLAY_INFO info;
+
+    // 白黒で描かせてマスクにする
+    ZeroMem(&info, sizeof(info));
+    info.ForegroundColor = screen_palette[EFI_WHITE];
+    info.BackgroundColor = screen_palette[EFI_BLACK];
+    info.FontInfoMask = HII_FONT_INFO_SYS_FONT | HII_FONT_INFO_SYS_SIZE | HII_FONT_INFO_SYS_STYLE;
+
+    for (UINTN c = GLYPH_FIRST; c <= GLYPH_LAST; c++) {
+
+        HII_IMAGE_OUTPUT *blt = NULL;
+        EFI_STATUS status;
+
+        status = uefi_call_wrapper(font->GetGlyph, 5, font, (CHAR16)c, &info, &blt, NULL);
+        if (EFI_ERROR(status) || blt == NULL) {
+            return EFI_UNSUPPORTED;
+        }
+
+        // セルの大きさは最初の文字で決める
+        if (r->glyphs == NULL) {
+            if (blt->Width == 0 || blt->Height == 0 || blt->Width > GLYPH_SIZE_MAX || blt->Height > GLYPH_SIZE_MAX) {
+                status = EFI_UNSUPPORTED;
+            } else {
+                r->cell_width = blt->Width;
+                r->cell_height = blt->Height;
+                r->glyphs = AllocateZeroPool(r->cell_width * r->cell_height * GLYPH_COUNT);
+                if (r->glyphs == NULL) {
+                    status = EFI_OUT_OF_RESOURCES;
+                }
+            }
+        }
+
+        // 幅の違う文字ははみ出さないように切る
+        if (!EFI_ERROR(status)) {
+            UINT8 *mask = r->glyphs + r->cell_width * r->cell_height * (c - GLYPH_FIRST);
+            for (UINTN y = 0; y < blt->Height && y < r->cell_height; y++) {
+                for (UINTN x = 0; x < blt->Width && x < r->cell_width; x++) {
+                    mask[y * r->cell_width + x] = blt->Image.Bitmap[y * blt->Width + x].Green >= 0x80;
+                }
+            }
+        }
+
+        FreePool(blt->Image.Bitmap);
+        FreePool(blt);
+
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Release the renderer
+static void free_renderer(struct gop_renderer *r) {
+
+    if (r->glyphs != NULL) {
+        FreePool(r->glyphs);
+    }
+    if (r->back_buffer != NULL) {
+        FreePool(r->back_buffer);
+    }
+    FreePool(r);
+}
+
+// Set up the GOP renderer
+static EFI_STATUS gop_init() {
+
+    EFI_STATUS status;
+    EFI_GUID gop_guid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
+    EFI_GUID font_guid = NEOBOOT_HII_FONT_GUID;
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *gop;
+    NEOBOOT_HII_FONT *font;
+    struct gop_renderer *r;
+
+    status = uefi_call_wrapper(BS->LocateProtocol, 3, &gop_guid, NULL, (VOID **)&gop);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    // フォントはファームウェアのものを使う
+    status = uefi_call_wrapper(BS->LocateProtocol, 3, &font_guid, NULL, (VOID **)&font);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    r = AllocateZeroPool(sizeof(struct gop_renderer));
+    if (r == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+    r->gop = gop;
+    r->width = gop->Mode->Info->HorizontalResolution;
+    r->height = gop->Mode->Info->VerticalResolution;
+    r->attribute = EFI_LIGHTGRAY | EFI_BACKGROUND_BLACK;
+
+    // BGRのフレームバッファーならBltを通さずに書く
+    r->direct = gop->Mode->Info->PixelFormat == PixelBlueGreenRedReserved8BitPerColor && gop->Mode->FrameBufferBase != 0;
+
+    status = build_glyph_cache(r, font);
+    if (EFI_ERROR(status)) {
+        free_renderer(r);
+        return status;
+    }
+
+    r->columns = r->width / r->cell_width;
+    r->rows = r->height / r->cell_height;
+    if (r->columns == 0 || r->rows == 0) {
+        free_renderer(r);
+        return EFI_UNSUPPORTED;
+    }
+
+    r->back_buffer = AllocateZeroPool(sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL) * r->width * r->height);
+    if (r->back_buffer == NULL) {
+        free_renderer(r);
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    renderer = r;
+
+    return EFI_SUCCESS;
+}
+
+// Choose the renderer, the text mode is used when GOP cannot be
+EFI_STATUS screen_init(BOOLEAN use_gop) {
+
+    EFI_STATUS status;
+
+    if (renderer != NULL || !use_gop) {
+        return EFI_SUCCESS;
+    }
+
+    status = gop_init();
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    // ファームウェアのカーソルが上に描かれないようにする
+    uefi_call_wrapper(ST->ConOut->EnableCursor, 2, ST->ConOut, FALSE);
+
+    return EFI_SUCCESS;
+}
+
+BOOLEAN screen_is_graphics() {
+    return renderer != NULL;
+}
+
+// Number of text columns and rows
+void screen_size(UINTN *columns, UINTN *rows) {
+
+    if (renderer != NULL) {
+        *columns = renderer->columns;
+        *rows = renderer->rows;
+        return;
+    }
+
+    if (EFI_ERROR(uefi_call_wrapper(ST->ConOut->QueryMode, 4, ST->ConOut, ST->ConOut->Mode->Mode, columns, rows))) {
+        *columns = 80;
+        *rows = 25;
+    }
+}
+
+// Add a rectangle to the damage
+static void damage_add(UINTN left, UINTN top, UINTN right, UINTN bottom) {
+
+    struct damage_rect *d = &renderer->damage;
+
+    if (d->right == d->left) {
+        d->left = left;
+        d->top = top;
+        d->right = right;
+        d->bottom = bottom;
+        return;
+    }
+
+    d->left = left < d->left ? left : d->left;
+    d->top = top < d->top ? top : d->top;
+    d->right = right > d->right ? right : d->right;
+    d->bottom = bottom > d->bottom ? bottom : d->bottom;
+}
+
+// Draw a glyph into the back buffer
+static void draw_glyph(UINTN column, UINTN row, CHAR16 c, UINTN attribute) {
+
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL fg = screen_palette[attribute & 0x0F];
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL bg = screen_palette[(attribute >> 4) & 0x07];
+    UINTN cw = renderer->cell_width;
+    UINTN ch = renderer->cell_height;
+    UINT8 *mask;
+
+    if (c < GLYPH_FIRST || c > GLYPH_LAST) {
+        c = GLYPH_REPLACEMENT;
+    }
+    mask = renderer->glyphs + cw * ch * (c - GLYPH_FIRST);
+
+    for (UINTN y = 0; y < ch; y++) {
+        EFI_GRAPHICS_OUTPUT_BLT_PIXEL *line = renderer->back_buffer + (row * ch + y) * renderer->width + column * cw;
+        for (UINTN x = 0; x < cw; x++) {
+            line[x] = mask[y * cw + x] ? fg : bg;
+        }
+    }
+}
+
+// Draw text into the back buffer from a cell, clipped at the right edge
+static UINTN draw_text(UINTN column, UINTN row, CHAR16 *text, UINTN attribute) {
+
+    UINTN start = column;
+
+    if (row >= renderer->rows) {
+        return 0;
+    }
+
+    for (; *text != '\0' && column < renderer->columns; text++, column++) {
+        draw_glyph(column, row, *text, attribute);
+    }
+
+    if (column > start) {
+        damage_add(start * renderer->cell_width, row * renderer->cell_height, column * renderer->cell_width, (row + 1) * renderer->cell_height);
+    }
+
+    return column - start;
+}
+
+// Fill the back buffer with the background of the attribute
+static void fill_back_buffer(UINTN attribute) {
+
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL bg = screen_palette[(attribute >> 4) & 0x07];
+    UINTN pixels = renderer->width * renderer->height;
+
+    for (UINTN i = 0; i < pixels; i++) {
+        renderer->back_buffer[i] = bg;
+    }
+
+    damage_add(0, 0, renderer->width, renderer->height);
+}
+
+// Send the damaged rectangle to the screen
+void screen_flush() {
+
+    struct damage_rect *d;
+
+    if (renderer == NULL) {
+        return;
+    }
+
+    d = &renderer->damage;
+    if (d->right == d->left || d->bottom == d->top) {
+        return;
+    }
+
+    if (renderer->direct) {
+
+        // 1行ずつフレームバッファーにコピー
+        EFI_GRAPHICS_OUTPUT_BLT_PIXEL *fb = (EFI_GRAPHICS_OUTPUT_BLT_PIXEL *)renderer->gop->Mode->FrameBufferBase;
+        UINTN pitch = renderer->gop->Mode->Info->PixelsPerScanLine;
+        for (UINTN y = d->top; y < d->bottom; y++) {
+            CopyMem(fb + y * pitch + d->left, renderer->back_buffer + y * renderer->width + d->left, sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL) * (d->right - d->left));
+        }
+
+    } else {
+        uefi_call_wrapper(renderer->gop->Blt, 10, renderer->gop, renderer->back_buffer, EfiBltBufferToVideo, d->left, d->top, d->left, d->top, d->right - d->left, d->bottom - d->top, sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL) * renderer->width);
+    }
+
+    ZeroMem(d, sizeof(struct damage_rect));
+}
+
+// Clear the screen and move the cursor home
+void screen_clear() {
+
+    if (renderer == NULL) {
+        uefi_call_wrapper(ST->ConOut->ClearScreen, 1, ST->ConOut);
+        return;
+    }
+
+    renderer->attribute = EFI_LIGHTGRAY | EFI_BACKGROUND_BLACK;
+    renderer->cursor_x = 0;
+    renderer->cursor_y = 0;
+    fill_back_buffer(renderer->attribute);
+    screen_flush();
+}
+
+// Print text at a cell with the attribute
+void screen_print_at(UINTN column, UINTN row, UINTN attribute, CHAR16 *text) {
+
+    if (renderer == NULL) {
+        uefi_call_wrapper(ST->ConOut->SetCursorPosition, 3, ST->ConOut, column, row);
+        uefi_call_wrapper(ST->ConOut->SetAttribute, 2, ST->ConOut, attribute);
+        uefi_call_wrapper(ST->ConOut->OutputString, 2, ST->ConOut, text);
+        uefi_call_wrapper(ST->ConOut->SetAttribute, 2, ST->ConOut, EFI_LIGHTGRAY | EFI_BACKGROUND_BLACK);
+        return;
+    }
+
+    draw_text(column, row, text, attribute);
+    screen_flush();
+}
+
+// Scroll the text area up by a row
+static void scroll_up() {
+
+    UINTN row_pixels = renderer->width * renderer->cell_height;
+    UINTN text_pixels = row_pixels * renderer->rows;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL bg = screen_palette[(renderer->attribute >> 4) & 0x07];
+
+    CopyMem(renderer->back_buffer, renderer->back_buffer + row_pixels, sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL) * (text_pixels - row_pixels));
+    for (UINTN i = text_pixels - row_pixels; i < text_pixels; i++) {
+        renderer->back_buffer[i] = bg;
+    }
+
+    damage_add(0, 0, renderer->width, renderer->rows * renderer->cell_height);
+}
+
+// Write text at the cursor like OutputString
+static void screen_write(CHAR16 *text) {
+
+    if (renderer == NULL) {
+        uefi_call_wrapper(ST->ConOut->OutputString, 2, ST->ConOut, text);
+        return;
+    }
+
+    for (; *text != '\0'; text++) {
+        switch (*text) {
+            case CHAR_CARRIAGE_RETURN:
+                renderer->cursor_x = 0;
+                break;
+            case CHAR_LINEFEED:
+                renderer->cursor_y += 1;
+                if (renderer->cursor_y >= renderer->rows) {
+                    scroll_up();
+                    renderer->cursor_y = renderer->rows - 1;
+                }
+                break;
+            case CHAR_BACKSPACE:
+                if (renderer->cursor_x > 0) {
+                    renderer->cursor_x -= 1;
+                    draw_text(renderer->cursor_x, renderer->cursor_y, L" ", renderer->attribute);
+                }
+                break;
+            default:
+                // 右端で折り返す
+                if (renderer->cursor_x >= renderer->columns) {
+                    renderer->cursor_x = 0;
+                    renderer->cursor_y += 1;
+                }
+                if (renderer->cursor_y >= renderer->rows) {
+                    scroll_up();
+                    renderer->cursor_y = renderer->rows - 1;
+                }
+                CHAR16 c[2] = { *text, '\0' };
+                renderer->cursor_x += draw_text(renderer->cursor_x, renderer->cursor_y, c, renderer->attribute);
+                break;
+        }
+    }
+
+    screen_flush();
+}
+
+// Print formatted text at the cursor
+void screen_print(CHAR16 *format, ...) {
+
+    CHAR16 buffer[SCREEN_PRINT_MAX];
+    va_list marker;
+
+    va_start(marker, format);
+    VSPrint(buffer, sizeof(buffer), format, marker);
+    va_end(marker);
+
+    screen_write(buffer);
+}
@@ -0,0 +1,94 @@
+#ifndef _SCREEN_H
+#define _SCREEN_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// EFI_HII_FONT_PROTOCOL (UEFI Specification 34.1)
+// gnu-efiには含まれていないので定義する
+#define NEOBOOT_HII_FONT_GUID { 0xe9ca4775, 0x8657, 0x47fc, { 0x97, 0xe7, 0x7e, 0xd6, 0x5a, 0x08, 0x43, 0x24 } }
+
+#define HII_FONT_INFO_SYS_FONT 0x00000001
+#define HII_FONT_INFO_SYS_SIZE 0x00000002
+#define HII_FONT_INFO_SYS_STYLE 0x00000004
+
+typedef struct {
+    UINT32 FontStyle;
+    UINT16 FontSize;
+    CHAR16 FontName[1];
+} HII_FONT_INFO;
+
+typedef struct {
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL ForegroundColor;
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL BackgroundColor;
+    UINT32 FontInfoMask;
+    HII_FONT_INFO FontInfo;
+} HII_FONT_DISPLAY_INFO;
+
+typedef struct {
+    UINT16 Width;
+    UINT16 Height;
+    union {
+        EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Bitmap;
+        EFI_GRAPHICS_OUTPUT_PROTOCOL *Screen;
+    } Image;
+} HII_IMAGE_OUTPUT;
+
+typedef struct _NEOBOOT_HII_FONT {
+    VOID *StringToImage;
+    VOID *StringIdToImage;
+    EFI_STATUS (EFIAPI *GetGlyph)(struct _NEOBOOT_HII_FONT *This, CHAR16 Char, HII_FONT_DISPLAY_INFO *StringInfo, HII_IMAGE_OUTPUT **Blt, UINTN *Baseline);
+    VOID *GetFontInfo;
+} NEOBOOT_HII_FONT;
+
+// キャッシュする文字 (表示できるASCII)
+#define GLYPH_FIRST 0x20
+#define GLYPH_LAST 0x7E
+#define GLYPH_COUNT (GLYPH_LAST - GLYPH_FIRST + 1)
+
+// キャッシュにない文字の代わり
+#define GLYPH_REPLACEMENT '?'
+
+// 大きすぎるフォントは使わない
+#define GLYPH_SIZE_MAX 64
+
+// screen_printで一度に書ける文字数
+#define SCREEN_PRINT_MAX 512
+
+// DAMAGE_RECT
+// 次のflushで画面に送る範囲 (ピクセル、右と下は含まない)
+struct damage_rect {
+    UINTN left;
+    UINTN top;
+    UINTN right;
+    UINTN bottom;
+};
+
+// GOP_RENDERER
+struct gop_renderer {
+    EFI_GRAPHICS_OUTPUT_PROTOCOL *gop;
+
+    // 画面
+    UINTN width;
+    UINTN height;
+    BOOLEAN direct; // フレームバッファーに直接書けるか
+    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *back_buffer;
+
+    // 文字のセル
+    UINTN cell_width;
+    UINTN cell_height;
+    UINTN columns;
+    UINTN rows;
+
+    // 1ピクセル1バイトのマスク、0でなければ前景
+    UINT8 *glyphs;
+
+    // コンソールのカーソル
+    UINTN cursor_x;
+    UINTN cursor_y;
+    UINTN attribute;
+
+    struct damage_rect damage;
+};
+
+#endif
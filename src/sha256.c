@@ -0,0 +1,333 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// SIMD
+#include <immintrin.h>
+
+// NEOBOOT
+#include "sha256.h"
+#include "cpu.h"
+#ifdef NEOBOOT_HOST
+#include "host.h" // tools/でホスト向けにビルドする場合
+#else
+#include "proto.h"
+#endif
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const UINT32 sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static sha256_compress_function sha256_compress = NULL;
+static const CHAR16 *sha256_name = L"portable";
+
+// 64 rounds over a message schedule with the constants already added
+static inline __attribute__((always_inline)) void sha256_rounds(UINT32 h[8], const UINT32 wk[64]) {
+
+    UINT32 a = h[0], b = h[1], c = h[2], d = h[3];
+    UINT32 e = h[4], f = h[5], g = h[6], k = h[7];
+
+    for (UINTN t = 0; t < 64; t++) {
+        UINT32 s1 = SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25);
+        UINT32 ch = (e & f) ^ (~e & g);
+        UINT32 t1 = k + s1 + ch + wk[t];
+        UINT32 s0 = SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22);
+        UINT32 maj = (a & b) ^ (a & c) ^ (b & c);
+        UINT32 t2 = s0 + maj;
+
+        k = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+// Portable
+static void sha256_compress_portable(UINT32 h[8], const UINT8 *blocks, UINTN count) {
+
+    UINT32 w[64];
+
+    for (; count > 0; count--, blocks += SHA256_BLOCK_SIZE) {
+
+        for (UINTN t = 0; t < 16; t++) {
+            w[t] = ((UINT32)blocks[t * 4] << 24) | ((UINT32)blocks[t * 4 + 1] << 16) | ((UINT32)blocks[t * 4 + 2] << 8) | blocks[t * 4 + 3];
+        }
+        for (UINTN t = 16; t < 64; t++) {
+            UINT32 s0 = SHA256_ROTR(w[t - 15], 7) ^ SHA256_ROTR(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            UINT32 s1 = SHA256_ROTR(w[t - 2], 17) ^ SHA256_ROTR(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+        for (UINTN t = 0; t < 64; t++) {
+            w[t] += sha256_k[t];
+        }
+
+        sha256_rounds(h, w);
+    }
+}
+
+// AVX2
+// 2ブロックのメッセージスケジュールを上下の128bitで同時に計算し、ラウンドはBMI2のrorxで回す
+
+__attribute__((target("avx2,bmi2")))
+static inline __m256i sha256_rotr8x32(__m256i x, int n) {
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+__attribute__((target("avx2,bmi2")))
+static inline __m256i sha256_sigma1_8x32(__m256i x) {
+    return _mm256_xor_si256(_mm256_xor_si256(sha256_rotr8x32(x, 17), sha256_rotr8x32(x, 19)), _mm256_srli_epi32(x, 10));
+}
+
+__attribute__((target("avx2,bmi2")))
+static void sha256_compress_avx2(UINT32 h[8], const UINT8 *blocks, UINTN count) {
+
+    UINT32 wk[2][64];
+    const __m256i bswap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    const __m256i zero = _mm256_setzero_si256();
+
+    while (count > 0) {
+
+        // 1ブロックしか残っていなければ同じブロックを2回計算する
+        UINTN n = count >= 2 ? 2 : 1;
+        const UINT8 *second = blocks + SHA256_BLOCK_SIZE * (n - 1);
+        __m256i x[4];
+
+        for (UINTN i = 0; i < 4; i++) {
+            __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(blocks + i * 16))), _mm_loadu_si128((const __m128i *)(second + i * 16)), 1);
+            x[i] = _mm256_shuffle_epi8(v, bswap);
+        }
+
+        for (UINTN i = 0; i < 16; i++) {
+            __m256i k = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)&sha256_k[i * 4]));
+
+            if (i >= 4) {
+                // x[i & 3]はw[t-16..t-13]、x[(i + 3) & 3]はw[t-4..t-1]
+                __m256i w15 = _mm256_alignr_epi8(x[(i + 1) & 3], x[i & 3], 4);
+                __m256i w7 = _mm256_alignr_epi8(x[(i + 3) & 3], x[(i + 2) & 3], 4);
+                __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(sha256_rotr8x32(w15, 7), sha256_rotr8x32(w15, 18)), _mm256_srli_epi32(w15, 3));
+                __m256i v = _mm256_add_epi32(_mm256_add_epi32(x[i & 3], s0), w7);
+
+                // w[t+2]とw[t+3]はw[t]とw[t+1]に依存するので、2回に分けて足す
+                v = _mm256_add_epi32(v, _mm256_blend_epi32(sha256_sigma1_8x32(_mm256_shuffle_epi32(x[(i + 3) & 3], 0xFE)), zero, 0xCC));
+                v = _mm256_add_epi32(v, _mm256_blend_epi32(zero, sha256_sigma1_8x32(_mm256_shuffle_epi32(v, 0x40)), 0xCC));
+                x[i & 3] = v;
+            }
+
+            __m256i sum = _mm256_add_epi32(x[i & 3], k);
+            _mm_storeu_si128((__m128i *)&wk[0][i * 4], _mm256_castsi256_si128(sum));
+            _mm_storeu_si128((__m128i *)&wk[1][i * 4], _mm256_extracti128_si256(sum, 1));
+        }
+
+        sha256_rounds(h, wk[0]);
+        if (n == 2) {
+            sha256_rounds(h, wk[1]);
+        }
+
+        blocks += SHA256_BLOCK_SIZE * n;
+        count -= n;
+    }
+}
+
+// SHA-NI
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_compress_shani(UINT32 h[8], const UINT8 *blocks, UINTN count) {
+
+    const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i state0, state1, tmp;
+
+    // ABEFとCDGHの形にする
+    tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[0]), 0xB1);
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[4]), 0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; count > 0; count--, blocks += SHA256_BLOCK_SIZE) {
+
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+        __m128i m[4];
+
+        for (UINTN i = 0; i < 16; i++) {
+            __m128i wk;
+
+            if (i < 4) {
+                m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(blocks + i * 16)), bswap);
+            } else {
+                // m[i & 3]はw[i-4]、m[(i + 3) & 3]はw[i-1]
+                __m128i x = _mm_add_epi32(_mm_sha256msg1_epu32(m[i & 3], m[(i + 1) & 3]), _mm_alignr_epi8(m[(i + 3) & 3], m[(i + 2) & 3], 4));
+                m[i & 3] = _mm_sha256msg2_epu32(x, m[(i + 3) & 3]);
+            }
+
+            wk = _mm_add_epi32(m[i & 3], _mm_loadu_si128((const __m128i *)&sha256_k[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0E));
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+    // ABCDとEFGHに戻す
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i *)&h[0], state0);
+    _mm_storeu_si128((__m128i *)&h[4], state1);
+}
+
+// Choose the fastest implementation
+static void sha256_select() {
+
+    UINT32 features = cpu_features();
+
+    if ((features & (CPU_SHA | CPU_SSE41 | CPU_SSSE3)) == (CPU_SHA | CPU_SSE41 | CPU_SSSE3)) {
+        sha256_compress = sha256_compress_shani;
+        sha256_name = L"SHA-NI";
+    } else if ((features & (CPU_AVX2 | CPU_BMI2)) == (CPU_AVX2 | CPU_BMI2)) {
+        sha256_compress = sha256_compress_avx2;
+        sha256_name = L"AVX2";
+    } else {
+        sha256_compress = sha256_compress_portable;
+        sha256_name = L"portable";
+    }
+}
+
+// Use the implementation regardless of the CPU, for tests and benchmarks
+void sha256_force(UINT32 features) {
+
+    if (features & CPU_SHA) {
+        sha256_compress = sha256_compress_shani;
+        sha256_name = L"SHA-NI";
+    } else if (features & CPU_AVX2) {
+        sha256_compress = sha256_compress_avx2;
+        sha256_name = L"AVX2";
+    } else {
+        sha256_compress = sha256_compress_portable;
+        sha256_name = L"portable";
+    }
+}
+
+// Name of the selected implementation
+const CHAR16 *sha256_implementation() {
+
+    if (sha256_compress == NULL) {
+        sha256_select();
+    }
+
+    return sha256_name;
+}
+
+void sha256_init(struct sha256_state *state) {
+
+    static const UINT32 iv[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+    if (sha256_compress == NULL) {
+        sha256_select();
+    }
+
+    for (UINTN i = 0; i < 8; i++) {
+        state->h[i] = iv[i];
+    }
+    state->total = 0;
+    state->buffered = 0;
+}
+
+void sha256_update(struct sha256_state *state, const VOID *data, UINTN size) {
+
+    const UINT8 *p = data;
+
+    state->total += size;
+
+    // 前回の残りを埋める
+    if (state->buffered > 0) {
+        UINTN n = SHA256_BLOCK_SIZE - state->buffered;
+        if (n > size) {
+            n = size;
+        }
+        CopyMem(state->buffer + state->buffered, p, n);
+        state->buffered += n;
+        p += n;
+        size -= n;
+
+        if (state->buffered < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        sha256_compress(state->h, state->buffer, 1);
+        state->buffered = 0;
+    }
+
+    // 残りはバッファーを通さずにまとめて処理する
+    if (size >= SHA256_BLOCK_SIZE) {
+        sha256_compress(state->h, p, size / SHA256_BLOCK_SIZE);
+        p += size & ~(UINTN)(SHA256_BLOCK_SIZE - 1);
+        size &= SHA256_BLOCK_SIZE - 1;
+    }
+
+    if (size > 0) {
+        CopyMem(state->buffer, p, size);
+        state->buffered = size;
+    }
+}
+
+void sha256_final(struct sha256_state *state, UINT8 digest[SHA256_DIGEST_SIZE]) {
+
+    UINT64 bits = state->total * 8;
+    UINT8 pad[SHA256_BLOCK_SIZE * 2];
+    UINTN pad_size;
+
+    // 0x80と0を入れて、最後の8バイトにビット長を書く
+    pad_size = (state->buffered < SHA256_BLOCK_SIZE - 8 ? SHA256_BLOCK_SIZE : SHA256_BLOCK_SIZE * 2) - state->buffered;
+    ZeroMem(pad, pad_size);
+    pad[0] = 0x80;
+    for (UINTN i = 0; i < 8; i++) {
+        pad[pad_size - 1 - i] = (UINT8)(bits >> (i * 8));
+    }
+    sha256_update(state, pad, pad_size);
+
+    for (UINTN i = 0; i < 8; i++) {
+        digest[i * 4] = (UINT8)(state->h[i] >> 24);
+        digest[i * 4 + 1] = (UINT8)(state->h[i] >> 16);
+        digest[i * 4 + 2] = (UINT8)(state->h[i] >> 8);
+        digest[i * 4 + 3] = (UINT8)state->h[i];
+    }
+}
+
+// Parse a digest written as 64 hex digits
+BOOLEAN sha256_parse(const char *hex, UINT8 digest[SHA256_DIGEST_SIZE]) {
+
+    for (UINTN i = 0; i < SHA256_DIGEST_SIZE * 2; i++) {
+        char c = hex[i];
+        UINT8 v;
+
+        if (c >= '0' && c <= '9') {
+            v = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            v = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            v = c - 'A' + 10;
+        } else {
+            return FALSE;
+        }
+
+        digest[i / 2] = (i % 2 == 0) ? v << 4 : digest[i / 2] | v;
+    }
+
+    return hex[SHA256_DIGEST_SIZE * 2] == '\0';
+}
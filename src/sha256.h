@@ -0,0 +1,22 @@
+#ifndef _SHA256_H
+#define _SHA256_H
+
+#include <efi.h>
+#include <efilib.h>
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_DIGEST_SIZE 32
+
+// SHA256_STATE
+// 入力はチャンクごとに渡せる
+struct sha256_state {
+    UINT32 h[8];
+    UINT64 total;
+    UINT8 buffer[SHA256_BLOCK_SIZE];
+    UINT32 buffered;
+};
+
+// ブロックをまとめて処理する関数 (CPUによって選ぶ)
+typedef void (*sha256_compress_function)(UINT32 h[8], const UINT8 *blocks, UINTN count);
+
+#endif
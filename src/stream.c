@@ -0,0 +1,596 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "stream.h"
+#include "proto.h"
+
+// 全てのファイル読み込みで使う転送の単位
+static struct file_io file_io = { FILE_STREAM_CHUNK_SIZE, 0 };
+
+// Tune the transfer size to the volume that files are read from
+void file_io_configure(EFI_HANDLE volume) {
+
+    EFI_GUID block_io_guid = EFI_BLOCK_IO_PROTOCOL_GUID;
+    EFI_BLOCK_IO_PROTOCOL *block_io;
+    UINTN granularity = 0;
+
+    file_io.chunk_size = FILE_STREAM_CHUNK_SIZE;
+    file_io.io_align = 0;
+
+    if (EFI_ERROR(uefi_call_wrapper(BS->HandleProtocol, 3, volume, &block_io_guid, (VOID **)&block_io))) {
+        return;
+    }
+
+    file_io.io_align = block_io->Media->IoAlign;
+
+    // Revision 3から最適な転送の単位がわかる
+    if (block_io->Revision >= EFI_BLOCK_IO_PROTOCOL_REVISION3) {
+        granularity = (UINTN)block_io->Media->OptimalTransferLengthGranularity * block_io->Media->BlockSize;
+    }
+
+    // 単位の倍数に切り上げる
+    if (granularity != 0 && granularity <= FILE_STREAM_CHUNK_MAX) {
+        file_io.chunk_size = (FILE_STREAM_CHUNK_SIZE + granularity - 1) / granularity * granularity;
+        if (file_io.chunk_size > FILE_STREAM_CHUNK_MAX) {
+            file_io.chunk_size = FILE_STREAM_CHUNK_MAX / granularity * granularity;
+        }
+    }
+}
+
+// Transfer size for the file
+// ネイティブのリーダーは連続したクラスタやエクステントをまとめて読むので、最大の単位で渡す
+static UINTN file_chunk_size(EFI_FILE_PROTOCOL *file) {
+    return fat_is_native(file) || ext4_is_native(file) ? FILE_STREAM_CHUNK_MAX : file_io.chunk_size;
+}
+
+// Read bytes at the offset of the file in chunks, retrying failed ones
+EFI_STATUS read_file_at(EFI_FILE_PROTOCOL *file, UINT64 offset, UINTN size, VOID *buffer) {
+
+    EFI_STATUS status;
+    UINT8 *dst = buffer;
+    UINTN done = 0;
+    UINTN chunk_size = file_chunk_size(file);
+
+    while (done < size) {
+        UINTN chunk = size - done < chunk_size ? size - done : chunk_size;
+        UINTN read_size;
+
+        for (UINTN retry = 0; ; retry++) {
+
+            // 失敗した読み込みの後は位置がわからないので毎回シークする
+            status = uefi_call_wrapper(file->SetPosition, 2, file, offset + done);
+            if (!EFI_ERROR(status)) {
+                read_size = chunk;
+                status = uefi_call_wrapper(file->Read, 3, file, &read_size, dst + done);
+            }
+
+            if (status != EFI_DEVICE_ERROR || retry == FILE_READ_RETRIES) {
+                break;
+            }
+        }
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+
+        // ファイルが途中で終わっている
+        if (read_size == 0) {
+            return EFI_END_OF_FILE;
+        }
+
+        done += read_size;
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Allocate zeroed pages for a view of size bytes and a NULL end
+EFI_STATUS file_view_alloc(file_view *view, UINT64 size) {
+
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS address;
+
+    view->data = NULL;
+    view->size = 0;
+    view->no_of_pages = EFI_SIZE_TO_PAGES(size + 1);
+
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, view->no_of_pages, &address);
+    if (EFI_ERROR(status)) {
+        view->no_of_pages = 0;
+        return status;
+    }
+
+    view->data = (UINT8 *)address;
+    view->size = size;
+
+    // ファイルの後ろからページの終わりまでを0にする
+    mem_zero(view->data + size, view->no_of_pages * EFI_PAGE_SIZE - size);
+
+    return EFI_SUCCESS;
+}
+
+// Read the whole file into pages
+// max_size limits the file size, 0 means no limit
+EFI_STATUS map_file(EFI_FILE_PROTOCOL *root, CHAR16 *path, UINT64 max_size, file_view *view) {
+
+    EFI_STATUS status;
+    EFI_FILE_PROTOCOL *file;
+    EFI_FILE_INFO *info;
+    UINT64 size;
+
+    view->data = NULL;
+    view->size = 0;
+    view->no_of_pages = 0;
+
+    status = uefi_call_wrapper(root->Open, 5, root, &file, path, EFI_FILE_MODE_READ, 0);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    // Get the file size
+    info = LibFileInfo(file);
+    if (info == NULL) {
+        status = EFI_DEVICE_ERROR;
+        goto close;
+    }
+    size = info->FileSize;
+    FreePool(info);
+
+    if (max_size != 0 && size > max_size) {
+        status = EFI_BAD_BUFFER_SIZE;
+        goto close;
+    }
+
+    status = file_view_alloc(view, size);
+    if (EFI_ERROR(status)) {
+        goto close;
+    }
+
+    status = read_file_at(file, 0, size, view->data);
+    if (EFI_ERROR(status)) {
+        unmap_file(view);
+    }
+
+close:
+    uefi_call_wrapper(file->Close, 1, file);
+
+    return status;
+}
+
+// Free the pages of the view
+void unmap_file(file_view *view) {
+
+    if (view->no_of_pages != 0) {
+        uefi_call_wrapper(BS->FreePages, 2, (EFI_PHYSICAL_ADDRESS)view->data, view->no_of_pages);
+    }
+
+    view->data = NULL;
+    view->size = 0;
+    view->no_of_pages = 0;
+}
+
+// Issue a read of the next chunk into the buffer
+static void file_stream_issue(struct file_stream *stream, UINTN index) {
+
+    EFI_STATUS status;
+    EFI_FILE_IO_TOKEN *token = &stream->tokens[index];
+    UINT64 rest = stream->file_size - stream->position;
+    UINTN size = rest < stream->chunk_size ? rest : stream->chunk_size;
+
+    // ファイルの終わり
+    if (size == 0) {
+        stream->pending[index] = FALSE;
+        return;
+    }
+
+    token->Buffer = stream->dst != NULL ? stream->dst + stream->position : stream->buffers[index];
+    token->BufferSize = size;
+    token->Status = EFI_SUCCESS;
+    stream->pending[index] = TRUE;
+    stream->position += size;
+
+    // Asynchronous
+    if (stream->async) {
+        status = uefi_call_wrapper(stream->file->ReadEx, 2, stream->file, token);
+        if (!EFI_ERROR(status)) {
+            return;
+        }
+
+        // ReadExが使えなければ同期読み込みに切り替える
+        // 発行済みの読み込みの後から読むように位置を合わせる
+        stream->async = FALSE;
+        for (UINTN i = 0; i < FILE_STREAM_BUFFERS; i++) {
+            if (i != index && stream->pending[i]) {
+                UINTN event_index;
+                uefi_call_wrapper(BS->WaitForEvent, 3, 1, &stream->tokens[i].Event, &event_index);
+            }
+        }
+        uefi_call_wrapper(stream->file->SetPosition, 2, stream->file, stream->position - size);
+    }
+
+    // Synchronous
+    token->Status = uefi_call_wrapper(stream->file->Read, 3, stream->file, &token->BufferSize, token->Buffer);
+}
+
+// Open a stream on the file, the first chunks are requested right away
+EFI_STATUS file_stream_open(EFI_FILE_PROTOCOL *file, struct file_stream *stream) {
+    return file_stream_open_into(file, NULL, stream);
+}
+
+// Open a stream that reads the file straight into dst
+// dst must hold the whole file, chunks are returned in place
+EFI_STATUS file_stream_open_into(EFI_FILE_PROTOCOL *file, UINT8 *dst, struct file_stream *stream) {
+
+    EFI_STATUS status;
+    EFI_FILE_INFO *info;
+    UINTN align;
+
+    ZeroMem(stream, sizeof(struct file_stream));
+    stream->file = file;
+    stream->chunk_size = file_chunk_size(file);
+    stream->dst = dst;
+
+    // Get the file size
+    info = LibFileInfo(file);
+    if (info == NULL) {
+        return EFI_DEVICE_ERROR;
+    }
+    stream->file_size = info->FileSize;
+    FreePool(info);
+
+    // 先頭から読む
+    status = uefi_call_wrapper(file->SetPosition, 2, file, 0);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    // ページより大きいIoAlignは余分に確保して揃える
+    align = file_io.io_align > EFI_PAGE_SIZE ? file_io.io_align : 0;
+    stream->buffer_pages = EFI_SIZE_TO_PAGES(stream->chunk_size + align);
+
+    // Chunk buffers
+    for (UINTN i = 0; i < FILE_STREAM_BUFFERS && dst == NULL; i++) {
+        status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, stream->buffer_pages, &stream->allocations[i]);
+        if (EFI_ERROR(status)) {
+            stream->allocations[i] = 0;
+            file_stream_close(stream);
+            return status;
+        }
+        stream->buffers[i] = (UINT8 *)(align == 0 ? stream->allocations[i] : (stream->allocations[i] + align - 1) & ~((EFI_PHYSICAL_ADDRESS)align - 1));
+    }
+
+    // ReadEx is available from the revision 2
+    if (file->Revision >= EFI_FILE_PROTOCOL_REVISION2) {
+        stream->async = TRUE;
+        for (UINTN i = 0; i < FILE_STREAM_BUFFERS; i++) {
+            status = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL, &stream->tokens[i].Event);
+            if (EFI_ERROR(status)) {
+                stream->async = FALSE;
+                break;
+            }
+        }
+    }
+
+    // 返すバッファー以外は全て先読みに使う
+    for (UINTN i = 0; i < FILE_STREAM_BUFFERS - 1; i++) {
+        file_stream_issue(stream, i);
+    }
+    stream->next_issue = FILE_STREAM_BUFFERS - 1;
+
+    return EFI_SUCCESS;
+}
+
+// Wait for the next chunk and request one more
+// The chunk returned by the previous call is released
+EFI_STATUS file_stream_next(struct file_stream *stream, UINT8 **data, UINTN *size) {
+
+    EFI_STATUS status;
+    UINTN index = stream->current;
+    EFI_FILE_IO_TOKEN *token = &stream->tokens[index];
+
+    // End of file
+    if (!stream->pending[index]) {
+        *data = NULL;
+        *size = 0;
+        return EFI_SUCCESS;
+    }
+
+    // Wait for the chunk
+    if (stream->async) {
+        UINTN event_index;
+        status = uefi_call_wrapper(BS->WaitForEvent, 3, 1, &token->Event, &event_index);
+        if (EFI_ERROR(status)) {
+            return status;
+        }
+    }
+    stream->pending[index] = FALSE;
+
+    if (EFI_ERROR(token->Status)) {
+        return token->Status;
+    }
+    if (token->BufferSize == 0) {
+        return EFI_END_OF_FILE;
+    }
+
+    // 前に返したバッファーは空いたので次のチャンクを読む
+    stream->current = (index + 1) % FILE_STREAM_BUFFERS;
+    file_stream_issue(stream, stream->next_issue);
+    stream->next_issue = (stream->next_issue + 1) % FILE_STREAM_BUFFERS;
+
+    *data = token->Buffer;
+    *size = token->BufferSize;
+
+    return EFI_SUCCESS;
+}
+
+// Close the stream, the file stays open
+void file_stream_close(struct file_stream *stream) {
+
+    // 読み込み中のバッファーは解放できない
+    for (UINTN i = 0; i < FILE_STREAM_BUFFERS; i++) {
+        if (stream->pending[i] && stream->async) {
+            UINTN event_index;
+            uefi_call_wrapper(BS->WaitForEvent, 3, 1, &stream->tokens[i].Event, &event_index);
+        }
+        stream->pending[i] = FALSE;
+    }
+
+    for (UINTN i = 0; i < FILE_STREAM_BUFFERS; i++) {
+        if (stream->tokens[i].Event != NULL) {
+            uefi_call_wrapper(BS->CloseEvent, 1, stream->tokens[i].Event);
+            stream->tokens[i].Event = NULL;
+        }
+        if (stream->allocations[i] != 0) {
+            uefi_call_wrapper(BS->FreePages, 2, stream->allocations[i], stream->buffer_pages);
+            stream->allocations[i] = 0;
+            stream->buffers[i] = NULL;
+        }
+    }
+}
+
+// Read the whole file into dst, each chunk is hashed while the next one is being read
+// sha may be NULL
+EFI_STATUS read_file_into(EFI_FILE_PROTOCOL *file, UINT8 *dst, UINT64 size, struct sha256_state *sha) {
+
+    EFI_STATUS status;
+    struct file_stream stream;
+    UINT8 *chunk;
+    UINTN chunk_size;
+    UINT64 total = 0;
+
+    status = file_stream_open_into(file, dst, &stream);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    // dstに入りきらないファイルは読まない
+    if (stream.file_size != size) {
+        file_stream_close(&stream);
+        return EFI_BAD_BUFFER_SIZE;
+    }
+
+    while (TRUE) {
+        status = file_stream_next(&stream, &chunk, &chunk_size);
+        if (EFI_ERROR(status) || chunk_size == 0) {
+            break;
+        }
+
+        if (sha != NULL) {
+            sha256_update(sha, chunk, chunk_size);
+        }
+        total += chunk_size;
+    }
+
+    file_stream_close(&stream);
+
+    // 途中でファイルが短くなった
+    if (!EFI_ERROR(status) && total != size) {
+        status = EFI_END_OF_FILE;
+    }
+
+    return status;
+}
+
+// Decompress the whole file into dst while the next chunk is being read
+// The compressed data is hashed into sha if it is not NULL
+EFI_STATUS decompress_file(EFI_FILE_PROTOCOL *file, UINT32 format, UINT8 *dst, UINT64 size, struct sha256_state *sha) {
+
+    EFI_STATUS status;
+    struct file_stream stream;
+    struct decoder *dec;
+    UINT8 *chunk;
+    UINTN chunk_size;
+
+    // Huffman/FSEのテーブルがあるのでスタックには置かない
+    dec = AllocatePool(sizeof(struct decoder));
+    if (dec == NULL) {
+        return EFI_OUT_OF_RESOURCES;
+    }
+
+    status = decoder_init(dec, format, dst, size);
+    if (EFI_ERROR(status)) {
+        FreePool(dec);
+        return status;
+    }
+
+    status = file_stream_open(file, &stream);
+    if (EFI_ERROR(status)) {
+        decoder_finish(dec);
+        FreePool(dec);
+        return status;
+    }
+
+    // Decode each chunk as it arrives
+    while (TRUE) {
+        status = file_stream_next(&stream, &chunk, &chunk_size);
+        if (EFI_ERROR(status) || chunk_size == 0) {
+            break;
+        }
+
+        if (sha != NULL) {
+            sha256_update(sha, chunk, chunk_size);
+        }
+
+        status = decoder_feed(dec, chunk, chunk_size);
+        if (EFI_ERROR(status)) {
+            break;
+        }
+    }
+
+    file_stream_close(&stream);
+
+    if (EFI_ERROR(status)) {
+        decoder_finish(dec);
+    } else {
+        status = decoder_finish(dec);
+    }
+
+    // 展開後のサイズがヘッダーと一致する
+    if (!EFI_ERROR(status) && dec->pos != size) {
+        status = EFI_VOLUME_CORRUPTED;
+    }
+
+    FreePool(dec);
+
+    return status;
+}
+
+// Load a payload file such as image=, decompressing it if needed
+// If digest is not NULL, the file as stored on the disk must have this SHA-256
+EFI_STATUS load_payload(EFI_FILE_PROTOCOL *root, CHAR16 *path, const UINT8 *digest, payload *out) {
+
+    EFI_STATUS status;
+    EFI_FILE_PROTOCOL *file;
+    EFI_FILE_INFO *info;
+    UINT8 header[FRAME_HEADER_SIZE_MAX];
+    UINT64 file_size;
+    UINT64 content_size;
+    struct sha256_state sha;
+    UINT8 actual[SHA256_DIGEST_SIZE];
+
+    out->base = 0;
+    out->size = 0;
+    out->no_of_pages = 0;
+    out->format = FORMAT_RAW;
+
+    // Open the file
+    status = uefi_call_wrapper(root->Open, 5, root, &file, path, EFI_FILE_MODE_READ, 0);
+    if (EFI_ERROR(status)) {
+        Print(L"Cannot open %s: %r\n", path, status);
+        return status;
+    }
+
+    // Get the file size
+    info = LibFileInfo(file);
+    if (info == NULL) {
+        uefi_call_wrapper(file->Close, 1, file);
+        return EFI_DEVICE_ERROR;
+    }
+    file_size = info->FileSize;
+    FreePool(info);
+
+    // Check the format by the frame header
+    content_size = file_size;
+    if (file_size >= sizeof(header)) {
+        status = read_file_at(file, 0, sizeof(header), header);
+        if (EFI_ERROR(status)) {
+            goto close;
+        }
+
+        status = decoder_probe(header, sizeof(header), &out->format, &content_size);
+        if (status == EFI_UNSUPPORTED) {
+            Print(L"%s has no content size in the frame header\n", path);
+            goto close;
+        }
+        if (EFI_ERROR(status)) {
+            goto close;
+        }
+        if (out->format == FORMAT_RAW) {
+            content_size = file_size;
+        }
+    }
+
+    sha256_init(&sha);
+
+    // 空のファイル
+    out->size = content_size;
+    if (content_size == 0) {
+        goto verify;
+    }
+
+    // Allocate pages for the content (カーネルが2MiBのページでマップできるように揃える)
+    out->no_of_pages = EFI_SIZE_TO_PAGES(content_size);
+    status = allocate_aligned_pages(EfiLoaderData, out->no_of_pages, PAYLOAD_ALIGN, &out->base);
+    if (EFI_ERROR(status)) {
+        Print(L"Cannot allocate pages for %s: %r\n", path, status);
+        out->no_of_pages = 0;
+        goto close;
+    }
+
+    if (out->format == FORMAT_RAW) {
+        // 圧縮されていなければそのままページに読み込む
+        status = read_file_into(file, (UINT8 *)out->base, content_size, digest != NULL ? &sha : NULL);
+    } else {
+        status = decompress_file(file, out->format, (UINT8 *)out->base, content_size, digest != NULL ? &sha : NULL);
+    }
+
+    if (EFI_ERROR(status)) {
+        Print(L"Cannot load %s: %r\n", path, status);
+        free_payload(out);
+        goto close;
+    }
+
+verify:
+    if (digest != NULL) {
+        sha256_final(&sha, actual);
+        if (CompareMem(actual, digest, SHA256_DIGEST_SIZE) != 0) {
+            Print(L"SHA-256 of %s does not match\n", path);
+            status = EFI_SECURITY_VIOLATION;
+            free_payload(out);
+        }
+    }
+
+close:
+    uefi_call_wrapper(file->Close, 1, file);
+
+    return status;
+}
+
+// Free pages of the payload
+void free_payload(payload *p) {
+
+    if (p->no_of_pages != 0) {
+        uefi_call_wrapper(BS->FreePages, 2, p->base, p->no_of_pages);
+    }
+
+    p->base = 0;
+    p->size = 0;
+    p->no_of_pages = 0;
+}
+
+// Replace the file with the data
+EFI_STATUS write_file(EFI_FILE_PROTOCOL *root, CHAR16 *path, VOID *data, UINTN size) {
+
+    EFI_STATUS status;
+    EFI_FILE_PROTOCOL *file;
+
+    // 古い内容が残らないように一度削除する
+    status = uefi_call_wrapper(root->Open, 5, root, &file, path, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0);
+    if (!EFI_ERROR(status)) {
+        uefi_call_wrapper(file->Delete, 1, file);
+    }
+
+    status = uefi_call_wrapper(root->Open, 5, root, &file, path, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+
+    status = uefi_call_wrapper(file->Write, 3, file, &size, data);
+    if (EFI_ERROR(status)) {
+        uefi_call_wrapper(file->Close, 1, file);
+        return status;
+    }
+
+    return uefi_call_wrapper(file->Close, 1, file);
+}
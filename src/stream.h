@@ -0,0 +1,156 @@
+#ifndef _STREAM_H
+#define _STREAM_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// 1回の読み込みサイズ (メディアに合わせて切り上げる)
+#define FILE_STREAM_CHUNK_SIZE (256 * 1024)
+#define FILE_STREAM_CHUNK_MAX (4 * 1024 * 1024)
+
+// バッファーの数、1つを処理している間に残りを先読みする
+#define FILE_STREAM_BUFFERS 3
+
+// 読み込みに失敗した時にやり直す回数
+#define FILE_READ_RETRIES 3
+
+// FILE_IO
+// 読み込むボリュームに合わせた転送の単位
+struct file_io {
+    UINTN chunk_size; // OptimalTransferLengthGranularityの倍数
+    UINT32 io_align;
+};
+
+// FILE_STREAM
+// バッファーを順番に使い、処理している間に次のチャンクを読み込む
+struct file_stream {
+    EFI_FILE_PROTOCOL *file;
+    UINT64 file_size;
+    UINT64 position; // 読み込みを発行したバイト数
+    BOOLEAN async; // ReadExが使えるか
+    UINTN chunk_size;
+    UINT8 *dst; // NULLでなければバッファーを使わずにここへ直接読み込む
+    UINTN buffer_pages;
+    EFI_PHYSICAL_ADDRESS allocations[FILE_STREAM_BUFFERS];
+    UINT8 *buffers[FILE_STREAM_BUFFERS]; // IoAlignに揃えたアドレス
+    EFI_FILE_IO_TOKEN tokens[FILE_STREAM_BUFFERS];
+    BOOLEAN pending[FILE_STREAM_BUFFERS];
+    UINTN current; // 次に返すバッファー
+    UINTN next_issue; // 次に読み込みを発行するバッファー
+};
+
+// FILE_VIEW
+// ページに読み込んだファイル全体、後ろはページの終わりまで0で埋める
+typedef struct _FILE_VIEW {
+    UINT8 *data;
+    UINT64 size;
+    UINTN no_of_pages;
+} file_view;
+
+// 圧縮形式
+#define FORMAT_RAW 0
+#define FORMAT_LZ4 1
+#define FORMAT_ZSTD 2
+
+// Magic numbers
+#define LZ4_MAGIC 0x184D2204
+#define ZSTD_MAGIC 0xFD2FB528
+#define SKIPPABLE_MAGIC 0x184D2A50 // 下位4bitは任意
+#define SKIPPABLE_MASK 0xFFFFFFF0
+
+// ブロックの最大サイズ
+#define ZSTD_BLOCK_SIZE_MAX (128 * 1024)
+#define LZ4_BLOCK_SIZE_MAX (4 * 1024 * 1024)
+
+// 圧縮データのヘッダーを判別するのに必要なサイズ
+#define FRAME_HEADER_SIZE_MAX 19
+
+// 次に来るデータ
+#define STAGE_FRAME 0
+#define STAGE_BLOCK 1
+#define STAGE_CHECKSUM 2
+#define STAGE_SKIP 3
+
+// zstd tables
+#define HUF_LOG_MAX 11
+#define LL_LOG_MAX 9
+#define ML_LOG_MAX 9
+#define OF_LOG_MAX 8
+
+// FSE decoding table
+typedef struct {
+    UINT8 symbol;
+    UINT8 nb_bits;
+    UINT16 new_state;
+} fse_entry;
+
+// Huffman decoding table
+typedef struct {
+    UINT8 symbol;
+    UINT8 nb_bits;
+} huf_entry;
+
+// xxHash
+struct xxh64_state {
+    UINT64 v[4];
+    UINT64 total;
+    UINT8 buffer[32];
+    UINT32 buffered;
+};
+
+struct xxh32_state {
+    UINT32 v[4];
+    UINT64 total;
+    UINT8 buffer[16];
+    UINT32 buffered;
+};
+
+// DECODER
+// 出力先は連続したメモリーで、既に展開したデータをそのまま辞書として使う
+struct decoder {
+    UINT32 format;
+
+    // 出力先
+    UINT8 *dst;
+    UINT64 capacity;
+    UINT64 pos;
+    UINT64 frame_start;
+
+    // ブロックがチャンクをまたぐ場合のバッファー
+    UINT8 *staging;
+    UINTN staging_size;
+    UINTN staged;
+
+    // 状態
+    UINT32 stage;
+    UINT64 skip;
+    UINTN no_of_frames;
+    BOOLEAN content_checksum;
+    BOOLEAN block_checksum;
+
+    // zstd
+    UINT64 rep[3];
+    UINT8 *literals;
+    huf_entry huf_table[1 << HUF_LOG_MAX];
+    UINT32 huf_log;
+    BOOLEAN huf_valid;
+    fse_entry ll_table[1 << LL_LOG_MAX];
+    fse_entry of_table[1 << OF_LOG_MAX];
+    fse_entry ml_table[1 << ML_LOG_MAX];
+    UINT32 ll_log, of_log, ml_log;
+    BOOLEAN ll_valid, of_valid, ml_valid;
+    struct xxh64_state xxh64;
+
+    // lz4
+    struct xxh32_state xxh32;
+};
+
+// 読み込まれたペイロード
+typedef struct _PAYLOAD {
+    EFI_PHYSICAL_ADDRESS base;
+    UINT64 size;
+    UINTN no_of_pages;
+    UINT32 format;
+} payload;
+
+#endif
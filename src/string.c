@@ -0,0 +1,92 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#ifdef NEOBOOT_HOST
+#include "host.h" // tools/でホスト向けにビルドする場合
+#else
+#include "proto.h"
+#endif
+
+// Strlen
+unsigned int my_strlen(const char *str) {
+    return mem_span(str, "");
+}
+
+// Strcpy
+char *my_strcpy(char *dest, const char *src) {
+
+    // 終端文字もコピーする
+    mem_copy(dest, src, mem_span(src, "") + 1);
+
+    return dest;
+}
+
+// Strchr
+char *my_strchr(const char *str, int c) {
+
+    // 終端文字を探している場合は終端で止まる
+    char stops[2] = { (char)c, '\0' };
+    const char *p = str + mem_span(str, stops);
+
+    if (*p == (char)c) {
+        return (char *)p;
+    }
+
+    return NULL;
+}
+
+// Strdup
+char *my_strdup(const char *s) {
+
+    // Caluclate size of string
+    UINTN len = mem_span(s, "");
+
+    // Reserve memory
+    char *dup = (char *)AllocatePool(len + 1);
+    if (dup == NULL) {
+        return NULL;
+    }
+
+    // Copy string with the NULL end
+    mem_copy(dup, s, len + 1);
+
+    return dup;
+}
+
+// Convert a path in the config file to a EFI file path
+CHAR16 *to_efi_path(const char *path) {
+
+    UINTN length = my_strlen(path);
+    UINTN j = 0;
+
+    // AllocatePoolでメモリーを確保
+    CHAR16 *efi_path = AllocatePool((length + 2) * sizeof(CHAR16));
+    if (efi_path == NULL) {
+        return NULL;
+    }
+
+    // ルートから始める
+    if (path[0] != '\\' && path[0] != '/') {
+        efi_path[j++] = '\\';
+    }
+
+    for (UINTN i = 0; i < length; i++) {
+
+        // "/"は"\"として扱う
+        CHAR16 c = (path[i] == '/') ? '\\' : path[i];
+
+        // "\\"のような連続した区切りは1つにまとめる
+        if (c == '\\' && j > 0 && efi_path[j - 1] == '\\') {
+            continue;
+        }
+
+        efi_path[j++] = c;
+    }
+
+    // 終端の設定
+    efi_path[j] = '\0';
+
+    return efi_path;
+}
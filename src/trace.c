@@ -0,0 +1,146 @@
+// GNU_EFI
+#include <efi.h>
+#include <efilib.h>
+
+// NEOBOOT
+#include "trace.h"
+#include "proto.h"
+
+static struct trace_header *boot_trace = NULL;
+
+// フェーズの名前
+static const CHAR16 *trace_names[TRACE_PHASES] = {
+    L"boot",
+    L"config discovery",
+    L"config parse",
+    L"disk enumeration",
+    L"memmap",
+    L"menu",
+    L"kernel load",
+    L"image load",
+    L"handoff",
+    L"exit boot services",
+};
+
+// Read the time stamp counter
+static UINT64 read_tsc() {
+    UINT32 low, high;
+    __asm__ volatile ("rdtsc" : "=a"(low), "=d"(high));
+    return ((UINT64)high << 32) | low;
+}
+
+// Size of the trace buffer
+static UINTN trace_size() {
+    return sizeof(struct trace_header) + sizeof(struct trace_event) * TRACE_EVENTS_MAX;
+}
+
+// Allocate the buffer and calibrate the TSC against Stall
+EFI_STATUS trace_init() {
+
+    EFI_STATUS status;
+    EFI_PHYSICAL_ADDRESS address;
+    EFI_GUID trace_guid = TRACE_TABLE_GUID;
+    UINT64 start, end;
+
+    // カーネルに渡すのでページに置く
+    status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, EFI_SIZE_TO_PAGES(trace_size()), &address);
+    if (EFI_ERROR(status)) {
+        return status;
+    }
+    boot_trace = (struct trace_header *)address;
+    ZeroMem(boot_trace, trace_size());
+
+    boot_trace->magic = TRACE_MAGIC;
+    boot_trace->version = TRACE_VERSION;
+    boot_trace->event_size = sizeof(struct trace_event);
+    boot_trace->max_events = TRACE_EVENTS_MAX;
+
+    // Calibrate
+    start = read_tsc();
+    uefi_call_wrapper(BS->Stall, 1, TRACE_CALIBRATION_US);
+    end = read_tsc();
+    boot_trace->tsc_frequency = (end - start) * (1000000 / TRACE_CALIBRATION_US);
+    boot_trace->tsc_start = start;
+
+    // カーネルは構成テーブルから見つける
+    status = uefi_call_wrapper(BS->InstallConfigurationTable, 2, &trace_guid, boot_trace);
+    if (EFI_ERROR(status)) {
+        Print(L"Cannot install the boot trace: %r\n", status);
+    }
+
+    return EFI_SUCCESS;
+}
+
+// Record an event
+static void trace_record(UINT16 phase, UINT16 kind) {
+
+    if (boot_trace == NULL || boot_trace->no_of_events >= boot_trace->max_events) {
+        return;
+    }
+
+    struct trace_event *event = (struct trace_event *)(boot_trace + 1) + boot_trace->no_of_events;
+    event->tsc = read_tsc();
+    event->phase = phase;
+    event->kind = kind;
+    boot_trace->no_of_events += 1;
+}
+
+void trace_begin(UINT16 phase) {
+    trace_record(phase, TRACE_BEGIN);
+}
+
+void trace_end(UINT16 phase) {
+    trace_record(phase, TRACE_END);
+}
+
+// The trace buffer given to the kernel, NULL if there is none
+VOID *trace_buffer() {
+    return boot_trace;
+}
+
+// Convert TSC ticks to microseconds
+UINT64 trace_to_us(UINT64 ticks) {
+
+    if (boot_trace == NULL || boot_trace->tsc_frequency == 0) {
+        return 0;
+    }
+
+    return ticks * 1000000 / boot_trace->tsc_frequency;
+}
+
+// Print the time of each phase
+void trace_print() {
+
+    struct trace_event *events;
+
+    if (boot_trace == NULL) {
+        return;
+    }
+    events = (struct trace_event *)(boot_trace + 1);
+
+    Print(L"\nBoot Trace (TSC %lu kHz)\n", boot_trace->tsc_frequency / 1000);
+
+    // 終了イベントに対応する開始イベントを探す
+    for (UINT32 i = 0; i < boot_trace->no_of_events; i++) {
+        if (events[i].kind != TRACE_END) {
+            continue;
+        }
+        for (UINT32 j = i; j-- > 0;) {
+            if (events[j].phase == events[i].phase && events[j].kind == TRACE_BEGIN) {
+                UINT64 us = trace_to_us(events[i].tsc - events[j].tsc);
+                Print(L"  %s: %lu.%03lu ms (at %lu us)\n", trace_names[events[i].phase], us / 1000, us % 1000, trace_to_us(events[j].tsc - boot_trace->tsc_start));
+                break;
+            }
+        }
+    }
+}
+
+// Write the trace next to the memory map
+EFI_STATUS trace_save(EFI_FILE_PROTOCOL *esp_root) {
+
+    if (boot_trace == NULL) {
+        return EFI_NOT_READY;
+    }
+
+    return write_file(esp_root, L"\\boottrace", boot_trace, sizeof(struct trace_header) + sizeof(struct trace_event) * boot_trace->no_of_events);
+}
@@ -0,0 +1,57 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <efi.h>
+#include <efilib.h>
+
+// "NBTR"
+#define TRACE_MAGIC 0x5254424E
+#define TRACE_VERSION 1
+
+// カーネルが構成テーブルからトレースを見つけるためのGUID
+#define TRACE_TABLE_GUID { 0x6e627472, 0x6163, 0x4565, { 0x9b, 0x2f, 0x51, 0x0d, 0x73, 0xa4, 0xe8, 0x16 } }
+
+// 記録できるイベントの数
+#define TRACE_EVENTS_MAX 256
+
+// TSCの校正に使う時間 (マイクロ秒)
+#define TRACE_CALIBRATION_US 1000
+
+// フェーズ
+#define TRACE_BOOT 0
+#define TRACE_CONFIG_DISCOVERY 1
+#define TRACE_CONFIG_PARSE 2
+#define TRACE_DISK_ENUMERATION 3
+#define TRACE_MEMMAP 4
+#define TRACE_MENU 5
+#define TRACE_KERNEL_LOAD 6
+#define TRACE_IMAGE_LOAD 7
+#define TRACE_HANDOFF 8
+#define TRACE_EXIT_BOOT_SERVICES 9 // ExitBootServicesからカーネルまで (カーネルだけが読める)
+#define TRACE_PHASES 10
+
+// イベントの種類
+#define TRACE_BEGIN 0
+#define TRACE_END 1
+
+// TRACE_EVENT
+struct trace_event {
+    UINT64 tsc;
+    UINT16 phase;
+    UINT16 kind;
+    UINT32 reserved;
+};
+
+// TRACE_HEADER
+// このヘッダーの後にイベントが続く
+struct trace_header {
+    UINT32 magic;
+    UINT16 version;
+    UINT16 event_size;
+    UINT64 tsc_frequency; // Hz
+    UINT64 tsc_start;
+    UINT32 no_of_events;
+    UINT32 max_events;
+};
+
+#endif
@@ -0,0 +1,288 @@
+// NEOBOOT Host Benchmark
+// 文字列、コンフィグのパーサー、メモリーのコピーと0埋め、CRC32、SHA-256をホストで測る
+//
+// Usage: bench [entries]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "host.h"
+
+// 1つのベンチマークを最低この時間だけ回す
+#define BENCH_MIN_NS 200000000ULL
+
+static UINT64 now_ns() {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (UINT64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Generate a config with a global section and the entries
+static char *synthetic_config(UINTN entries, UINTN *size) {
+
+    UINTN capacity = 256 + entries * 256;
+    char *text = malloc(capacity);
+    UINTN length = 0;
+
+    if (text == NULL) {
+        return NULL;
+    }
+
+    length += snprintf(text + length, capacity - length, "# global\nimage=none\ntimeout=5\nrenderer=gop\n\n");
+    for (UINTN i = 0; i < entries; i++) {
+        length += snprintf(text + length, capacity - length,
+            "[entry]\nname = My OS %lu\nkernel=/boot/kernel-%lu.elf, image=/boot/image-%lu.zst\nflags=\"debug,verbose\" # comment\r\n\n",
+            (unsigned long)i, (unsigned long)i, (unsigned long)i);
+    }
+
+    *size = length;
+
+    return text;
+}
+
+// Parse the config again and again
+static int bench_parser(UINTN entries) {
+
+    UINTN size;
+    char *text = synthetic_config(entries, &size);
+    char *work = malloc(size + 1);
+    UINT64 elapsed = 0, start;
+    UINTN runs = 0, allocations = 0, bytes = 0;
+    UINTN found = 0;
+
+    if (text == NULL || work == NULL) {
+        return 0;
+    }
+
+    // パーサーはテキストを書き換えるので毎回コピーする
+    while (elapsed < BENCH_MIN_NS) {
+        memcpy(work, text, size + 1);
+
+        UINTN base_allocations = host_pool_allocations;
+        UINTN base_bytes = host_pool_bytes;
+
+        start = now_ns();
+        Config *config = config_file_parser(work);
+        elapsed += now_ns() - start;
+
+        if (config == NULL) {
+            fprintf(stderr, "Cannot parse the synthetic config\n");
+            return 0;
+        }
+        allocations = host_pool_allocations - base_allocations;
+        bytes = host_pool_bytes - base_bytes;
+        runs++;
+
+        free_config(config);
+    }
+
+    printf("parse     %7lu entries %9.3f ms %8.1f MB/s %6lu allocations %9lu bytes\n", (unsigned long)entries,
+        elapsed / 1e6 / runs, (double)size * runs / (elapsed / 1e9) / 1e6, (unsigned long)allocations, (unsigned long)bytes);
+
+    // Lookups of every entry
+    memcpy(work, text, size + 1);
+    Config *config = config_file_parser(work);
+    runs = 0;
+    elapsed = 0;
+    while (elapsed < BENCH_MIN_NS) {
+        start = now_ns();
+        for (UINTN i = 1; i <= entries; i++) {
+            found += config_entry_value(config, i, "kernel") != NULL;
+            found += config_entry_value(config, i, "image") != NULL; // グローバルと同じキー
+            found += config_entry_value(config, i, "missing") != NULL;
+        }
+        elapsed += now_ns() - start;
+        runs++;
+    }
+    free_config(config);
+
+    printf("lookup    %7lu entries %9.1f ns/lookup (%lu found)\n", (unsigned long)entries, (double)elapsed / (runs * entries * 3), (unsigned long)found / runs);
+
+    free(work);
+    free(text);
+
+    return 1;
+}
+
+// my_strlen and my_strchr over a long string
+static void bench_strings() {
+
+    UINTN size = 1024 * 1024;
+    char *text = malloc(size + 1);
+    UINT64 elapsed = 0, start;
+    UINTN runs = 0, total = 0;
+
+    memset(text, 'a', size);
+    text[size] = '\0';
+
+    while (elapsed < BENCH_MIN_NS) {
+        start = now_ns();
+        total += my_strlen(text);
+        elapsed += now_ns() - start;
+        runs++;
+    }
+    printf("my_strlen %17.1f MB/s\n", (double)size * runs / (elapsed / 1e9) / 1e6);
+
+    elapsed = 0;
+    runs = 0;
+    while (elapsed < BENCH_MIN_NS) {
+        start = now_ns();
+        total += my_strchr(text, '=') == NULL;
+        elapsed += now_ns() - start;
+        runs++;
+    }
+    printf("my_strchr %17.1f MB/s\n", (double)size * runs / (elapsed / 1e9) / 1e6);
+
+    // 最適化で消されないように使う
+    if (total == 0) {
+        printf("\n");
+    }
+
+    free(text);
+}
+
+// Copy and zero with every implementation the CPU has, in cache and beyond it
+static void bench_memory() {
+
+    UINTN sizes[] = { 64 * 1024, 64 * 1024 * 1024 };
+    UINT32 features = cpu_features();
+    UINT32 levels[] = { 0, CPU_SSE2, features & CPU_AVX2 };
+
+    for (UINTN s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        UINTN size = sizes[s];
+        UINT8 *src = malloc(size);
+        UINT8 *dst = malloc(size);
+
+        memset(src, 0x5A, size);
+        memset(dst, 0, size);
+
+        for (UINTN level = 0; level < sizeof(levels) / sizeof(levels[0]); level++) {
+            UINT64 copy_ns = 0, zero_ns = 0, start;
+            UINTN copy_runs = 0, zero_runs = 0;
+
+            if (level != 0 && levels[level] == 0) {
+                continue;
+            }
+            mem_force(levels[level]);
+
+            while (copy_ns < BENCH_MIN_NS) {
+                start = now_ns();
+                mem_copy(dst, src, size);
+                copy_ns += now_ns() - start;
+                copy_runs++;
+            }
+            while (zero_ns < BENCH_MIN_NS) {
+                start = now_ns();
+                mem_zero(dst, size);
+                zero_ns += now_ns() - start;
+                zero_runs++;
+            }
+
+            const CHAR16 *name = mem_implementation();
+            printf("mem ");
+            for (UINTN i = 0; name[i] != 0; i++) {
+                putchar(name[i]);
+            }
+            printf("%*s%6lu KiB copy %8.1f MB/s zero %8.1f MB/s\n", (int)(6 - StrLen(name)), "", (unsigned long)(size / 1024),
+                (double)size * copy_runs / (copy_ns / 1e9) / 1e6, (double)size * zero_runs / (zero_ns / 1e9) / 1e6);
+        }
+
+        free(src);
+        free(dst);
+    }
+
+    mem_init();
+}
+
+// CRC32 and every SHA-256 implementation the CPU has
+static void bench_hashes() {
+
+    UINTN size = 4 * 1024 * 1024;
+    UINT8 *data = malloc(size);
+    UINT8 digest[SHA256_DIGEST_SIZE];
+    UINT32 crc = 0;
+    UINT64 elapsed = 0, start;
+    UINTN runs = 0;
+    UINT32 features = cpu_features();
+    UINT32 avx2 = (features & (CPU_AVX2 | CPU_BMI2)) == (CPU_AVX2 | CPU_BMI2) ? CPU_AVX2 : 0;
+    UINT32 sha = (features & (CPU_SHA | CPU_SSE41 | CPU_SSSE3)) == (CPU_SHA | CPU_SSE41 | CPU_SSSE3) ? CPU_SHA : 0;
+    UINT32 levels[] = { 0, avx2, sha };
+
+    for (UINTN i = 0; i < size; i++) {
+        data[i] = (UINT8)(i * 131 + (i >> 9));
+    }
+
+    while (elapsed < BENCH_MIN_NS) {
+        start = now_ns();
+        crc ^= crc32(data, size);
+        elapsed += now_ns() - start;
+        runs++;
+    }
+    printf("crc32     %17.1f MB/s\n", (double)size * runs / (elapsed / 1e9) / 1e6);
+
+    for (UINTN level = 0; level < sizeof(levels) / sizeof(levels[0]); level++) {
+
+        // CPUにない命令は測らない
+        if (level != 0 && levels[level] == 0) {
+            continue;
+        }
+        sha256_force(levels[level]);
+
+        elapsed = 0;
+        runs = 0;
+        while (elapsed < BENCH_MIN_NS) {
+            struct sha256_state state;
+            start = now_ns();
+            sha256_init(&state);
+            sha256_update(&state, data, size);
+            sha256_final(&state, digest);
+            elapsed += now_ns() - start;
+            runs++;
+        }
+
+        // ワイド文字の名前を表示する
+        const CHAR16 *name = sha256_implementation();
+        printf("sha256 ");
+        for (UINTN i = 0; name[i] != 0; i++) {
+            putchar(name[i]);
+        }
+        printf("%*s%.1f MB/s\n", (int)(19 - StrLen(name)), "", (double)size * runs / (elapsed / 1e9) / 1e6);
+    }
+    sha256_force(features);
+
+    if (crc == 0x12345678) {
+        printf("\n");
+    }
+
+    free(data);
+}
+
+int main(int argc, char **argv) {
+
+    UINTN entries = argc > 1 ? strtoul(argv[1], NULL, 10) : 0;
+
+    mem_init();
+
+    if (entries != 0) {
+        if (!bench_parser(entries)) {
+            return 1;
+        }
+    } else {
+        for (UINTN n = 1; n <= 100000; n *= 10) {
+            if (!bench_parser(n)) {
+                return 1;
+            }
+        }
+    }
+
+    bench_strings();
+    bench_memory();
+    bench_hashes();
+
+    return 0;
+}
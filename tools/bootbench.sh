@@ -0,0 +1,367 @@
+#!/bin/bash
+
+# NEOBOOT Boot Benchmark
+# 合成したディスク構成でQEMU/OVMFを繰り返し起動し、シリアル出力のBoot Traceから各フェーズの時間を集める
+#
+# Usage: tools/bootbench.sh run [-n RUNS] [-l LAYOUT,...]
+#        tools/bootbench.sh compare OLD.csv NEW.csv
+#        tools/bootbench.sh layouts
+#
+# 必要なもの: qemu-system-x86_64, OVMF, sgdisk, mtools, cc, objcopy, zstd, lz4
+# 先に build.sh build でローダーをビルドしておく
+
+set -e
+
+# sortとjoinの順序を揃える
+export LC_ALL=C
+
+# ディレクトリ
+script_dir="$(dirname "$(dirname "$(readlink -f "$0")")")"
+BUILD_DIR="${script_dir}/build"
+BENCH_DIR="${BUILD_DIR}/bench"
+
+# ローダーとコンフィグコンパイラー (build.shと同じ場所)
+LOADER_PATH="${BUILD_DIR}/loader.efi"
+NEOCFG_PATH="${BUILD_DIR}/neocfg"
+
+# ファームウェア、環境変数で変えられる
+OVMF="${OVMF:-${BUILD_DIR}/fw/OVMF.fd}"
+
+# 1回の起動を待つ秒数
+BOOT_TIMEOUT="${BOOT_TIMEOUT:-120}"
+
+# 全ての構成
+LAYOUTS="basic many-disks many-volumes large-kernel compressed big-config big-config-binary"
+
+# GPTのパーティションエントリー数
+GPT_ENTRIES=128
+
+# Create an empty disk with a GPT
+function new_disk() {
+    rm -f "$1"
+    truncate -s "$2"M "$1"
+    sgdisk -o -a 2048 "$1" > /dev/null
+    sgdisk --resize-table="${GPT_ENTRIES}" "$1" > /dev/null
+}
+
+# Add a FAT partition (disk, number, start MiB, size MiB, type, name)
+# FAT32は小さいボリュームに使えないので、ESP以外はmtoolsに任せる
+function add_volume() {
+    local disk="$1" number="$2" start="$3" size="$4" type="$5" name="$6"
+    local fat=()
+
+    sgdisk -n "${number}:$(( start * 2048 )):+${size}M" -t "${number}:${type}" -c "${number}:${name}" "${disk}" > /dev/null
+    if [ "${type}" = "ef00" ]; then
+        fat=(-F)
+    fi
+    mformat -i "${disk}@@${start}M" "${fat[@]}" -h 64 -s 32 -T $(( size * 2048 )) -v "${name}" ::
+}
+
+# Copy a file into the volume at start MiB
+function put_file() {
+    mcopy -o -i "$1@@$2M" "$3" "::$4"
+}
+
+# Put the loader into the ESP
+function put_loader() {
+    mmd -i "$1@@$2M" ::/EFI ::/EFI/BOOT
+    put_file "$1" "$2" "${LOADER_PATH}" /EFI/BOOT/BOOTX64.efi
+}
+
+# Build an x86_64 ELF kernel with a PT_LOAD of size MiB
+# 前半は乱数、後半は0なので圧縮率はおよそ2倍
+function make_kernel() {
+    local out="$1" size=$(( $2 * 1024 * 1024 ))
+    local work="${BENCH_DIR}/kernel-src"
+
+    mkdir -p "${work}"
+    cat > "${work}/kernel.c" << EOF
+unsigned char payload[${size}] = { 1 };
+void _start(void) {
+    for (;;) {
+    }
+}
+EOF
+    cc -O0 -static -nostdlib -no-pie -fno-pic -Wl,-Ttext-segment=0x200000 -Wl,--build-id=none "${work}/kernel.c" -o "${out}"
+
+    { head -c $(( size / 2 )) /dev/urandom; head -c $(( size - size / 2 )) /dev/zero; } > "${work}/data.bin"
+    objcopy --update-section .data="${work}/data.bin" "${out}"
+}
+
+# Write a config with the entries (path, number of entries, kernel, image)
+function make_config() {
+    {
+        echo "# bootbench"
+        echo "timeout=0"
+        echo "image=$4"
+        for (( i = 0; i < $2; i++ )); do
+            echo ""
+            echo "[entry]"
+            echo "name=bench ${i}"
+            echo "kernel=$3"
+            echo "flags=\"quiet,entry=${i}\""
+        done
+    } > "$1"
+}
+
+# Build the disks of the layout into the directory
+# 起動するディスクを最初に書く
+function make_layout() {
+    local layout="$1" dir="$2"
+    local files="${dir}/files"
+
+    rm -rf "${dir}"
+    mkdir -p "${files}"
+
+    case "${layout}" in
+        basic)
+            make_kernel "${files}/kernel.elf" 4
+            make_config "${files}/config.cfg" 1 /kernel.elf none
+            new_disk "${dir}/disk0.img" 300
+            add_volume "${dir}/disk0.img" 1 1 256 ef00 NEOBOOT
+            put_loader "${dir}/disk0.img" 1
+            put_file "${dir}/disk0.img" 1 "${files}/config.cfg" /config.cfg
+            put_file "${dir}/disk0.img" 1 "${files}/kernel.elf" /kernel.elf
+            ;;
+
+        many-disks)
+            # ESPにはローダーだけ置き、コンフィグは最後のディスクの最後のボリュームに置く
+            make_kernel "${files}/kernel.elf" 4
+            make_config "${files}/config.cfg" 1 /kernel.elf none
+            new_disk "${dir}/disk0.img" 300
+            add_volume "${dir}/disk0.img" 1 1 256 ef00 NEOBOOT
+            put_loader "${dir}/disk0.img" 1
+            for (( d = 1; d < 8; d++ )); do
+                new_disk "${dir}/disk${d}.img" 80
+                for (( v = 0; v < 4; v++ )); do
+                    add_volume "${dir}/disk${d}.img" $(( v + 1 )) $(( 1 + v * 16 )) 16 0700 "DATA${d}${v}"
+                done
+            done
+            put_file "${dir}/disk7.img" 49 "${files}/config.cfg" /config.cfg
+            put_file "${dir}/disk7.img" 49 "${files}/kernel.elf" /kernel.elf
+            ;;
+
+        many-volumes)
+            # 1つのディスクに64個のボリューム、コンフィグは最後に置く
+            make_kernel "${files}/kernel.elf" 4
+            make_config "${files}/config.cfg" 1 /kernel.elf none
+            new_disk "${dir}/disk0.img" 600
+            add_volume "${dir}/disk0.img" 1 1 64 ef00 NEOBOOT
+            put_loader "${dir}/disk0.img" 1
+            for (( v = 0; v < 64; v++ )); do
+                add_volume "${dir}/disk0.img" $(( v + 2 )) $(( 65 + v * 8 )) 8 0700 "VOL${v}"
+            done
+            put_file "${dir}/disk0.img" $(( 65 + 63 * 8 )) "${files}/config.cfg" /config.cfg
+            put_file "${dir}/disk0.img" $(( 65 + 63 * 8 )) "${files}/kernel.elf" /kernel.elf
+            ;;
+
+        large-kernel)
+            make_kernel "${files}/kernel.elf" 256
+            head -c $(( 256 * 1024 * 1024 )) /dev/urandom > "${files}/image.bin"
+            make_config "${files}/config.cfg" 1 /kernel.elf /image.bin
+            new_disk "${dir}/disk0.img" 1100
+            add_volume "${dir}/disk0.img" 1 1 1024 ef00 NEOBOOT
+            put_loader "${dir}/disk0.img" 1
+            put_file "${dir}/disk0.img" 1 "${files}/config.cfg" /config.cfg
+            put_file "${dir}/disk0.img" 1 "${files}/kernel.elf" /kernel.elf
+            put_file "${dir}/disk0.img" 1 "${files}/image.bin" /image.bin
+            ;;
+
+        compressed)
+            # zstdのカーネルとlz4のイメージ
+            make_kernel "${files}/kernel.elf" 256
+            { head -c $(( 128 * 1024 * 1024 )) /dev/urandom; head -c $(( 128 * 1024 * 1024 )) /dev/zero; } > "${files}/image.bin"
+            zstd -q -f -3 "${files}/kernel.elf" -o "${files}/kernel.zst"
+            lz4 -q -f --content-size "${files}/image.bin" "${files}/image.lz4"
+            make_config "${files}/config.cfg" 1 /kernel.zst /image.lz4
+            new_disk "${dir}/disk0.img" 600
+            add_volume "${dir}/disk0.img" 1 1 512 ef00 NEOBOOT
+            put_loader "${dir}/disk0.img" 1
+            put_file "${dir}/disk0.img" 1 "${files}/config.cfg" /config.cfg
+            put_file "${dir}/disk0.img" 1 "${files}/kernel.zst" /kernel.zst
+            put_file "${dir}/disk0.img" 1 "${files}/image.lz4" /image.lz4
+            ;;
+
+        big-config | big-config-binary)
+            make_kernel "${files}/kernel.elf" 4
+            make_config "${files}/config.cfg" 20000 /kernel.elf none
+            new_disk "${dir}/disk0.img" 300
+            add_volume "${dir}/disk0.img" 1 1 256 ef00 NEOBOOT
+            put_loader "${dir}/disk0.img" 1
+            put_file "${dir}/disk0.img" 1 "${files}/config.cfg" /config.cfg
+            put_file "${dir}/disk0.img" 1 "${files}/kernel.elf" /kernel.elf
+            if [ "${layout}" = "big-config-binary" ]; then
+                "${NEOCFG_PATH}" "${files}/config.cfg" "${files}/config.bin" > /dev/null
+                put_file "${dir}/disk0.img" 1 "${files}/config.bin" /config.bin
+            fi
+            ;;
+
+        *)
+            echo "Unknown layout: ${layout}" >&2
+            return 1
+            ;;
+    esac
+
+    # 合成に使ったファイルはもう要らない
+    rm -rf "${files}" "${BENCH_DIR}/kernel-src"
+}
+
+# Boot the layout once and write the serial output to the log
+function boot_once() {
+    local dir="$1" log="$2"
+    local drives=() accel=tcg
+    local index=0
+
+    for disk in "${dir}"/disk*.img; do
+        drives+=(-drive "id=d${index},if=none,format=raw,file=${disk}" -device "virtio-blk-pci,drive=d${index},bootindex=${index}")
+        index=$(( index + 1 ))
+    done
+    if [ -w /dev/kvm ]; then
+        accel=kvm
+    fi
+
+    rm -f "${log}"
+    qemu-system-x86_64 \
+    -machine q35,accel="${accel}" \
+    -cpu max \
+    -m 4G \
+    -smp 4 \
+    -drive if=pflash,format=raw,file="${dir}/OVMF.fd" \
+    "${drives[@]}" \
+    -display none \
+    -serial file:"${log}" \
+    -monitor none &
+    local pid=$!
+
+    # "All Done!"が出たら止める
+    local waited=0
+    while ! grep -q "All Done!" "${log}" 2> /dev/null; do
+        if ! kill -0 "${pid}" 2> /dev/null || (( waited >= BOOT_TIMEOUT * 10 )); then
+            kill "${pid}" 2> /dev/null || true
+            wait "${pid}" 2> /dev/null || true
+            return 1
+        fi
+        sleep 0.1
+        waited=$(( waited + 1 ))
+    done
+
+    kill "${pid}" 2> /dev/null || true
+    wait "${pid}" 2> /dev/null || true
+}
+
+# Print "phase,ms" for each line of the Boot Trace in the log
+function parse_trace() {
+    tr -d '\r' < "$1" | sed 's/\x1b\[[0-9;]*[A-Za-z]//g' | awk '
+        /^Boot Trace/ { inside = 1; next }
+        inside && /^  [a-z ]+: [0-9]+\.[0-9]+ ms/ {
+            split($0, parts, ":")
+            sub(/^ +/, "", parts[1])
+            split(parts[2], value, " ")
+            print parts[1] "," value[1]
+        }
+    '
+}
+
+# Run the layouts and write the CSV report
+function run() {
+    local runs=5 layouts="${LAYOUTS}"
+
+    while (( $# > 0 )); do
+        case "$1" in
+            -n) runs="$2"; shift ;;
+            -l) layouts="${2//,/ }"; shift ;;
+            *) echo "Unknown option: $1" >&2; return 1 ;;
+        esac
+        shift
+    done
+
+    if [ ! -f "${LOADER_PATH}" ] || [ ! -f "${OVMF}" ]; then
+        echo "Build the loader with build.sh build and put OVMF at ${OVMF}" >&2
+        return 1
+    fi
+
+    local commit
+    commit="$(git -C "${script_dir}" rev-parse --short HEAD)$(git -C "${script_dir}" diff --quiet || echo "-dirty")"
+    local report="${BENCH_DIR}/report-${commit}.csv"
+
+    mkdir -p "${BENCH_DIR}"
+    echo "commit,layout,run,cache,phase,ms" > "${report}"
+
+    for layout in ${layouts}; do
+        local dir="${BENCH_DIR}/${layout}"
+        echo "${layout}: building disks"
+        make_layout "${layout}" "${dir}"
+
+        # 1回目はNeobootCacheがないので全てのボリュームを探す
+        cp "${OVMF}" "${dir}/OVMF.fd"
+
+        for (( i = 0; i < runs; i++ )); do
+            local cache=warm
+            if (( i == 0 )); then
+                cache=cold
+            fi
+
+            if ! boot_once "${dir}" "${dir}/serial-${i}.log"; then
+                echo "${layout}: run ${i} did not finish, see ${dir}/serial-${i}.log" >&2
+                continue
+            fi
+            parse_trace "${dir}/serial-${i}.log" | sed "s/^/${commit},${layout},${i},${cache},/" >> "${report}"
+            echo "${layout}: run ${i} ($(parse_trace "${dir}/serial-${i}.log" | awk -F, '$1 == "boot" { print $2 " ms" }'))"
+        done
+
+        # ディスクは大きいので消す
+        rm -f "${dir}"/disk*.img
+    done
+
+    echo ""
+    summary "${report}"
+    echo ""
+    echo "Report: ${report}"
+}
+
+# Median of each layout, cache and phase
+function medians() {
+    tail -n +2 "$1" | sort -t, -k2,2 -k4,4 -k5,5 -k6,6g | awk -F, '
+        { key = $2 "," $4 "," $5; values[key, ++count[key]] = $6 }
+        END {
+            for (key in count) {
+                n = count[key]
+                median = n % 2 ? values[key, (n + 1) / 2] : (values[key, n / 2] + values[key, n / 2 + 1]) / 2
+                printf "%s,%.3f\n", key, median
+            }
+        }
+    ' | sort
+}
+
+# Print the medians of the report
+function summary() {
+    printf "%-20s %-5s %-18s %10s\n" layout cache phase "median ms"
+    medians "$1" | awk -F, '{ printf "%-20s %-5s %-18s %10.3f\n", $1, $2, $3, $4 }'
+}
+
+# Compare the medians of two reports
+function compare() {
+    printf "%-20s %-5s %-18s %10s %10s %8s\n" layout cache phase old new change
+    join -t, <(medians "$1" | sed 's/,/|/; s/,/|/') <(medians "$2" | sed 's/,/|/; s/,/|/') | awk -F, '{
+        split($1, key, "|")
+        change = $2 > 0 ? ($3 - $2) / $2 * 100 : 0
+        printf "%-20s %-5s %-18s %10.3f %10.3f %+7.1f%%\n", key[1], key[2], key[3], $2, $3, change
+    }'
+}
+
+# メイン
+case "$1" in
+    run)
+        shift
+        run "$@"
+        ;;
+    compare)
+        compare "$2" "$3"
+        ;;
+    layouts)
+        echo "${LAYOUTS}"
+        ;;
+    *)
+        echo "Usage: $0 run [-n RUNS] [-l LAYOUT,...] | compare OLD.csv NEW.csv | layouts"
+        ;;
+esac
@@ -0,0 +1,141 @@
+// NEOBOOT Config Fuzzer
+// テキストとバイナリのコンフィグのパーサーに任意の入力を与える
+//
+// libFuzzer: clang -fsanitize=fuzzer,address -DNEOBOOT_LIBFUZZER ...
+// AFLや再現用: fuzz_config FILE... (ファイルがなければ標準入力を読む)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+// Look up every key the way the loader does
+static void exercise_config(Config *config) {
+
+    UINTN number;
+
+    for (UINTN i = 0; i < config->no_of_pairs; i++) {
+        char *key = config_key(config, i);
+        char *value = config_lookup(config, config->pairs[i].section, key);
+
+        // テキストなら同じセクションの後のキーが優先されるので、見つからないことはない
+        // バイナリのハッシュはCRC32が合っていれば信用するので、見つからなくてもよい
+        if (value == NULL) {
+            if (!config->is_binary) {
+                abort();
+            }
+            value = config_value(config, i);
+        }
+
+        config_number(value, &number);
+        CHAR16 *path = to_efi_path(value);
+        FreePool(path);
+    }
+
+    // 範囲外のエントリーはグローバルの値になる
+    for (UINTN entry = 0; entry <= config_entries(config) + 1; entry++) {
+        config_entry_value(config, entry, "kernel");
+        config_entry_value(config, entry, "");
+    }
+    for (UINTN section = 0; section < config->no_of_sections; section++) {
+        config_section_name(config, section);
+    }
+
+    // 起動キャッシュと同じようにセクション名も含めて全体をハッシュする
+    config_digest(config);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+
+    // テキストはNULL終端で、パーサーが書き換える
+    char *text = malloc(size + 1);
+    if (text == NULL) {
+        return 0;
+    }
+    memcpy(text, data, size);
+    text[size] = '\0';
+
+    Config *config = config_file_parser(text);
+    if (config != NULL) {
+        exercise_config(config);
+        free_config(config);
+    }
+    free(text);
+
+    // バイナリ形式はバッファーをそのまま使うので、揃ったコピーを渡す
+    UINT32 *binary = malloc(size + sizeof(UINT32));
+    if (binary == NULL) {
+        return 0;
+    }
+    memcpy(binary, data, size);
+
+    if (config_is_binary(binary, size)) {
+        config = config_binary_open(binary, size);
+        if (config != NULL) {
+            exercise_config(config);
+            free_config(config);
+        }
+    }
+    free(binary);
+
+    return 0;
+}
+
+#ifndef NEOBOOT_LIBFUZZER
+
+// Read the whole stream
+static UINT8 *read_stream(FILE *f, size_t *size) {
+
+    size_t capacity = 4096, length = 0, n;
+    UINT8 *buffer = malloc(capacity);
+
+    while (buffer != NULL && (n = fread(buffer + length, 1, capacity - length, f)) > 0) {
+        length += n;
+        if (length == capacity) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+        }
+    }
+
+    *size = length;
+
+    return buffer;
+}
+
+int main(int argc, char **argv) {
+
+    UINT8 *data;
+    size_t size;
+
+    if (argc < 2) {
+        data = read_stream(stdin, &size);
+        if (data == NULL) {
+            return 1;
+        }
+        LLVMFuzzerTestOneInput(data, size);
+        free(data);
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++) {
+        FILE *f = fopen(argv[i], "rb");
+        if (f == NULL) {
+            fprintf(stderr, "Cannot read %s\n", argv[i]);
+            return 1;
+        }
+        data = read_stream(f, &size);
+        fclose(f);
+        if (data == NULL) {
+            return 1;
+        }
+        LLVMFuzzerTestOneInput(data, size);
+        free(data);
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,52 @@
+// ホストでビルドするためのgnu-efiの代わり
+// ローダーのソースが使う型と定数だけを定義する
+
+#ifndef _HOST_EFI_H
+#define _HOST_EFI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int8_t INT8;
+typedef int16_t INT16;
+typedef int32_t INT32;
+typedef int64_t INT64;
+typedef uintptr_t UINTN;
+typedef intptr_t INTN;
+typedef char CHAR8;
+typedef uint16_t CHAR16;
+typedef uint8_t BOOLEAN;
+typedef void VOID;
+typedef UINTN EFI_STATUS;
+
+#define CONST const
+#define EFIAPI
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+// Status codes
+#define EFI_ERROR_BIT ((UINTN)1 << (sizeof(UINTN) * 8 - 1))
+#define EFI_ERROR(status) (((INTN)(status)) < 0)
+#define EFI_SUCCESS 0
+#define EFI_INVALID_PARAMETER (EFI_ERROR_BIT | 2)
+#define EFI_UNSUPPORTED (EFI_ERROR_BIT | 3)
+#define EFI_BAD_BUFFER_SIZE (EFI_ERROR_BIT | 4)
+#define EFI_BUFFER_TOO_SMALL (EFI_ERROR_BIT | 5)
+#define EFI_DEVICE_ERROR (EFI_ERROR_BIT | 7)
+#define EFI_VOLUME_CORRUPTED (EFI_ERROR_BIT | 10)
+#define EFI_OUT_OF_RESOURCES (EFI_ERROR_BIT | 9)
+#define EFI_NOT_FOUND (EFI_ERROR_BIT | 14)
+#define EFI_CRC_ERROR (EFI_ERROR_BIT | 27)
+#define EFI_END_OF_FILE (EFI_ERROR_BIT | 31)
+
+#define EFI_PAGE_SIZE 4096
+#define EFI_SIZE_TO_PAGES(size) (((size) + EFI_PAGE_SIZE - 1) / EFI_PAGE_SIZE)
+
+#endif
@@ -0,0 +1,71 @@
+// ホストでビルドするためのgnu-efiライブラリの代わり
+
+#ifndef _HOST_EFILIB_H
+#define _HOST_EFILIB_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "efi.h"
+
+// プールの確保の回数とバイト数 (tools/bench.cで測る)
+// 全てのファイルで同じ変数を使うようにweakで定義する
+__attribute__((weak)) UINTN host_pool_allocations;
+__attribute__((weak)) UINTN host_pool_bytes;
+
+static inline VOID *AllocatePool(UINTN size) {
+    host_pool_allocations++;
+    host_pool_bytes += size;
+    return malloc(size == 0 ? 1 : size);
+}
+
+static inline VOID *AllocateZeroPool(UINTN size) {
+    host_pool_allocations++;
+    host_pool_bytes += size;
+    return calloc(1, size == 0 ? 1 : size);
+}
+
+static inline VOID *ReallocatePool(VOID *old, UINTN old_size, UINTN new_size) {
+    (void)old_size;
+    host_pool_allocations++;
+    host_pool_bytes += new_size;
+    return realloc(old, new_size);
+}
+
+static inline VOID FreePool(VOID *p) {
+    free(p);
+}
+
+static inline VOID CopyMem(VOID *dst, const VOID *src, UINTN size) {
+    memmove(dst, src, size);
+}
+
+static inline VOID SetMem(VOID *dst, UINTN size, UINT8 value) {
+    memset(dst, value, size);
+}
+
+static inline VOID ZeroMem(VOID *dst, UINTN size) {
+    memset(dst, 0, size);
+}
+
+static inline INTN CompareMem(const VOID *a, const VOID *b, UINTN size) {
+    return memcmp(a, b, size);
+}
+
+static inline UINTN StrLen(const CHAR16 *s) {
+    UINTN length = 0;
+    while (s[length] != 0) {
+        length++;
+    }
+    return length;
+}
+
+static inline UINTN strlena(const CHAR8 *s) {
+    return strlen(s);
+}
+
+static inline INTN strcmpa(const CHAR8 *a, const CHAR8 *b) {
+    return strcmp(a, b);
+}
+
+#endif
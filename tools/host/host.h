@@ -0,0 +1,62 @@
+// ホストでビルドするローダーのソースの関数
+// proto.hはEFIのプロトコルに依存するので、こちらを使う
+
+#ifndef _HOST_H
+#define _HOST_H
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "config.h"
+#include "cpu.h"
+#include "sha256.h"
+#include "memops.h"
+
+// String
+unsigned int my_strlen(const char *str);
+char *my_strcpy(char *dest, const char *src);
+char *my_strchr(const char *str, int c);
+char *my_strdup(const char *s);
+CHAR16 *to_efi_path(const char *path);
+
+// CRC32
+UINT32 crc32_update(UINT32 crc, const VOID *data, UINTN size);
+UINT32 crc32(const VOID *data, UINTN size);
+
+// CPU
+UINT32 cpu_features();
+
+// Memory
+void mem_init();
+void mem_force(UINT32 features);
+const CHAR16 *mem_implementation();
+void mem_copy(VOID *dst, const VOID *src, UINTN size);
+void mem_zero(VOID *dst, UINTN size);
+void mem_zero_any_core(VOID *dst, UINTN size);
+UINTN mem_span(const char *s, const char *stops);
+
+// SHA-256
+void sha256_force(UINT32 features);
+const CHAR16 *sha256_implementation();
+void sha256_init(struct sha256_state *state);
+void sha256_update(struct sha256_state *state, const VOID *data, UINTN size);
+void sha256_final(struct sha256_state *state, UINT8 digest[SHA256_DIGEST_SIZE]);
+BOOLEAN sha256_parse(const char *hex, UINT8 digest[SHA256_DIGEST_SIZE]);
+
+// Config
+Config *config_file_parser(char *config_txt);
+void free_config(Config *config);
+char *config_lookup(Config *config, UINTN section, const char *key);
+UINTN config_entries(Config *config);
+char *config_entry_value(Config *config, UINTN entry, const char *key);
+char *get_config_value(Config *config, const char *key);
+BOOLEAN config_number(const char *value, UINTN *number);
+char *config_key(Config *config, UINTN pair);
+char *config_value(Config *config, UINTN pair);
+char *config_section_name(Config *config, UINTN section);
+UINT32 config_digest(Config *config);
+BOOLEAN config_is_binary(VOID *buffer, UINTN size);
+Config *config_binary_open(VOID *buffer, UINTN size);
+Config *config_open(VOID *buffer, UINTN size);
+
+#endif
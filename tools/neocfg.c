@@ -0,0 +1,195 @@
+// NEOBOOT Config Compiler
+// テキストのコンフィグファイルをローダーがそのまま使えるバイナリ形式に変換する
+//
+// Usage: neocfg config.cfg config.bin
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+
+// 4バイト境界に揃える
+#define ALIGN4(x) (((x) + 3) & ~(UINTN)3)
+
+// Read the whole file with a NULL end
+static char *read_text(const char *path, UINTN *size) {
+
+    FILE *f = fopen(path, "rb");
+    char *buffer;
+    long length;
+
+    if (f == NULL) {
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    buffer = malloc(length + 1);
+    if (buffer == NULL || fread(buffer, 1, length, f) != (size_t)length) {
+        free(buffer);
+        fclose(f);
+        return NULL;
+    }
+    buffer[length] = '\0';
+    fclose(f);
+
+    *size = length;
+
+    return buffer;
+}
+
+// Append a string to the pool and return its offset
+static UINT32 add_string(char *pool, UINTN *pool_size, const char *s) {
+
+    UINT32 offset = *pool_size;
+    UINTN length = strlen(s) + 1;
+
+    memcpy(pool + *pool_size, s, length);
+    *pool_size += length;
+
+    return offset;
+}
+
+// Serialize the parsed config
+static UINT8 *compile_config(Config *config, UINTN text_size, UINTN *size) {
+
+    struct config_binary_header header;
+    config_section *sections;
+    config_pair *pairs;
+    char *pool;
+    UINTN pool_size = 0;
+    UINT8 *out;
+
+    // 文字列は元のテキストより大きくならない
+    pool = malloc(text_size + 1);
+    sections = malloc(sizeof(config_section) * config->no_of_sections);
+    pairs = malloc(sizeof(config_pair) * (config->no_of_pairs + 1));
+    if (pool == NULL || sections == NULL || pairs == NULL) {
+        return NULL;
+    }
+
+    // コメントなどを除いて文字列を詰める
+    for (UINTN i = 0; i < config->no_of_sections; i++) {
+        char *name = config_section_name(config, i);
+        sections[i] = config->sections[i];
+        sections[i].name = name == NULL ? CONFIG_NO_NAME : add_string(pool, &pool_size, name);
+    }
+    for (UINTN i = 0; i < config->no_of_pairs; i++) {
+        pairs[i] = config->pairs[i];
+        pairs[i].key = add_string(pool, &pool_size, config_key(config, i));
+        pairs[i].value = add_string(pool, &pool_size, config_value(config, i));
+    }
+    if (pool_size == 0) {
+        pool[pool_size++] = '\0';
+    }
+
+    // Layout
+    memset(&header, 0, sizeof(header));
+    header.magic = CONFIG_BINARY_MAGIC;
+    header.version = CONFIG_BINARY_VERSION;
+    header.header_size = sizeof(struct config_binary_header);
+    header.no_of_sections = config->no_of_sections;
+    header.no_of_pairs = config->no_of_pairs;
+    header.table_size = config->table_size;
+    header.strings_size = pool_size;
+    header.sections_offset = ALIGN4(sizeof(struct config_binary_header));
+    header.pairs_offset = header.sections_offset + sizeof(config_section) * header.no_of_sections;
+    header.table_offset = header.pairs_offset + sizeof(config_pair) * header.no_of_pairs;
+    header.strings_offset = header.table_offset + sizeof(UINT32) * header.table_size;
+    header.size = header.strings_offset + pool_size;
+
+    out = calloc(1, header.size);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    memcpy(out + header.sections_offset, sections, sizeof(config_section) * header.no_of_sections);
+    memcpy(out + header.pairs_offset, pairs, sizeof(config_pair) * header.no_of_pairs);
+    memcpy(out + header.table_offset, config->table, sizeof(UINT32) * header.table_size);
+    memcpy(out + header.strings_offset, pool, pool_size);
+
+    // CRC32はこのフィールドを0として計算する
+    memcpy(out, &header, sizeof(header));
+    header.crc32 = crc32(out, header.size);
+    memcpy(out, &header, sizeof(header));
+
+    free(pool);
+    free(sections);
+    free(pairs);
+
+    *size = header.size;
+
+    return out;
+}
+
+// Check that the loader reads the same values from the binary
+static int verify_config(Config *text, UINT8 *binary, UINTN size) {
+
+    Config *config = config_binary_open(binary, size);
+    if (config == NULL) {
+        return 0;
+    }
+
+    for (UINTN i = 0; i < text->no_of_pairs; i++) {
+        UINT32 section = text->pairs[i].section;
+        char *expected = config_lookup(text, section, config_key(text, i));
+        char *actual = config_lookup(config, section, config_key(text, i));
+        if (actual == NULL || strcmp(expected, actual) != 0) {
+            free_config(config);
+            return 0;
+        }
+    }
+
+    free_config(config);
+
+    return 1;
+}
+
+int main(int argc, char **argv) {
+
+    Config *config;
+    char *text;
+    UINT8 *binary;
+    UINTN text_size, size;
+    FILE *f;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s config.cfg config.bin\n", argv[0]);
+        return 2;
+    }
+
+    text = read_text(argv[1], &text_size);
+    if (text == NULL) {
+        fprintf(stderr, "Cannot read %s\n", argv[1]);
+        return 1;
+    }
+
+    config = config_file_parser(text);
+    if (config == NULL) {
+        fprintf(stderr, "Cannot parse %s\n", argv[1]);
+        return 1;
+    }
+
+    binary = compile_config(config, text_size, &size);
+    if (binary == NULL || !verify_config(config, binary, size)) {
+        fprintf(stderr, "Cannot compile %s\n", argv[1]);
+        return 1;
+    }
+
+    f = fopen(argv[2], "wb");
+    if (f == NULL || fwrite(binary, 1, size, f) != size || fclose(f) != 0) {
+        fprintf(stderr, "Cannot write %s\n", argv[2]);
+        return 1;
+    }
+
+    printf("%s: %lu entries, %lu keys, %lu bytes\n", argv[2], (unsigned long)config_entries(config), (unsigned long)config->no_of_pairs, (unsigned long)size);
+
+    free(binary);
+    free_config(config);
+    free(text);
+
+    return 0;
+}